@@ -0,0 +1,92 @@
+/**
+ * Copyright (c) 2011-2021 Bill Greiman
+ * This file is part of the SdFat library for SD memory cards.
+ *
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#define DBG_FILE "ExFatDirIterator.cpp"
+#include "../common/DebugMacros.h"
+#include "ExFatLib.h"
+//------------------------------------------------------------------------------
+// Characters in one name entry.
+static const uint8_t NAME_CHARS_PER_ENTRY = 15;
+//------------------------------------------------------------------------------
+int8_t ExFatDirIterator::next() {
+  uint8_t buf[32];
+  // if not a directory file or miss-positioned return an error
+  if (!m_dir->isDir() || (0X1F & m_dir->curPosition())) {
+    DBG_FAIL_MACRO;
+    return -1;
+  }
+  while (1) {
+    int n = m_dir->read(buf, sizeof(buf));
+    if (n != sizeof(buf)) {
+      return n == 0 ? 0 : -1;
+    }
+    // end of directory
+    if (buf[0] == 0) {
+      return 0;
+    }
+    // skip unused entries and the entries of the volume
+    if (buf[0] != EXFAT_TYPE_FILE) {
+      continue;
+    }
+    const DirFile_t* dirFile = reinterpret_cast<DirFile_t*>(buf);
+    uint8_t setCount = dirFile->setCount;
+    m_attributes = getLe16(dirFile->attributes);
+    if (setCount < 2) {
+      continue;
+    }
+
+    n = m_dir->read(buf, sizeof(buf));
+    if (n != sizeof(buf)) {
+      return -1;
+    }
+    if (buf[0] != EXFAT_TYPE_STREAM) {
+      continue;
+    }
+    const DirStream_t* dirStream = reinterpret_cast<DirStream_t*>(buf);
+    uint8_t nameLength = dirStream->nameLength;
+    m_fileSize = getLe64(dirStream->validLength);
+    m_firstCluster = getLe32(dirStream->firstCluster);
+    m_nameTruncated = nameLength > NAME_SIZE - 1;
+    m_nameLength = m_nameTruncated ? NAME_SIZE - 1 : nameLength;
+
+    uint16_t k = 0;
+    for (uint8_t i = 2; i <= setCount; i++) {
+      n = m_dir->read(buf, sizeof(buf));
+      if (n != sizeof(buf)) {
+        return -1;
+      }
+      if (buf[0] != EXFAT_TYPE_NAME) {
+        continue;
+      }
+      const DirName_t* dirName = reinterpret_cast<DirName_t*>(buf);
+      for (uint8_t j = 0; j < NAME_CHARS_PER_ENTRY && k < m_nameLength; j++, k++) {
+        uint16_t c = getLe16(dirName->unicode + 2*j);
+        m_name[k] = c >= 0X7F ? '?' : c;
+      }
+    }
+    m_nameLength = k;
+    m_name[k] = '\0';
+    return 1;
+  }
+}
@@ -0,0 +1,81 @@
+/**
+ * Copyright (c) 2011-2021 Bill Greiman
+ * This file is part of the SdFat library for SD memory cards.
+ *
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#ifndef ExFatDirIterator_h
+#define ExFatDirIterator_h
+/**
+ * \file
+ * \brief ExFatDirIterator class
+ */
+#include "ExFatFile.h"
+//------------------------------------------------------------------------------
+/**
+ * \class ExFatDirIterator
+ * \brief Iterator over the raw entries of an exFAT directory.
+ *
+ * Entry sets are decoded directly from the directory, so no file is opened
+ * to get its name, size or first cluster.
+ */
+class ExFatDirIterator {
+ public:
+  /** Size of the name buffer, longer names are truncated. */
+  static const uint8_t NAME_SIZE = 64;
+  /** Create an iterator.
+   *
+   * \param[in] dir Open directory, positioned at its first entry.
+   */
+  explicit ExFatDirIterator(ExFatFile* dir) : m_dir(dir) {}
+  /** Set the directory position to the first entry. */
+  void rewind() {m_dir->rewind();}
+  /** Advance to the next file or subdirectory entry set.
+   *
+   * \return 1 if an entry was found, 0 at the end of the directory
+   *         or -1 if an error occurred.
+   */
+  int8_t next();
+  /** \return Name of the current entry, '?' replaces non-ASCII characters. */
+  const char* name() const {return m_name;}
+  /** \return Length of name(). */
+  uint8_t nameLength() const {return m_nameLength;}
+  /** \return True if the name did not fit into NAME_SIZE. */
+  bool isNameTruncated() const {return m_nameTruncated;}
+  /** \return Valid length of the current entry in bytes. */
+  uint64_t fileSize() const {return m_fileSize;}
+  /** \return First cluster of the current entry, zero if none is allocated. */
+  uint32_t firstCluster() const {return m_firstCluster;}
+  /** \return True if the current entry is a subdirectory. */
+  bool isDir() const {return m_attributes & EXFAT_ATTRIB_DIRECTORY;}
+  /** \return True if the current entry is a file. */
+  bool isFile() const {return !isDir();}
+
+ private:
+  ExFatFile* m_dir;
+  char m_name[NAME_SIZE];
+  uint8_t m_nameLength = 0;
+  bool m_nameTruncated = false;
+  uint16_t m_attributes = 0;
+  uint64_t m_fileSize = 0;
+  uint32_t m_firstCluster = 0;
+};
+#endif  // ExFatDirIterator_h
@@ -26,4 +26,5 @@
 #define ExFatLib_h
 #include "ExFatVolume.h"
 #include "ExFatFormatter.h"
+#include "ExFatDirIterator.h"
 #endif  // ExFatLib_h
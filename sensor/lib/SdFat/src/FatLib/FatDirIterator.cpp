@@ -0,0 +1,152 @@
+/**
+ * Copyright (c) 2011-2021 Bill Greiman
+ * This file is part of the SdFat library for SD memory cards.
+ *
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#define DBG_FILE "FatDirIterator.cpp"
+#include "../common/DebugMacros.h"
+#include "FatLib.h"
+//------------------------------------------------------------------------------
+// Characters in one LFN entry.
+static const uint8_t LFN_CHARS_PER_ENTRY = 13;
+//------------------------------------------------------------------------------
+static uint16_t lfnChar(const DirLfn_t* ldir, uint8_t i) {
+  if (i < 5) {
+    return getLe16(ldir->unicode1 + 2*i);
+  } else if (i < 11) {
+    return getLe16(ldir->unicode2 + 2*i - 10);
+  }
+  return getLe16(ldir->unicode3 + 2*i - 22);
+}
+//------------------------------------------------------------------------------
+void FatDirIterator::appendChar(uint16_t index, uint16_t c) {
+  if (index >= NAME_SIZE - 1) {
+    m_nameTruncated = true;
+    return;
+  }
+  m_name[index] = c >= 0X7F ? '?' : c;
+}
+//------------------------------------------------------------------------------
+uint8_t FatDirIterator::lfnChecksum(const uint8_t* name) {
+  uint8_t sum = 0;
+  for (uint8_t i = 0; i < 11; i++) {
+    sum = (((sum & 1) << 7) | (sum >> 1)) + name[i];
+  }
+  return sum;
+}
+//------------------------------------------------------------------------------
+int8_t FatDirIterator::next() {
+  DirFat_t dir;
+  uint8_t lfnOrd = 0;    // order of the last LFN entry read, 0 if none
+  uint8_t checksum = 0;
+  uint16_t lfnLength = 0;
+  // if not a directory file or miss-positioned return an error
+  if (!m_dir->isDir() || (0X1F & m_dir->curPosition())) {
+    DBG_FAIL_MACRO;
+    return -1;
+  }
+  while (1) {
+    int n = m_dir->read(&dir, sizeof(DirFat_t));
+    if (n != sizeof(DirFat_t)) {
+      return n == 0 ? 0 : -1;
+    }
+    // last entry if FAT_NAME_FREE
+    if (dir.name[0] == FAT_NAME_FREE) {
+      return 0;
+    }
+    // skip empty entries and entry for .  and ..
+    if (dir.name[0] == FAT_NAME_DELETED || dir.name[0] == '.') {
+      lfnOrd = 0;
+      continue;
+    }
+    if (isLongName(&dir)) {
+      const DirLfn_t* ldir = reinterpret_cast<DirLfn_t*>(&dir);
+      uint8_t ord = ldir->order & 0X1F;
+      if (ldir->order & FAT_ORDER_LAST_LONG_ENTRY) {
+        // first entry of a set, holds the end of the name
+        checksum = ldir->checksum;
+        m_nameTruncated = false;
+        lfnLength = (ord - 1)*LFN_CHARS_PER_ENTRY;
+        for (uint8_t i = 0; i < LFN_CHARS_PER_ENTRY; i++) {
+          uint16_t c = lfnChar(ldir, i);
+          if (c == 0) {
+            break;
+          }
+          lfnLength++;
+        }
+      } else if (ord == 0 || ord + 1 != lfnOrd || ldir->checksum != checksum) {
+        lfnOrd = 0;
+        continue;
+      }
+      lfnOrd = ord;
+      uint16_t base = (ord - 1)*LFN_CHARS_PER_ENTRY;
+      for (uint8_t i = 0; i < LFN_CHARS_PER_ENTRY && base + i < lfnLength; i++) {
+        appendChar(base + i, lfnChar(ldir, i));
+      }
+      continue;
+    }
+    if (!isFileOrSubdir(&dir)) {
+      // volume label
+      lfnOrd = 0;
+      continue;
+    }
+    if (lfnOrd == 1 && checksum == lfnChecksum(dir.name)) {
+      m_nameLength = lfnLength < NAME_SIZE - 1 ? lfnLength : NAME_SIZE - 1;
+      m_name[m_nameLength] = '\0';
+    } else {
+      setShortName(&dir);
+    }
+    m_attributes = dir.attributes;
+    m_fileSize = getLe32(dir.fileSize);
+    m_firstCluster = (uint32_t)getLe16(dir.firstClusterHigh) << 16 |
+                     getLe16(dir.firstClusterLow);
+    return 1;
+  }
+}
+//------------------------------------------------------------------------------
+void FatDirIterator::setShortName(const DirFat_t* dir) {
+  uint8_t j = 0;
+  uint8_t lcBit = FAT_CASE_LC_BASE;
+  const uint8_t* ptr = dir->name;
+  m_nameTruncated = false;
+  for (uint8_t i = 0; i < 12; i++) {
+    char c;
+    if (i == 8) {
+      if (*ptr == ' ') {
+        break;
+      }
+      lcBit = FAT_CASE_LC_EXT;
+      c = '.';
+    } else {
+      c = *ptr++;
+      if ('A' <= c && c <= 'Z' && (lcBit & dir->caseFlags)) {
+        c += 'a' - 'A';
+      }
+      if (c == ' ') {
+        continue;
+      }
+    }
+    m_name[j++] = c;
+  }
+  m_name[j] = '\0';
+  m_nameLength = j;
+}
@@ -26,4 +26,5 @@
 #define FatLib_h
 #include "FatVolume.h"
 #include "FatFormatter.h"
+#include "FatDirIterator.h"
 #endif  // FatLib_h
@@ -82,6 +82,8 @@ public:
 	inline void sdaHigh(void) const;
 	inline void sclLow(void) const;
 	inline void sclHigh(void) const;
+	inline uint8_t readSda(void) const;
+	inline uint8_t readScl(void) const;
 	inline bool sclHighAndStretch(AsyncDelay& timeout) const;
 
 
@@ -326,6 +328,17 @@ void SoftWire::sclHigh(void) const
 	_sclHigh(this);
 }
 
+uint8_t SoftWire::readSda(void) const
+{
+	return _readSda(this);
+}
+
+
+uint8_t SoftWire::readScl(void) const
+{
+	return _readScl(this);
+}
+
 bool SoftWire::sclHighAndStretch(AsyncDelay& timeout) const
 {
 	_sclHigh(this);
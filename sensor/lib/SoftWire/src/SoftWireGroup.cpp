@@ -0,0 +1,277 @@
+#include <SoftWireGroup.h>
+
+
+SoftWireGroup::SoftWireGroup(SoftWire *const *buses, uint8_t count) :
+	_count(count > maxBuses ? maxBuses : count),
+	_delay_us(0)
+{
+	for (uint8_t i = 0; i < _count; ++i) {
+		_buses[i] = buses[i];
+		if (buses[i]->getDelay_us() > _delay_us)
+			_delay_us = buses[i]->getDelay_us();
+	}
+}
+
+
+void SoftWireGroup::writeTo(uint8_t address, const uint8_t *data, uint8_t quantity,
+                            uint8_t *results, bool sendStop) const
+{
+	SoftWire::result_t res[maxBuses];
+	uint8_t active = llStart(allBuses(), (address << 1) + SoftWire::writeMode, res);
+	for (uint8_t i = 0; i < _count; ++i)
+		results[i] = ((active >> i) & 1) ? 0 : (res[i] == SoftWire::nack ? 2 : 4);
+
+	for (uint8_t n = 0; n < quantity && active; ++n) {
+		uint8_t acked = llWrite(active, data[n], res);
+		for (uint8_t i = 0; i < _count; ++i)
+			if (((active & ~acked) >> i) & 1)
+				results[i] = (res[i] == SoftWire::nack ? 3 : 4);
+		active = acked;
+	}
+
+	if (sendStop)
+		stop(allBuses());
+}
+
+
+void SoftWireGroup::requestFrom(uint8_t address, uint8_t quantity, uint8_t *const *buffers,
+                                uint8_t *bytesRead, bool sendStop) const
+{
+	SoftWire::result_t res[maxBuses];
+	uint8_t data[maxBuses];
+	for (uint8_t i = 0; i < _count; ++i)
+		bytesRead[i] = 0;
+
+	uint8_t active = llStart(allBuses(), (address << 1) + SoftWire::readMode, res);
+	for (uint8_t n = 0; n < quantity && active; ++n) {
+		active = llRead(active, data, n != (quantity - 1), res);
+		for (uint8_t i = 0; i < _count; ++i)
+			if ((active >> i) & 1) {
+				buffers[i][n] = data[i];
+				++bytesRead[i];
+			}
+	}
+
+	if (sendStop)
+		stop(allBuses());
+}
+
+
+uint8_t SoftWireGroup::llStart(uint8_t active, uint8_t rawAddr, SoftWire::result_t *results) const
+{
+	// Force SDA low
+	for (uint8_t i = 0; i < _count; ++i)
+		if ((active >> i) & 1)
+			_buses[i]->sdaLow();
+	delayMicroseconds(_delay_us);
+
+	// Force SCL low
+	for (uint8_t i = 0; i < _count; ++i)
+		if ((active >> i) & 1)
+			_buses[i]->sclLow();
+	delayMicroseconds(_delay_us);
+	return llWrite(active, rawAddr, results);
+}
+
+
+uint8_t SoftWireGroup::llWrite(uint8_t active, uint8_t data, SoftWire::result_t *results) const
+{
+	uint32_t timeouts_us[maxBuses];
+	startTimeouts(timeouts_us);
+	for (uint8_t b = 8; b; --b) {
+		for (uint8_t i = 0; i < _count; ++i)
+			if ((active >> i) & 1) {
+				// Force SCL low
+				_buses[i]->sclLow();
+
+				if (data & 0x80)
+					_buses[i]->sdaHigh(); // Release SDA
+				else
+					_buses[i]->sdaLow(); // Force SDA low
+			}
+		delayMicroseconds(_delay_us);
+
+		// Release SCL. Buses which time out are reset and drop out.
+		active = sclHighAndStretch(active, timeouts_us, results);
+
+		delayMicroseconds(_delay_us);
+
+		data <<= 1;
+	}
+
+	// Get ACK
+	for (uint8_t i = 0; i < _count; ++i)
+		if ((active >> i) & 1) {
+			// Force SCL low
+			_buses[i]->sclLow();
+
+			// Release SDA
+			_buses[i]->sdaHigh();
+		}
+
+	delayMicroseconds(_delay_us);
+
+	// Release SCL
+	active = sclHighAndStretch(active, timeouts_us, results);
+
+	uint8_t acked = 0;
+	for (uint8_t i = 0; i < _count; ++i)
+		if ((active >> i) & 1) {
+			if (_buses[i]->readSda() == LOW)
+				acked |= 1 << i;
+			else
+				results[i] = SoftWire::nack;
+		}
+
+	delayMicroseconds(_delay_us);
+
+	// Keep SCL low between bytes
+	for (uint8_t i = 0; i < _count; ++i)
+		if ((active >> i) & 1)
+			_buses[i]->sclLow();
+
+	return acked;
+}
+
+
+uint8_t SoftWireGroup::llRead(uint8_t active, uint8_t *data, bool sendAck, SoftWire::result_t *results) const
+{
+	uint32_t timeouts_us[maxBuses];
+	startTimeouts(timeouts_us);
+	for (uint8_t i = 0; i < _count; ++i)
+		data[i] = 0;
+
+	for (uint8_t b = 8; b; --b) {
+		for (uint8_t i = 0; i < _count; ++i)
+			if ((active >> i) & 1) {
+				data[i] <<= 1;
+
+				// Force SCL low
+				_buses[i]->sclLow();
+
+				// Release SDA (from previous ACK)
+				_buses[i]->sdaHigh();
+			}
+		delayMicroseconds(_delay_us);
+
+		// Release SCL
+		active = sclHighAndStretch(active, timeouts_us, results);
+		delayMicroseconds(_delay_us);
+
+		// Read clock stretch
+		active = waitForScl(active, timeouts_us, results, true);
+
+		for (uint8_t i = 0; i < _count; ++i)
+			if (((active >> i) & 1) && _buses[i]->readSda())
+				data[i] |= 1;
+	}
+
+
+	// Put ACK/NACK
+	for (uint8_t i = 0; i < _count; ++i)
+		if ((active >> i) & 1) {
+			// Force SCL low
+			_buses[i]->sclLow();
+			if (sendAck)
+				_buses[i]->sdaLow(); // Force SDA low
+			else
+				_buses[i]->sdaHigh(); // Release SDA
+		}
+
+	delayMicroseconds(_delay_us);
+
+	// Release SCL
+	active = sclHighAndStretch(active, timeouts_us, results);
+	delayMicroseconds(_delay_us);
+
+	// Wait for SCL to return high
+	active = waitForScl(active, timeouts_us, results, true);
+
+	delayMicroseconds(_delay_us);
+
+	// Keep SCL low between bytes
+	for (uint8_t i = 0; i < _count; ++i)
+		if ((active >> i) & 1)
+			_buses[i]->sclLow();
+
+	return active;
+}
+
+
+void SoftWireGroup::stop(uint8_t active) const
+{
+	SoftWire::result_t results[maxBuses];
+	uint32_t timeouts_us[maxBuses];
+	startTimeouts(timeouts_us);
+
+	// Force SCL low
+	for (uint8_t i = 0; i < _count; ++i)
+		if ((active >> i) & 1)
+			_buses[i]->sclLow();
+	delayMicroseconds(_delay_us);
+
+	// Force SDA low
+	for (uint8_t i = 0; i < _count; ++i)
+		if ((active >> i) & 1)
+			_buses[i]->sdaLow();
+	delayMicroseconds(_delay_us);
+
+	// Release SCL
+	active = sclHighAndStretch(active, timeouts_us, results);
+	delayMicroseconds(_delay_us);
+
+	// Release SDA
+	for (uint8_t i = 0; i < _count; ++i)
+		if ((active >> i) & 1)
+			_buses[i]->sdaHigh();
+	delayMicroseconds(_delay_us);
+}
+
+
+void SoftWireGroup::startTimeouts(uint32_t *timeouts_us) const
+{
+	for (uint8_t i = 0; i < _count; ++i)
+		timeouts_us[i] = _buses[i]->getTimeout_ms() * 1000UL;
+}
+
+
+uint8_t SoftWireGroup::sclHighAndStretch(uint8_t active, uint32_t *timeouts_us,
+                                         SoftWire::result_t *results) const
+{
+	for (uint8_t i = 0; i < _count; ++i)
+		if ((active >> i) & 1)
+			_buses[i]->sclHigh();
+
+	// Wait for SCL to actually become high in case a slave keeps it low
+	// (clock stretching). Do not allow clock stretching when resetting.
+	return waitForScl(active, timeouts_us, results, false);
+}
+
+
+uint8_t SoftWireGroup::waitForScl(uint8_t active, uint32_t *timeouts_us, SoftWire::result_t *results,
+                                  bool allowClockStretch) const
+{
+	uint8_t waiting = active;
+	uint32_t start = micros();
+	while (true) {
+		uint32_t waited = micros() - start;
+		for (uint8_t i = 0; i < _count; ++i)
+			if (((waiting >> i) & 1) && _buses[i]->readScl() != LOW) {
+				waiting &= ~(1 << i);
+				// Only the time until its own SCL rises counts against a bus
+				timeouts_us[i] = waited < timeouts_us[i] ? timeouts_us[i] - waited : 0;
+			}
+		if (!waiting)
+			return active;
+
+		for (uint8_t i = 0; i < _count; ++i)
+			if (((waiting >> i) & 1) && waited >= timeouts_us[i]) {
+				_buses[i]->stop(allowClockStretch); // Reset bus
+				results[i] = SoftWire::timedOut;
+				waiting &= ~(1 << i);
+				active &= ~(1 << i);
+			}
+		if (!waiting)
+			return active;
+	}
+}
@@ -0,0 +1,76 @@
+#ifndef SOFTWIREGROUP_H
+#define SOFTWIREGROUP_H
+
+#include <SoftWire.h>
+
+// Drives several SoftWire buses in lockstep: one timing loop clocks the
+// same transfer on all buses, and SDA is written and sampled per bus, so
+// a transfer to N devices with the same address takes about as long as a
+// transfer to one. The bus delay is the largest of the buses.
+//
+// Every bus keeps its own timeout, which limits how long its device may
+// stretch the clock during one byte. Waiting for the other buses does not
+// count against it, so a device which stretches the clock too long only
+// fails its own bus.
+//
+// A bus whose device does not acknowledge, or which times out, drops out
+// of the rest of the transfer and keeps SCL low until the stop
+// condition, which is sent on all buses.
+class SoftWireGroup {
+public:
+	static const uint8_t maxBuses = 8;
+
+	// The buses must have been set up with begin(). The group only keeps
+	// pointers to them.
+	SoftWireGroup(SoftWire *const *buses, uint8_t count);
+
+	inline uint8_t getCount(void) const;
+
+	// Write the same data to the same address on all buses. results[i]
+	// receives the status of bus i, with the values returned by
+	// SoftWire::endTransmission().
+	void writeTo(uint8_t address, const uint8_t *data, uint8_t quantity,
+	             uint8_t *results, bool sendStop = true) const;
+
+	// Read quantity bytes from the same address on all buses into
+	// buffers[i]. bytesRead[i] receives the number of bytes read from bus
+	// i, as returned by SoftWire::requestFrom().
+	void requestFrom(uint8_t address, uint8_t quantity, uint8_t *const *buffers,
+	                 uint8_t *bytesRead, bool sendStop = true) const;
+
+private:
+	SoftWire *_buses[maxBuses];
+	uint8_t _count;
+	uint8_t _delay_us;
+
+	// The functions below operate on the buses whose bits are set in
+	// active. They set results[i] for buses which fail and return the
+	// buses which can continue.
+	uint8_t llStart(uint8_t active, uint8_t rawAddr, SoftWire::result_t *results) const;
+	uint8_t llWrite(uint8_t active, uint8_t data, SoftWire::result_t *results) const;
+	uint8_t llRead(uint8_t active, uint8_t *data, bool sendAck, SoftWire::result_t *results) const;
+	void stop(uint8_t active) const;
+
+	// timeouts_us[i] is the time which the device of bus i may still
+	// stretch the clock during the current byte.
+	void startTimeouts(uint32_t *timeouts_us) const;
+	uint8_t sclHighAndStretch(uint8_t active, uint32_t *timeouts_us, SoftWire::result_t *results) const;
+	uint8_t waitForScl(uint8_t active, uint32_t *timeouts_us, SoftWire::result_t *results,
+	                   bool allowClockStretch) const;
+
+	inline uint8_t allBuses(void) const;
+};
+
+
+uint8_t SoftWireGroup::getCount(void) const
+{
+	return _count;
+}
+
+
+uint8_t SoftWireGroup::allBuses(void) const
+{
+	return _count == 8 ? 0xFF : (1 << _count) - 1;
+}
+
+#endif
@@ -0,0 +1,138 @@
+#ifndef AVERAGINGACCUMULATOR_H
+#define AVERAGINGACCUMULATOR_H
+
+#include "main.h"
+
+#include <algorithm>
+#include <array>
+
+/**
+ * Running sums of measured values, from which their average is computed in the fixed-point representation.
+ *
+ * Only the sums are kept, so adding a sample and computing the average take constant time and the memory does
+ * not depend on the number of averaged samples. Every value is converted to a 64-bit fixed-point number with
+ * FRACTION_BITS fractional bits, exactly from 2^-16 up, whose upper and lower LOW_BITS bits are summed separately,
+ * so that the sums of up to MAX_COUNT samples do not overflow. Both parts are converted from float to 32-bit
+ * integers, which the FPU does, and the average takes at most two 64-bit divisions, or none for windows whose
+ * length is a power of two.
+ *
+ * The average is rounded as it was when it was computed with doubles and passed to the packet as a float: it is
+ * rounded to the nearest float, which is then scaled and rounded to floor(DATAPOINT_SCALE * average + 0.5). The
+ * result therefore agrees bit by bit with the former wire format. Both roundings are done with integers, as the
+ * Cortex-M4F has a single-precision FPU only and no doubles are used.
+ *
+ * @tparam channels Number of values of one sample
+ */
+template<size_t channels>
+class AveragingAccumulator
+{
+public:
+    typedef std::array<float, channels> Sample;
+    typedef std::array<uint32_t, channels> Average;
+
+    static constexpr uint32_t MAX_COUNT = 1 << 16;
+
+    /**
+     * Add a sample to the sums. NaN and negative values count as 0, values beyond VALUE_LIMIT are limited.
+     */
+    void add(const Sample& sample) {
+        assert(count < MAX_COUNT);
+        for (size_t i = 0; i < channels; ++i) {
+            float value = sample[i] > 0.0f ? std::min(sample[i], VALUE_LIMIT) : 0.0f;
+            // scaling by powers of two and taking the fraction are exact, the conversion of the lower part
+            // truncates bits below 2^-FRACTION_BITS
+            float scaled = value * HIGH_SCALE;
+            uint32_t high = static_cast<uint32_t>(scaled);
+            highSums[i] += high;
+            lowSums[i] += static_cast<uint32_t>((scaled - static_cast<float>(high)) * LOW_SCALE);
+        }
+        ++count;
+    }
+
+    /**
+     * Get the average of the added samples in units of 1 / DATAPOINT_SCALE, limited to [0, DATAPOINT_MAX_VALUE].
+     * Must not be called without samples.
+     */
+    Average getAverage() const {
+        assert(count > 0);
+        static_assert(SystemConfig::DATAPOINT_SCALE == 25 << 7, "The scaling below assumes DATAPOINT_SCALE = 3200");
+        Average avg{};
+        const bool powerOfTwo = (count & (count - 1)) == 0;
+        for (size_t i = 0; i < channels; ++i) {
+            uint64_t high = highSums[i] + (lowSums[i] >> LOW_BITS);
+            uint64_t low = lowSums[i] & LOW_MASK;
+            // the integer part of the average in units of 2^-FRACTION_BITS, and whether there are more bits below it
+            uint64_t average;
+            bool inexact;
+            if (powerOfTwo) {
+                // the average is at most 2^(FRACTION_BITS + 16), so no bits are shifted out at the top
+                int shift = __builtin_ctz(count);
+                average = (high << (LOW_BITS - shift)) + (low >> shift);
+                inexact = (low & (count - 1)) != 0;
+            } else if ((high >> LOW_BITS) == 0) {
+                uint64_t sum = (high << LOW_BITS) + low;
+                average = sum / count;
+                inexact = sum % count != 0;
+            } else {
+                uint64_t rest = ((high % count) << LOW_BITS) + low;
+                average = ((high / count) << LOW_BITS) + rest / count;
+                inexact = rest % count != 0;
+            }
+            avg[i] = scaleFloat(average, inexact);
+        }
+        return avg;
+    }
+
+    uint32_t getCount() const { return count; }
+
+    void clear() {
+        highSums = {};
+        lowSums = {};
+        count = 0;
+    }
+
+private:
+    /**
+     * Round a non-negative value to the nearest float, ties to even, and compute floor(DATAPOINT_SCALE * f + 0.5) of
+     * that float f, limited to DATAPOINT_MAX_VALUE.
+     * @param value Value in units of 2^-FRACTION_BITS
+     * @param inexact true if the value has further non-zero bits below 2^-FRACTION_BITS
+     */
+    static uint32_t scaleFloat(uint64_t value, bool inexact) {
+        if (value < (1ull << (FLOAT_MANTISSA_BITS - 1))) {
+            return 0;  // below 2^-17, which is scaled to less than 0.025
+        }
+        if (value >= (1ull << (FRACTION_BITS + 13))) {
+            return SystemConfig::DATAPOINT_MAX_VALUE;  // 2^13 is scaled beyond it
+        }
+        // keep the upper FLOAT_MANTISSA_BITS bits as the mantissa and round the bits below it to the nearest, ties
+        // to even. The value gets one more bit, which is set if any bits below it are, so that a tie is exact.
+        int shift = 64 - __builtin_clzll(value) - FLOAT_MANTISSA_BITS + 1;
+        uint64_t extended = (value << 1) | (inexact ? 1 : 0);
+        uint64_t mantissa = (extended + ((1ull << (shift - 1)) - 1) + ((extended >> shift) & 1)) >> shift;
+        // f = mantissa * 2^(shift - 1 - FRACTION_BITS) and DATAPOINT_SCALE = 25 * 2^7. The shift is at most
+        // FRACTION_BITS + 14 - FLOAT_MANTISSA_BITS, so the scaled float is 25 * mantissa / 2^scaleShift with
+        // scaleShift >= 4, and no bits are lost before the rounding. The mantissa may have been rounded up to
+        // 2^FLOAT_MANTISSA_BITS, which is still exact.
+        int scaleShift = FRACTION_BITS - 6 - shift;
+        uint64_t scaled = (mantissa * 25 + (1ull << (scaleShift - 1))) >> scaleShift;
+        return std::min<uint64_t>(scaled, SystemConfig::DATAPOINT_MAX_VALUE);
+    }
+
+    static constexpr int FRACTION_BITS = 40;
+    static constexpr int FLOAT_MANTISSA_BITS = 24;
+    static constexpr int LOW_BITS = 32;
+    static constexpr uint64_t LOW_MASK = (1ull << LOW_BITS) - 1;
+    static constexpr float HIGH_SCALE = 1 << (FRACTION_BITS - LOW_BITS);
+    static constexpr float LOW_SCALE = 4294967296.0f;  // 2^LOW_BITS
+    // far beyond the measurement range of the SPS30
+    static constexpr float VALUE_LIMIT = 65536.0f;
+
+    // the high sums stay below MAX_COUNT * VALUE_LIMIT * 2^(FRACTION_BITS - LOW_BITS) = 2^40, the low sums below
+    // MAX_COUNT * 2^LOW_BITS = 2^48
+    std::array<uint64_t, channels> highSums{};
+    std::array<uint64_t, channels> lowSums{};
+    uint32_t count = 0;
+};
+
+#endif
@@ -0,0 +1,95 @@
+#include "AveragingBenchmark.h"
+#include "AveragingAccumulator.h"
+
+#include <vector>
+
+namespace {
+
+typedef std::array<double, 10> DatapointDouble;
+
+// the averages are written here, so that they are not optimised away
+volatile uint32_t averageSink;
+
+/**
+ * The former averaging of MeasurementCollector::recordMeasurement() and computeAverage(), and the conversion of
+ * DataPointPacket::append().
+ */
+class FormerAveraging
+{
+public:
+    explicit FormerAveraging(uint16_t window) : window(window) {}
+
+    void cycle(const DatapointFloat& measurement) {
+        DatapointDouble mes;
+        std::copy(measurement.begin(), measurement.end(), mes.begin());
+        averagingVector.push_back(mes);
+        if (averagingVector.size() == window) {
+            DatapointDouble avg{};
+            for (const DatapointDouble& dp : averagingVector) {
+                for (uint8_t i = 0; i < dp.size(); i++) {
+                    avg[i] += dp[i];
+                }
+            }
+            for (double& val : avg) {
+                val /= window;
+            }
+            averagingVector.clear();
+            for (const float valF : avg) {
+                uint32_t valI = 100.0 * 32.0 * valF + 0.5;
+                averageSink = valI;
+            }
+        }
+    }
+
+private:
+    uint16_t window;
+    std::vector<DatapointDouble> averagingVector;
+};
+
+class AccumulatorAveraging
+{
+public:
+    explicit AccumulatorAveraging(uint16_t window) : window(window) {}
+
+    void cycle(const DatapointFloat& measurement) {
+        accumulator.add(measurement);
+        if (accumulator.getCount() == window) {
+            for (uint32_t value : accumulator.getAverage()) {
+                averageSink = value;
+            }
+            accumulator.clear();
+        }
+    }
+
+private:
+    uint16_t window;
+    AveragingAccumulator<10> accumulator;
+};
+
+template<class Averaging>
+uint32_t measure(uint16_t window, uint32_t cycles, const std::array<DatapointFloat, 16>& measurements)
+{
+    Averaging averaging(window);
+    uint32_t startTicks = System.ticks();
+    for (uint32_t c = 0; c < cycles; ++c) {
+        averaging.cycle(measurements[c % measurements.size()]);
+    }
+    return (System.ticks() - startTicks) / cycles;
+}
+
+}
+
+AveragingBenchmark::Result AveragingBenchmark::run(uint16_t window, uint32_t cycles)
+{
+    // concentrations between 0 and 1000 #/cm3
+    std::array<DatapointFloat, 16> measurements;
+    uint32_t random = 20;
+    for (DatapointFloat& measurement : measurements) {
+        for (float& value : measurement) {
+            random = random * 1664525 + 1013904223;
+            value = (random >> 8) * (1000.0f / (1 << 24));
+        }
+    }
+    return {measure<FormerAveraging>(window, cycles, measurements),
+            measure<AccumulatorAveraging>(window, cycles, measurements)};
+}
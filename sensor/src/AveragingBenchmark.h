@@ -0,0 +1,31 @@
+#ifndef AVERAGINGBENCHMARK_H
+#define AVERAGINGBENCHMARK_H
+
+#include "main.h"
+
+/**
+ * Benchmark of the averaging of the acquisition cycles: the former path, which widened the measurements to double,
+ * kept them in a vector, averaged them in double and converted the average through float to the fixed-point
+ * representation, against the Averaging Accumulator. Both compute the same values.
+ *
+ * The cycles are counted with System.ticks(), so on the device the result is in CPU cycles, where the doubles are
+ * emulated in software. The benchmark is run by the "benchmarkAveraging" function if the firmware is built with
+ * ENABLE_AVERAGING_BENCHMARK_FUNCTION, and by the host benchmark in test/.
+ */
+class AveragingBenchmark
+{
+public:
+    struct Result {
+        uint32_t formerTicks;  // ticks per acquisition cycle
+        uint32_t accumulatorTicks;
+    };
+
+    /**
+     * Average the same pseudo-random measurements with both paths.
+     * @param window Number of measurements averaged into one data point
+     * @param cycles Number of acquisition cycles
+     */
+    static Result run(uint16_t window, uint32_t cycles);
+};
+
+#endif
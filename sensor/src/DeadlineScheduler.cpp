@@ -0,0 +1,33 @@
+#include "DeadlineScheduler.h"
+
+DeadlineScheduler::DeadlineScheduler(system_tick_t period) : period(period), deadline(millis())
+{
+}
+
+void DeadlineScheduler::start()
+{
+    deadline = millis();
+}
+
+uint32_t DeadlineScheduler::waitForNextDeadline()
+{
+    uint32_t periods = 1;
+    deadline += period;
+    // signed, so that a deadline in the past gives a negative difference across the wrap-around of millis()
+    int32_t remaining = static_cast<int32_t>(deadline - millis());
+    if(remaining >= 0) {
+        delay(remaining);
+    } else {
+        ++stats.overruns;
+        uint32_t missed = static_cast<uint32_t>(-remaining) / period;
+        deadline += missed * period;
+        periods += missed;
+        stats.skipped += missed;
+    }
+
+    system_tick_t jitter = millis() - deadline;
+    ++stats.cycles;
+    stats.totalJitter += jitter;
+    stats.maxJitter = std::max(stats.maxJitter, jitter);
+    return periods;
+}
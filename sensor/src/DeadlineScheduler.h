@@ -0,0 +1,52 @@
+#ifndef DEADLINESCHEDULER_H
+#define DEADLINESCHEDULER_H
+
+#include "main.h"
+
+/**
+ * Paces a periodic task by absolute deadlines on a fixed grid of millis() ticks, so that the variable duration of
+ * the task does not shift the following cycles.
+ *
+ * A cycle whose task has lasted past the next deadline is an overrun; the next cycle starts immediately, but stays
+ * on the grid. Deadlines that have passed completely are skipped instead of being run back to back.
+ *
+ * The scheduler is not thread safe, it is meant to be used by a single thread.
+ */
+class DeadlineScheduler
+{
+public:
+    struct Stats {
+        uint32_t cycles;          // deadlines reached
+        uint32_t overruns;        // cycles that started late, because the previous one lasted past the deadline
+        uint32_t skipped;         // deadlines skipped, because a cycle lasted longer than a whole period
+        uint32_t totalJitter;     // sum of the delays (ms) between the deadlines and the starts of the cycles
+        system_tick_t maxJitter;  // longest delay (ms) between a deadline and the start of its cycle
+    };
+
+    /**
+     * @param period Time (ms) between two deadlines
+     */
+    explicit DeadlineScheduler(system_tick_t period);
+
+    /**
+     * Place the current deadline at the current time, the next one follows a period later.
+     */
+    void start();
+
+    /**
+     * Wait until the next deadline, or return immediately if it has passed.
+     * @return Number of periods since the previous deadline, more than 1 if deadlines have been skipped
+     */
+    uint32_t waitForNextDeadline();
+
+    Stats getStats() const { return stats; }
+
+    void resetStats() { stats = {}; }
+
+private:
+    system_tick_t period;
+    system_tick_t deadline;  // deadline of the current cycle
+    Stats stats{};
+};
+
+#endif
@@ -66,7 +66,7 @@ void ErrorHandler::sendErrorMessages(const std::string& msg)
         }
         else
         {
-            packetPublishingQueue.push(ep);
+            packetPublishingQueue.push(ep, PacketQueue::Lane::PRIORITY);
         }
     }
 }
@@ -74,17 +74,19 @@ void ErrorHandler::sendErrorMessages(const std::string& msg)
 void ErrorHandler::publishWaitingPackets()
 {
     if(Particle.disconnected()) return;
-    Packet packet;
-    bool s = waitingPackets.take(&packet, 0);
+    PacketHandle handle;
+    bool s = waitingPackets.take(&handle, 0);
     while (s)
     {
-        packetPublishingQueue.push(packet);
-        s = waitingPackets.take(&packet, 0);
+        packetPublishingQueue.push(handle, PacketQueue::Lane::PRIORITY);  // moved without copying the packet
+        packetPublishingQueue.getPool().release(handle);
+        s = waitingPackets.take(&handle, 0);
     }
 }
 
 void ErrorHandler::init()
 {
-    waitingPackets.init(sysconfig.PACKET_QUEUE_CAPACITY);
+    waitingPackets.init(sysconfig.PACKET_QUEUE_CAPACITY, packetPublishingQueue.getPool(),
+                        PacketQueue::OverflowPolicy::DROP_OLDEST);
     publishWaitingPacketsTimer.start();
 }
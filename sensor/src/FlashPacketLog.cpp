@@ -0,0 +1,489 @@
+#include "FlashPacketLog.h"
+
+#include "filesystem.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+bool FlashPacketLog::init()
+{
+    system_tick_t start = millis();
+    if (loadJournal()) {
+        Log.info("Flash index loaded from the journal in %lu ms, %d packets.", millis() - start, count);
+    } else {
+        if (!scanRecords()) return false;
+        Log.info("Flash index rebuilt from records in %lu ms, %d packets.", millis() - start, count);
+        if (!writeSnapshot()) return false;
+    }
+    Log.info("Flash packet log capacity: %d packets in %d segments.", capacity, segments);
+
+    migrateLegacyPacketFiles();
+    return true;
+}
+
+bool FlashPacketLog::clear()
+{
+    std::vector<uint32_t> numbers;
+    if (!listSegments(numbers)) return false;
+    for (uint32_t segment : numbers) {
+        char path[32];
+        makeSegmentPath(segment, path, sizeof(path));
+        if (unlink(path) != 0 && errno != ENOENT) return false;
+    }
+    resetIndex(0);
+    return writeSnapshot();
+}
+
+uint16_t FlashPacketLog::freeSegments()
+{
+    // free blocks of the LittleFS instance, counted by traversing its metadata without writing anything
+    filesystem_t* fs = filesystem_get_instance(FILESYSTEM_INSTANCE_DEFAULT, nullptr);
+    if (fs == nullptr) return 0;
+    filesystem_lock(fs);
+    lfs_ssize_t used = lfs_fs_size(&fs->instance);
+    filesystem_unlock(fs);
+    if (used < 0) return 0;
+    uint32_t freeBlocks = fs->config.block_count - std::min<uint32_t>(used, fs->config.block_count);
+    // the data blocks of a segment, and one more for the skip-list pointers and the metadata of the file
+    uint32_t blocksPerSegment = (SEGMENT_SIZE + fs->config.block_size - 1) / fs->config.block_size + 1;
+    return std::min<uint32_t>(freeBlocks / blocksPerSegment, MAX_SEGMENTS);
+}
+
+void FlashPacketLog::setSegments(uint16_t available)
+{
+    segments = std::min(available, MAX_SEGMENTS);
+    // Leave some space for other files, but keep at least one segment
+    if (segments > 0 && available < MAX_SEGMENTS) {
+        segments -= std::min<uint16_t>(segments - 1, SystemConfig::FLASH_RESERVED_SEGMENTS);
+    }
+    capacity = segments * RECORDS_PER_SEGMENT;
+}
+
+void FlashPacketLog::migrateLegacyPacketFiles()
+{
+    DIR* packetsDir = opendir("/Packets");
+    if (packetsDir == nullptr) return;
+    // the directory is not sorted, but the packets must be appended in timestamp order
+    std::vector<time32_t> timestamps;
+    dirent* dirEntry = readdir(packetsDir);
+    while (dirEntry != nullptr) {
+        f_string name(dirEntry->d_name);
+        size_t pointPos = name.find('.');
+        if (pointPos != f_string::npos && name.substr(pointPos + 1) == "pkt") {
+            timestamps.push_back(std::atoi(name.c_str()));
+        }
+        dirEntry = readdir(packetsDir);
+    }
+    closedir(packetsDir);
+    if (timestamps.empty()) return;
+    std::sort(timestamps.begin(), timestamps.end());
+
+    uint16_t migrated = 0, kept = 0;
+    for (time32_t timestamp : timestamps) {
+        char path[64];
+        std::snprintf(path, sizeof(path), "/Packets/%ld.pkt", static_cast<long>(timestamp));
+        // a reset during the migration leaves files whose packets have already been appended
+        bool done = findPosition(timestamp) != -1;
+        if (!done) {
+            uint8_t buf[MAX_RECORD_DATA_SIZE];
+            int f = open(path, O_RDONLY);
+            if (f == -1) {
+                ++kept;
+                continue;
+            }
+            int size = ::read(f, buf, sizeof(buf));
+            close(f);
+            done = size > 0 && append(Packet(DataPointPacket::eventName, buf, size)) && findPosition(timestamp) != -1;
+        }
+        if (done && unlink(path) == 0) {
+            ++migrated;
+        } else {
+            ++kept;
+        }
+    }
+    Log.info("Migrated %d packet files of the old flash layout into the log.", migrated);
+    if (kept > 0) {
+        Log.warn("%d packet files of the old flash layout could not be migrated.", kept);
+    }
+}
+
+bool FlashPacketLog::scanRecords()
+{
+    std::vector<uint32_t> numbers;
+    if (!listSegments(numbers)) return false;
+    if (segments == 0) {
+        // the size of the log is not known, the existing segments are part of the available space
+        setSegments(std::min<size_t>(numbers.size() + freeSegments(), MAX_SEGMENTS));
+        if (segments == 0) return false;
+    }
+
+    // The log consists of consecutive segments ending with the newest one, all others are left over
+    size_t first = numbers.size();
+    while (first > 0 && numbers.size() - first < segments
+           && (first == numbers.size() || numbers[first - 1] + 1 == numbers[first])) {
+        --first;
+    }
+    for (size_t i = 0; i < first; ++i) {
+        char path[32];
+        makeSegmentPath(numbers[i], path, sizeof(path));
+        Log.warn("Flash segment %s is not part of the log, deleting it.", path);
+        unlink(path);
+    }
+    resetIndex(first < numbers.size() ? numbers[first] : 0);
+
+    RecordHeader header{};
+    for (size_t i = first; i < numbers.size(); ++i) {
+        bool newest = i + 1 == numbers.size();
+        char path[32];
+        makeSegmentPath(numbers[i], path, sizeof(path));
+        int f = open(path, O_RDWR);
+        if (f == -1) return false;
+        off_t fileSize = lseek(f, 0, SEEK_END);
+        uint16_t records = std::min<off_t>(fileSize / RECORD_SIZE, RECORDS_PER_SEGMENT);
+        uint16_t valid = 0;
+        for (; valid < records; ++valid) {
+            if (lseek(f, valid * RECORD_SIZE, SEEK_SET) == -1
+                || ::read(f, &header, sizeof(header)) != sizeof(header)) {
+                close(f);
+                return false;
+            }
+            if (header.magic != RECORD_MAGIC || header.size > MAX_RECORD_DATA_SIZE
+                || (count > 0 && header.timestamp <= getTimestampAt(count - 1))) {
+                break;
+            }
+            pushTimestamp(header.timestamp);
+        }
+        bool s = true;
+        if (newest && fileSize != static_cast<off_t>(valid * RECORD_SIZE)) {
+            // record of an append that was interrupted by a reset
+            Log.warn("Flash segment %s ends with an incomplete record, truncating it.", path);
+            s = ftruncate(f, valid * RECORD_SIZE) == 0;
+        }
+        s = (close(f) == 0) && s;
+        if (!s) return false;
+
+        if (!newest && valid < RECORDS_PER_SEGMENT) {
+            // the records of the following segments would not be at their positions
+            Log.warn("Flash segment %s is corrupt, deleting it and the older segments.", path);
+            for (size_t j = first; j <= i; ++j) {
+                makeSegmentPath(numbers[j], path, sizeof(path));
+                unlink(path);
+            }
+            resetIndex(numbers[i] + 1);
+        }
+    }
+    return true;
+}
+
+bool FlashPacketLog::loadJournal()
+{
+    int f = open(JOURNAL_PATH, O_RDONLY);
+    if (f == -1) return false;
+    JournalHeader header{};
+    if (::read(f, &header, sizeof(header)) != sizeof(header) || header.magic != JOURNAL_MAGIC
+        || header.segments == 0 || header.segments > MAX_SEGMENTS) {
+        close(f);
+        return false;
+    }
+    // the size of the log is kept even if the rest of the journal turns out to be invalid
+    segments = header.segments;
+    capacity = segments * RECORDS_PER_SEGMENT;
+    resetIndex(header.firstSegment);
+
+    bool s = header.count <= capacity;
+    uint32_t checksum = headerChecksum(header);
+    for (uint16_t i = 0; s && i < header.count; ++i) {
+        time32_t timestamp;
+        s = ::read(f, &timestamp, sizeof(timestamp)) == sizeof(timestamp);
+        checksum ^= slotChecksum(i, timestamp);
+        pushTimestamp(timestamp);
+    }
+    if (!s || checksum != header.checksum) {
+        close(f);
+        Log.warn("Flash index journal snapshot is corrupt.");
+        return false;
+    }
+    snapshotCount = header.count;
+
+    // Replay the entries. A new segment replaced the oldest one whenever the log was full.
+    JournalEntry entry{};
+    journalEntries = 0;
+    int r;
+    while ((r = ::read(f, &entry, sizeof(entry))) == sizeof(entry)
+           && entry.check == slotChecksum(snapshotCount + journalEntries, entry.timestamp)) {
+        if (count == capacity) {
+            dropOldestSegment();
+        }
+        pushTimestamp(entry.timestamp);
+        ++journalEntries;
+    }
+    close(f);
+    // an entry torn by a reset would be followed by the entries appended later
+    bool torn = r != 0;
+
+    // The journal is appended after the record, so a reset in between leaves a record that is not in the journal.
+    // The segments must match the index exactly.
+    uint16_t newestRecords = count == 0 ? 0 : (count - 1) % RECORDS_PER_SEGMENT + 1;
+    uint32_t newestSegment = firstSegment + (count == 0 ? 0 : (count - 1) / RECORDS_PER_SEGMENT);
+    if (getSegmentFileSize(newestSegment) != static_cast<off_t>(newestRecords * RECORD_SIZE)
+        || (newestRecords == RECORDS_PER_SEGMENT && getSegmentFileSize(newestSegment + 1) != 0)
+        || (firstSegment != newestSegment && getSegmentFileSize(firstSegment) != static_cast<off_t>(SEGMENT_SIZE))) {
+        Log.warn("Flash index journal does not match the segments.");
+        return false;
+    }
+    if (torn) {
+        Log.warn("Flash index journal ends with an incomplete entry, compacting it.");
+        return writeSnapshot();
+    }
+    return true;
+}
+
+bool FlashPacketLog::writeSnapshot()
+{
+    JournalHeader header{JOURNAL_MAGIC, segments, count, firstSegment, 0};
+    header.checksum = headerChecksum(header);
+    for (uint16_t i = 0; i < count; ++i) {
+        header.checksum ^= slotChecksum(i, getTimestampAt(i));
+    }
+    int f = open(JOURNAL_TEMP_PATH, O_WRONLY | O_CREAT | O_TRUNC);
+    if (f == -1) return false;
+    bool s = write(f, &header, sizeof(header)) == sizeof(header);
+    for (const auto& [begin, end] : getIndexRanges()) {
+        ssize_t size = (end - begin) * sizeof(time32_t);
+        s = s && write(f, begin, size) == size;
+    }
+    s = (close(f) == 0) && s;
+    // the new journal replaces the current one atomically
+    s = s && rename(JOURNAL_TEMP_PATH, JOURNAL_PATH) == 0;
+    if (s) {
+        snapshotCount = count;
+        journalEntries = 0;
+    }
+    return s;
+}
+
+bool FlashPacketLog::appendJournalEntry()
+{
+    if (journalEntries >= capacity) {
+        return writeSnapshot();
+    }
+    time32_t timestamp = getTimestampAt(count - 1);
+    JournalEntry entry{timestamp, slotChecksum(snapshotCount + journalEntries, timestamp)};
+    int f = open(JOURNAL_PATH, O_WRONLY | O_APPEND);
+    if (f == -1) return false;
+    bool s = write(f, &entry, sizeof(entry)) == sizeof(entry);
+    s = (close(f) == 0) && s;
+    if (s) ++journalEntries;
+    return s;
+}
+
+uint32_t FlashPacketLog::headerChecksum(const JournalHeader& header)
+{
+    return slotChecksum(header.segments, header.firstSegment) * 3 ^ slotChecksum(header.count, JOURNAL_MAGIC) * 5;
+}
+
+uint32_t FlashPacketLog::slotChecksum(uint32_t position, time32_t timestamp)
+{
+    // multiplicative hash of position and timestamp, so that swapped or shifted entries are detected
+    uint32_t h = static_cast<uint32_t>(timestamp) * 2654435761u;
+    h ^= (position + 0x9E3779B9u) * 2246822519u;
+    return h ^ (h >> 15);
+}
+
+bool FlashPacketLog::append(const Packet& packet)
+{
+    assert(DataPointPacket::isDataPointPacket(packet));
+    if (capacity == 0) return false;
+
+    uint16_t dataSize;
+    const uint8_t* data = packet.getBytes(&dataSize);
+    if (dataSize > MAX_RECORD_DATA_SIZE) return false;
+
+    if (count > 0 && packet.getTimestamp() <= getTimestampAt(count - 1)) {
+        // the index is searched with binary search and must stay sorted and unique, the packet is still saved
+        // to the SD card
+        Log.warn("Packet %ld is not newer than the newest packet in flash, not saving it to the flash.",
+                 static_cast<long>(packet.getTimestamp()));
+        return true;
+    }
+
+    // A full newest segment is followed by a new one, which takes the place of the oldest one if the log is full
+    bool newSegment = count % RECORDS_PER_SEGMENT == 0;
+    if (newSegment && count == capacity) {
+        char path[32];
+        makeSegmentPath(firstSegment, path, sizeof(path));
+        if (unlink(path) != 0 && errno != ENOENT) return false;
+        dropOldestSegment();
+    }
+
+    uint8_t record[RECORD_SIZE]{};
+    RecordHeader header{RECORD_MAGIC, packet.getTimestamp(), dataSize, fletcher16(data, dataSize)};
+    std::memcpy(record, &header, sizeof(header));
+    std::memcpy(record + sizeof(header), data, dataSize);
+
+    char path[32];
+    makeSegmentPath(firstSegment + count / RECORDS_PER_SEGMENT, path, sizeof(path));
+    // a file left over by an interrupted creation of the new segment is emptied
+    int f = open(path, O_WRONLY | O_CREAT | O_APPEND | (newSegment ? O_TRUNC : 0));
+    if (f == -1) return false;
+    bool s = write(f, record, sizeof(record)) == sizeof(record);
+    s = (close(f) == 0) && s;
+    if (!s) return false;
+
+    pushTimestamp(header.timestamp);
+    return appendJournalEntry();
+}
+
+bool FlashPacketLog::read(time32_t timestamp, uint8_t* buf, uint16_t* size) const
+{
+    int32_t position = findPosition(timestamp);
+    if (position == -1) return false;
+
+    RecordHeader header{};
+    if (!readRecord(position, &header, buf) || header.timestamp != timestamp
+        || header.checksum != fletcher16(buf, header.size)) {
+        return false;
+    }
+    *size = header.size;
+    return true;
+}
+
+bool FlashPacketLog::readSize(time32_t timestamp, uint16_t* size) const
+{
+    int32_t position = findPosition(timestamp);
+    if (position == -1) return false;
+
+    RecordHeader header{};
+    if (!readRecord(position, &header, nullptr) || header.timestamp != timestamp) return false;
+    *size = header.size;
+    return true;
+}
+
+bool FlashPacketLog::readRecord(uint16_t position, RecordHeader* header, uint8_t* buf) const
+{
+    char path[32];
+    makeSegmentPath(firstSegment + position / RECORDS_PER_SEGMENT, path, sizeof(path));
+    int f = open(path, O_RDONLY);
+    if (f == -1) return false;
+    bool s = lseek(f, (position % RECORDS_PER_SEGMENT) * RECORD_SIZE, SEEK_SET) != -1
+             && ::read(f, header, sizeof(RecordHeader)) == sizeof(RecordHeader)
+             && header->magic == RECORD_MAGIC
+             && header->size <= MAX_RECORD_DATA_SIZE
+             && (buf == nullptr || ::read(f, buf, header->size) == header->size);
+    close(f);
+    return s;
+}
+
+std::array<std::pair<const time32_t*, const time32_t*>, 2> FlashPacketLog::getIndexRanges() const
+{
+    const time32_t* base = slotTimestamps.data();
+    if (head + count <= capacity) {
+        return {{{base + head, base + head + count}, {base, base}}};
+    }
+    return {{{base + head, base + capacity}, {base, base + (head + count - capacity)}}};
+}
+
+bool FlashPacketLog::findSequenceRange(uint32_t first, uint32_t last, uint16_t* begin, uint16_t* end) const
+{
+    if (!lowerBoundSequence(first, begin)) return false;
+    if (last == UINT32_MAX) {
+        *end = count;
+        return true;
+    }
+    return lowerBoundSequence(last + 1, end);
+}
+
+bool FlashPacketLog::lowerBoundSequence(uint32_t sequenceNumber, uint16_t* position) const
+{
+    uint16_t low = 0, high = count;
+    while (low < high) {
+        uint16_t mid = low + (high - low) / 2;
+        uint32_t midSequenceNumber;
+        if (!readSequenceNumber(mid, &midSequenceNumber)) return false;
+        if (midSequenceNumber < sequenceNumber) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    *position = low;
+    return true;
+}
+
+bool FlashPacketLog::readSequenceNumber(uint16_t position, uint32_t* sequenceNumber) const
+{
+    RecordHeader header{};
+    uint8_t buf[MAX_RECORD_DATA_SIZE];
+    if (!readRecord(position, &header, buf)) return false;
+    // packets of the first format have no sequence number
+    if (!DataPointPacket::getSequenceNumber(buf, header.size, sequenceNumber)) {
+        *sequenceNumber = 0;
+    }
+    return true;
+}
+
+int32_t FlashPacketLog::findPosition(time32_t timestamp) const
+{
+    for (const auto& [begin, end] : getIndexRanges()) {
+        const time32_t* it = std::lower_bound(begin, end, timestamp);
+        if (it != end && *it == timestamp) {
+            return (it - slotTimestamps.data() + capacity - head) % capacity;
+        }
+    }
+    return -1;
+}
+
+void FlashPacketLog::pushTimestamp(time32_t timestamp)
+{
+    slotTimestamps[(head + count) % capacity] = timestamp;
+    ++count;
+}
+
+void FlashPacketLog::dropOldestSegment()
+{
+    ++firstSegment;
+    head = (head + RECORDS_PER_SEGMENT) % capacity;
+    count -= std::min(count, RECORDS_PER_SEGMENT);
+}
+
+void FlashPacketLog::resetIndex(uint32_t firstSegment)
+{
+    this->firstSegment = firstSegment;
+    head = segments == 0 ? 0 : (firstSegment % segments) * RECORDS_PER_SEGMENT;
+    count = 0;
+}
+
+bool FlashPacketLog::listSegments(std::vector<uint32_t>& numbers)
+{
+    DIR* packetsDir = opendir("/Packets");
+    if (packetsDir == nullptr) return false;
+    dirent* dirEntry = readdir(packetsDir);
+    while (dirEntry != nullptr) {
+        f_string name(dirEntry->d_name);
+        size_t pointPos = name.find('.');
+        if (pointPos != 0 && pointPos != f_string::npos && name.substr(pointPos + 1) == "seg") {
+            numbers.push_back(std::strtoul(name.c_str(), nullptr, 10));
+        }
+        dirEntry = readdir(packetsDir);
+    }
+    closedir(packetsDir);
+    std::sort(numbers.begin(), numbers.end());
+    return true;
+}
+
+off_t FlashPacketLog::getSegmentFileSize(uint32_t segment)
+{
+    char path[32];
+    makeSegmentPath(segment, path, sizeof(path));
+    struct stat st{};
+    return stat(path, &st) == 0 ? st.st_size : 0;
+}
+
+void FlashPacketLog::makeSegmentPath(uint32_t segment, char* path, size_t size)
+{
+    std::snprintf(path, size, "/Packets/%lu.seg", static_cast<unsigned long>(segment));
+}
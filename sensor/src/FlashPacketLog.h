@@ -0,0 +1,273 @@
+#ifndef FLASHPACKETLOG_H
+#define FLASHPACKETLOG_H
+
+#include "main.h"
+
+#include "Packets/Packet.h"
+#include "Packets/DataPointPacket.h"
+
+#include <fcntl.h>
+
+#include <vector>
+
+/**
+ * Circular log of Data Point Packets in the flash file system.
+ *
+ * The log consists of a number of segment files (/Packets/<n>.seg) which are only ever appended to. Every
+ * segment holds RECORDS_PER_SEGMENT fixed-size records, the segment numbers grow with every new segment. When the
+ * newest segment is full, the next packet starts a new one, and if the log already has its maximum number of
+ * segments, the oldest segment is deleted first. So appending a packet and evicting the oldest ones are O(1) and
+ * never rewrite data in the file system, which is copy-on-write. The maximum number of segments is derived from
+ * the free space of the file system when the log is created.
+ *
+ * Record structure:
+ * Bytes          |Function
+ * ---------------|--------------------------------------------------
+ * 0-3            |RECORD_MAGIC
+ * 4-7            |packet timestamp
+ * 8-9            |packet size
+ * 10-11          |checksum of the packet data
+ * 12-end         |packet data, padded to MAX_RECORD_DATA_SIZE
+ *
+ * The index of the log (timestamp of every record) is kept in /Packets/index.bin, so that it can be loaded at boot
+ * instead of reading all record headers. The index file is a journal: a snapshot of the index, to which an entry is
+ * appended for every packet. Once the journal holds as many entries as the log can hold packets, it is compacted
+ * into a new snapshot, which replaces the file atomically.
+ *
+ * Index journal structure:
+ * Bytes          |Function
+ * ---------------|--------------------------------------------------
+ * 0-3            |JOURNAL_MAGIC
+ * 4-5            |maximum number of segments
+ * 6-7            |number of records in the snapshot
+ * 8-11           |number of the oldest segment
+ * 12-15          |checksum of the header and the timestamps
+ * 16-...         |timestamps of the records in the snapshot, oldest first (4 bytes each)
+ * ...-end        |journal entries: timestamp and check of every record appended after the snapshot (8 bytes each)
+ *
+ * The log is not thread safe, access is synchronized by the Packet Storage Manager.
+ */
+class FlashPacketLog
+{
+public:
+    struct RecordHeader {
+        uint32_t magic;
+        time32_t timestamp;
+        uint16_t size;
+        uint16_t checksum;
+    };
+
+    static constexpr uint16_t RECORDS_PER_SEGMENT = SystemConfig::FLASH_SEGMENT_RECORDS;
+    static constexpr uint16_t MAX_SEGMENTS = SystemConfig::FLASH_MAX_PACKETS / RECORDS_PER_SEGMENT;
+    static constexpr size_t MAX_RECORD_DATA_SIZE = DataPointPacket::MAX_SIZE_BYTES;
+    static constexpr size_t RECORD_SIZE = sizeof(RecordHeader) + MAX_RECORD_DATA_SIZE;
+    static constexpr size_t SEGMENT_SIZE = RECORD_SIZE * RECORDS_PER_SEGMENT;
+
+    static constexpr uint32_t RECORD_MAGIC = 0x44524350;  // "PCRD"
+
+    struct JournalHeader {
+        uint32_t magic;
+        uint16_t segments;
+        uint16_t count;
+        uint32_t firstSegment;
+        uint32_t checksum;
+    };
+
+    struct JournalEntry {
+        time32_t timestamp;
+        uint32_t check;  // slotChecksum() of the position of the record in the journal and the timestamp
+    };
+
+    static constexpr uint32_t JOURNAL_MAGIC = 0x4C4A4950;  // "PIJL"
+
+    /**
+     * Load the index from the journal. If the journal is missing or does not match the segment files, the index is
+     * rebuilt from the record headers. The maximum number of segments is derived from the free space if the log
+     * is created.
+     * @return true on success, false on failure
+     */
+    bool init();
+
+    /**
+     * Discard all records.
+     * @return true on success, false on failure
+     */
+    bool clear();
+
+    /**
+     * Append a packet to the log, deleting the oldest segment if the log is full. The timestamps in the log must
+     * be unique and ascending, so a packet which is not newer than the newest record is skipped (and logged).
+     * @param packet The packet to be saved, must be a Data Point Packet
+     * @return true on success or if the packet was skipped, false on failure
+     */
+    bool append(const Packet& packet);
+
+    /**
+     * Read the data of the packet with the given timestamp.
+     * @param timestamp Packet timestamp
+     * @param buf Output buffer, must hold at least MAX_RECORD_DATA_SIZE bytes
+     * @param size Size of the packet data
+     * @return true on success, false if the packet was not found or the record is corrupt
+     */
+    bool read(time32_t timestamp, uint8_t* buf, uint16_t* size) const;
+
+    /**
+     * Read the size of the packet with the given timestamp from its record header.
+     * @return true on success, false if the packet was not found or the record is corrupt
+     */
+    bool readSize(time32_t timestamp, uint16_t* size) const;
+
+    /**
+     * The index is a ring buffer, so it is exposed as two sorted contiguous ranges of timestamps.
+     * All timestamps in the first range precede the timestamps in the second one.
+     * @return Begin and end pointers of both ranges, empty ranges have begin == end
+     */
+    std::array<std::pair<const time32_t*, const time32_t*>, 2> getIndexRanges() const;
+
+    /**
+     * Find the records whose packets have sequence numbers in the given range. Sequence numbers grow with the
+     * position in the log, so the range is found with binary search over the record data. Packets without a
+     * sequence number are treated as older than all others.
+     * @param first First sequence number (inclusive)
+     * @param last Last sequence number (inclusive)
+     * @param begin Position (0 is the oldest record) of the first record in the range
+     * @param end Position after the last record in the range
+     * @return true on success, false on failure
+     */
+    bool findSequenceRange(uint32_t first, uint32_t last, uint16_t* begin, uint16_t* end) const;
+
+    /**
+     * Get the timestamp of the record at a position, 0 being the oldest record.
+     */
+    time32_t getTimestampAt(uint16_t position) const { return slotTimestamps[(head + position) % capacity]; }
+
+    bool empty() const { return count == 0; }
+
+    uint16_t size() const { return count; }
+
+    uint16_t getCapacity() const { return capacity; }
+
+    time32_t getEarliestTimestamp() const { return slotTimestamps[head]; }
+
+private:
+    /**
+     * Find out how many segments fit into the free blocks of the file system.
+     * @return Number of segments, at most MAX_SEGMENTS
+     */
+    static uint16_t freeSegments();
+
+    /**
+     * Set the maximum number of segments, leaving FLASH_RESERVED_SEGMENTS of the available ones for other files,
+     * but at least one for the log.
+     * @param available Number of segments that fit into the file system
+     */
+    void setSegments(uint16_t available);
+
+    /**
+     * Move the packets of the former one-file-per-packet layout (/Packets/<timestamp>.pkt) into the log, in
+     * timestamp order. A file is only removed after its packet has been appended, so packets which cannot be
+     * migrated stay in the flash.
+     */
+    void migrateLegacyPacketFiles();
+
+    /**
+     * Read all record headers and restore the index, the oldest segment and the number of records. Segments that
+     * do not belong to the log are deleted, a torn record at the end of the newest segment is truncated.
+     * @return true on success, false on failure
+     */
+    bool scanRecords();
+
+    /**
+     * Load the index from the journal and check it against the segment files.
+     * @return true if the journal is valid, false otherwise
+     */
+    bool loadJournal();
+
+    /**
+     * Write a snapshot of the index into a new journal, which replaces the current one.
+     * @return true on success, false on failure
+     */
+    bool writeSnapshot();
+
+    /**
+     * Append the entry of the newest record to the journal, or compact the journal if it has grown too long.
+     * @return true on success, false on failure
+     */
+    bool appendJournalEntry();
+
+    /**
+     * Read the header and the data of the record at a position, 0 being the oldest record.
+     * @param buf Output buffer, must hold MAX_RECORD_DATA_SIZE bytes, or nullptr to read the header only
+     */
+    bool readRecord(uint16_t position, RecordHeader* header, uint8_t* buf) const;
+
+    /**
+     * Read the sequence number of the packet at a position, 0 if the packet has none.
+     */
+    bool readSequenceNumber(uint16_t position, uint32_t* sequenceNumber) const;
+
+    /**
+     * Find the position of the first record whose sequence number is not less than the given one.
+     */
+    bool lowerBoundSequence(uint32_t sequenceNumber, uint16_t* position) const;
+
+    /**
+     * Contribution of one record to the checksums of the journal.
+     */
+    static uint32_t slotChecksum(uint32_t position, time32_t timestamp);
+
+    /**
+     * Contribution of the header fields to the checksum of the snapshot.
+     */
+    static uint32_t headerChecksum(const JournalHeader& header);
+
+    /**
+     * Find the position of the record that holds the packet with the given timestamp.
+     * @return Position or -1 if not found
+     */
+    int32_t findPosition(time32_t timestamp) const;
+
+    /**
+     * Add the record of a packet with the given timestamp after the newest record of the index.
+     */
+    void pushTimestamp(time32_t timestamp);
+
+    /**
+     * Remove the records of the oldest segment from the index.
+     */
+    void dropOldestSegment();
+
+    /**
+     * Make the given segment the oldest one of the index, which is then empty.
+     */
+    void resetIndex(uint32_t firstSegment);
+
+    /**
+     * Get the numbers of all segment files, in ascending order.
+     * @return true on success, false on failure
+     */
+    static bool listSegments(std::vector<uint32_t>& numbers);
+
+    /**
+     * Get the size of a segment file, 0 if it does not exist.
+     */
+    static off_t getSegmentFileSize(uint32_t segment);
+
+    static void makeSegmentPath(uint32_t segment, char* path, size_t size);
+
+    static constexpr char JOURNAL_PATH[] = "/Packets/index.bin";
+    static constexpr char JOURNAL_TEMP_PATH[] = "/Packets/index.tmp";
+
+    // timestamp of the record in every slot, in ring order starting at head. The records of segment n are in the
+    // slots of (n % segments).
+    std::array<time32_t, SystemConfig::FLASH_MAX_PACKETS> slotTimestamps{};
+    uint16_t segments = 0;      // maximum number of segments
+    uint16_t capacity = 0;      // number of records in all segments
+    uint16_t head = 0;          // slot of the oldest record
+    uint16_t count = 0;         // number of records in the log
+    uint32_t firstSegment = 0;  // number of the oldest segment
+    uint16_t snapshotCount = 0;   // number of records in the snapshot of the journal
+    uint16_t journalEntries = 0;  // number of entries appended to the journal since the snapshot
+};
+
+#endif
@@ -11,7 +11,7 @@ HandshakeHandler::HandshakeHandler(PacketStorageManager &psm, PacketQueue &packe
 void HandshakeHandler::start()
 {
     os_mutex_create(&handshakeMutex);
-    thread = Thread("HandshakeHandler", [this] { run(); });
+    thread = Thread("HandshakeHandler", [this] { run(); }, OS_THREAD_PRIORITY_DEFAULT, SystemConfig::THREAD_STACK_SIZE);
 }
 
 bool HandshakeHandler::putHandshake(const char* encodedData)
@@ -35,13 +35,84 @@ bool HandshakeHandler::putHandshake(const char* encodedData)
             delay(100);
         }
         os_mutex_lock(handshakeMutex);
-        static_vector<interval_t, HandshakePacket::MAX_INTERVALS> intervals{};
-        handshake.getIntervals(std::back_inserter(intervals));
-        Log.info("Received handshake with %d intervals, timestamp %d.", intervals.size(), handshake.getTimestamp());
         static_vector<PacketStorageManager::PacketDescriptor, SystemConfig::MAX_REQUESTED_PACKETS_PER_HANDSHAKE> packets{};
-        psm.findPackets(intervals, packets);
+        bool s;
+        if(handshake.getMode() == HandshakePacket::SEQUENCE_RANGES) {
+            static_vector<sequence_range_t, HandshakePacket::MAX_INTERVALS> ranges{};
+            handshake.getSequenceRanges(std::back_inserter(ranges));
+            Log.info("Received handshake with %d sequence ranges, timestamp %d.", ranges.size(),
+                     handshake.getTimestamp());
+            s = psm.findPacketsBySequence(ranges, packets);
+        } else {
+            static_vector<interval_t, HandshakePacket::MAX_INTERVALS> intervals{};
+            handshake.getIntervals(std::back_inserter(intervals));
+            Log.info("Received handshake with %d intervals, timestamp %d.", intervals.size(), handshake.getTimestamp());
+            s = psm.findPackets(intervals, packets);
+        }
+        if(!s) {
+            Log.error("SD card error while searching requested packets");
+            eh.sdError();
+        }
         Log.info("Filled vector, size %d", packets.size());
+        std::sort(packets.begin(), packets.end(), [](const auto& lhs, const auto& rhs) {
+            return lhs.packetTimestamp < rhs.packetTimestamp;
+        });
+        if(!respond(packets)) {
+            Log.warn("Handshake response aborted, publishing queue is full");
+        }
         os_mutex_unlock(handshakeMutex);
         handshakeAvailable = false;
     }
+}
+
+template<class Container>
+bool HandshakeHandler::respond(const Container& packets)
+{
+    constexpr size_t ENTRY_HEADER_SIZE = RequestedDataPointPacket::ENTRY_HEADER_SIZE;
+    constexpr size_t MAX_PAYLOAD_SIZE = RequestedDataPointPacket::MAX_PAYLOAD_SIZE;
+
+    // lay out the response, a size of 0 marks a packet that could not be found
+    static_vector<uint16_t, SystemConfig::MAX_REQUESTED_PACKETS_PER_HANDSHAKE> sizes;
+    uint8_t totalPackets = 1;
+    size_t freeSpace = MAX_PAYLOAD_SIZE;
+    for(const auto& d : packets) {
+        uint16_t size = 0;
+        if(!psm.getPacketSize(d, &size) || ENTRY_HEADER_SIZE + size > MAX_PAYLOAD_SIZE) {
+            Log.warn("Could not read requested packet %d", d.packetTimestamp);
+            size = 0;
+        } else if(freeSpace < ENTRY_HEADER_SIZE + size) {
+            ++totalPackets;
+            freeSpace = MAX_PAYLOAD_SIZE;
+        }
+        if(size > 0) freeSpace -= ENTRY_HEADER_SIZE + size;
+        sizes.push_back(size);
+    }
+
+    uint8_t packetNumber = 0;
+    freeSpace = MAX_PAYLOAD_SIZE;
+    RequestedDataPointPacket rdp(handshake, packetNumber, totalPackets);
+    static_vector<uint8_t, DataPointPacket::MAX_SIZE_BYTES> packetData;
+    auto sizeIt = sizes.begin();
+    for(const auto& d : packets) {
+        uint16_t size = *sizeIt++;
+        if(size == 0) continue;
+        // the rdp packets are split where the layout splits them, so that the total stays correct
+        if(freeSpace < ENTRY_HEADER_SIZE + size) {
+            if(!packetPublishingQueue.push(rdp, SystemConfig::HANDSHAKE_RESPONSE_QUEUE_TIMEOUT,
+                                           PacketQueue::Lane::PRIORITY)) {
+                return false;
+            }
+            rdp = RequestedDataPointPacket(handshake, ++packetNumber, totalPackets);
+            freeSpace = MAX_PAYLOAD_SIZE;
+        }
+        freeSpace -= ENTRY_HEADER_SIZE + size;
+        packetData.clear();
+        if(!psm.getPacket(d, std::back_inserter(packetData)) || packetData.size() != size) {
+            Log.warn("Could not read requested packet %d", d.packetTimestamp);
+            continue;
+        }
+        rdp.appendPacket(packetData.data(), packetData.size());
+    }
+    return packetPublishingQueue.push(rdp, SystemConfig::HANDSHAKE_RESPONSE_QUEUE_TIMEOUT,
+                                      PacketQueue::Lane::PRIORITY);
 }
\ No newline at end of file
@@ -19,6 +19,18 @@ public:
 private:
     [[noreturn]] void run();
 
+    /**
+     * Read the requested packets and publish them in Requested Data Point Packets. The sizes of the packets are
+     * read first, so that the packets can be laid out into rdp packets and every rdp carries the total number of
+     * rdp packets. The packets are then read from the storage while the previous rdp packets wait in the
+     * publishing queue. A packet that cannot be read in the meantime (e.g. evicted from flash) leaves a gap in
+     * its rdp. An empty response consists of one rdp without payload.
+     * @param packets Descriptors of the requested packets, sorted by timestamp
+     * @return true if all rdp packets were queued, false on timeout
+     */
+    template<class Container>
+    bool respond(const Container& packets);
+
     Thread thread;
 
     os_mutex_t handshakeMutex{};
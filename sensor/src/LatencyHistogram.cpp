@@ -0,0 +1,49 @@
+#include "LatencyHistogram.h"
+
+LatencyHistogram::LatencyHistogram(const char* name, uint32_t firstBucketLimitUs)
+    : name(name), firstBucketLimit(firstBucketLimitUs)
+{
+}
+
+void LatencyHistogram::record(uint32_t latencyUs)
+{
+    size_t bucket = 0;
+    uint32_t limit = firstBucketLimit;
+    while(bucket < BUCKETS - 1 && latencyUs >= limit) {
+        ++bucket;
+        limit *= 2;
+    }
+    ++buckets[bucket];
+    ++count;
+    totalLatency += latencyUs;
+    maxLatency = std::max(maxLatency, latencyUs);
+}
+
+void LatencyHistogram::log() const
+{
+    char line[256];
+    size_t length = 0;
+    uint32_t limit = firstBucketLimit;
+    for(size_t i = 0; i < BUCKETS && length < sizeof(line); ++i, limit *= 2) {
+        if(buckets[i] == 0) continue;
+        if(i < BUCKETS - 1) {
+            length += std::snprintf(line + length, sizeof(line) - length, " <%luus:%lu",
+                                    static_cast<unsigned long>(limit), static_cast<unsigned long>(buckets[i]));
+        } else {
+            length += std::snprintf(line + length, sizeof(line) - length, " >=%luus:%lu",
+                                    static_cast<unsigned long>(limit / 2), static_cast<unsigned long>(buckets[i]));
+        }
+    }
+    line[std::min(length, sizeof(line) - 1)] = '\0';
+
+    Log.info("%s latency: n=%lu mean=%luus max=%luus |%s", name, static_cast<unsigned long>(count),
+             static_cast<unsigned long>(getMean()), static_cast<unsigned long>(maxLatency), line);
+}
+
+void LatencyHistogram::reset()
+{
+    buckets.fill(0);
+    count = 0;
+    maxLatency = 0;
+    totalLatency = 0;
+}
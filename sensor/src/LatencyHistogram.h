@@ -0,0 +1,51 @@
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include "main.h"
+
+/**
+ * Histogram of operation latencies with power-of-two buckets.
+ * Bucket 0 counts latencies below the first bucket limit, each following bucket doubles the limit and
+ * the last bucket counts everything above the limit of the previous one.
+ */
+class LatencyHistogram
+{
+public:
+    static constexpr size_t BUCKETS = 12;
+    static constexpr uint32_t FIRST_BUCKET_LIMIT_US = 256;
+
+    /**
+     * @param name Name used in the log
+     * @param firstBucketLimitUs Upper limit of the first bucket, sets the range of the histogram
+     */
+    explicit LatencyHistogram(const char* name, uint32_t firstBucketLimitUs = FIRST_BUCKET_LIMIT_US);
+
+    /**
+     * Add one measurement to the histogram
+     * @param latencyUs Latency in microseconds
+     */
+    void record(uint32_t latencyUs);
+
+    /**
+     * Log the count, mean, max and non-empty buckets of the histogram
+     */
+    void log() const;
+
+    void reset();
+
+    uint32_t getCount() const { return count; }
+    uint32_t getMean() const { return count ? static_cast<uint32_t>(totalLatency / count) : 0; }
+    uint32_t getMax() const { return maxLatency; }
+    uint32_t getBucket(size_t i) const { return buckets[i]; }
+    uint32_t getBucketLimit(size_t i) const { return firstBucketLimit << i; }
+
+private:
+    const char* name;
+    uint32_t firstBucketLimit;
+    std::array<uint32_t, BUCKETS> buckets{};
+    uint32_t count = 0;
+    uint32_t maxLatency = 0;
+    uint64_t totalLatency = 0;
+};
+
+#endif
@@ -12,99 +12,254 @@ MeasurementCollector::MeasurementCollector(PacketQueue& packetPublishingQueue,
 
 void MeasurementCollector::start()
 {
-    thread = Thread{"MeasurementCollector", [this] { run(); }};
+    thread = Thread{"MeasurementCollector", [this] { run(); }, OS_THREAD_PRIORITY_DEFAULT, SystemConfig::THREAD_STACK_SIZE};
 }
 
 [[noreturn]] void MeasurementCollector::run()
 {
-    std::queue<DatapointDouble> timestamplessDataPoints{};
+    std::queue<TimestamplessDataPoint> timestamplessDataPoints{};
+    time32_t timestamplessSpan = 0;  // time since the first timestampless data point began
+    uint32_t windowPeriods = 0;  // measurement periods in the current averaging window
+
+    if (!sequenceCounter.init())
+    {
+        Log.error("Could not reserve sequence numbers in the flash.");
+    }
 
     // Init SPS30s
     sensor1.startMeasurement();
     sensor2.startMeasurement();
 
+    scheduler.start();
     while (true)
     {
-        recordMeasurement();
-        if (averagingVector.size() == sysconfig.N_DATA_POINTS_AVERAGING)
+        uint32_t periods = scheduler.waitForNextDeadline();
+        bool timeValid = advanceDeadlineTime(periods);
+        if (!recordMeasurement())
+            continue;
+        uint32_t startTicks = System.ticks();
+        // the window may have been reduced below the number of its periods in the meantime
+        if (++windowPeriods >= sysstate.averagingWindow)
         {
-            // We have collected enough data points to calculate the average
-            auto avg = computeAverage();
-            averagingVector.clear();
+            // The window is complete. It holds fewer measurements than periods if the sensors had no new values.
+            time32_t period = windowPeriods * sysconfig.SPS30_MEASUREMENT_PERIOD;
+            uint32_t count = averagingAccumulator.getCount();
+            // statistics of fewer measurements are not worth their size. The length of the window decides, so
+            // that a stale measurement does not change the format of the packet.
+            bool withStatistics = SystemConfig::DATA_POINT_STATISTICS &&
+                                  windowPeriods >= SystemConfig::STATISTICS_MIN_WINDOW;
+            DatapointInteger avg{};
+            DatapointStatistics statistics{};
+            if (count > 0)
+            {
+                avg = averagingAccumulator.getAverage();
+                if (withStatistics)
+                {
+                    statistics = {statisticsAccumulator.getMinimum(), statisticsAccumulator.getMaximum(),
+                                  statisticsAccumulator.getStandardDeviation()};
+                }
+            }
+            averagingAccumulator.clear();
+            statisticsAccumulator.clear();
+            windowPeriods = 0;
 
-            if (Time.year() == 2000 || Particle.syncTimePending())
+            if (!timeValid)
             {
                 // Oh-oh: we don't know what time it is and can't stamp the
                 // packet, so it goes into the queue of timestamp-less packets
-                timestamplessDataPoints.push(avg);
+                timestamplessSpan += period;
+                if (count > 0)
+                    timestamplessDataPoints.push({avg, period, timestamplessSpan, withStatistics, statistics});
             }
             else
             {
                 // System time is correct, so we push the timestampless
                 // datapoints first in FIFO order before pushing the current
-                // datapoint (avg). We deduce timestamps based on position in the
-                // queue. Beforehand, we set the lastHandshakeTimestamp variable to 
-                // current time, so that the PacketPublisher can start sending packets
-                // before the first handshake arrives from the server.
+                // datapoint (avg). We deduce their timestamps from the time
+                // that has passed since the end of their windows. Beforehand, we set
+                // the lastHandshakeTimestamp variable to current time, so that
+                // the PacketPublisher can start sending packets before the first
+                // handshake arrives from the server.
                 sysstate.lastHandshakeTimestamp = Time.now();
+                timestamplessSpan += period;
                 while (!timestamplessDataPoints.empty())
                 {
-                    auto dp = timestamplessDataPoints.front();
-                    time32_t t = Time.now() - timestamplessDataPoints.size() *
-                                                  sysconfig.SPS30_MEASUREMENT_PERIOD *
-                                                  sysconfig.N_DATA_POINTS_AVERAGING;
-                    currentPacket.append(dp, t);
+                    const TimestamplessDataPoint& dp = timestamplessDataPoints.front();
+                    appendDataPoint(dp.values, deadlineTime - (timestamplessSpan - dp.end), dp.period,
+                                    dp.withStatistics ? &dp.statistics : nullptr);
                     timestamplessDataPoints.pop();
-                    if (currentPacket.isFull())
-                        pushCurrentPacket();
                 }
-                currentPacket.append(avg, Time.now());
-                if (currentPacket.isFull())
-                    pushCurrentPacket();
+                timestamplessSpan = 0;
+                // a window without any measurement leaves a gap
+                if (count > 0)
+                    appendDataPoint(avg, deadlineTime, period, withStatistics ? &statistics : nullptr);
             }
         }
+        recordAcquisitionCycles(System.ticks() - startTicks);
+    }
+}
 
-        delay(sysconfig.SPS30_MEASUREMENT_PERIOD * 1000 - 50);
+bool MeasurementCollector::advanceDeadlineTime(uint32_t periods)
+{
+    if (deadlineTime != 0)
+        deadlineTime += periods * sysconfig.SPS30_MEASUREMENT_PERIOD;
+    if (Time.year() == 2000 || Particle.syncTimePending())
+        return false;
+
+    // the deadlines follow millis(), which drifts against the synchronized system time
+    time32_t now = Time.now();
+    if (deadlineTime == 0 || now - deadlineTime > SystemConfig::ACQUISITION_MAX_CLOCK_DEVIATION)
+    {
+        if (deadlineTime != 0)
+            Log.info("Acquisition deadlines realigned to the system time by %ld s", static_cast<long>(now - deadlineTime));
+        deadlineTime = now;
+        deadlineSlewing = false;
     }
+    else if (deadlineTime - now > SystemConfig::ACQUISITION_MAX_CLOCK_DEVIATION)
+    {
+        // Moving the deadlines back would make the timestamps decrease. Instead, they are held back by one second
+        // per cycle until the system time catches up, but stay after the timestamp of the last data point.
+        if (!deadlineSlewing)
+            Log.info("Acquisition deadlines are %ld s ahead of the system time, slowing them down",
+                     static_cast<long>(deadlineTime - now));
+        deadlineSlewing = true;
+        deadlineTime = std::max(deadlineTime - 1, lastDataPointTimestamp + 1);
+    }
+    else
+    {
+        deadlineSlewing = false;
+    }
+    return true;
 }
 
-void MeasurementCollector::recordMeasurement()
+bool MeasurementCollector::recordMeasurement()
 {
-    SPS30MeasuredValues val1, val2;
-    while (!(sensor1.readDataReadyFlag() && sensor2.readDataReadyFlag()))
-        delay(2);
-    sensor1.readMeasuredValues(&val1);
-    sensor2.readMeasuredValues(&val2);
-    DatapointDouble mes{val1.NumberConcentration.pm005, val1.NumberConcentration.pm010,
+    constexpr uint8_t sensorCount = std::tuple_size<decltype(sensorValues)>::value;
+    SPS30* sensors[sensorCount] = {&sensor1, &sensor2};
+    bool ready[sensorCount];
+    SPS30::readDataReadyFlags(sensors, sensorCount, ready);
+
+    // only the sensors with new values are read
+    SPS30* readySensors[sensorCount];
+    SPS30MeasuredValues* readyValues[sensorCount];
+    uint8_t readyCount = 0;
+    uint8_t readyIndexes[sensorCount];
+    bool fresh[sensorCount] = {};
+    for (uint8_t i = 0; i < sensorCount; ++i)
+    {
+        if (ready[i])
+        {
+            readySensors[readyCount] = sensors[i];
+            readyValues[readyCount] = &sensorValues[i];
+            readyIndexes[readyCount] = i;
+            ++readyCount;
+        }
+    }
+    if (readyCount > 0)
+    {
+        bool valid[sensorCount];
+        SPS30::readMeasuredValues(readySensors, readyCount, readyValues, valid);
+        for (uint8_t i = 0; i < readyCount; ++i)
+        {
+            fresh[readyIndexes[i]] = valid[i];
+        }
+    }
+    bool allFresh = true;
+    for (uint8_t i = 0; i < sensorCount; ++i)
+    {
+        if (fresh[i])
+        {
+            sensorMeasured[i] = true;
+        }
+        else
+        {
+            ++staleMeasurements;
+            allFresh = false;
+        }
+    }
+    if (!sensorMeasured[0] || !sensorMeasured[1])
+        return false;
+    if (!allFresh)
+    {
+        // the previous values of the stale sensor would be counted twice
+        slidingMeans.skip();
+        return true;
+    }
+
+    const SPS30MeasuredValues& val1 = sensorValues[0];
+    const SPS30MeasuredValues& val2 = sensorValues[1];
+    DatapointFloat mes{val1.NumberConcentration.pm005, val1.NumberConcentration.pm010,
                         val1.NumberConcentration.pm025, val1.NumberConcentration.pm040,
                         val1.NumberConcentration.pm100, val2.NumberConcentration.pm005,
                         val2.NumberConcentration.pm010, val2.NumberConcentration.pm025,
                         val2.NumberConcentration.pm040, val2.NumberConcentration.pm100};
-    averagingVector.push_back(mes);
+    averagingAccumulator.add(mes);
+    if (SystemConfig::DATA_POINT_STATISTICS)
+        statisticsAccumulator.add(mes);
+    slidingMeans.add(mes);
+    return true;
+}
+
+void MeasurementCollector::appendDataPoint(const DatapointInteger& dp, time32_t timestamp, time32_t period,
+                                           const DatapointStatistics* statistics)
+{
+    bool withStatistics = statistics != nullptr;
+    if (currentPacket.getPeriod() != period || currentPacket.hasStatistics() != withStatistics)
+    {
+        // the averaging window has changed, but all data points of a packet share one period and format
+        if (!currentPacket.isEmpty())
+            pushCurrentPacket();
+        currentPacket = DataPointPacket{DataPointPacket::DEFAULT_ENCODING, withStatistics};
+        currentPacket.setPeriod(period);
+    }
+    if (!currentPacket.append(dp, timestamp, statistics))
+    {
+        // the data point does not fit, so it starts the next packet
+        pushCurrentPacket();
+        currentPacket.append(dp, timestamp, statistics);
+    }
+    if (currentPacket.isFull())
+        pushCurrentPacket();
+    lastDataPointTimestamp = timestamp;
 }
 
 void MeasurementCollector::pushCurrentPacket()
 {
-    // Push current packet into the packetPublishingQueue and packetStorageQueue
-    packetPublishingQueue.push(currentPacket);
-    packetStorageQueue.push(currentPacket);
+    // Push current packet into the packetPublishingQueue and packetStorageQueue. The packet is copied into the
+    // packet pool once and shared by both queues.
+    currentPacket.finish(sequenceCounter.next());
+    PacketPool& pool = packetPublishingQueue.getPool();
+    PacketHandle handle = pool.allocate(currentPacket);
+    if(handle.isValid()) {
+        packetPublishingQueue.push(handle);
+        packetStorageQueue.push(handle);
+        pool.release(handle);
+    } else {
+        Log.error("Packet pool exhausted, data point packet dropped");
+    }
     currentPacket.reset();
 }
 
-DatapointDouble MeasurementCollector::computeAverage()
+void MeasurementCollector::recordAcquisitionCycles(uint32_t cycles)
 {
-    // average all values in the averagingVector and return the result
-    DatapointDouble avg;
-    for (const DatapointDouble& dp : averagingVector)
+    ++acquisitionCount;
+    acquisitionCyclesTotal += cycles;
+    acquisitionCyclesMax = std::max(acquisitionCyclesMax, cycles);
+    if (acquisitionCount >= SystemConfig::ACQUISITION_STATS_LOG_INTERVAL)
     {
-        for (uint8_t i = 0; i < dp.size(); i++)
-        {
-            avg[i] += dp[i];
-        }
+        Log.info("Acquisition cycle: %lu cycles average, %lu cycles max",
+                 static_cast<unsigned long>(acquisitionCyclesTotal / acquisitionCount),
+                 static_cast<unsigned long>(acquisitionCyclesMax));
+        DeadlineScheduler::Stats stats = scheduler.getStats();
+        Log.info("Acquisition deadlines: %lu ms jitter average, %lu ms jitter max, %lu overruns, %lu skipped, "
+                 "%lu stale measurements",
+                 static_cast<unsigned long>(stats.cycles ? stats.totalJitter / stats.cycles : 0),
+                 static_cast<unsigned long>(stats.maxJitter), static_cast<unsigned long>(stats.overruns),
+                 static_cast<unsigned long>(stats.skipped), static_cast<unsigned long>(staleMeasurements));
+        scheduler.resetStats();
+        staleMeasurements = 0;
+        acquisitionCount = 0;
+        acquisitionCyclesTotal = 0;
+        acquisitionCyclesMax = 0;
     }
-    for (double& val : avg)
-    {
-        val /= sysconfig.N_DATA_POINTS_AVERAGING;
-    }
-    return avg;
-}
\ No newline at end of file
+}
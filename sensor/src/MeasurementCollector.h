@@ -1,8 +1,13 @@
 #ifndef MEASUREMENTCOLLECTOR_H
 #define MEASUREMENTCOLLECTOR_H
 
+#include "AveragingAccumulator.h"
+#include "DeadlineScheduler.h"
 #include "PacketQueue.h"
 #include "Packets/DataPointPacket.h"
+#include "SequenceCounter.h"
+#include "SlidingMeans.h"
+#include "StatisticsAccumulator.h"
 #include <SPS30.h>
 #include <main.h>
 
@@ -29,36 +34,103 @@ public:
      */
     void start();
 
+    /**
+     * Format the sliding means of the measurements as JSON, to be exported as a cloud variable. Can be called by
+     * any thread.
+     */
+    String getSlidingMeansString() const { return slidingMeans.getSnapshotString(); }
+
 private:
     /**
-     * The run function of the thread. Starts the SPS30 sensors, then acquires measurements in intervals
-     * specified in the System Config by calling recordMeasurement(). Current Packet is filled with data points,
-     * then pushCurrentPacket() is invoked.
+     * The run function of the thread. Starts the SPS30 sensors, then acquires measurements at the deadlines of the
+     * Deadline Scheduler, which are SPS30_MEASUREMENT_PERIOD apart, by calling recordMeasurement(). Current Packet
+     * is filled with data points, then pushCurrentPacket() is invoked.
      *
+     * The data points are timestamped with the times of the deadlines, so that they lie on an exact grid. An
+     * averaging window always spans the same number of deadlines, and a window without any measurement leaves a gap.
      * The function also handles data points acquired when the system time is not set.
      */
     [[noreturn]] void run();
 
     /**
-     * Measurements are pushed into the Averaging Vector, and when it is full, the computeAverage() function is called.
+     * Advances the Deadline Time to the current deadline, and aligns it to the system time if it is unknown or has
+     * drifted away. A Deadline Time behind the system time jumps ahead, one ahead of it is held back gradually, so
+     * that the timestamps of the data points never decrease.
+     * @param periods Number of measurement periods since the previous deadline
+     * @return false if the system time is not set, so the Deadline Time is not valid
+     */
+    bool advanceDeadlineTime(uint32_t periods);
+
+    /**
+     * Reads a measurement from the sensors and adds it to the Averaging Accumulator, the Sliding Means and, if
+     * statistics are sent, to the Statistics Accumulator.
+     *
+     * The sensors measure once per second on their own clocks, so their phase slowly drifts against the
+     * deadlines, and now and then a sensor has no new values at a deadline. Such a sensor, or one whose frame fails
+     * the CRC check, is counted as stale, and the measurement is left out of the averages, so that no values are
+     * counted twice. The sensors are read at once, in lockstep on their buses.
+     * @return false if a sensor has not measured yet
      */
-    void recordMeasurement();
+    bool recordMeasurement();
 
     /**
-     * Pushes the Current Packet into the Packet Storage Queue and Packet Publishing Queue, and resets it.
+     * Appends a data point to the Current Packet, pushing the packet when it is full, the data point does not fit or
+     * the period or the presence of statistics has changed.
+     * @param dp Data point
+     * @param timestamp Timestamp
+     * @param period Time (s) over which the data point was averaged
+     * @param statistics Statistics of the averaged measurements, or nullptr
+     */
+    void appendDataPoint(const DatapointInteger& dp, time32_t timestamp, time32_t period,
+                         const DatapointStatistics* statistics);
+
+    /**
+     * Assigns the next sequence number to the Current Packet, pushes it into the Packet Storage Queue and Packet
+     * Publishing Queue, and resets it. Both queues share one copy of the packet in the packet pool.
      */
     void pushCurrentPacket();
 
     /**
-     * Computes the average from the Averaging Vector.
-     * @return Data point with averaged values
+     * Record the CPU cycles spent on processing one acquisition cycle and log their and the scheduling statistics
+     * periodically.
      */
-    DatapointDouble computeAverage();
+    void recordAcquisitionCycles(uint32_t cycles);
+
+    // averaged data point acquired while the system time was not set
+    struct TimestamplessDataPoint {
+        DatapointInteger values;
+        time32_t period;
+        time32_t end;  // time from the beginning of the first timestampless data point to the end of this one
+        bool withStatistics;
+        DatapointStatistics statistics;
+    };
+
+    static_assert(SystemConfig::AVERAGING_MIN_WINDOW >= 1 &&
+                  SystemConfig::AVERAGING_MAX_WINDOW <= AveragingAccumulator<10>::MAX_COUNT,
+                  "The averaging window exceeds the capacity of the accumulator");
 
     Thread thread;
 
-    std::vector<DatapointDouble> averagingVector{};
-    DataPointPacket currentPacket{};
+    DeadlineScheduler scheduler{SystemConfig::SPS30_MEASUREMENT_PERIOD * 1000};
+    time32_t deadlineTime = 0;  // system time of the current deadline, 0 if not known yet
+    bool deadlineSlewing = false;  // the deadlines are ahead of the system time and are held back
+    time32_t lastDataPointTimestamp = 0;
+
+    // last values read from the sensors
+    std::array<SPS30MeasuredValues, 2> sensorValues{};
+    std::array<bool, 2> sensorMeasured{};
+    uint32_t staleMeasurements = 0;
+
+    AveragingAccumulator<10> averagingAccumulator{};
+    StatisticsAccumulator<10> statisticsAccumulator{};
+    SlidingMeans slidingMeans{};
+
+    // CPU cycles spent on processing acquisition cycles, without the wait for the sensors
+    uint32_t acquisitionCount = 0;
+    uint64_t acquisitionCyclesTotal = 0;
+    uint32_t acquisitionCyclesMax = 0;
+    DataPointPacket currentPacket{DataPointPacket::DEFAULT_ENCODING};
+    SequenceCounter sequenceCounter{};
     SPS30 sensor1{sysconfig.SPS30_SDA_1, sysconfig.SPS30_SCL_1};
     SPS30 sensor2{sysconfig.SPS30_SDA_2, sysconfig.SPS30_SCL_2};
 
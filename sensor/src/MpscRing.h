@@ -0,0 +1,102 @@
+#ifndef MPSCRING_H
+#define MPSCRING_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Bounded lock-free ring buffer for several producer threads (D. Vyukov's bounded queue).
+ *
+ * Every cell carries a sequence number which tells whether it is ready to be written or read in the current
+ * lap, so producers only contend on one compare-and-swap of the enqueue position. pop() uses the same scheme
+ * and is therefore also safe when an occasional second consumer (e.g. a producer emptying a full queue)
+ * competes with the regular one.
+ *
+ * @tparam T Trivially copyable item type
+ * @tparam N Capacity, must be a power of two
+ */
+template<class T, size_t N>
+class MpscRing
+{
+    static_assert(N > 0 && (N & (N - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    MpscRing() {
+        for(size_t i = 0; i < N; ++i) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * Append an item, may be called from any thread.
+     * @return false if the ring is full
+     */
+    bool push(const T& item) {
+        Cell* cell;
+        size_t pos = enqueuePos.load(std::memory_order_relaxed);
+        while(true) {
+            cell = &cells[pos & (N - 1)];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if(dif == 0) {
+                if(enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if(dif < 0) {
+                return false;  // full
+            } else {
+                pos = enqueuePos.load(std::memory_order_relaxed);  // another producer took this cell
+            }
+        }
+        cell->data = item;
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Remove the oldest item.
+     * @return false if the ring is empty
+     */
+    bool pop(T* item) {
+        Cell* cell;
+        size_t pos = dequeuePos.load(std::memory_order_relaxed);
+        while(true) {
+            cell = &cells[pos & (N - 1)];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if(dif == 0) {
+                if(dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if(dif < 0) {
+                return false;  // empty
+            } else {
+                pos = dequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+        *item = cell->data;
+        cell->sequence.store(pos + N, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const {
+        size_t pos = dequeuePos.load(std::memory_order_acquire);
+        return cells[pos & (N - 1)].sequence.load(std::memory_order_acquire) != pos + 1;
+    }
+
+    static constexpr size_t capacity() { return N; }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+    std::array<Cell, N> cells;
+    std::atomic<size_t> enqueuePos{0};
+    std::atomic<size_t> dequeuePos{0};
+};
+
+#endif
@@ -0,0 +1,88 @@
+#include "PacketPool.h"
+
+void PacketPool::init()
+{
+    os_mutex_create(&mutex);
+    for(uint16_t i = 0; i < CAPACITY; ++i) {
+        freeSlots[i] = CAPACITY - 1 - i;
+    }
+    freeCount = CAPACITY;
+    stats.capacity = CAPACITY;
+}
+
+PacketHandle PacketPool::allocate(const Packet& packet)
+{
+    uint16_t dataSize;
+    packet.getBytes(&dataSize);
+    os_mutex_lock(mutex);
+    if(freeCount == 0) {
+        ++stats.failedAllocations;
+        os_mutex_unlock(mutex);
+        return {};
+    }
+    uint16_t index = freeSlots[--freeCount];
+    refCounts[index] = 1;
+    PacketHandle handle{.index = index, .generation = ++generations[index]};
+
+    ++stats.used;
+    stats.peakUsed = std::max(stats.peakUsed, stats.used);
+    ++stats.allocations;
+    stats.bytesCopied += dataSize;  // the copy of the static_vector copies the used bytes only
+    os_mutex_unlock(mutex);
+
+    // the slot is not reachable by other threads until the handle is published
+    slots[index] = packet;  // convert any Packet child to Packet base class
+    return handle;
+}
+
+void PacketPool::retain(PacketHandle handle)
+{
+    os_mutex_lock(mutex);
+    assert(handle.isValid() && generations[handle.index] == handle.generation && refCounts[handle.index] > 0);
+    ++refCounts[handle.index];
+    os_mutex_unlock(mutex);
+}
+
+void PacketPool::release(PacketHandle handle)
+{
+    os_mutex_lock(mutex);
+    assert(handle.isValid() && generations[handle.index] == handle.generation && refCounts[handle.index] > 0);
+    if(--refCounts[handle.index] == 0) {
+        freeSlots[freeCount++] = handle.index;
+        --stats.used;
+    }
+    os_mutex_unlock(mutex);
+}
+
+const Packet& PacketPool::get(PacketHandle handle) const
+{
+    assert(handle.isValid() && generations[handle.index] == handle.generation);
+    return slots[handle.index];
+}
+
+void PacketPool::copyOut(PacketHandle handle, Packet* packet)
+{
+    *packet = get(handle);
+    uint16_t dataSize;
+    packet->getBytes(&dataSize);
+    os_mutex_lock(mutex);
+    stats.bytesCopied += dataSize;
+    os_mutex_unlock(mutex);
+}
+
+PacketPool::Stats PacketPool::getStats() const
+{
+    os_mutex_lock(mutex);
+    Stats s = stats;
+    os_mutex_unlock(mutex);
+    return s;
+}
+
+void PacketPool::logStats() const
+{
+    Stats s = getStats();
+    Log.info("Packet pool: %u/%u slots used, peak %u (%u bytes), %lu allocations, %lu failed, %lu bytes copied",
+             s.used, s.capacity, s.peakUsed, static_cast<unsigned>(s.peakUsed * sizeof(Packet)),
+             static_cast<unsigned long>(s.allocations), static_cast<unsigned long>(s.failedAllocations),
+             static_cast<unsigned long>(s.bytesCopied));
+}
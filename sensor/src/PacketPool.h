@@ -0,0 +1,87 @@
+#ifndef PACKETPOOL_H
+#define PACKETPOOL_H
+
+#include "Packets/Packet.h"
+#include "Particle.h"
+
+/**
+ * Handle of a packet stored in the Packet Pool. Handles are passed through the packet queues instead of
+ * packet copies.
+ */
+struct PacketHandle {
+    static constexpr uint16_t INVALID_INDEX = 0xFFFF;
+
+    uint16_t index = INVALID_INDEX;
+    uint16_t generation = 0;  // incremented every time the slot is reused, detects stale handles
+
+    bool isValid() const { return index != INVALID_INDEX; }
+};
+
+static_assert(sizeof(PacketHandle) == 4, "Packet handle must stay small, it is copied through the queues");
+
+/**
+ * Fixed-size arena of reference-counted packets shared by the packet queues.
+ *
+ * A packet is copied into the pool once, and the handle can then be pushed into several queues. Each queue
+ * and each consumer holds its own reference, and the slot is freed when the last reference is released.
+ * The pool is thread safe.
+ */
+class PacketPool
+{
+public:
+    struct Stats {
+        uint16_t capacity;
+        uint16_t used;             // slots in use
+        uint16_t peakUsed;         // highest number of slots in use
+        uint32_t allocations;      // packets copied into the pool
+        uint32_t failedAllocations;  // allocations that failed because the pool was exhausted
+        uint32_t bytesCopied;      // bytes copied into and out of the pool
+    };
+
+    void init();
+
+    /**
+     * Copy a packet into a free slot.
+     * @param packet Packet (any Packet child is sliced into the Packet base class)
+     * @return Handle holding one reference, or an invalid handle if the pool is exhausted
+     */
+    PacketHandle allocate(const Packet& packet);
+
+    /**
+     * Add a reference to a packet.
+     */
+    void retain(PacketHandle handle);
+
+    /**
+     * Drop a reference to a packet, the slot is freed when no references are left.
+     */
+    void release(PacketHandle handle);
+
+    /**
+     * Access a packet. The caller must hold a reference for as long as the packet is used.
+     */
+    const Packet& get(PacketHandle handle) const;
+
+    /**
+     * Copy a packet out of the pool.
+     */
+    void copyOut(PacketHandle handle, Packet* packet);
+
+    Stats getStats() const;
+
+    void logStats() const;
+
+private:
+    static constexpr uint16_t CAPACITY = SystemConfig::PACKET_POOL_SIZE;
+
+    std::array<Packet, CAPACITY> slots{};
+    std::array<uint8_t, CAPACITY> refCounts{};
+    std::array<uint16_t, CAPACITY> generations{};
+    std::array<uint16_t, CAPACITY> freeSlots{};  // stack of free slot indexes
+    uint16_t freeCount = 0;
+
+    Stats stats{};
+    mutable os_mutex_t mutex{};
+};
+
+#endif
@@ -10,30 +10,151 @@ PacketPublisher::PacketPublisher(PacketQueue& packetPublishingQueue, const Syste
 
 void PacketPublisher::start()
 {
-    thread = Thread{"PacketPublisher", [this] { run(); }};
+    os_semaphore_create(&completion, SystemConfig::PUBLISH_WINDOW_SIZE, 0);
+    thread = Thread{"PacketPublisher", [this] { run(); }, OS_THREAD_PRIORITY_DEFAULT, SystemConfig::THREAD_STACK_SIZE};
 }
 
 [[noreturn]] void PacketPublisher::run()
 {
-    Packet packet;
+    PacketPool& pool = packetPublishingQueue.getPool();
+    PacketHandle handle;
     while (true)
     {
-        packetPublishingQueue.take(&packet, CONCURRENT_WAIT_FOREVER);
-        if(Time.now() - sysstate.lastHandshakeTimestamp < sysconfig.HANDSHAKE_MAX_PERIOD) {
-            uint16_t dataSize;
-            const uint8_t* data = packet.getBytes(&dataSize);
-            const size_t PACKET_MAX_SIZE_UTF8 = SystemConfig::PACKET_MAX_SIZE_BYTES * 5 / 4;
-            uint8_t encodedData[PACKET_MAX_SIZE_UTF8];
-            auto encodedLength = encode_ascii85(data, dataSize,
-                                                encodedData, PACKET_MAX_SIZE_UTF8);
-            String encodedDataString(reinterpret_cast<char*>(encodedData), encodedLength);
-
-            Particle.publish(packet.getEventNameString(), encodedDataString,
-                             NO_ACK); // can block for as long as 10 minutes
-        } else {
-            Log.warn("PacketPublisher: Packet dropped because of handshake timeout.");
+        processCompletions();
+        // the flash is written here rather than by the producers, so that a backlog never delays the measurements
+        packetPublishingQueue.spillBacklog();
+
+        if(inFlight.load() == SystemConfig::PUBLISH_WINDOW_SIZE || !Particle.connected()) {
+            // while disconnected, packets stay in the queue (or are spilled) instead of failing one by one
+            os_semaphore_take(completion, PUBLISH_POLL_PERIOD, false);
+            continue;
+        }
+
+        // wait for the rate limit before taking a packet, so that a packet queued in the priority lane in the
+        // meantime is published first
+        system_tick_t wait = publishBucket.waitForToken();
+        if(wait > 0) {
+            ++stats.rateLimited;
+            stats.totalWait += wait;
+            stats.maxWait = std::max(stats.maxWait, wait);
+        }
+
+        // in-flight publishes must be checked for timeouts even if no packets arrive
+        system_tick_t takeTimeout = inFlight.load() > 0 ? PUBLISH_POLL_PERIOD : CONCURRENT_WAIT_FOREVER;
+        // the spilled packets are taken from the flash in their order
+        if(!packetPublishingQueue.take(&handle, takeTimeout)) {
+            continue;
+        }
+
+        publish(handle);
+        if(++stats.published % SystemConfig::PACKET_POOL_STATS_LOG_INTERVAL == 0) {
+            pool.logStats();
+            packetPublishingQueue.logOverflowStats("Publishing");
+            publishLatency.log();
+            publishLatency.reset();
         }
+    }
+}
+
+void PacketPublisher::publish(PacketHandle handle)
+{
+    PacketPool& pool = packetPublishingQueue.getPool();
+    if(Time.now() - sysstate.lastHandshakeTimestamp >= sysconfig.HANDSHAKE_MAX_PERIOD) {
+        Log.warn("PacketPublisher: Packet dropped because of handshake timeout.");
+        pool.release(handle);
+        return;
+    }
+
+    const Packet& packet = pool.get(handle);
+    uint16_t dataSize;
+    const uint8_t* data = packet.getBytes(&dataSize);
+    constexpr size_t PACKET_MAX_SIZE_UTF8 = ascii85MaxEncodedLength(SystemConfig::PACKET_MAX_SIZE_BYTES);
+    static_assert(PACKET_MAX_SIZE_UTF8 <= SystemConfig::CLOUD_DATA_MAX_SIZE, "Encoded packets must fit into an event");
+    uint8_t encodedData[PACKET_MAX_SIZE_UTF8];
+    auto encodedLength = encode_ascii85(data, dataSize,
+                                        encodedData, PACKET_MAX_SIZE_UTF8);
+    String encodedDataString(reinterpret_cast<char*>(encodedData), encodedLength);
+
+    uint8_t slot = 0;
+    while(InFlightPublish::getStatus(window[slot].state.load()) != InFlightPublish::IDLE) {
+        ++slot;  // there is a free slot, as the window is not full
+    }
+    InFlightPublish& p = window[slot];
+    uint32_t id = ++nextPublishId;
+    p.handle = handle;
+    p.startTime = millis();
+    p.state.store(InFlightPublish::makeState(id, InFlightPublish::PENDING));
+    ++inFlight;
+    publishBucket.tryTake();
 
-        delay(1000); // prevents internal buffer overflow if sending a large number of packets in rapid succession
+    // returns once the event is handed to the system thread, the callbacks may run before it returns. The publish
+    // completes when the cloud acknowledges the event, so a lost event fails or times out and is queued again.
+    Particle.publish(packet.getEventNameString(), encodedDataString, WITH_ACK)
+        .onSuccess([this, slot, id](bool) { complete(slot, id, true); })
+        .onError([this, slot, id](const particle::Error&) { complete(slot, id, false); });
+}
+
+void PacketPublisher::complete(uint8_t slot, uint32_t id, bool succeeded)
+{
+    InFlightPublish& p = window[slot];
+    uint32_t expected = InFlightPublish::makeState(id, InFlightPublish::PENDING);
+    if(!p.state.compare_exchange_strong(expected, InFlightPublish::makeState(id, InFlightPublish::COMPLETING))) {
+        return;  // the publish has timed out and the slot may already be reused
+    }
+    p.doneTime = millis();
+    p.state.store(InFlightPublish::makeState(id, succeeded ? InFlightPublish::SUCCEEDED : InFlightPublish::FAILED));
+    os_semaphore_give(completion, false);
+}
+
+void PacketPublisher::processCompletions()
+{
+    PacketPool& pool = packetPublishingQueue.getPool();
+    system_tick_t now = millis();
+    for(InFlightPublish& p : window) {
+        uint32_t state = p.state.load();
+        switch(InFlightPublish::getStatus(state)) {
+        case InFlightPublish::PENDING:
+            if(now - p.startTime < SystemConfig::PUBLISH_TIMEOUT) continue;
+            // claim the slot, so that a late completion callback is ignored
+            if(!p.state.compare_exchange_strong(state, InFlightPublish::makeState(0, InFlightPublish::IDLE))) {
+                continue;
+            }
+            ++stats.timedOut;
+            requeue(p.handle);
+            break;
+        case InFlightPublish::SUCCEEDED:
+            ++stats.succeeded;
+            publishLatency.record((p.doneTime - p.startTime) * 1000);
+            pool.release(p.handle);
+            break;
+        case InFlightPublish::FAILED:
+            ++stats.failed;
+            requeue(p.handle);
+            break;
+        default:
+            continue;  // IDLE or COMPLETING
+        }
+        p.state.store(InFlightPublish::makeState(0, InFlightPublish::IDLE));
+        --inFlight;
     }
-}
\ No newline at end of file
+}
+
+void PacketPublisher::requeue(PacketHandle handle)
+{
+    // spill the backlog first, so that the producers do not have to write to the flash
+    packetPublishingQueue.spillBacklog();
+    packetPublishingQueue.push(handle);
+    packetPublishingQueue.getPool().release(handle);
+}
+
+String PacketPublisher::getStatsString() const
+{
+    Stats s = getStats();
+    PacketQueue::DepthStats d = packetPublishingQueue.getDepthStats();
+    PacketQueue::OverflowStats o = packetPublishingQueue.getOverflowStats();
+    return String::format("{\"published\":%lu,\"succeeded\":%lu,\"failed\":%lu,\"timedOut\":%lu,"
+                          "\"inFlight\":%u,\"rateLimited\":%lu,\"waitMs\":%lu,\"maxWaitMs\":%lu,"
+                          "\"depth\":%u,\"peakDepth\":%u,\"dropped\":%lu,\"spilled\":%lu}",
+                          s.published, s.succeeded, s.failed, s.timedOut, s.inFlight, s.rateLimited, s.totalWait,
+                          s.maxWait, d.depth, d.peakDepth, o.dropped, o.spilled);
+}
@@ -1,12 +1,27 @@
 #ifndef PACKETPUBLISHINGTHREAD_H
 #define PACKETPUBLISHINGTHREAD_H
 
+#include "LatencyHistogram.h"
 #include "PacketQueue.h"
+#include "TokenBucket.h"
 #include "main.h"
 
+#include <atomic>
+
 class PacketPublisher
 {
 public:
+    struct Stats {
+        uint32_t published;     // packets taken from the queue or the spill area
+        uint32_t succeeded;     // publishes acknowledged by the cloud
+        uint32_t failed;        // publishes completed with an error, the packets were queued again
+        uint32_t timedOut;      // publishes not completed within PUBLISH_TIMEOUT, the packets were queued again
+        uint32_t rateLimited;   // times the publisher had to wait for the rate limit
+        uint32_t totalWait;     // time (ms) spent waiting for the rate limit
+        system_tick_t maxWait;  // longest wait (ms) for the rate limit
+        uint8_t inFlight;       // publishes currently in flight
+    };
+
     /**
      * Construct a new Packet Publisher object with the provided references to the shared resources.
      * Warning: Packet Publisher should not be constructed as a global variable.
@@ -20,21 +35,98 @@ public:
 
     void start();
 
+    Stats getStats() const
+    {
+        Stats s = stats;
+        s.inFlight = inFlight.load();
+        return s;
+    }
+
+    /**
+     * Format the publisher and publishing queue statistics as JSON, to be exported as a cloud variable.
+     */
+    String getStatsString() const;
+
 private:
+    /**
+     * Publish that has been handed to the system thread and not yet been processed by the publisher.
+     *
+     * The state packs the publish id (upper bits) and the status (lower 3 bits), so that a completion callback
+     * of a publish that has already timed out cannot change the state of a newer publish in the same slot.
+     */
+    struct InFlightPublish {
+        enum Status : uint32_t {
+            IDLE,
+            PENDING,     // waiting for completion
+            COMPLETING,  // the completion callback is writing the result
+            SUCCEEDED,
+            FAILED
+        };
+
+        static constexpr uint32_t STATUS_BITS = 3;
+
+        static uint32_t makeState(uint32_t id, Status status) { return (id << STATUS_BITS) | status; }
+
+        static Status getStatus(uint32_t state) { return static_cast<Status>(state & ((1 << STATUS_BITS) - 1)); }
+
+        PacketHandle handle;
+        system_tick_t startTime = 0;
+        system_tick_t doneTime = 0;  // written by the completion callback
+        std::atomic<uint32_t> state{IDLE};
+    };
+
     /**
      * Run function of the Packet Publisher thread.
      *
      * Grabs new packets from Packet Publishing Queue, and publishes them as events to the Particle cloud.
-     * Drops packets if handshake timeout has occurred.
+     * While packets pile up in the queue, e.g. while disconnected, routine packets are moved to the flash spill
+     * area, from which the queue returns them in their order. Publishing is limited
+     * by a token bucket matched to the Particle cloud rate limit.
+     *
+     * Publishes are asynchronous and acknowledged by the cloud: up to PUBLISH_WINDOW_SIZE publishes are in flight,
+     * and their packets are released when the acknowledgement arrives, or queued again when they fail or time out.
      */
     [[noreturn]] void run();
 
+    /**
+     * Start publishing a packet as an event to the Particle cloud.
+     * Drops the packet if handshake timeout has occurred.
+     * @param handle Packet, the reference is taken over by the in-flight publish
+     */
+    void publish(PacketHandle handle);
+
+    /**
+     * Completion callback of a publish, called from the system thread.
+     */
+    void complete(uint8_t slot, uint32_t id, bool succeeded);
+
+    /**
+     * Release the packets of completed publishes, queue the packets of failed and timed out ones again.
+     */
+    void processCompletions();
+
+    /**
+     * Put the packet of a failed publish back into the publishing queue.
+     */
+    void requeue(PacketHandle handle);
+
+    // how often (ms) the publisher checks the in-flight publishes for timeouts while it waits
+    static constexpr system_tick_t PUBLISH_POLL_PERIOD = 100;
+
     Thread thread;
 
+    TokenBucket publishBucket{SystemConfig::PUBLISH_BURST_SIZE, SystemConfig::PUBLISH_REFILL_PERIOD};
+    std::array<InFlightPublish, SystemConfig::PUBLISH_WINDOW_SIZE> window{};
+    uint32_t nextPublishId = 0;
+    os_semaphore_t completion{};  // given by the completion callbacks
+    LatencyHistogram publishLatency{"Publish", 16 * 1024};
+    Stats stats{};
+    std::atomic<uint8_t> inFlight{0};  // read by the cloud variable from another thread
+
     //  SHARED RESOURCES
     PacketQueue& packetPublishingQueue;
     const SystemState& sysstate;
     const SystemConfig& sysconfig;
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -1,36 +1,376 @@
 #include "PacketQueue.h"
 
-void PacketQueue::init(size_t size, bool autoEmpty)
+void PacketQueue::init(size_t size, PacketPool& pool, OverflowPolicy overflowPolicy, Backend backend)
 {
-    this->autoEmpty = autoEmpty;
-    os_queue_create(&queue, sizeof(Packet), size, nullptr);
+    assert(!(backend == Backend::SPSC_RING && overflowPolicy == OverflowPolicy::DROP_OLDEST));
+    assert(!(backend == Backend::OS_QUEUE && overflowPolicy == OverflowPolicy::SPILL));
+    // the ring backends hold exactly RING_CAPACITY handles, which is accounted for in PACKET_POOL_SIZE
+    this->overflowPolicy = overflowPolicy;
+    this->pool = &pool;
+    this->backend = backend;
+    if (backend == Backend::OS_QUEUE)
+    {
+        os_queue_create(&queue, sizeof(PacketHandle), size, nullptr);
+    }
+    else
+    {
+        assert(size == RING_CAPACITY);
+        os_semaphore_create(&notEmpty, 1, 0);
+    }
+    if (overflowPolicy == OverflowPolicy::SPILL)
+    {
+        os_mutex_create(&spillMutex);
+    }
+}
+
+bool PacketQueue::push(const Packet &packet, Lane lane)
+{
+    PacketHandle handle = pool->allocate(packet);
+    if (!handle.isValid())
+    {
+        return false;
+    }
+    bool s = push(handle, lane);
+    pool->release(handle);
+    return s;
+}
+
+bool PacketQueue::push(const Packet& packet, system_tick_t timeout, Lane lane)
+{
+    PacketHandle handle = pool->allocate(packet);
+    if (!handle.isValid())
+    {
+        return false;
+    }
+    bool s = push(handle, timeout, lane);
+    pool->release(handle);
+    return s;
 }
 
-bool PacketQueue::push(const Packet &packet)
+bool PacketQueue::push(PacketHandle handle, Lane lane)
 {
-    Packet basePacket = packet; // convert any Packet child to Packet base class to ensure correct
-                                // byte-copying.
-    if (os_queue_put(queue, &basePacket, 0, nullptr) != 0)
+    pool->retain(handle);  // reference of the queue
+    if (tryPut(handle, lane))
     {
-        if (autoEmpty)
+        return true;
+    }
+
+    switch (overflowPolicy)
+    {
+    case OverflowPolicy::SPILL:
+        if (spillArea != nullptr && backend != Backend::SPSC_RING)
+        {
+            // another producer may take the slot that was made free, then the next packet is spilled
+            for (uint8_t attempt = 0; attempt < SystemConfig::PACKET_QUEUE_DROP_ATTEMPTS; ++attempt)
+            {
+                os_mutex_lock(spillMutex);
+                bool full = spillArea->full();
+                bool spilledOldest = spillOldest();
+                bool s = !full && tryPut(handle, lane);
+                os_mutex_unlock(spillMutex);
+                if (s)
+                {
+                    return true;
+                }
+                if (full)
+                {
+                    break;
+                }
+                if (!spilledOldest)
+                {
+                    delay(1);  // a producer preempted within its push, as below
+                }
+            }
+        }
+        // the spill area is full, the oldest packet is dropped
+        [[fallthrough]];
+    case OverflowPolicy::DROP_OLDEST:
+        if (backend != Backend::SPSC_RING)
+        {
+            // only routine packets are dropped to make room
+            PacketHandle oldest;
+            for (uint8_t attempt = 0; attempt < SystemConfig::PACKET_QUEUE_DROP_ATTEMPTS; ++attempt)
+            {
+                if (tryTake(&oldest, false))
+                {
+                    pool->release(oldest);
+                    ++dropped;
+                }
+                else
+                {
+                    // A producer preempted within its push makes the ring look full and empty at once. Let
+                    // it run, it may have a lower priority than this thread.
+                    delay(1);
+                }
+                if (tryPut(handle, lane))
+                {
+                    return true;
+                }
+            }
+        }
+        break;
+    case OverflowPolicy::BLOCK_WITH_TIMEOUT:
+        pool->release(handle);  // the timed push takes its own reference
+        if (push(handle, SystemConfig::PACKET_QUEUE_BLOCK_TIMEOUT, lane))
         {
-            Packet wasteBin;
-            while (os_queue_take(queue, &wasteBin, 0, nullptr))
-                ;
-            os_queue_put(queue, &basePacket, CONCURRENT_WAIT_FOREVER, nullptr);
             return true;
-        } else {
+        }
+        ++dropped;
+        return false;
+    default:
+        break;
+    }
+
+    // DROP_NEWEST
+    pool->release(handle);
+    ++dropped;
+    return false;
+}
 
-            return false;   
+bool PacketQueue::push(PacketHandle handle, system_tick_t timeout, Lane lane)
+{
+    pool->retain(handle);
+    bool s;
+    if (backend == Backend::OS_QUEUE)
+    {
+        ++depth;
+        s = os_queue_put(queue, &handle, timeout, nullptr) == 0;
+        if (s)
+        {
+            updatePeakDepth();
+        }
+        else
+        {
+            --depth;
         }
     }
     else
     {
-        return true;
+        // the consumer does not signal free space, so a full ring is polled
+        system_tick_t start = millis();
+        while (!(s = tryPut(handle, lane)) && millis() - start < timeout)
+        {
+            delay(1);
+        }
+    }
+    if (!s)
+    {
+        pool->release(handle);
+    }
+    return s;
+}
+
+uint16_t PacketQueue::spillBacklog()
+{
+    if (overflowPolicy != OverflowPolicy::SPILL || spillArea == nullptr)
+    {
+        return 0;
+    }
+    uint32_t spilledBefore = spilled.load();
+    os_mutex_lock(spillMutex);
+    while (depth.load() > SystemConfig::PACKET_QUEUE_SPILL_THRESHOLD && spillOldest())
+    {
+    }
+    os_mutex_unlock(spillMutex);
+    return spilled.load() - spilledBefore;
+}
+
+bool PacketQueue::spillOldest()
+{
+    PacketHandle oldest;
+    if (spillArea->full() || !tryTake(&oldest, false))
+    {
+        return false;
+    }
+    if (spillArea->push(pool->get(oldest)))
+    {
+        ++spilled;
     }
+    else
+    {
+        ++dropped;
+    }
+    pool->release(oldest);
+    return true;
 }
 
 bool PacketQueue::take(Packet *packet, system_tick_t del)
 {
-    return os_queue_take(queue, packet, del, nullptr) == 0;
-}
\ No newline at end of file
+    PacketHandle handle;
+    if (!take(&handle, del))
+    {
+        return false;
+    }
+    pool->copyOut(handle, packet);
+    pool->release(handle);
+    return true;
+}
+
+bool PacketQueue::take(PacketHandle* handle, system_tick_t del)
+{
+    if (backend == Backend::OS_QUEUE)
+    {
+        if (os_queue_take(queue, handle, del, nullptr) != 0)
+        {
+            return false;
+        }
+        --depth;
+        return true;
+    }
+
+    if (tryTakeNext(handle))
+    {
+        return true;
+    }
+    system_tick_t start = millis();
+    while (true)
+    {
+        // announce the wait, then check again so that a push between the checks is not missed
+        consumerWaiting.store(true);
+        if (tryTakeNext(handle))
+        {
+            consumerWaiting.store(false);
+            return true;
+        }
+        system_tick_t elapsed = millis() - start;
+        if (del != CONCURRENT_WAIT_FOREVER && elapsed >= del)
+        {
+            consumerWaiting.store(false);
+            return false;
+        }
+        system_tick_t wait = del == CONCURRENT_WAIT_FOREVER ? CONCURRENT_WAIT_FOREVER : del - elapsed;
+        if (spillArea != nullptr && overflowPolicy == OverflowPolicy::SPILL)
+        {
+            // a spilled packet waits for a free slot in the pool, which is not signalled
+            os_mutex_lock(spillMutex);
+            if (!spillArea->empty())
+            {
+                wait = std::min<system_tick_t>(wait, 1);
+            }
+            os_mutex_unlock(spillMutex);
+        }
+        os_semaphore_take(notEmpty, wait, false);
+        consumerWaiting.store(false);
+        if (tryTakeNext(handle))
+        {
+            return true;
+        }
+    }
+}
+
+bool PacketQueue::tryPut(PacketHandle handle, Lane lane)
+{
+    // counted before the put, so that a fast consumer never sees a negative depth
+    ++depth;
+    bool s;
+    switch (backend)
+    {
+    case Backend::SPSC_RING:
+        s = spscRing.push(handle);
+        break;
+    case Backend::MPSC_RING:
+        // a full priority lane overflows into the routine lane
+        s = (lane == Lane::PRIORITY && priorityRing.push(handle)) || mpscRing.push(handle);
+        break;
+    default:
+        s = os_queue_put(queue, &handle, 0, nullptr) == 0;
+        break;
+    }
+    if (!s)
+    {
+        --depth;
+        return false;
+    }
+    updatePeakDepth();
+    if (backend != Backend::OS_QUEUE && consumerWaiting.exchange(false))
+    {
+        os_semaphore_give(notEmpty, false);
+    }
+    return true;
+}
+
+bool PacketQueue::tryTake(PacketHandle* handle, bool includePriority)
+{
+    bool s;
+    switch (backend)
+    {
+    case Backend::SPSC_RING:
+        s = spscRing.pop(handle);
+        break;
+    case Backend::MPSC_RING:
+        s = (includePriority && priorityRing.pop(handle)) || mpscRing.pop(handle);
+        break;
+    default:
+        s = os_queue_take(queue, handle, 0, nullptr) == 0;
+        break;
+    }
+    if (s)
+    {
+        --depth;
+    }
+    return s;
+}
+
+bool PacketQueue::tryTakeNext(PacketHandle* handle)
+{
+    if (overflowPolicy != OverflowPolicy::SPILL || spillArea == nullptr)
+    {
+        return tryTake(handle);
+    }
+    if (backend == Backend::MPSC_RING && priorityRing.pop(handle))
+    {
+        --depth;
+        return true;
+    }
+    // the routine lane is only taken from when no packet is on its way to the spill area
+    os_mutex_lock(spillMutex);
+    bool s = takeSpilled(handle) || (spillArea->empty() && tryTake(handle, false));
+    os_mutex_unlock(spillMutex);
+    return s;
+}
+
+bool PacketQueue::takeSpilled(PacketHandle* handle)
+{
+    Packet packet;
+    // a record that cannot be read is discarded by front()
+    while (!spillArea->empty())
+    {
+        if (spillArea->front(&packet))
+        {
+            *handle = pool->allocate(packet);
+            if (!handle->isValid())
+            {
+                return false;  // the packet stays in the spill area
+            }
+            spillArea->pop();
+            return true;
+        }
+    }
+    return false;
+}
+
+void PacketQueue::updatePeakDepth()
+{
+    uint16_t d = depth.load();
+    uint16_t peak = peakDepth.load();
+    while (d > peak && !peakDepth.compare_exchange_weak(peak, d))
+    {
+    }
+}
+
+PacketQueue::OverflowStats PacketQueue::getOverflowStats() const
+{
+    return {dropped.load(), spilled.load()};
+}
+
+PacketQueue::DepthStats PacketQueue::getDepthStats() const
+{
+    return {depth.load(), peakDepth.load()};
+}
+
+void PacketQueue::logOverflowStats(const char* queueName) const
+{
+    OverflowStats s = getOverflowStats();
+    Log.info("%s queue: %lu packets dropped, %lu spilled, %u in the spill area", queueName, s.dropped, s.spilled,
+             spillArea != nullptr ? spillArea->size() : 0);
+}
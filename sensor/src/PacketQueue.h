@@ -2,23 +2,169 @@
 #define PACKETQUEUE_H
 
 #include "Packets/Packet.h"
+#include "PacketPool.h"
+#include "SpscRing.h"
+#include "MpscRing.h"
+#include "PacketSpillArea.h"
 #include "Particle.h"
 
+#include <atomic>
 #include <queue>
 
+/**
+ * Queue of packets stored in the Packet Pool. The queue carries handles, every queued handle holds a reference
+ * to its packet.
+ *
+ * Handles are stored in one of three backends:
+ * - OS_QUEUE: RTOS queue, any number of producers and consumers.
+ * - SPSC_RING: lock-free ring for one producer and one consumer thread. Only the consumer may remove handles,
+ *   so the DROP_OLDEST overflow policy cannot be used.
+ * - MPSC_RING: lock-free ring for any number of producers and one consumer. It has a second, priority lane,
+ *   which the consumer empties before the routine lane. A full priority lane overflows into the routine lane.
+ *   The other backends have a single lane and ignore the lane argument of push().
+ * With the ring backends, the consumer only waits on a semaphore when the ring is empty, and producers only
+ * signal it when the consumer is waiting.
+ *
+ * The overflow policy decides what push() does when the queue is full:
+ * - DROP_OLDEST: the oldest queued packet is discarded. If no room can be made within
+ *   PACKET_QUEUE_DROP_ATTEMPTS attempts, the new packet is discarded instead.
+ * - DROP_NEWEST: the new packet is discarded.
+ * - BLOCK_WITH_TIMEOUT: push() waits up to PACKET_QUEUE_BLOCK_TIMEOUT for free space, then discards the new packet.
+ * - SPILL: the oldest routine packet is moved to the spill area instead of being dropped. So that the producers
+ *   rarely write to the flash, the consumer keeps room in the queue by calling spillBacklog(), which moves routine
+ *   packets to the spill area as well. The spilled packets are older than those in the routine lane, so take()
+ *   returns them after the priority lane and before the routine lane, and the routine packets keep their order.
+ *   If the spill area is full, the oldest packet is dropped as with DROP_OLDEST. Needs a ring backend, and the
+ *   SPSC_RING backend, whose producer cannot remove packets, only spills by spillBacklog().
+ */
 class PacketQueue
 {
 public:
-    void init(size_t size, bool autoEmpty = true);
+    enum class Backend {
+        OS_QUEUE,
+        SPSC_RING,
+        MPSC_RING
+    };
 
-    bool push(const Packet& packet);
-    // returns false if queue is full.
+    enum class OverflowPolicy {
+        DROP_OLDEST,
+        DROP_NEWEST,
+        BLOCK_WITH_TIMEOUT,
+        SPILL
+    };
+
+    enum class Lane {
+        ROUTINE,
+        PRIORITY
+    };
+
+    struct OverflowStats {
+        uint32_t dropped;  // packets discarded because the queue was full
+        uint32_t spilled;  // packets moved to the spill area
+    };
+
+    struct DepthStats {
+        uint16_t depth;      // packets currently in the queue
+        uint16_t peakDepth;  // highest number of packets in the queue
+    };
+
+    // capacity of the ring backends
+    static constexpr size_t RING_CAPACITY = SystemConfig::PACKET_QUEUE_CAPACITY;
+    // capacity of the priority lane of the MPSC_RING backend
+    static constexpr size_t PRIORITY_RING_CAPACITY = SystemConfig::PACKET_PRIORITY_LANE_CAPACITY;
+
+    void init(size_t size, PacketPool& pool, OverflowPolicy overflowPolicy = OverflowPolicy::DROP_OLDEST,
+              Backend backend = Backend::OS_QUEUE);
+
+    /**
+     * Set the area used by the SPILL overflow policy. Until it is set, the queue drops the oldest packet instead.
+     * Packets left in the area by a reset are taken first.
+     */
+    void setSpillArea(PacketSpillArea* spillArea) { this->spillArea = spillArea; }
+
+    PacketSpillArea* getSpillArea() { return spillArea; }
+
+    /**
+     * Move routine packets to the spill area while more than PACKET_QUEUE_SPILL_THRESHOLD packets are queued.
+     * Must only be called by the consumer thread. Does nothing unless the overflow policy is SPILL.
+     * @return Number of spilled packets
+     */
+    uint16_t spillBacklog();
+
+    bool push(const Packet& packet, Lane lane = Lane::ROUTINE);
+    // copies the packet into the pool. Returns false if the new packet had to be dropped.
+
+    bool push(const Packet& packet, system_tick_t timeout, Lane lane = Lane::ROUTINE);
+    // waits up to timeout (ms) for free space instead of applying the overflow policy, returns false on timeout.
+
+    bool push(PacketHandle handle, Lane lane = Lane::ROUTINE);
+    // shares a packet that is already in the pool, the caller keeps its own reference.
+
+    bool push(PacketHandle handle, system_tick_t timeout, Lane lane = Lane::ROUTINE);
 
     bool take(Packet* packet, system_tick_t del);
+    // copies the packet out of the pool.
+
+    bool take(PacketHandle* handle, system_tick_t del);
+    // takes over the reference of the queue, the caller must release the handle in the pool. Packets in the
+    // priority lane are taken first, then spilled packets.
+
+    PacketPool& getPool() { return *pool; }
+
+    OverflowStats getOverflowStats() const;
+
+    DepthStats getDepthStats() const;
+
+    void logOverflowStats(const char* queueName) const;
 
-    bool autoEmpty = true;
 private:
+    /**
+     * Put a handle into the backend without waiting.
+     */
+    bool tryPut(PacketHandle handle, Lane lane);
+
+    /**
+     * Take a handle from the backend without waiting.
+     * @param includePriority false to take only from the routine lane
+     */
+    bool tryTake(PacketHandle* handle, bool includePriority = true);
+
+    /**
+     * Take the next handle in the order of the queue without waiting: with the SPILL policy, a spilled packet is
+     * taken after the priority lane and before the routine lane.
+     */
+    bool tryTakeNext(PacketHandle* handle);
+
+    /**
+     * Copy the oldest spilled packet into the pool and remove it from the spill area. spillMutex must be locked.
+     * @return false if the spill area is empty or the pool is exhausted
+     */
+    bool takeSpilled(PacketHandle* handle);
+
+    /**
+     * Move the oldest routine packet to the spill area. If the packet cannot be written, it is dropped.
+     * spillMutex must be locked.
+     * @return false if the spill area is full or the routine lane is empty
+     */
+    bool spillOldest();
+
+    void updatePeakDepth();
+
+    Backend backend = Backend::OS_QUEUE;
+    OverflowPolicy overflowPolicy = OverflowPolicy::DROP_OLDEST;
+    PacketSpillArea* spillArea = nullptr;
+    os_mutex_t spillMutex{};  // keeps the order of the packets moved between the routine lane and the spill area
+    std::atomic<uint32_t> dropped{0};
+    std::atomic<uint32_t> spilled{0};
+    std::atomic<uint16_t> depth{0};
+    std::atomic<uint16_t> peakDepth{0};
     os_queue_t queue{};
+    SpscRing<PacketHandle, RING_CAPACITY> spscRing;
+    MpscRing<PacketHandle, RING_CAPACITY> mpscRing;
+    MpscRing<PacketHandle, PRIORITY_RING_CAPACITY> priorityRing;
+    os_semaphore_t notEmpty{};  // given by a producer when the consumer is waiting for an empty ring
+    std::atomic<bool> consumerWaiting{false};
+    PacketPool* pool = nullptr;
 };
 
 #endif
@@ -0,0 +1,161 @@
+#include "PacketSpillArea.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool PacketSpillArea::init()
+{
+    int f = open(path, O_RDWR | O_CREAT);
+    if (f == -1) return false;
+
+    // the records end at the first invalid one, the last read offset record tells which packets have been read
+    RecordHeader header;
+    uint8_t data[SystemConfig::PACKET_MAX_SIZE_BYTES];
+    readOffset = fileSize = 0;
+    while (fileSize < MAX_FILE_SIZE && readRecord(f, &header, data)) {
+        if (header.type == RECORD_READ_OFFSET) {
+            std::memcpy(&readOffset, data, sizeof(readOffset));
+        }
+        fileSize += sizeof(header) + header.size;
+    }
+    count = 0;
+    for (uint32_t offset = readOffset; offset < fileSize; offset += sizeof(header) + header.size) {
+        if (lseek(f, offset, SEEK_SET) == -1 || ::read(f, &header, sizeof(header)) != sizeof(header)) {
+            count = 0;
+            break;
+        }
+        count += header.type == RECORD_PACKET;
+    }
+    // a record torn by a reset would shift the records appended after it
+    struct stat st;
+    bool s = count == 0 || (fstat(f, &st) == 0 && (static_cast<uint32_t>(st.st_size) == fileSize ||
+                                                   ftruncate(f, fileSize) == 0));
+    s = (close(f) == 0) && s;
+
+    active = s && (count > 0 || truncate());
+    if (active && count > 0) {
+        Log.info("Spill area holds %u packets from before the reset.", count);
+    }
+    return active;
+}
+
+bool PacketSpillArea::push(const Packet& packet)
+{
+    uint16_t dataSize;
+    const uint8_t* data = packet.getBytes(&dataSize);
+    RecordHeader header{dataSize, fletcher16(data, dataSize), "", RECORD_PACKET};
+    std::strncpy(header.eventName, packet.getEventName(), sizeof(header.eventName) - 1);
+
+    // room is kept for the read offset records of all packets
+    if (!active || fileSize + sizeof(header) + dataSize + (count + 1) * READ_OFFSET_RECORD_SIZE > MAX_FILE_SIZE) {
+        return false;
+    }
+    if (!append(header, data)) return false;
+    ++count;
+    return true;
+}
+
+bool PacketSpillArea::front(Packet* packet)
+{
+    if (!active || count == 0) return false;
+    RecordHeader header{};
+    uint8_t data[SystemConfig::PACKET_MAX_SIZE_BYTES];
+    int f = open(path, O_RDONLY);
+    bool s = f != -1
+             && lseek(f, readOffset, SEEK_SET) != -1
+             && ::read(f, &header, sizeof(header)) == sizeof(header)
+             && header.size <= sizeof(data) && header.type == RECORD_PACKET;
+    bool valid = s
+                 && ::read(f, data, header.size) == header.size
+                 && header.checksum == fletcher16(data, header.size);
+    if (f != -1) close(f);
+
+    if (!s) {
+        // the following records cannot be found without a valid header
+        Log.warn("Spill area is corrupt, discarding %u packets.", count);
+        truncate();
+        return false;
+    }
+    if (!valid) {
+        // a corrupt record is skipped, so that it does not block the area
+        Log.warn("Spilled packet could not be read, discarding.");
+        pop();
+        return false;
+    }
+    header.eventName[sizeof(header.eventName) - 1] = '\0';
+    *packet = Packet(header.eventName, data, header.size);
+    return true;
+}
+
+bool PacketSpillArea::pop()
+{
+    if (!active || count == 0) return false;
+    if (count == 1) {
+        return truncate();
+    }
+
+    // the next packet follows the removed one, after the read offset records appended in the meantime
+    RecordHeader header{};
+    int f = open(path, O_RDONLY);
+    bool s = f != -1
+             && lseek(f, readOffset, SEEK_SET) != -1
+             && ::read(f, &header, sizeof(header)) == sizeof(header);
+    uint32_t offset = readOffset + sizeof(header) + header.size;
+    while (s && offset < fileSize) {
+        s = lseek(f, offset, SEEK_SET) != -1 && ::read(f, &header, sizeof(header)) == sizeof(header);
+        if (s && header.type == RECORD_PACKET) break;
+        offset += sizeof(header) + header.size;
+    }
+    if (f != -1) close(f);
+    if (!s || offset >= fileSize) {
+        Log.warn("Spill area is corrupt, discarding %u packets.", count);
+        truncate();
+        return false;
+    }
+    readOffset = offset;
+    --count;
+
+    RecordHeader offsetHeader{sizeof(readOffset), fletcher16(reinterpret_cast<const uint8_t*>(&readOffset),
+                                                             sizeof(readOffset)), "", RECORD_READ_OFFSET};
+    if (!append(offsetHeader, &readOffset)) {
+        // the packet is published again after a reset
+        Log.warn("Read offset of the spill area could not be written.");
+        return false;
+    }
+    return true;
+}
+
+bool PacketSpillArea::readRecord(int f, RecordHeader* header, uint8_t* data)
+{
+    return ::read(f, header, sizeof(*header)) == sizeof(*header)
+           && header->size <= SystemConfig::PACKET_MAX_SIZE_BYTES
+           && (header->type == RECORD_PACKET || (header->type == RECORD_READ_OFFSET && header->size == sizeof(uint32_t)))
+           && ::read(f, data, header->size) == header->size
+           && header->checksum == fletcher16(data, header->size);
+}
+
+bool PacketSpillArea::append(const RecordHeader& header, const void* data)
+{
+    int f = open(path, O_WRONLY | O_APPEND);
+    if (f == -1) return false;
+    bool s = write(f, &header, sizeof(header)) == sizeof(header)
+             && write(f, data, header.size) == header.size;
+    if (!s) {
+        // a partial record would shift all records appended after it
+        ftruncate(f, fileSize);
+    }
+    s = (close(f) == 0) && s;
+    if (s) {
+        fileSize += sizeof(header) + header.size;
+    }
+    return s;
+}
+
+bool PacketSpillArea::truncate()
+{
+    readOffset = fileSize = 0;
+    count = 0;
+    int f = open(path, O_WRONLY | O_CREAT | O_TRUNC);
+    if (f == -1) return false;
+    return close(f) == 0;
+}
@@ -0,0 +1,120 @@
+#ifndef PACKETSPILLAREA_H
+#define PACKETSPILLAREA_H
+
+#include "main.h"
+
+#include "Packets/Packet.h"
+
+#include <fcntl.h>
+
+/**
+ * Overflow area in the flash file system for packets that do not fit into the Packet Publishing Queue.
+ *
+ * The area is one file (/Packets/spill.bin) which is used as a FIFO: packets are appended to the file, and read
+ * from an offset. The file is never written in place, which would copy all blocks after the written one in the
+ * copy-on-write file system. So the read offset is not kept in a file header either: after a packet has been
+ * removed, a record with the new read offset is appended, and init() continues from the last one, so that the
+ * spilled packets survive a reset. Once all packets have been read, the file is truncated to zero. The space of
+ * read packets is only reused after that, the file holds at most CAPACITY packets of the maximum size and their
+ * read offset records.
+ *
+ * Record structure:
+ * Bytes          |Function
+ * ---------------|--------------------------------------------------
+ * 0-1            |data size
+ * 2-3            |checksum of the data
+ * 4-13           |event name (empty in a read offset record)
+ * 14-15          |record type: RECORD_PACKET or RECORD_READ_OFFSET
+ * 16-end         |packet data, or the read offset (4 bytes)
+ *
+ * The area is not thread safe, the Packet Queue which spills into it synchronizes the access.
+ */
+class PacketSpillArea
+{
+public:
+    struct RecordHeader {
+        uint16_t size;
+        uint16_t checksum;
+        char eventName[10];  // same length as in Packet
+        uint16_t type;
+    };
+
+    static constexpr uint16_t RECORD_PACKET = 0;
+    static constexpr uint16_t RECORD_READ_OFFSET = 1;
+
+    static constexpr uint16_t CAPACITY = SystemConfig::FLASH_SPILL_RECORDS;
+    static constexpr size_t MAX_RECORD_SIZE = sizeof(RecordHeader) + SystemConfig::PACKET_MAX_SIZE_BYTES;
+    static constexpr size_t READ_OFFSET_RECORD_SIZE = sizeof(RecordHeader) + sizeof(uint32_t);
+    static constexpr size_t MAX_FILE_SIZE = CAPACITY * (MAX_RECORD_SIZE + READ_OFFSET_RECORD_SIZE);
+
+    /**
+     * @param path Path of the spill file
+     */
+    explicit PacketSpillArea(const char* path = "/Packets/spill.bin") : path(path) {}
+
+    /**
+     * Open the spill file, continuing after the last read offset recorded in it, or create it.
+     * A record that was torn by a reset is cut off. Must be called once, after the /Packets directory has been
+     * created.
+     * @return true on success, false on failure
+     */
+    bool init();
+
+    /**
+     * Append a packet.
+     * @return false if the area is full, not initialized or the write failed
+     */
+    bool push(const Packet& packet);
+
+    /**
+     * Read the oldest packet without removing it. A record that cannot be read is discarded.
+     * @param packet Output packet
+     * @return false if the area is empty or the record could not be read
+     */
+    bool front(Packet* packet);
+
+    /**
+     * Remove the oldest packet and append the new read offset, or truncate the file once the area is empty.
+     * @return false if the area is empty or the file could not be written
+     */
+    bool pop();
+
+    bool empty() const { return count == 0; }
+
+    /**
+     * @return true if a packet of the maximum size may not fit into the area
+     */
+    bool full() const {
+        return !active || fileSize + MAX_RECORD_SIZE + (count + 1) * READ_OFFSET_RECORD_SIZE > MAX_FILE_SIZE;
+    }
+
+    uint16_t size() const { return count; }
+
+private:
+    /**
+     * Read the record at the current position of the file and validate it.
+     * @param data Output buffer of PACKET_MAX_SIZE_BYTES
+     * @return true if a valid record was read
+     */
+    static bool readRecord(int f, RecordHeader* header, uint8_t* data);
+
+    /**
+     * Append a record to the file.
+     * @return true on success, false on failure
+     */
+    bool append(const RecordHeader& header, const void* data);
+
+    /**
+     * Empty the file and reset the FIFO.
+     * @return true on success, false on failure
+     */
+    bool truncate();
+
+    const char* path;
+    bool active = false;      // set once by init()
+    uint32_t readOffset = 0;  // offset of the oldest packet in the file
+    uint32_t fileSize = 0;    // offset after the last record
+    uint16_t count = 0;       // number of spilled packets
+};
+
+#endif
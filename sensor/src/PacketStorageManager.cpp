@@ -3,14 +3,14 @@
 PacketStorageManager::PacketStorageManager(PacketQueue& packetStorageQueue, const SdFat32& sd,
                                            const SystemConfig& config,
                                            const SystemState& sysstate, ErrorHandler& eh)
-    : packetStorageQueue(packetStorageQueue), sd(sd), sysconfig(config), sysstate(sysstate),
+    : sd(sd), packetStorageQueue(packetStorageQueue), sysconfig(config), sysstate(sysstate),
       eh(eh)
 {
 }
 
 void PacketStorageManager::start()
 {
-    thread = Thread{"PacketStorageManager", [this] { run(); }};
+    thread = Thread{"PacketStorageManager", [this] { run(); }, OS_THREAD_PRIORITY_DEFAULT, SystemConfig::THREAD_STACK_SIZE};
 }
 
 void PacketStorageManager::initStorage()
@@ -18,7 +18,7 @@ void PacketStorageManager::initStorage()
     os_mutex_create(&storageMutex);
 
     if (sysstate.flashActive)
-     // Directory structure: /Packets/<first data point unix timestamp>.<event name>.pkt
+     // Directory structure: /Packets/<segment number>.seg, see FlashPacketLog
     {
         bool s = initFlashStorage(); // todo: add success check
         if(s) {
@@ -44,41 +44,29 @@ bool PacketStorageManager::initSDCardStorage()
 {
     os_mutex_lock(storageMutex);
 
-    subFolderTimestampsIndex.clear();  // reset the index
-
-    subFolderTimestampsIndex.reserve(365);  // todo: reserve more?
-    
     SD_TRY(sd.begin(SdSpiConfig(SD_CARD_CS_PIN, DEDICATED_SPI, 250000, &softSpi)));  Log.info("One");  // todo: move CS pin to SystemConfig
 
 
-    File32 dir;
-    File32 file;  // todo: rename to subfolder for clarity
     SD_TRY(sd.chdir("/")); // go to root  
+    if(folderDir.isOpen()) folderDir.close();
+    folderDirTimestamp = 0;
+    for(auto& index : folderIndexCache) {
+        index.folderTimestamp = 0;
+    }
     // create board-specific directory if it does not exist
     if (!sd.exists(sysconfig.deviceId.c_str()))
     {
         SD_TRY(sd.mkdir(Particle.deviceID()))
     }
-
-    SD_TRY(dir.open(Particle.deviceID()));
-    file = dir.openNextFile(O_RDONLY);
-
-    while(file) {  // todo: unhandled sd card error: opennextfile
-        char name[64];
-        size_t nameSize = file.getName(name, 64);
-        time32_t timestamp = std::atoi(name);
-        if(timestamp > 1600000000) {
-            // valid sub-folder, add timestamp to the index
-            subFolderTimestampsIndex.push_back(timestamp);
-        }
-        SD_TRY(file.close())
-        file = dir.openNextFile(O_RDONLY);
-    }
-    SD_TRY(dir.close());
-
-    std::sort(subFolderTimestampsIndex.begin(), subFolderTimestampsIndex.end());
-    Log.info("SD Init completed, added %d sub-folders to the index.",
-                 subFolderTimestampsIndex.size());
+    SD_TRY(openSequenceIndex());
+    if(migrationSegmentFile.isOpen()) migrationSegmentFile.close();
+    migrationSegmentTimestamp = 0;
+    // the former layouts are migrated once, the marker file is written when no packet files are left
+    char markerPath[64];
+    makeMigrationMarkerPath(markerPath, sizeof(markerPath));
+    sdMigrationPending = !sd.exists(markerPath);
+    migrationCursor = 0;
+    Log.info("SD Init completed.");
 
     os_mutex_unlock(storageMutex);
 
@@ -89,46 +77,40 @@ bool PacketStorageManager::initFlashStorage()
 {
     os_mutex_lock(storageMutex);
 
-    DIR* packetsDir;
     if (mkdir("/Packets", 0777) != 0 && errno != EEXIST) FLASH_ERROR();
-    packetsDir = opendir("/Packets");
-    if (packetsDir == nullptr) FLASH_ERROR();
+    if (!flashLog.init()) FLASH_ERROR();
 
-    // Build index of all packets currently stored in flash.
-    dirent* dirEntry = readdir(packetsDir);
-    while (dirEntry != nullptr)
-    {
-        f_string name(dirEntry->d_name);
-        time32_t timestamp = std::atoi(name.c_str());
-        if(checkPacketName(name)) {
-            if (timestamp > 1600000000) {
-                flashPacketTimestampsIndex.push_back(timestamp);
-            } else {
-                Log.warn("Invalid packet found in flash: /Packets/%s", name.c_str());
-                dirEntry = readdir(packetsDir);
-            }
-        }
-        dirEntry = readdir(packetsDir);
-    }
-    if (errno) FLASH_ERROR();
-    if (closedir(packetsDir) != 0) FLASH_ERROR();
-    if (flashPacketTimestampsIndex.size() > sysconfig.FLASH_MAX_PACKETS) FLASH_ERROR();
-
-    std::sort(flashPacketTimestampsIndex.begin(), flashPacketTimestampsIndex.end());
-    Log.info("%d packets found in flash.", flashPacketTimestampsIndex.size());
+    os_mutex_unlock(storageMutex);
+    return true;
+}
 
+bool PacketStorageManager::clearFlash()
+{
+    os_mutex_lock(storageMutex);
+    if (!flashLog.clear()) FLASH_ERROR();
     os_mutex_unlock(storageMutex);
     return true;
 }
 
 void PacketStorageManager::run()
 {
-    Packet packet;
+    PacketPool& pool = packetStorageQueue.getPool();
+    PacketHandle handle;
     while (true)
     {
-        packetStorageQueue.take(&packet, CONCURRENT_WAIT_FOREVER);
+        // packet files of the former SD card layouts are migrated while no packets arrive
+        bool migrating = sdMigrationPending && sysstate.sdActive;
+        system_tick_t timeout = migrating ? SystemConfig::SD_CARD_MIGRATION_IDLE_PERIOD : CONCURRENT_WAIT_FOREVER;
+        if(!packetStorageQueue.take(&handle, timeout)) {
+            if(migrating && !migrateLegacySDStep()) {
+                Log.error("SD card error while migrating packet files");
+                eh.sdError();
+            }
+            continue;
+        }
+        const Packet& packet = pool.get(handle);
 
-        if(std::strcmp(packet.getEventName(), DataPointPacket::eventName)) {
+        if(!DataPointPacket::isDataPointPacket(packet)) {
             // Packet is not DataPointPacket
             Log.error("Packet Storage Manager received invalid packet from the packet storage queue.");
         }
@@ -148,6 +130,7 @@ void PacketStorageManager::run()
         } else {
             Log.info("SD is not active, not saving.");
         }
+        pool.release(handle);
     }
 }
 
@@ -155,94 +138,801 @@ bool PacketStorageManager::savePacketToSD(const Packet& packet)
 {
     // Wait for storage to become available
     os_mutex_lock(storageMutex);
-    // Produce filename and get binary data from the Packet instance
-    f_string filename = packet.makeFilename();
+    uint32_t startUs = micros();
+
+    if(SystemConfig::SD_CARD_SEGMENT_FILES) {
+        // Structure: /<device id>/<start of day timestamp>/<start of interval timestamp>.seg
+        SD_TRY(appendPacketToSegment(packet));
+    } else {
+        // Produce filename and get binary data from the Packet instance
+        f_string filename = packet.makeFilename();
+
+        uint16_t dataSize;
+        const uint8_t* data = packet.getBytes(&dataSize);
+
+        // Write to the sd card
+        // Structure: /<device id>/<start of day timestamp>/<start of interval timestamp>/<timestamp>.<event name>.pkt
+        File32 file;
+        time32_t usedSubFolderTimestamp = getSubFolderTimestamp(packet.getTimestamp());
+
+        char subfolderPath[64];
+        makeSubFolderPath(usedSubFolderTimestamp, subfolderPath, sizeof(subfolderPath));
+
+        if(usedSubFolderTimestamp != folderDirTimestamp) {
+            // the previous sub-folder is complete
+            if(SystemConfig::SD_CARD_FOLDER_INDEX_FILES && folderDirTimestamp != 0 &&
+               !writeFolderIndexFile(folderDirTimestamp)) {
+                Log.warn("Could not write the index file of sub-folder %d", folderDirTimestamp);
+            }
+            SD_TRY(openFolderDir(usedSubFolderTimestamp, subfolderPath));
+            removeFolderIndexFile(usedSubFolderTimestamp);
+        }
+        SD_TRY(file.open(&folderDir, filename.c_str(), O_RDWR | O_CREAT));
+        SD_TRY(file.write(data, dataSize));
+        SD_TRY(file.close());
+        updateFolderIndex(usedSubFolderTimestamp, packet.getTimestamp(), 0);
+        SD_TRY(updateSequenceIndex(packet, 0));
+    }
+
+    saveLatency.record(micros() - startUs);
+    if(saveLatency.getCount() >= SystemConfig::SD_CARD_LATENCY_LOG_INTERVAL) {
+        saveLatency.log();
+        saveLatency.reset();
+        packetStorageQueue.logOverflowStats("Storage");
+    }
+
+    os_mutex_unlock(storageMutex);
+    return true;
+}
+
+bool PacketStorageManager::openFolderDir(time32_t folderTimestamp, const char* path)
+{
+    if(folderDir.isOpen()) {
+        if(folderTimestamp == folderDirTimestamp) {
+            return true;
+        }
+        folderDir.close();
+    }
+    folderDirTimestamp = 0;
+
+    if(!folderDir.open(path, O_RDONLY)) {
+        if(!sd.mkdir(path) || !folderDir.open(path, O_RDONLY)) {  // mkdir also creates the parent folder
+            return false;
+        }
+    }
+    folderDirTimestamp = folderTimestamp;
+    return true;
+}
+
+bool PacketStorageManager::appendPacketToSegment(const Packet& packet, bool migrated)
+{
+    static_assert(SystemConfig::SD_CARD_SEGMENT_BUFFER_SIZE >= 512 + sizeof(SegmentRecordHeader) + DataPointPacket::MAX_SIZE_BYTES,
+                  "Segment buffer must hold a sector and a record");
+
+    time32_t subFolderTimestamp = getSubFolderTimestamp(packet.getTimestamp());
+    if(subFolderTimestamp != segmentTimestamp) {
+        // packet belongs to another period, roll over to its segment file
+        if(segmentTimestamp != 0 && !closeSegment()) return false;
+        if(!openSegment(subFolderTimestamp)) return false;
+    }
 
     uint16_t dataSize;
     const uint8_t* data = packet.getBytes(&dataSize);
+    SegmentRecordHeader header{.magic = SEGMENT_RECORD_MAGIC, .size = dataSize, .timestamp = packet.getTimestamp(),
+                               .checksum = fletcher16(data, dataSize), .reserved = 0};
+
+    if(segmentBuffer.bytesFree() < sizeof(header) + dataSize && !segmentBuffer.sync()) return false;
+    uint32_t offset = segmentFile.curPosition() + segmentBuffer.bytesUsed();
+    if(segmentBuffer.write(&header, sizeof(header)) != sizeof(header)) return false;
+    if(segmentBuffer.write(data, dataSize) != dataSize) return false;
+    updateFolderIndex(subFolderTimestamp, header.timestamp, offset);
+    if(!updateSequenceIndex(packet, offset, migrated)) return false;
+
+    // write only whole sectors, the partial one stays in the buffer until the next sync
+    size_t bytesUsed = segmentBuffer.bytesUsed();
+    if(bytesUsed >= 512 && segmentBuffer.writeOut(bytesUsed - bytesUsed % 512) != bytesUsed - bytesUsed % 512) {
+        return false;
+    }
 
-    // Write to the sd card
-    // Structure: /<device id>/<start of interval timestamp>/<timestamp>.<event name>.pkt
-    File32 file;
-    time32_t pt = packet.getTimestamp();
-    time32_t usedSubFolderTimestamp = 0; // where we are going to write the file
-    if(!subFolderTimestampsIndex.empty()) {
-        time32_t d = Time.now() - subFolderTimestampsIndex.back();
-        if (d < 0) {
-            Log.error("Timestamp of the latest SD card subfolder is in the future");
-            for(int i = 0; i < subFolderTimestampsIndex.size() - 1; ++i) {
-                auto t1 = subFolderTimestampsIndex[i];
-                auto t2 = subFolderTimestampsIndex[i+1];
-                if(t1 <= pt && pt <= t2) {
-                    usedSubFolderTimestamp = t1;
-                    break;
+    if(++unsyncedRecords >= SystemConfig::SD_CARD_SEGMENT_SYNC_RECORDS) {
+        if(!segmentBuffer.sync() || !segmentFile.sync()) return false;
+        unsyncedRecords = 0;
+    }
+    return true;
+}
+
+bool PacketStorageManager::openSegment(time32_t subFolderTimestamp)
+{
+    time32_t parentFolderTimestamp = getParentFolderTimestamp(subFolderTimestamp);
+    char parentPath[64];
+    std::snprintf(parentPath, sizeof(parentPath), "/%s/%d", sysconfig.deviceId.c_str(), parentFolderTimestamp);
+    if(!openFolderDir(parentFolderTimestamp, parentPath)) return false;
+
+    char name[16];
+    std::snprintf(name, sizeof(name), "%d.seg", subFolderTimestamp);
+    // the index of the segment is kept up to date while it is written
+    FolderIndex& index = allocateFolderIndex(subFolderTimestamp);
+    index.clear();
+    if(segmentFile.open(&folderDir, name, O_RDWR)) {
+        // continue after the last valid record
+        removeFolderIndexFile(subFolderTimestamp);
+        if(!scanSegment(segmentFile, subFolderTimestamp, index)) return false;
+        if(segmentFile.fileSize() < SEGMENT_PREALLOCATE_SIZE) {
+            // closing the file released its preallocated space, which cannot be preallocated again once the file
+            // has clusters: it is extended with zeros instead, so that appending doesn't allocate clusters either
+            static const uint8_t zeros[512] = {};
+            uint32_t end = segmentFile.curPosition();
+            bool extended = segmentFile.seekSet(segmentFile.fileSize());
+            while(extended && segmentFile.fileSize() < SEGMENT_PREALLOCATE_SIZE) {
+                size_t n = std::min<size_t>(sizeof(zeros), SEGMENT_PREALLOCATE_SIZE - segmentFile.fileSize());
+                extended = segmentFile.write(zeros, n) == n;
+            }
+            if(!extended) {
+                Log.warn("Could not extend segment file %s/%s", parentPath, name);
+            }
+            if(!segmentFile.seekSet(end)) return false;
+        }
+    } else {
+        // contiguous clusters for the whole period, so appending never searches for free clusters
+        if(!segmentFile.open(&folderDir, name, O_RDWR | O_CREAT)) return false;
+        if(!segmentFile.preAllocate(SEGMENT_PREALLOCATE_SIZE)) {
+            Log.warn("Could not preallocate segment file %s/%s", parentPath, name);
+        }
+    }
+
+    segmentBuffer.begin(&segmentFile);
+    segmentTimestamp = subFolderTimestamp;
+    unsyncedRecords = 0;
+    return true;
+}
+
+bool PacketStorageManager::closeSegment()
+{
+    time32_t closedTimestamp = segmentTimestamp;
+    segmentTimestamp = 0;
+    unsyncedRecords = 0;
+    bool s = segmentBuffer.sync();
+    s = s && segmentFile.truncate();  // release the preallocated space after the last record
+    s = segmentFile.close() && s;
+    if(s && SystemConfig::SD_CARD_FOLDER_INDEX_FILES && !writeFolderIndexFile(closedTimestamp)) {
+        Log.warn("Could not write the index file of segment %d", closedTimestamp);
+    }
+    return s;
+}
+
+bool PacketStorageManager::scanSegment(File32& file, time32_t subFolderTimestamp, FolderIndex& index)
+{
+    SegmentRecordHeader header;
+    uint8_t buf[DataPointPacket::MAX_SIZE_BYTES];
+    uint32_t end = 0;
+    while(readSegmentRecord(file, subFolderTimestamp, &header, buf)) {
+        index.insert(header.timestamp, end);
+        end = file.curPosition();
+    }
+    if(!index.complete) {
+        Log.warn("Segment %d holds more than %u packets, its index is incomplete", subFolderTimestamp,
+                 static_cast<unsigned>(MAX_PACKETS_PER_FOLDER));
+    }
+    return file.seekSet(end);
+}
+
+bool PacketStorageManager::appendMigratedPacket(const Packet& packet)
+{
+    time32_t subFolderTimestamp = getSubFolderTimestamp(packet.getTimestamp());
+    bool current = subFolderTimestamp == segmentTimestamp;
+    if(!current && subFolderTimestamp != migrationSegmentTimestamp) {
+        if(!closeMigrationSegment() || !openMigrationSegment(subFolderTimestamp)) return false;
+    }
+    const FolderIndex* index = getFolderIndex(subFolderTimestamp);
+    if(index != nullptr &&
+       std::binary_search(index->timestamps.begin(), index->timestamps.end(), packet.getTimestamp())) {
+        return true;  // migrated before a reset, which left the packet file behind
+    }
+
+    if(current) {
+        // the record must be on the card before the packet file is removed
+        return appendPacketToSegment(packet, true) && segmentBuffer.sync() && segmentFile.sync();
+    }
+
+    uint16_t dataSize;
+    const uint8_t* data = packet.getBytes(&dataSize);
+    SegmentRecordHeader header{.magic = SEGMENT_RECORD_MAGIC, .size = dataSize, .timestamp = packet.getTimestamp(),
+                               .checksum = fletcher16(data, dataSize), .reserved = 0};
+    uint32_t offset = migrationSegmentFile.curPosition();
+    if(migrationSegmentFile.write(&header, sizeof(header)) != sizeof(header)) return false;
+    if(migrationSegmentFile.write(data, dataSize) != dataSize) return false;
+    if(!migrationSegmentFile.sync()) return false;
+    updateFolderIndex(subFolderTimestamp, header.timestamp, offset);
+    return updateSequenceIndex(packet, offset, true);
+}
+
+bool PacketStorageManager::openMigrationSegment(time32_t subFolderTimestamp)
+{
+    char path[64];
+    std::snprintf(path, sizeof(path), "/%s/%d", sysconfig.deviceId.c_str(),
+                  getParentFolderTimestamp(subFolderTimestamp));
+    if(!sd.exists(path) && !sd.mkdir(path)) return false;
+    makeSegmentPath(subFolderTimestamp, path, sizeof(path));
+
+    // the index file is written again when the segment file is closed
+    removeFolderIndexFile(subFolderTimestamp);
+    FolderIndex& index = allocateFolderIndex(subFolderTimestamp);
+    index.clear();
+    if(!migrationSegmentFile.open(path, O_RDWR | O_CREAT)) return false;
+    if(!scanSegment(migrationSegmentFile, subFolderTimestamp, index)) {
+        migrationSegmentFile.close();
+        return false;
+    }
+    migrationSegmentTimestamp = subFolderTimestamp;
+    return true;
+}
+
+bool PacketStorageManager::closeMigrationSegment()
+{
+    if(migrationSegmentTimestamp == 0) return true;
+    time32_t closedTimestamp = migrationSegmentTimestamp;
+    migrationSegmentTimestamp = 0;
+    // a segment file that was left preallocated by a reset ends after its last record as well
+    bool s = migrationSegmentFile.truncate();
+    s = migrationSegmentFile.close() && s;
+    if(s && SystemConfig::SD_CARD_FOLDER_INDEX_FILES && !writeFolderIndexFile(closedTimestamp)) {
+        Log.warn("Could not write the index file of segment %d", closedTimestamp);
+    }
+    return s;
+}
+
+void PacketStorageManager::makeMigrationMarkerPath(char* path, size_t size) const
+{
+    // a marker per layout, so that switching to segment files migrates the packet files again
+    std::snprintf(path, size, "/%s/migrated.%s", sysconfig.deviceId.c_str(),
+                  SystemConfig::SD_CARD_SEGMENT_FILES ? "seg" : "pkt");
+}
+
+bool PacketStorageManager::migrateLegacySDStep()
+{
+    os_mutex_lock(storageMutex);
+    if(!sdMigrationPending) {
+        os_mutex_unlock(storageMutex);
+        return true;
+    }
+
+    // the directory is not sorted, so it is scanned for the oldest folder that has not been migrated yet
+    char path[64];
+    std::snprintf(path, sizeof(path), "/%s", sysconfig.deviceId.c_str());
+    File32 dir;
+    SD_TRY(dir.open(path, O_RDONLY));
+    time32_t folderTimestamp = 0;
+    {
+        FatDirIterator entries(&dir);
+        int8_t r;
+        while((r = entries.next()) > 0) {
+            time32_t timestamp = std::atoi(entries.name());
+            if(entries.isDir() && timestamp > migrationCursor && (folderTimestamp == 0 || timestamp < folderTimestamp)) {
+                folderTimestamp = timestamp;
+            }
+        }
+        dir.close();
+        SD_TRY(r >= 0);
+    }
+    if(folderTimestamp == 0) {
+        makeMigrationMarkerPath(path, sizeof(path));
+        File32 marker;
+        SD_TRY(marker.open(path, O_WRONLY | O_CREAT));
+        SD_TRY(marker.close());
+        sdMigrationPending = false;
+        Log.info("No packet files of former SD card layouts left.");
+        os_mutex_unlock(storageMutex);
+        return true;
+    }
+
+    std::snprintf(path, sizeof(path), "/%s/%d", sysconfig.deviceId.c_str(), folderTimestamp);
+    // a parent folder of the current layout holds no packet files, unless a former folder happens to be aligned
+    bool parentFolder = folderTimestamp % SystemConfig::SD_CARD_PARENT_FOLDER_TIMESPAN == 0;
+    uint8_t budget = SystemConfig::SD_CARD_MIGRATION_BATCH;
+    bool done;
+    bool s = migratePacketFiles(path, &budget, &done);
+
+    if(s && done && parentFolder && SystemConfig::SD_CARD_SEGMENT_FILES) {
+        // sub-folders of the layout with one file per packet
+        static_vector<time32_t, SystemConfig::SD_CARD_PARENT_FOLDER_TIMESPAN / SystemConfig::SD_CARD_SUBFOLDER_TIMESPAN>
+            subFolders;
+        s = dir.open(path, O_RDONLY);
+        if(s) {
+            FatDirIterator entries(&dir);
+            int8_t r;
+            while((r = entries.next()) > 0 && subFolders.size() < subFolders.capacity()) {
+                time32_t timestamp = std::atoi(entries.name());
+                if(entries.isDir() && timestamp != 0) {
+                    subFolders.push_back(timestamp);
                 }
             }
-        } else if (d < sysconfig.SD_CARD_SUBFOLDER_TIMESPAN) {
-            // we can use the latest sub-foler
-            Log.warn("Saving packet to the latest subfolder.");
-            usedSubFolderTimestamp = subFolderTimestampsIndex.back();
+            dir.close();
+            s = r >= 0;
+        }
+        for(size_t i = 0; s && i < subFolders.size(); ++i) {
+            char subFolderPath[sizeof(path) + 12];  // room for the parent folder path and a timestamp
+            std::snprintf(subFolderPath, sizeof(subFolderPath), "%s/%d", path, subFolders[i]);
+            s = migratePacketFiles(subFolderPath, &budget, &done);
+            if(!s || !done) break;
+            removeMigratedFolder(subFolderPath);
+        }
+    }
+    // the migrated records are on the card, the index file of the segment file is written
+    s = closeMigrationSegment() && s;
+    SD_TRY(s);
+
+    if(done) {
+        if(!parentFolder) {
+            removeMigratedFolder(path);
+        }
+        migrationCursor = folderTimestamp;
+    }
+    os_mutex_unlock(storageMutex);
+    return true;
+}
+
+bool PacketStorageManager::migratePacketFiles(const char* path, uint8_t* budget, bool* done)
+{
+    // the files are collected first, as the directory changes while they are migrated
+    static_vector<time32_t, SystemConfig::SD_CARD_MIGRATION_BATCH> timestamps;
+    File32 dir;
+    if(!dir.open(path, O_RDONLY)) return false;
+    FatDirIterator entries(&dir);
+    int8_t r;
+    *done = true;
+    while((r = entries.next()) > 0) {
+        if(!entries.isFile() || entries.isNameTruncated()) continue;
+        f_string name(entries.name(), entries.nameLength());
+        time32_t timestamp = std::atoi(name.c_str());
+        if(!checkPacketName(name) || timestamp == 0) continue;
+        if(timestamps.size() == *budget) {
+            *done = false;
+            break;
+        }
+        timestamps.push_back(timestamp);
+    }
+    dir.close();
+    if(r < 0) return false;
+
+    for(time32_t timestamp : timestamps) {
+        char filePath[80];
+        std::snprintf(filePath, sizeof(filePath), "%s/%d.pkt", path, timestamp);
+        if(!migratePacketFile(filePath, timestamp)) return false;
+        --*budget;
+    }
+    return true;
+}
+
+bool PacketStorageManager::migratePacketFile(const char* path, time32_t timestamp)
+{
+    char newPath[80];
+    File32 file;
+    if(!file.open(path, O_RDONLY)) return false;
+    size_t size = file.fileSize();
+    uint8_t buf[DataPointPacket::MAX_SIZE_BYTES];
+    bool valid = size >= sizeof(time32_t) && size <= sizeof(buf);
+    if(valid && file.read(buf, size) != static_cast<int>(size)) {
+        file.close();
+        return false;
+    }
+    file.close();
+    Packet packet(DataPointPacket::eventName, buf, valid ? size : 0);
+    if(!valid || packet.getTimestamp() != timestamp) {
+        // kept for inspection, but not migrated again
+        Log.warn("Packet file %s is invalid, renaming it", path);
+        std::snprintf(newPath, sizeof(newPath), "%.*s.bad", static_cast<int>(std::strlen(path) - 4), path);
+        return sd.rename(path, newPath);
+    }
+
+    time32_t subFolderTimestamp = getSubFolderTimestamp(timestamp);
+    if(SystemConfig::SD_CARD_SEGMENT_FILES) {
+        return appendMigratedPacket(packet) && sd.remove(path);
+    }
+
+    // one file per packet: the file is moved into its sub-folder
+    makeSubFolderPath(subFolderTimestamp, newPath, sizeof(newPath));
+    if(!sd.exists(newPath) && !sd.mkdir(newPath)) return false;
+    size_t pathLength = std::strlen(newPath);
+    std::snprintf(newPath + pathLength, sizeof(newPath) - pathLength, "/%d.pkt", timestamp);
+    if(sd.exists(newPath)) {
+        return sd.remove(path);  // already migrated before a reset
+    }
+    if(!sd.rename(path, newPath)) return false;
+    removeFolderIndexFile(subFolderTimestamp);
+    updateFolderIndex(subFolderTimestamp, timestamp, 0);
+    return true;
+}
+
+void PacketStorageManager::removeMigratedFolder(const char* path)
+{
+    char indexPath[80];
+    std::snprintf(indexPath, sizeof(indexPath), "%s/index.bin", path);
+    if(sd.exists(indexPath)) {
+        sd.remove(indexPath);
+    }
+    if(!sd.rmdir(path)) {
+        Log.warn("Folder %s is not empty after the migration, keeping it", path);
+    }
+}
+
+bool PacketStorageManager::readSegmentRecord(File32& file, time32_t subFolderTimestamp, SegmentRecordHeader* header,
+                                             uint8_t* buf)
+{
+    if(file.read(header, sizeof(*header)) != sizeof(*header)) return false;
+    if(header->magic != SEGMENT_RECORD_MAGIC || header->size > DataPointPacket::MAX_SIZE_BYTES ||
+       getSubFolderTimestamp(header->timestamp) != subFolderTimestamp) {
+        return false;
+    }
+    if(buf == nullptr) return true;
+    if(file.read(buf, header->size) != header->size) return false;
+    return fletcher16(buf, header->size) == header->checksum;
+}
+
+void PacketStorageManager::makeSegmentPath(time32_t subFolderTimestamp, char* path, size_t size) const {
+    makeSubFolderPath(subFolderTimestamp, path, size);
+    size_t pathLength = std::strlen(path);
+    std::snprintf(path + pathLength, size - pathLength, ".seg");
+}
+
+PacketStorageManager::FolderIndex* PacketStorageManager::getFolderIndex(time32_t folderTimestamp)
+{
+    for(auto& index : folderIndexCache) {
+        if(index.folderTimestamp == folderTimestamp) {
+            index.lastUse = ++folderIndexUseCounter;
+            return &index;
+        }
+    }
+
+    FolderIndex& index = allocateFolderIndex(folderTimestamp);
+    if(SystemConfig::SD_CARD_FOLDER_INDEX_FILES && loadFolderIndexFile(index)) {
+        return &index;
+    }
+    if(!buildFolderIndex(index)) {
+        index.folderTimestamp = 0;
+        return nullptr;
+    }
+    return &index;
+}
+
+PacketStorageManager::FolderIndex& PacketStorageManager::allocateFolderIndex(time32_t folderTimestamp)
+{
+    FolderIndex* entry = &folderIndexCache[0];
+    for(auto& index : folderIndexCache) {
+        if(index.folderTimestamp == folderTimestamp) {
+            entry = &index;
+            break;
+        }
+        if(index.lastUse < entry->lastUse) {
+            entry = &index;
+        }
+    }
+    if(entry->folderTimestamp != folderTimestamp) {
+        entry->folderTimestamp = folderTimestamp;
+        entry->clear();
+    }
+    entry->lastUse = ++folderIndexUseCounter;
+    return *entry;
+}
+
+void PacketStorageManager::updateFolderIndex(time32_t folderTimestamp, time32_t packetTimestamp, uint32_t offset)
+{
+    for(auto& index : folderIndexCache) {
+        if(index.folderTimestamp == folderTimestamp) {
+            bool wasComplete = index.complete;
+            if(!index.insert(packetTimestamp, offset) && wasComplete) {
+                Log.warn("Folder %d holds more than %u packets, its index is incomplete", folderTimestamp,
+                         static_cast<unsigned>(MAX_PACKETS_PER_FOLDER));
+            }
+        }
+    }
+}
+
+bool PacketStorageManager::FolderIndex::insert(time32_t timestamp, uint32_t offset)
+{
+    auto it = std::lower_bound(timestamps.begin(), timestamps.end(), timestamp);
+    size_t i = it - timestamps.begin();
+    if(it != timestamps.end() && *it == timestamp) {
+        offsets[i] = offset;
+        return true;
+    }
+    if(timestamps.size() == timestamps.capacity()) {
+        // the earliest packets are kept, so that a search can continue after the last one
+        complete = false;
+        if(it == timestamps.end()) {
+            return false;
+        }
+        timestamps.pop_back();
+        offsets.pop_back();
+        timestamps.insert(it, timestamp);
+        offsets.insert(offsets.begin() + i, offset);
+        return false;
+    }
+    timestamps.insert(it, timestamp);
+    offsets.insert(offsets.begin() + i, offset);
+    return true;
+}
+
+bool PacketStorageManager::buildFolderIndex(FolderIndex& index, time32_t after)
+{
+    time32_t folderTimestamp = index.folderTimestamp;
+    index.clear();
+
+    if(SystemConfig::SD_CARD_SEGMENT_FILES) {
+        File32 file;
+        File32* segment = &file;
+        uint32_t writePosition = 0;
+        if(folderTimestamp == segmentTimestamp) {
+            // segment that is being appended to, read the records through the write handle
+            if(!segmentBuffer.sync()) return false;
+            segment = &segmentFile;
+            writePosition = segmentFile.curPosition();
+            if(!segmentFile.seekSet(0)) return false;
         } else {
-            // the latest sub-folder is too old, so we're creating a new one
-            Log.warn("Latest sub-folder too old, creating a new one.");
-            usedSubFolderTimestamp = pt;
-            subFolderTimestampsIndex.push_back(usedSubFolderTimestamp);
+            char path[64];
+            makeSegmentPath(folderTimestamp, path, sizeof(path));
+            if(!sd.exists(path)) {
+                // no packets were saved in this period
+                return true;
+            }
+            if(!file.open(path, O_RDONLY)) return false;
         }
 
-    } else {
-        // no sub-folders yet
-        Log.info("No subfolders found, creating new one.");
-        usedSubFolderTimestamp = pt;
-        subFolderTimestampsIndex.push_back(usedSubFolderTimestamp);
+        SegmentRecordHeader header;
+        uint8_t buf[DataPointPacket::MAX_SIZE_BYTES];
+        uint32_t offset = 0;
+        // records are appended in time order, unless the clock has been adjusted
+        while(readSegmentRecord(*segment, folderTimestamp, &header, buf)) {
+            if(header.timestamp > after) {
+                index.insert(header.timestamp, offset);
+            }
+            offset = segment->curPosition();
+        }
+        if(!index.complete && after == 0) {
+            Log.warn("Segment %d holds more than %u packets, it is searched in several passes", folderTimestamp,
+                     static_cast<unsigned>(MAX_PACKETS_PER_FOLDER));
+        }
+
+        if(segment == &segmentFile) {
+            return segmentFile.seekSet(writePosition);
+        }
+        return file.close();
     }
 
     char subfolderPath[64];
-    std::snprintf(subfolderPath, sizeof(subfolderPath), "/%s/%d", sysconfig.deviceId.c_str(), usedSubFolderTimestamp);
+    makeSubFolderPath(folderTimestamp, subfolderPath, sizeof(subfolderPath));
+    File32 dir;
+    if(!dir.open(subfolderPath, O_RDONLY)) {
+        // no packets were saved in this period, unless the folder could not be opened
+        return !sd.exists(subfolderPath);
+    }
+    // directory entries are decoded directly, without opening each packet file
+    FatDirIterator entries(&dir);
+    int8_t r;
+    while((r = entries.next()) > 0) {
+        if(!entries.isFile() || entries.isNameTruncated()) continue;
+        f_string name(entries.name(), entries.nameLength());
+        if(checkPacketName(name)) {
+            time32_t timestamp = std::atoi(name.c_str());
+            if(timestamp == 0) {
+                Log.warn("Found .pkt file with invalid filename: %s/%s", subfolderPath, name.c_str());
+            } else if(timestamp > after) {
+                index.insert(timestamp, 0);
+            }
+        }
+    }
+    if(!index.complete && after == 0) {
+        Log.warn("Folder %s holds more than %u packets, it is searched in several passes", subfolderPath,
+                 static_cast<unsigned>(MAX_PACKETS_PER_FOLDER));
+    }
+    return dir.close() && r >= 0;
+}
 
-    if(!sd.exists(subfolderPath)) {
-        SD_TRY(sd.mkdir(subfolderPath))
+bool PacketStorageManager::loadFolderIndexFile(FolderIndex& index)
+{
+    char path[64];
+    makeFolderIndexPath(index.folderTimestamp, path, sizeof(path));
+    File32 file;
+    if(!file.open(path, O_RDONLY)) return false;
+
+    FolderIndexFileHeader header;
+    bool s = file.read(&header, sizeof(header)) == sizeof(header) && header.magic == FOLDER_INDEX_MAGIC &&
+             header.count <= index.timestamps.capacity();
+    if(s) {
+        index.timestamps.resize(header.count);
+        index.offsets.resize(header.count);
+        size_t size = header.count * sizeof(time32_t);
+        s = file.read(index.timestamps.data(), size) == static_cast<int>(size) &&
+            file.read(index.offsets.data(), size) == static_cast<int>(size) &&
+            fletcher16(reinterpret_cast<const uint8_t*>(index.timestamps.data()), size) == header.timestampsChecksum &&
+            fletcher16(reinterpret_cast<const uint8_t*>(index.offsets.data()), size) == header.offsetsChecksum &&
+            std::is_sorted(index.timestamps.begin(), index.timestamps.end());
     }
-    SD_TRY(sd.chdir(subfolderPath))
-    SD_TRY(file.open(filename.c_str(), O_RDWR | O_CREAT));
-    SD_TRY(file.write(data, dataSize));
-    SD_TRY(file.close());
-    SD_TRY(sd.chdir("/"));
+    file.close();
 
-    os_mutex_unlock(storageMutex);
-    return true;
+    if(!s) {
+        Log.warn("Invalid folder index file %s", path);
+        index.timestamps.clear();
+        index.offsets.clear();
+    }
+    return s;
 }
 
-bool PacketStorageManager::savePacketToFlash(const Packet& packet) {
-    assert(!std::strcmp(packet.getEventName(), DataPointPacket::eventName));
+bool PacketStorageManager::writeFolderIndexFile(time32_t folderTimestamp)
+{
+    const FolderIndex* index = getFolderIndex(folderTimestamp);
+    if(index == nullptr) return false;
+    if(!index->complete) {
+        // without an index file the folder is scanned, which finds all of its packets
+        removeFolderIndexFile(folderTimestamp);
+        return true;
+    }
+
+    size_t size = index->timestamps.size() * sizeof(time32_t);
+    FolderIndexFileHeader header{
+        .magic = FOLDER_INDEX_MAGIC, .count = static_cast<uint16_t>(index->timestamps.size()), .reserved = 0,
+        .timestampsChecksum = fletcher16(reinterpret_cast<const uint8_t*>(index->timestamps.data()), size),
+        .offsetsChecksum = fletcher16(reinterpret_cast<const uint8_t*>(index->offsets.data()), size)};
 
-    os_mutex_lock(storageMutex);
-    if(flashPacketTimestampsIndex.size() == sysconfig.FLASH_MAX_PACKETS) {
-        //The memory is full. We erase the earliest packet file and remove
-        // the corresponding timestamp from the index vector.
-        char path[64];
-        snprintf(path, sizeof(path), "/Packets/%d.pkt", flashPacketTimestampsIndex[0]);
-        if (unlink(path) != 0) FLASH_ERROR();
-        flashPacketTimestampsIndex.erase(flashPacketTimestampsIndex.begin());
-    } else if (flashPacketTimestampsIndex.size() > sysconfig.FLASH_MAX_PACKETS) {
-        FLASH_ERROR();
-    }
-    
-    // Write new packet file and add its timestamp to the index vector.
     char path[64];
-    snprintf(path, sizeof(path), "/Packets/%s", packet.makeFilename().c_str());
-    int f = open(path, O_RDWR | O_CREAT);
+    makeFolderIndexPath(folderTimestamp, path, sizeof(path));
+    File32 file;
+    if(!file.open(path, O_WRONLY | O_CREAT | O_TRUNC)) return false;
+    bool s = file.write(&header, sizeof(header)) == sizeof(header) &&
+             file.write(index->timestamps.data(), size) == size &&
+             file.write(index->offsets.data(), size) == size;
+    return file.close() && s;
+}
+
+void PacketStorageManager::removeFolderIndexFile(time32_t folderTimestamp)
+{
+    if(!SystemConfig::SD_CARD_FOLDER_INDEX_FILES) return;
+    char path[64];
+    makeFolderIndexPath(folderTimestamp, path, sizeof(path));
+    sd.remove(path);  // fails if there is no index file
+}
+
+void PacketStorageManager::makeFolderIndexPath(time32_t folderTimestamp, char* path, size_t size) const
+{
+    makeSubFolderPath(folderTimestamp, path, size);
+    size_t pathLength = std::strlen(path);
+    std::snprintf(path + pathLength, size - pathLength, SystemConfig::SD_CARD_SEGMENT_FILES ? ".idx" : "/index.bin");
+}
+
+bool PacketStorageManager::openSequenceIndex()
+{
+    static constexpr uint32_t SEQUENCE_INDEX_SIZE = SystemConfig::SD_CARD_SEQUENCE_INDEX_ENTRIES * sizeof(SequenceIndexEntry);
+    if(sequenceIndexFile.isOpen()) sequenceIndexFile.close();
+    unsyncedSequenceEntries = 0;
+
+    char path[64];
+    std::snprintf(path, sizeof(path), "/%s/sequence.idx", sysconfig.deviceId.c_str());
+    if(sequenceIndexFile.open(path, O_RDWR)) {
+        if(sequenceIndexFile.fileSize() == SEQUENCE_INDEX_SIZE) {
+            return true;
+        }
+        // index of another size, the entries are at other positions
+        sequenceIndexFile.close();
+        if(!sd.remove(path)) return false;
+    }
+    // a contiguous file, so that looking up an entry never follows the cluster chain
+    return sequenceIndexFile.createContiguous(path, SEQUENCE_INDEX_SIZE);
+}
+
+bool PacketStorageManager::updateSequenceIndex(const Packet& packet, uint32_t offset, bool migrated)
+{
     uint16_t dataSize;
     const uint8_t* data = packet.getBytes(&dataSize);
-    if (f == -1) FLASH_ERROR();
-    if (write(f, data, dataSize) == -1) FLASH_ERROR();
-    if (close(f) == -1) FLASH_ERROR();
+    SequenceIndexEntry entry{.sequenceNumber = 0, .timestamp = packet.getTimestamp(), .offset = offset, .check = 0};
+    if(!DataPointPacket::getSequenceNumber(data, dataSize, &entry.sequenceNumber)) {
+        return true;
+    }
+    entry.check = entry.computeCheck();
+
+    uint32_t position = entry.sequenceNumber % SystemConfig::SD_CARD_SEQUENCE_INDEX_ENTRIES * sizeof(entry);
+    if(migrated) {
+        SequenceIndexEntry current;
+        if(!sequenceIndexFile.seekSet(position)) return false;
+        if(sequenceIndexFile.read(&current, sizeof(current)) != sizeof(current)) return false;
+        if(current.sequenceNumber != entry.sequenceNumber || current.timestamp != entry.timestamp) {
+            return true;
+        }
+    }
+    if(!sequenceIndexFile.seekSet(position)) return false;
+    if(sequenceIndexFile.write(&entry, sizeof(entry)) != sizeof(entry)) return false;
+    if(++unsyncedSequenceEntries >= SystemConfig::SD_CARD_SEGMENT_SYNC_RECORDS) {
+        if(!sequenceIndexFile.sync()) return false;
+        unsyncedSequenceEntries = 0;
+    }
+    return true;
+}
 
-    flashPacketTimestampsIndex.push_back(packet.getTimestamp());
+bool PacketStorageManager::readSequenceIndex(uint32_t sequenceNumber, PacketDescriptor* d, bool* found)
+{
+    SequenceIndexEntry entry;
+    uint32_t position = sequenceNumber % SystemConfig::SD_CARD_SEQUENCE_INDEX_ENTRIES * sizeof(entry);
+    if(!sequenceIndexFile.seekSet(position)) return false;
+    if(sequenceIndexFile.read(&entry, sizeof(entry)) != sizeof(entry)) return false;
+    *found = entry.sequenceNumber == sequenceNumber && entry.check == entry.computeCheck();
+    if(*found) {
+        *d = PacketDescriptor{.location = getSubFolderTimestamp(entry.timestamp), .packetTimestamp = entry.timestamp,
+                              .offset = entry.offset};
+    }
+    return true;
+}
 
+bool PacketStorageManager::readPacketFromSD(const PacketDescriptor& d, uint8_t* buf, uint16_t* size)
+{
+    if(SystemConfig::SD_CARD_SEGMENT_FILES) {
+        SegmentRecordHeader header;
+        bool s;
+        if(d.location == segmentTimestamp) {
+            // segment that is being appended to, read the record through the write handle
+            if(!segmentBuffer.sync()) return false;
+            uint32_t writePosition = segmentFile.curPosition();
+            s = segmentFile.seekSet(d.offset) && readSegmentRecord(segmentFile, d.location, &header, buf);
+            if(!segmentFile.seekSet(writePosition)) return false;
+        } else {
+            char path[64];
+            makeSegmentPath(d.location, path, sizeof(path));
+            File32 file;
+            if(!file.open(path, O_RDONLY)) return false;
+            s = file.seekSet(d.offset) && readSegmentRecord(file, d.location, &header, buf);
+            file.close();
+        }
+        if(!s || header.timestamp != d.packetTimestamp) return false;
+        *size = header.size;
+        return true;
+    }
+
+    File32 packetFile;
+    char path[64];
+    makeSubFolderPath(d.location, path, sizeof(path));
+    size_t pathLength = std::strlen(path);
+    std::snprintf(path + pathLength, sizeof(path) - pathLength, "/%d.pkt", d.packetTimestamp);
+    if(!packetFile.open(path, O_RDONLY)) return false;
+    size_t fileSize = packetFile.fileSize();
+    if(fileSize > DataPointPacket::MAX_SIZE_BYTES) {
+        packetFile.close();
+        return false;
+    }
+    bool s = buf == nullptr || packetFile.read(buf, fileSize) == static_cast<int>(fileSize);
+    packetFile.close();
+    *size = fileSize;
+    return s;
+}
+
+bool PacketStorageManager::getPacketSize(const PacketDescriptor& d, uint16_t* size)
+{
+    os_mutex_lock(storageMutex);
+    bool s = d.location == PacketDescriptor::FLASH_LOCATION ? flashLog.readSize(d.packetTimestamp, size)
+                                                            : readPacketFromSD(d, nullptr, size);
+    os_mutex_unlock(storageMutex);
+    return s;
+}
+
+bool PacketStorageManager::savePacketToFlash(const Packet& packet) {
+    assert(DataPointPacket::isDataPointPacket(packet));
+
+    os_mutex_lock(storageMutex);
+    if (!flashLog.append(packet)) FLASH_ERROR();
     os_mutex_unlock(storageMutex);
     return true;
 }
 
+time32_t PacketStorageManager::getSubFolderTimestamp(time32_t packetTimestamp) {
+    return packetTimestamp - packetTimestamp % SystemConfig::SD_CARD_SUBFOLDER_TIMESPAN;
+}
+
+time32_t PacketStorageManager::getParentFolderTimestamp(time32_t subFolderTimestamp) {
+    static_assert(SystemConfig::SD_CARD_PARENT_FOLDER_TIMESPAN % SystemConfig::SD_CARD_SUBFOLDER_TIMESPAN == 0);
+    return subFolderTimestamp - subFolderTimestamp % SystemConfig::SD_CARD_PARENT_FOLDER_TIMESPAN;
+}
+
+void PacketStorageManager::makeSubFolderPath(time32_t subFolderTimestamp, char* path, size_t size) const {
+    std::snprintf(path, size, "/%s/%d/%d", sysconfig.deviceId.c_str(),
+                  getParentFolderTimestamp(subFolderTimestamp), subFolderTimestamp);
+}
+
 bool PacketStorageManager::checkPacketName(const f_string& name) const {
     size_t pointPos = name.find('.');
     if(pointPos == std::string::npos) {
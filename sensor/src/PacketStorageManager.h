@@ -4,11 +4,14 @@
 #include "main.h"
 
 #include "ErrorHandler.h"
+#include "FlashPacketLog.h"
+#include "LatencyHistogram.h"
 #include "packets/RequestedDataPointPacket.h"
 #include "packets/HandshakePacket.h"
 #include "packets/DataPointPacket.h"
 
 #include <SdFat.h>
+#include <RingBuf.h>
 #include <dirent.h>
 #include <fcntl.h>
 
@@ -50,12 +53,18 @@ public:
      */
     void start();
 
+    /**
+     * Discard all packets stored in the flash.
+     * @return true on success, false on failure
+     */
+    bool clearFlash();
+
     /**
      * Searches packets in the specified intervals in the storage. Checks SD card first, then looks in
      * the flash if there are any gaps.
      * 
      * Note: this function does access SD card, but not flash. For the flash, search is performed
-     * in the flashPacketTimestampsIndex vector.
+     * in the index of the flash packet log.
      * 
      * @tparam Container A container with value type PacketDescriptor supporting std::back_inserter, to which the descriptors
      * of the found packets are written.
@@ -68,6 +77,21 @@ public:
     template<class Container, size_t s_intervals>
     bool findPackets(static_vector<interval_t, s_intervals> &intervals, Container& output);
 
+    /**
+     * Searches Data Point Packets by their sequence numbers. The sequence index on the SD card is looked up
+     * first, sequence numbers that are not found in it are searched in the flash packet log.
+     *
+     * @tparam Container A container with value type PacketDescriptor, to which the descriptors of the found
+     * packets are written.
+     * @tparam s_ranges Size of the static vector with sequence ranges
+     * @param ranges Sequence ranges in which to search packets; first and last are inclusive
+     * @param output The output container
+     * @return true Success
+     * @return false SD card or flash error
+     */
+    template<class Container, size_t s_ranges>
+    bool findPacketsBySequence(const static_vector<sequence_range_t, s_ranges>& ranges, Container& output);
+
     /**
      * Stores location of the packet in the storage
      */
@@ -75,8 +99,114 @@ public:
         static constexpr time32_t FLASH_LOCATION = -1;
         time32_t location;  // either SD sub-folder timestamp or FLASH_LOCATION
         time32_t packetTimestamp; // timestamp, as in the file name of the packet
+        uint32_t offset;  // offset of the record in the SD card segment file, if segment files are used
+    };
+
+    /**
+     * Header of a packet record in an SD card segment file.
+     * Structure:
+     * Bytes   |Function
+     * --------|-------------------
+     * 0-1     |SEGMENT_RECORD_MAGIC
+     * 2-3     |Packet size
+     * 4-7     |Packet timestamp
+     * 8-9     |Checksum of the packet data
+     * 10-11   |Reserved
+     * 12-end  |Packet data
+     */
+    struct SegmentRecordHeader {
+        uint16_t magic;
+        uint16_t size;
+        time32_t timestamp;
+        uint16_t checksum;
+        uint16_t reserved;
+    };
+
+    static constexpr uint16_t SEGMENT_RECORD_MAGIC = 0x5053;  // "SP"
+
+    // Maximum number of packets in one SD card sub-folder or segment file
+    static constexpr size_t MAX_PACKETS_PER_FOLDER = SystemConfig::SD_CARD_SUBFOLDER_TIMESPAN / DataPointPacket::MIN_TIMESPAN + 1;
+
+    // Number of bytes preallocated for a segment file
+    static constexpr uint32_t SEGMENT_PREALLOCATE_SIZE =
+        MAX_PACKETS_PER_FOLDER * (sizeof(SegmentRecordHeader) + DataPointPacket::MAX_SIZE_BYTES);
+
+    /**
+     * Sorted timestamps and segment file offsets of the packets in one sub-folder or segment file.
+     *
+     * A folder holds at most MAX_PACKETS_PER_FOLDER packets of the minimal timespan, but shorter packets are pushed
+     * when the format of the data points changes, so a folder may hold more. The index then holds the earliest
+     * MAX_PACKETS_PER_FOLDER packets only and is marked incomplete, and the folder is searched in several passes.
+     */
+    struct FolderIndex {
+        time32_t folderTimestamp = 0;  // 0 if the cache entry is unused
+        uint32_t lastUse = 0;  // value of the use counter when the index was last used
+        bool complete = true;  // false if packets did not fit into the index
+        static_vector<time32_t, MAX_PACKETS_PER_FOLDER> timestamps{};
+        static_vector<uint32_t, MAX_PACKETS_PER_FOLDER> offsets{};
+
+        /**
+         * Insert a packet, keeping the timestamps sorted. The offset of an existing packet with the
+         * same timestamp is replaced. If the index is full, the latest packet is left out and the index
+         * is marked incomplete.
+         * @return false if a packet was left out
+         */
+        bool insert(time32_t timestamp, uint32_t offset);
+
+        void clear() {
+            timestamps.clear();
+            offsets.clear();
+            complete = true;
+        }
+    };
+
+    /**
+     * Header of a folder index file, which is written when the sub-folder or segment file is closed.
+     * Structure:
+     * Bytes          |Function
+     * ---------------|-------------------
+     * 0-3            |FOLDER_INDEX_MAGIC
+     * 4-5            |Number of packets
+     * 6-7            |Reserved
+     * 8-9            |Checksum of the timestamps
+     * 10-11          |Checksum of the offsets
+     * 12-...         |Timestamps (count * 4 bytes)
+     * ...-end        |Offsets (count * 4 bytes)
+     */
+    struct FolderIndexFileHeader {
+        uint32_t magic;
+        uint16_t count;
+        uint16_t reserved;
+        uint16_t timestampsChecksum;
+        uint16_t offsetsChecksum;
     };
 
+    static constexpr uint32_t FOLDER_INDEX_MAGIC = 0x58444946;  // "FIDX"
+
+    /**
+     * Entry of the sequence index file, which maps sequence numbers to packet locations on the SD card.
+     * The entry of a packet is at position (sequence number % SD_CARD_SEQUENCE_INDEX_ENTRIES), so newer packets
+     * replace older ones. The file is preallocated and its unwritten entries contain stale data, which is detected
+     * by the check field.
+     * Structure:
+     * Bytes   |Function
+     * --------|-------------------
+     * 0-3     |Sequence number
+     * 4-7     |Packet timestamp
+     * 8-11    |Offset of the record in the segment file
+     * 12-15   |Sequence number ^ timestamp ^ offset ^ SEQUENCE_INDEX_MAGIC
+     */
+    struct SequenceIndexEntry {
+        uint32_t sequenceNumber;
+        time32_t timestamp;
+        uint32_t offset;
+        uint32_t check;
+
+        uint32_t computeCheck() const { return sequenceNumber ^ timestamp ^ offset ^ SEQUENCE_INDEX_MAGIC; }
+    };
+
+    static constexpr uint32_t SEQUENCE_INDEX_MAGIC = 0x51585349;  // "ISXQ"
+
     /**
      * Retrieves a Data Point Packet (as raw byte data) from storage
      * @tparam Container type of the output container with values of type (uint8_t), should support std::back_insert_iterator<>
@@ -87,16 +217,24 @@ public:
     template<class Container>
     bool getPacket(const PacketDescriptor& d, std::back_insert_iterator<Container> outputIt);
 
+    /**
+     * Get the size of a Data Point Packet in storage without reading its data
+     * @param d Packet descriptor
+     * @param size Output size
+     * @return true on success, false on failure
+     */
+    bool getPacketSize(const PacketDescriptor& d, uint16_t* size);
+
 private:
     /**
-     * Initialize SD card by trying to establish SPI connection and building sub-folder index.
+     * Initialize SD card by trying to establish SPI connection and creating the board-specific directory.
      * @return true on success, false on failure
      */
     bool initSDCardStorage();
 
     /**
-     * Initialize the flash storage by creating the index of currently stored packets
-     * @return
+     * Initialize the flash storage by opening the flash packet log
+     * @return true on success, false on failure
      */
     bool initFlashStorage();
 
@@ -107,6 +245,134 @@ private:
      */
     bool savePacketToSD(const Packet& packet);
 
+    /**
+     * Make folderDir the handle of the given folder, creating the folder if it does not exist.
+     * The handle stays open until a packet is saved to another folder. Storage mutex must be locked.
+     * @param folderTimestamp Timestamp identifying the folder
+     * @param path Absolute path of the folder
+     * @return true on success, false on failure
+     */
+    bool openFolderDir(time32_t folderTimestamp, const char* path);
+
+    /**
+     * Append a packet to the segment file of its sub-folder period, rolling over to a new segment file
+     * if necessary. Storage mutex must be locked.
+     * @param packet The packet to be saved, must be a Data Point Packet
+     * @param migrated true for a packet migrated from a former layout, see updateSequenceIndex()
+     * @return true on success, false on failure
+     */
+    bool appendPacketToSegment(const Packet& packet, bool migrated = false);
+
+    /**
+     * Open (or create and preallocate) the segment file of a sub-folder period for appending. A segment file that
+     * was closed before is extended to its preallocated size again.
+     * Storage mutex must be locked.
+     * @param subFolderTimestamp Sub-folder timestamp
+     * @return true on success, false on failure
+     */
+    bool openSegment(time32_t subFolderTimestamp);
+
+    /**
+     * Flush the record buffer, release the unused preallocated space and close the current segment file.
+     * Storage mutex must be locked.
+     * @return true on success, false on failure
+     */
+    bool closeSegment();
+
+    /**
+     * Read the valid records of a segment file into the index of its sub-folder period and position the file after
+     * the last one. Storage mutex must be locked.
+     * @param file Segment file, positioned at its start
+     * @param subFolderTimestamp Sub-folder timestamp of the segment file
+     * @param index Folder index of the segment file, cleared by the caller
+     * @return true on success, false on failure
+     */
+    bool scanSegment(File32& file, time32_t subFolderTimestamp, FolderIndex& index);
+
+    /**
+     * Append a packet migrated from a former layout to the segment file of its sub-folder period and sync it.
+     * Only the packets of the period of the current segment file are written through it, the others are appended
+     * to migrationSegmentFile, so that the current segment file keeps its preallocated space. A packet that is
+     * already in the segment file, as a reset interrupted its migration, is not appended again.
+     * Storage mutex must be locked.
+     * @param packet The packet to be saved, must be a Data Point Packet
+     * @return true on success, false on failure
+     */
+    bool appendMigratedPacket(const Packet& packet);
+
+    /**
+     * Open (or create) the segment file of a past sub-folder period as migrationSegmentFile, without preallocating
+     * it. Storage mutex must be locked.
+     * @param subFolderTimestamp Sub-folder timestamp
+     * @return true on success, false on failure
+     */
+    bool openMigrationSegment(time32_t subFolderTimestamp);
+
+    /**
+     * Close migrationSegmentFile, if it is open, and write its folder index file. Storage mutex must be locked.
+     * @return true on success, false on failure
+     */
+    bool closeMigrationSegment();
+
+    /**
+     * Produce the path of the file that marks the migration to the current layout as finished.
+     */
+    void makeMigrationMarkerPath(char* path, size_t size) const;
+
+    /**
+     * Migrate up to SD_CARD_MIGRATION_BATCH packet files of the former SD card layouts, oldest folder first:
+     * - /<device id>/<folder timestamp>/<timestamp>.pkt, with folders that were created when the previous one was
+     *   too old, so they are not aligned to SD_CARD_PARENT_FOLDER_TIMESPAN,
+     * - /<device id>/<parent folder timestamp>/<sub-folder timestamp>/<timestamp>.pkt if segment files are used.
+     * The packets are saved in the current layout and the files and empty folders are removed afterwards, so that
+     * an interrupted migration is continued. Folders are visited in ascending order after the last migrated one.
+     * Once no packet files are left, sdMigrationPending is cleared and the migration marker file is written, so that
+     * the card is not scanned again after a reset.
+     * @return true on success, false on SD card error
+     */
+    bool migrateLegacySDStep();
+
+    /**
+     * Migrate the packet files directly inside a folder, up to the remaining budget. Storage mutex must be locked.
+     * @param path Absolute path of the folder
+     * @param budget Number of packet files that may still be migrated, decremented for every migrated file
+     * @param done Set to true if no packet files are left in the folder
+     * @return true on success, false on SD card error
+     */
+    bool migratePacketFiles(const char* path, uint8_t* budget, bool* done);
+
+    /**
+     * Save the packet of a packet file of a former layout in the current layout and remove the file. A file that
+     * does not hold a valid packet is renamed to <timestamp>.bad. Storage mutex must be locked.
+     * @param path Absolute path of the packet file
+     * @param timestamp Packet timestamp, as in the file name
+     * @return true on success, false on SD card error
+     */
+    bool migratePacketFile(const char* path, time32_t timestamp);
+
+    /**
+     * Remove a folder of a former layout whose packet files have been migrated, with its stale folder index file.
+     * A folder that still holds other files is kept. Storage mutex must be locked.
+     */
+    void removeMigratedFolder(const char* path);
+
+    /**
+     * Read the record at the current position of a segment file and validate it.
+     * The preallocated tail of a segment file contains stale data, so the records end at the first invalid one.
+     * @param file Segment file
+     * @param subFolderTimestamp Sub-folder timestamp of the segment file
+     * @param header Output header
+     * @param buf Output buffer, must hold DataPointPacket::MAX_SIZE_BYTES, or nullptr to read and validate the
+     *            header only
+     * @return true if a valid record was read, false at the end of the records
+     */
+    static bool readSegmentRecord(File32& file, time32_t subFolderTimestamp, SegmentRecordHeader* header, uint8_t* buf);
+
+    /**
+     * Produce the path of the segment file of a sub-folder period.
+     */
+    void makeSegmentPath(time32_t subFolderTimestamp, char* path, size_t size) const;
+
     /**
      * Attempt to save a packet to the flash
      * @param packet The packet to be saved, must be a Data Point Packet
@@ -115,32 +381,124 @@ private:
     bool savePacketToFlash(const Packet& packet);
 
     /**
-     * Search for packets on the SD card
+     * Get the index of packets of one sub-folder or segment file from the cache. On a cache miss, the least
+     * recently used index is replaced by one loaded from the folder index file or built by scanning the folder.
+     * Storage mutex must be locked.
+     * @param folderTimestamp Sub-folder timestamp
+     * @return The index, or nullptr on SD card error
+     */
+    FolderIndex* getFolderIndex(time32_t folderTimestamp);
+
+    /**
+     * Take the cache entry of a folder, or the least recently used one, and mark it as used.
+     * The content of a reused entry is cleared.
+     */
+    FolderIndex& allocateFolderIndex(time32_t folderTimestamp);
+
+    /**
+     * Add a saved packet to the cached index of its folder, if there is one.
+     */
+    void updateFolderIndex(time32_t folderTimestamp, time32_t packetTimestamp, uint32_t offset);
+
+    /**
+     * Build the index of packets of one sub-folder or segment file by scanning it.
+     * The index is empty if the sub-folder does not exist. Storage mutex must be locked.
+     * @param index Output index, folderTimestamp must be set
+     * @param after Only packets with later timestamps are indexed, to continue the search in a folder whose index
+     * is incomplete
+     * @return true on success, false on SD card error
+     */
+    bool buildFolderIndex(FolderIndex& index, time32_t after = 0);
+
+    /**
+     * Load the index of packets of one sub-folder or segment file from its folder index file.
+     * @param index Output index, folderTimestamp must be set
+     * @return true if a valid index file was loaded
+     */
+    bool loadFolderIndexFile(FolderIndex& index);
+
+    /**
+     * Write the folder index file of a sub-folder or segment file, which is no longer written to.
+     * Storage mutex must be locked.
+     * @return true on success, false on failure
+     */
+    bool writeFolderIndexFile(time32_t folderTimestamp);
+
+    /**
+     * Remove the folder index file of a sub-folder or segment file that is written to again, as it would be outdated.
+     */
+    void removeFolderIndexFile(time32_t folderTimestamp);
+
+    /**
+     * Produce the path of the folder index file: <sub-folder>.idx for segment files, <sub-folder>/index.bin otherwise.
+     */
+    void makeFolderIndexPath(time32_t folderTimestamp, char* path, size_t size) const;
+
+    /**
+     * Open the sequence index file, creating and preallocating it if it does not exist. Storage mutex must be locked.
+     * @return true on success, false on failure
+     */
+    bool openSequenceIndex();
+
+    /**
+     * Record the location of a saved packet in the sequence index. Packets without a sequence number are ignored.
+     * Storage mutex must be locked.
+     * @param packet The saved packet, must be a Data Point Packet
+     * @param offset Offset of the record in the segment file, 0 if segment files are not used
+     * @param migrated true if the packet has been migrated from a former layout. Only the entry of the packet itself
+     * is updated then, as the entry may have been reused by a newer packet.
+     * @return true on success, false on failure
+     */
+    bool updateSequenceIndex(const Packet& packet, uint32_t offset, bool migrated = false);
+
+    /**
+     * Look up a sequence number in the sequence index. Storage mutex must be locked.
+     * @param sequenceNumber Sequence number
+     * @param d Output descriptor of the packet
+     * @param found Set to true if the sequence index has a valid entry for the sequence number
+     * @return true on success, false on SD card error
+     */
+    bool readSequenceIndex(uint32_t sequenceNumber, PacketDescriptor* d, bool* found);
+
+    /**
+     * Read a packet from the SD card. Storage mutex must be locked.
+     * @param d Packet descriptor
+     * @param buf Output buffer, must hold DataPointPacket::MAX_SIZE_BYTES, or nullptr to read the size only
+     * @param size Size of the packet
+     * @return true on success, false on failure
+     */
+    bool readPacketFromSD(const PacketDescriptor& d, uint8_t* buf, uint16_t* size);
+
+    /**
+     * Search for packets on the SD card. Folders and intervals are visited in a single sweep, so every sub-folder
+     * covered by the intervals is opened once and only with the intervals that overlap it.
      *
      * @tparam Container Output container with values of type PacketDescriptor, should support std::back_insert_iterator
      * @tparam s_intervals Max size of the intervals static vector
-     * @param intervals Static vector containing the time intervals in which to search packets
+     * @param intervals Static vector containing the time intervals in which to search packets, sorted and not overlapping
      * @param outputIt std::back_insert_iterator of the output container
      * @return True on success, false on failure
      */
     template<class Container, size_t s_intervals>
-    bool findPacketsOnSDCard(static_vector<interval_t, s_intervals> intervals, 
-                             std::back_insert_iterator<Container> outputIt) const;
+    bool findPacketsOnSDCard(const static_vector<interval_t, s_intervals>& intervals,
+                             std::back_insert_iterator<Container> outputIt);
 
     /**
-     * Search for packets in a specific folder on the SD card
+     * Search for packets in a specific folder on the SD card. A folder that does not exist contains no packets.
+     * If the index of the folder is incomplete, the folder is indexed and searched again from the last indexed
+     * packet on, until all packets have been searched.
      *
      * @tparam Container Output container with values of type PacketDescriptor, should support std::back_insert_iterator
-     * @tparam s_intervals Max size of the intervals static vector
+     * @tparam It Interval iterator
      * @param folderTimestamp Timestamp of the folder in which to perform the search
-     * @param intervals Static vector containing the time intervals in which to search packets
+     * @param intervalsBegin Begin of the time intervals in which to search packets, sorted and not overlapping
+     * @param intervalsEnd End of the time intervals
      * @param outputIt std::back_insert_iterator of the output container
      * @return True on success, false on failure
      */
-    template<class Container, size_t s_intervals>
-    bool findPacketsInFolder(time32_t folderTimestamp, 
-                                const static_vector<interval_t, s_intervals> &intervals, 
-                                std::back_insert_iterator<Container> outputIt) const;
+    template<class Container, class It>
+    bool findPacketsInFolder(time32_t folderTimestamp, It intervalsBegin, It intervalsEnd,
+                             std::back_insert_iterator<Container> outputIt);
 
     /**
      * Search for packets in the flash
@@ -149,9 +507,33 @@ private:
      * @param interval Time interval in which to search the packet
      * @param outputIt std::back_insert_iterator of the output container
      * @return Does not return bool because the search is performed in the index vector, no file system operations.
+     * Locks the storage mutex, as the storage thread appends to the index concurrently.
      */
     template<class Container>
-    void findPacketsInFlash(interval_t interval, std::back_insert_iterator<Container> outputIt);
+    void findPacketsInFlash(const interval_t& interval, std::back_insert_iterator<Container> outputIt);
+
+    /**
+     * Get the timestamp of the SD card sub-folder in which a packet is stored. Sub-folders are aligned to
+     * multiples of SD_CARD_SUBFOLDER_TIMESPAN, so the location of a packet only depends on its timestamp.
+     * @param packetTimestamp Packet timestamp
+     * @return Sub-folder timestamp
+     */
+    static time32_t getSubFolderTimestamp(time32_t packetTimestamp);
+
+    /**
+     * Get the timestamp of the parent folder which contains a sub-folder.
+     * @param subFolderTimestamp Sub-folder timestamp
+     * @return Parent folder timestamp
+     */
+    static time32_t getParentFolderTimestamp(time32_t subFolderTimestamp);
+
+    /**
+     * Produce the path of a sub-folder: /<device id>/<parent folder timestamp>/<sub-folder timestamp>
+     * @param subFolderTimestamp Sub-folder timestamp
+     * @param path Output buffer
+     * @param size Size of the output buffer
+     */
+    void makeSubFolderPath(time32_t subFolderTimestamp, char* path, size_t size) const;
 
     /**
      * Returns true if the packet name follows the naming convention <UNIX timestamp>.pkt
@@ -160,15 +542,16 @@ private:
 
     /**
      * Given a sorted container of timestamps, find timestamps that lie within the specified time interval.
+     * Uses binary search, so the cost is logarithmic in the size of the container.
      * @tparam It Timestamp iterator
      * @param interval Interval in which to search timestamps (begin and end exclusive)
      * @param begin Begin of the timestamps container
      * @param end End of the timestamps container
      * @return Iterators of the original container pointing to the begin (incl) and end (excl) of the found range.
-     * Begin iterator is set to the "end" parameter if nothing was found.
+     * The range is empty if nothing was found.
      */
     template<class It>
-    std::pair<It, It> findInterval(const interval_t& interval, It begin, It end) const;
+    static std::pair<It, It> findInterval(const interval_t& interval, It begin, It end);
 
     /**
      * Run function of the Packet Storage Manager Thread. Receives packets from the Packet Storage Queue
@@ -177,10 +560,32 @@ private:
     [[noreturn]] void run();
     os_mutex_t storageMutex{};
 
-    static_vector<time32_t, 2048> flashPacketTimestampsIndex{};  // timestamps of all packets in the flash
+    FlashPacketLog flashLog{};
+
+    // least recently used cache of folder indexes, so that repeated handshakes don't rescan the SD card
+    std::array<FolderIndex, SystemConfig::SD_CARD_FOLDER_INDEX_CACHE_SIZE> folderIndexCache{};
+    uint32_t folderIndexUseCounter = 0;
+
+    // folder in which packets are currently saved: the sub-folder, or the parent folder if segment files are used
+    File32 folderDir;
+    time32_t folderDirTimestamp = 0;
+    LatencyHistogram saveLatency{"SD save"};
 
-    static_vector<time32_t, 1024> subFolderTimestampsIndex{}; // timestamps of sub-folders on the sd card
-    // both index vectors are kept sorted to simplify search
+    // segment file to which packets are currently appended
+    File32 segmentFile;
+    RingBuf<File32, SystemConfig::SD_CARD_SEGMENT_BUFFER_SIZE> segmentBuffer;
+    time32_t segmentTimestamp = 0;  // sub-folder timestamp of the open segment file, 0 if none
+    uint16_t unsyncedRecords = 0;
+
+    // sequence index file, open while the SD card is active
+    File32 sequenceIndexFile;
+    uint16_t unsyncedSequenceEntries = 0;
+
+    // migration of the packet files of the former SD card layouts, see migrateLegacySDStep()
+    bool sdMigrationPending = false;
+    time32_t migrationCursor = 0;  // timestamp of the last folder that has been migrated completely
+    File32 migrationSegmentFile;  // segment file of a past period to which packets are migrated
+    time32_t migrationSegmentTimestamp = 0;  // sub-folder timestamp of migrationSegmentFile, 0 if it is closed
 
     SdFat32 sd;
 
@@ -206,30 +611,36 @@ bool PacketStorageManager::findPackets(static_vector<interval_t, s_intervals> &i
         Serial.printf("[%d, %d]\n", intv.first, intv.second);
     }
     Serial.printf("Output max size: %d, SD active: %d, flash active: %d\n", output.max_size(), 1, sysstate.flashActive);
+    std::sort(intervals.begin(), intervals.end(), [](const interval_t& lhs, const interval_t& rhs) {
+        return lhs.first < rhs.first;
+    });
     bool s = findPacketsOnSDCard(intervals, std::back_inserter(output));
     if(!s) {
         return false;
     }
-    if(flashPacketTimestampsIndex.empty() || !sysstate.flashActive) {
+    // the storage thread appends to the flash packet log concurrently
+    os_mutex_lock(storageMutex);
+    const bool flashEmpty = flashLog.empty();
+    const time32_t flashEarliestTimestamp = flashLog.getEarliestTimestamp();
+    os_mutex_unlock(storageMutex);
+    if(flashEmpty || !sysstate.flashActive) {
         // can't search in flash, so we're done
         return true;
     }
-    // sort the output vector and the intervals
+    // sort the output vector, the intervals have been sorted before the SD card search
     std::sort(output.begin(), output.end(), [](const PacketDescriptor& lhs, const PacketDescriptor& rhs){
         return lhs.packetTimestamp < rhs.packetTimestamp;
     });
 
-    std::sort(intervals.begin(), intervals.end(), [](const interval_t& lhs, const interval_t& rhs) {
-        return lhs.first < rhs.first;
-    });
-
     // look for missing data in the flash
-    const time32_t gapTreshold = 12; //DataPointPacket::TIMESPAN * 3/2;
+    // the packets may have been recorded with another averaging window, but the current one is the best guess
+    const time32_t gapTreshold = DataPointPacket::getMaxTimespan(sysstate.averagingWindow *
+                                                                 SystemConfig::SPS30_MEASUREMENT_PERIOD) * 3 / 2;
     auto pktIt = output.begin();
     auto intervalIt = intervals.begin();
     if(!output.empty()) {
         for(; intervalIt < intervals.end(); ++intervalIt) {
-            if(intervalIt->second < flashPacketTimestampsIndex[0]) {
+            if(intervalIt->second < flashEarliestTimestamp) {
                 // the entire interval precedes the earliest packet in the flash, so even if
                 // sth is missing, we have nothing in the flash for that period
                 continue;
@@ -302,134 +713,181 @@ bool PacketStorageManager::findPackets(static_vector<interval_t, s_intervals> &i
     return true;
 }
 
-template<class Container, size_t s_intervals>
-bool PacketStorageManager::findPacketsOnSDCard(static_vector<interval_t, s_intervals> intervals, 
-                                          std::back_insert_iterator<Container> outputIt) const {
-    static_vector<interval_t, s_intervals> relevantIntervals{}; // intervals which may include the PREVIOUS subfolder
-    for(size_t i = 1; i < subFolderTimestampsIndex.size(); ++i) {
-        relevantIntervals.clear();
-        const time32_t currentFolder = subFolderTimestampsIndex[i];
-        const time32_t previousFolder = subFolderTimestampsIndex[i-1];
-
-        // iterate over intervals and find intervals relevant for the current sub folder
-        // since the subFolderTimestampsVector is guaranteed to be sorted, if we reach
-        // the end of an interval, we can just remove it from the intervals vector, so that
-        // we don't check against it again. To enable removing elements while iterating
-        // over a vector, we increment the iterator manually.
-
-        auto intervalIt = intervals.begin();
-        while(intervalIt < intervals.end()) {
-            if(intervalIt->first < currentFolder) {
-                // the CURRENT sub folder's timestamp is within the interval, so we say
-                // that the interval is relevant for the PREVIOUS subfolder (because the previous 
-                // folder might, too, contain packets within the interval)
-                relevantIntervals.push_back(*intervalIt);
-
-                if(intervalIt->second < currentFolder) {
-                    // the current folder's timestamp is after the current interval, so the
-                    // interval is no longer relevant, and we remove it.
-                    intervalIt = intervals.erase(intervalIt);
-                    continue;
+template<class Container, size_t s_ranges>
+bool PacketStorageManager::findPacketsBySequence(const static_vector<sequence_range_t, s_ranges>& ranges,
+                                                 Container& output)
+{
+    for(const auto& [first, last] : ranges) {
+        if(last < first) {
+            continue;  // empty range
+        }
+        // the sequence index only holds the most recent SD_CARD_SEQUENCE_INDEX_ENTRIES packets
+        uint32_t indexFirst = std::max(first, last - std::min(last, SystemConfig::SD_CARD_SEQUENCE_INDEX_ENTRIES - 1));
+        uint32_t foundOnSD = 0;
+        uint32_t sequenceNumber = indexFirst;
+        bool done = !sysstate.sdActive;
+        while(!done && output.size() < output.max_size()) {
+            // the mutex is released between chunks, so that the storage thread is not blocked by a long lookup. An
+            // index entry overwritten in the meantime is not found, and the packet is looked for in the flash.
+            os_mutex_lock(storageMutex);
+            if(!sequenceIndexFile.isOpen()) {
+                os_mutex_unlock(storageMutex);
+                break;
+            }
+            for(uint16_t i = 0; i < SystemConfig::SD_CARD_SEQUENCE_LOOKUP_CHUNK && output.size() < output.max_size();
+                ++i) {
+                PacketDescriptor d;
+                bool found;
+                SD_TRY(readSequenceIndex(sequenceNumber, &d, &found));
+                if(found) {
+                    output.push_back(d);
+                    ++foundOnSD;
+                }
+                if(sequenceNumber == last) {
+                    done = true;
+                    break;
                 }
+                ++sequenceNumber;
             }
-            ++intervalIt;
+            os_mutex_unlock(storageMutex);
         }
-
-        // find packets in the previous folder which lie in the relevant intervals, inserting
-        // them into the result vector.
-
-        if(!relevantIntervals.empty()) Log.info("Relevant intervals for %d:", previousFolder);
-        for(auto& i : relevantIntervals) {
-            Log.info("[%d; %d]", i.first, i.second);
+        if(foundOnSD == last - first + 1 || output.size() == output.max_size() || !sysstate.flashActive) {
+            continue;
         }
 
-        if(!relevantIntervals.empty()) {
-            bool sdOk = findPacketsInFolder(previousFolder, relevantIntervals, outputIt);
-            if(!sdOk) return false;
-            if(i == subFolderTimestampsIndex.size() - 1) {
-                // current folder is the last one, so we process it as well
-                // since the relevant intervals have been calculated for the previous folder,
-                // and are not necessarily exhaustive for the current folder, we pass the entire
-                // intervals vector
-                sdOk = findPacketsInFolder(currentFolder, intervals, outputIt);
-                if(!sdOk) return false;
-            }
+        // look for the missing packets in the flash. The positions are relative to the oldest record, so the
+        // mutex is held until they are resolved, as an appended packet may evict the oldest one.
+        uint16_t flashBegin, flashEnd;
+        os_mutex_lock(storageMutex);
+        if(flashLog.empty()) {
+            os_mutex_unlock(storageMutex);
+            continue;
         }
-        if(intervals.empty()) {
-            break;  // all intervals covered
+        if(!flashLog.findSequenceRange(first, last, &flashBegin, &flashEnd)) FLASH_ERROR();
+        auto rangeBegin = output.end() - foundOnSD;
+        for(uint16_t position = flashBegin; position < flashEnd && output.size() < output.max_size(); ++position) {
+            time32_t timestamp = flashLog.getTimestampAt(position);
+            bool onSD = std::any_of(rangeBegin, output.end(), [timestamp](const PacketDescriptor& d) {
+                return d.packetTimestamp == timestamp;
+            });
+            if(!onSD) {
+                output.push_back(PacketDescriptor{.location = PacketDescriptor::FLASH_LOCATION,
+                                                  .packetTimestamp = timestamp, .offset = 0});
+            }
         }
+        os_mutex_unlock(storageMutex);
     }
     return true;
 }
 
 template<class Container, size_t s_intervals>
-bool PacketStorageManager::findPacketsInFolder(time32_t folderTimestamp, 
-                                                  const static_vector<interval_t, s_intervals>& intervals, 
-                                                  std::back_insert_iterator<Container> outputIt) const {
-    os_mutex_lock(storageMutex);
-    File32 dir;
-    File32 file;
-    // First, create an index of packet timestamps in the folder, so that we don't need to iterate over it for each intervals
-    char subfolderPath[64];
-    std::snprintf(subfolderPath, sizeof(subfolderPath), "/%s/%d", sysconfig.deviceId.c_str(), folderTimestamp);
-    SD_TRY(dir.open(subfolderPath));
-    static_vector<time32_t, SystemConfig::SD_CARD_SUBFOLDER_TIMESPAN / DataPointPacket::TIMESPAN + 1> packetTimestamps;
-    file = dir.openNextFile(O_RDONLY);
-    while(file) { // todo: unhandled exception
-        char nameChar[64];
-        size_t nameSize = file.getName(nameChar, 64);
-        f_string name(nameChar, nameSize);
-        if(checkPacketName(name)) {
-            time32_t timestamp = std::atoi(name.c_str());
-            if(timestamp != 0) {
-                packetTimestamps.push_back(timestamp);
-            } else {
-                Log.warn("Found .pkt file with invalid filename: /%s/%d/%s", 
-                         sysconfig.deviceId.c_str(), folderTimestamp, name.c_str());
+bool PacketStorageManager::findPacketsOnSDCard(const static_vector<interval_t, s_intervals>& intervals,
+                                               std::back_insert_iterator<Container> outputIt) {
+    // intervals overlapping the current folder are [relevantBegin, relevantEnd); both only move forward
+    auto relevantBegin = intervals.begin();
+    auto relevantEnd = intervals.begin();
+    time32_t nextFolder = 0;  // folders before this one have already been searched
+    time32_t parentFolder = 0;  // parent folder of the last folder
+    bool parentFolderExists = false;
+    for(const auto& interval : intervals) {
+        // begin and end of the interval are exclusive
+        if(interval.second - interval.first < 2) {
+            continue;  // empty interval
+        }
+        time32_t firstFolder = getSubFolderTimestamp(interval.first + 1);
+        time32_t endFolder = getSubFolderTimestamp(interval.second - 1);
+
+        for(time32_t folder = std::max(firstFolder, nextFolder); folder <= endFolder;
+            folder += sysconfig.SD_CARD_SUBFOLDER_TIMESPAN) {
+            if(getParentFolderTimestamp(folder) != parentFolder) {
+                parentFolder = getParentFolderTimestamp(folder);
+                char parentFolderPath[64];
+                std::snprintf(parentFolderPath, sizeof(parentFolderPath), "/%s/%d", sysconfig.deviceId.c_str(),
+                              parentFolder);
+                os_mutex_lock(storageMutex);
+                parentFolderExists = sd.exists(parentFolderPath);
+                os_mutex_unlock(storageMutex);
+            }
+            if(!parentFolderExists) {
+                // skip all sub-folders of the missing parent folder
+                folder = parentFolder + sysconfig.SD_CARD_PARENT_FOLDER_TIMESPAN - sysconfig.SD_CARD_SUBFOLDER_TIMESPAN;
+                nextFolder = folder + sysconfig.SD_CARD_SUBFOLDER_TIMESPAN;
                 continue;
             }
-        }
 
-        file=dir.openNextFile(O_RDONLY);
+            const time32_t folderEnd = folder + sysconfig.SD_CARD_SUBFOLDER_TIMESPAN;
+            while(relevantBegin != intervals.end() && relevantBegin->second <= folder) {
+                ++relevantBegin;  // interval ends before this folder
+            }
+            relevantEnd = std::max(relevantEnd, relevantBegin);
+            while(relevantEnd != intervals.end() && relevantEnd->first < folderEnd) {
+                ++relevantEnd;  // interval starts inside or before this folder
+            }
+            bool sdOk = findPacketsInFolder(folder, relevantBegin, relevantEnd, outputIt);
+            if(!sdOk) return false;
+            nextFolder = folderEnd;
+        }
     }
-    SD_TRY(dir.close());
-    SD_TRY(file.close());
-    std::sort(packetTimestamps.begin(), packetTimestamps.end());
-    
-    // Then, for each interval, find packets within it.
+    return true;
+}
 
-    for(const auto& interval : intervals) {
-        auto[packetsBegin, packetsEnd] = findInterval(interval, packetTimestamps.begin(), packetTimestamps.end());
-        if(packetsBegin == packetTimestamps.end()) {
-            continue; // not found
+template<class Container, class It>
+bool PacketStorageManager::findPacketsInFolder(time32_t folderTimestamp, It intervalsBegin, It intervalsEnd,
+                                               std::back_insert_iterator<Container> outputIt) {
+    os_mutex_lock(storageMutex);
+    // First, get the index of packets in the folder, so that we don't need to iterate over it for each interval
+    FolderIndex* index = getFolderIndex(folderTimestamp);
+    SD_TRY(index != nullptr);
+
+    // Then, for each interval, find packets within it. Intervals are sorted, so each search starts where
+    // the previous one ended.
+    bool partial = false;  // the index holds a later part of the folder
+    while(true) {
+        auto searchBegin = index->timestamps.begin();
+        for(auto interval = intervalsBegin; interval != intervalsEnd; ++interval) {
+            auto[packetsBegin, packetsEnd] = findInterval(*interval, searchBegin, index->timestamps.end());
+            for(auto it = packetsBegin; it < packetsEnd; ++it) {
+                outputIt = PacketDescriptor{.location = folderTimestamp, .packetTimestamp = *it,
+                                            .offset = index->offsets[it - index->timestamps.begin()]};
+            }
+            searchBegin = packetsEnd;
         }
-
-        for(auto it = packetsBegin; it < packetsEnd; ++it) {
-            outputIt = PacketDescriptor{.location = folderTimestamp, .packetTimestamp = *it};
+        if(index->complete) {
+            break;
+        }
+        // The index misses the packets after its last one, they are indexed in the next pass. The cached
+        // index is replaced by that part of the folder, so it is released afterwards.
+        partial = true;
+        if(!buildFolderIndex(*index, index->timestamps.back())) {
+            index->folderTimestamp = 0;
+            SD_TRY(false);
         }
     }
-    
+    if(partial) {
+        index->folderTimestamp = 0;
+    }
+
     os_mutex_unlock(storageMutex);
     return true;
 }
 
 template<class Container>
-void PacketStorageManager::findPacketsInFlash(interval_t interval, std::back_insert_iterator<Container> outputIt) {
+void PacketStorageManager::findPacketsInFlash(const interval_t& interval, std::back_insert_iterator<Container> outputIt) {
     Log.info("Find packets in flash called, %d", System.freeMemory());
-    auto[packetsBegin, packetsEnd] = findInterval(interval, flashPacketTimestampsIndex.begin(), flashPacketTimestampsIndex.end());
-    for(auto it = packetsBegin; it < packetsEnd; ++it) {
-        outputIt = PacketDescriptor{.location=PacketDescriptor::FLASH_LOCATION, .packetTimestamp=*it};
+    os_mutex_lock(storageMutex);
+    for(const auto& [indexBegin, indexEnd] : flashLog.getIndexRanges()) {
+        auto[packetsBegin, packetsEnd] = findInterval(interval, indexBegin, indexEnd);
+        for(auto it = packetsBegin; it < packetsEnd; ++it) {
+            outputIt = PacketDescriptor{.location=PacketDescriptor::FLASH_LOCATION, .packetTimestamp=*it, .offset=0};
+        }
     }
+    os_mutex_unlock(storageMutex);
 }
 
 template<class It>
-std::pair<It, It> PacketStorageManager::findInterval(const interval_t& interval, It begin, It end) const {
-    auto relevantPacketsBegin = std::find_if(begin, end, [interval](time32_t t) {
-        return interval.first < t;  // first packet inside the interval
-    });
-    auto relevantPacketsEnd = std::find_if(begin, end, [interval](time32_t t) {
-        return interval.second <= t;
-    });
+std::pair<It, It> PacketStorageManager::findInterval(const interval_t& interval, It begin, It end) {
+    auto relevantPacketsBegin = std::upper_bound(begin, end, interval.first);  // first packet inside the interval
+    auto relevantPacketsEnd = std::lower_bound(relevantPacketsBegin, end, interval.second);
     return {relevantPacketsBegin, relevantPacketsEnd};
 }
 
@@ -438,14 +896,11 @@ bool PacketStorageManager::getPacket(const PacketDescriptor& d, std::back_insert
     os_mutex_lock(storageMutex);
     if(d.location == PacketDescriptor::FLASH_LOCATION) {
         // Packet in flash
-        char path[64];
-        std::snprintf(path, sizeof(path), "/Packets/ %d.pkt", d.packetTimestamp);  // todo: is this right?
-        int f = open(path, O_RDONLY);
-        uint8_t buf[1024];
-        int size = read(f, buf, sizeof(buf));
-        close(f);
+        uint8_t buf[FlashPacketLog::MAX_RECORD_DATA_SIZE];
+        uint16_t size;
+        bool s = flashLog.read(d.packetTimestamp, buf, &size);
         os_mutex_unlock(storageMutex);
-        if(size > 0) {
+        if(s) {
             std::copy(buf, buf + size, outputIt);
             return true;
         } else {
@@ -453,20 +908,14 @@ bool PacketStorageManager::getPacket(const PacketDescriptor& d, std::back_insert
         }
     } else {
         // Packet on the SD card
-        File32 packetFile;
-        char path[64];
-        std::snprintf(path, sizeof(path), "/%s/%d/%d.pkt", sysconfig.deviceId.c_str(), d.location, d.packetTimestamp);
-        bool s = packetFile.open(path);
+        uint8_t buf[DataPointPacket::MAX_SIZE_BYTES];
+        uint16_t size;
+        bool s = readPacketFromSD(d, buf, &size);
+        os_mutex_unlock(storageMutex);
         if(s) {
-            size_t size = packetFile.fileSize();
-            uint8_t buf[1024];
-            packetFile.read(buf, size);
-            packetFile.close();
-            os_mutex_unlock(storageMutex);
             std::copy(buf, buf + size, outputIt);
             return true;
         } else {
-            os_mutex_unlock(storageMutex);
             return false;
         }
     }
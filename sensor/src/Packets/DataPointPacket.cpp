@@ -1,29 +1,244 @@
 #include "DataPointPacket.h"
 
 constexpr char DataPointPacket::eventName[];
+constexpr char DataPointPacket::statisticsEventName[];
 
 DataPointPacket::DataPointPacket() : Packet(eventName) {}
 
+DataPointPacket::DataPointPacket(Encoding encoding, bool statistics)
+    : Packet(statistics ? statisticsEventName : eventName), encoding(encoding), withStatistics(statistics) {}
+
 DataPointPacket::~DataPointPacket() = default;
 
-bool DataPointPacket::append(DatapointDouble& dpd, time32_t timestamp)
+bool DataPointPacket::append(const DatapointInteger& dpi, time32_t timestamp, const DatapointStatistics* statistics)
 {
-    if (isFull()) return false;
+    assert((statistics != nullptr) == withStatistics);
+    if (!data.empty() && data[6] == UINT8_MAX) {
+        return false;
+    }
+    std::array<uint32_t, 10> values{};
+    for (size_t i = 0; i < values.size(); ++i) {
+        values[i] = std::min(dpi[i], SystemConfig::DATAPOINT_MAX_VALUE);
+    }
+    if (encoding == ENCODING_RESIDUAL_DELTA_VARINT || encoding == ENCODING_RESIDUAL_DELTA_RICE) {
+        // sensor 2 minus sensor 1, as two's complement
+        for (size_t i = SENSOR_VALUES; i < values.size(); ++i) {
+            values[i] -= values[i - SENSOR_VALUES];
+        }
+    }
 
-    const uint8_t* bytesPtr;
-    bytesPtr = reinterpret_cast<const uint8_t*>(&timestamp);
-    data.insert(data.end(), bytesPtr, bytesPtr+sizeof(timestamp));
+    uint8_t buf[MAX_DATA_POINT_SIZE + MAX_STATISTICS_SIZE + 1] = {};
+    std::array<RiceContext, 40> contexts = riceContexts;
+    bool rice = isRiceEncoding();
+    size_t bits = rice ? encodeRice(values, dpi, timestamp, statistics, buf, contexts)
+                       : encodeVarint(values, dpi, timestamp, statistics, buf);
+    // the Rice codes continue in the last byte, if it is incomplete
+    size_t offset = rice ? bitLength % 8 : 0;
 
-    for (const float valF : dpd) {
-        uint32_t valI = measurementMultiplier * valF + 0.5;
-        bytesPtr = reinterpret_cast<const uint8_t*>(&valI);
-        data.insert(data.end(), bytesPtr, bytesPtr+3);
+    size_t size = data.empty() ? HEADER_SIZE : data.size() - (offset > 0);
+    // keep a byte for the padding
+    if (size + (bits + 7) / 8 + 1 > FULL_SIZE_BYTES) {
+        return false;
     }
+
+    if (data.empty()) {
+        const auto* bytesPtr = reinterpret_cast<const uint8_t*>(&timestamp);
+        data.insert(data.end(), bytesPtr, bytesPtr + sizeof(timestamp));
+        data.push_back(encoding | (withStatistics ? ENCODING_STATISTICS_FLAG : 0));
+        data.push_back(getHeaderPeriod());
+        data.push_back(0);
+        data.insert(data.end(), SEQUENCE_NUMBER_SIZE, 0);
+    }
+    const uint8_t* bytes = buf;
+    const uint8_t* end = buf + (bits + 7) / 8;
+    if (offset > 0) {
+        data.back() |= *bytes++;
+    }
+    data.insert(data.end(), bytes, end);
+    ++data[6];
+    previousValues = values;
+    previousTimestamp = timestamp;
+    riceContexts = contexts;
+    bitLength += bits - offset;
     return true;
 }
 
+size_t DataPointPacket::encodeVarint(const std::array<uint32_t, 10>& values, const DatapointInteger& dpi,
+                                     time32_t timestamp, const DatapointStatistics* statistics, uint8_t* buf) const
+{
+    uint8_t* end = buf;
+    bool residual = encoding == ENCODING_RESIDUAL_DELTA_VARINT;
+    if (data.empty()) {
+        // the first data point is stored as it is, residuals may be negative
+        for (size_t i = 0; i < values.size(); ++i) {
+            end = writeVarint(end, residual && i >= SENSOR_VALUES ? zigZag(values[i]) : values[i]);
+        }
+    } else {
+        end = writeVarint(end, zigZag(timestamp - (previousTimestamp + getHeaderPeriod())));
+        for (size_t i = 0; i < values.size(); ++i) {
+            end = writeVarint(end, zigZag(values[i] - previousValues[i]));
+        }
+    }
+    if (statistics) {
+        for (size_t i = 0; i < values.size(); ++i) {
+            // the minimum and maximum are rounded separately, so they may be off by one from the average
+            uint32_t value = std::min(dpi[i], SystemConfig::DATAPOINT_MAX_VALUE);
+            end = writeVarint(end, value - std::min(statistics->minimum[i], value));
+            end = writeVarint(end, std::max(statistics->maximum[i], value) - value);
+            end = writeVarint(end, std::min(statistics->standardDeviation[i], SystemConfig::DATAPOINT_MAX_VALUE));
+        }
+    }
+    return 8 * (end - buf);
+}
+
+namespace {
+
+/**
+ * Writes bits into a zeroed buffer, most significant bit first.
+ */
+struct BitWriter {
+    uint8_t* buf;
+    size_t bits;
+
+    void write(uint32_t value, uint8_t count) {
+        for (; count > 0; --count, ++bits) {
+            if ((value >> (count - 1)) & 1) {
+                buf[bits / 8] |= 0x80 >> (bits % 8);
+            }
+        }
+    }
+};
+
+}  // namespace
+
+size_t DataPointPacket::encodeRice(const std::array<uint32_t, 10>& values, const DatapointInteger& dpi,
+                                   time32_t timestamp, const DatapointStatistics* statistics, uint8_t* buf,
+                                   std::array<RiceContext, 40>& contexts) const
+{
+    BitWriter writer{buf, bitLength % 8};
+    auto writeRice = [&](RiceContext& context, uint32_t value) {
+        uint8_t k = context.parameter();
+        uint32_t quotient = value >> k;
+        if (quotient < RICE_ESCAPE) {
+            writer.write(((1u << quotient) - 1) << 1, quotient + 1);
+            writer.write(value & ((1u << k) - 1), k);
+        } else {
+            writer.write((1u << RICE_ESCAPE) - 1, RICE_ESCAPE);
+            writer.write(value, 32);
+        }
+        context.update(value);
+    };
+
+    bool residual = encoding == ENCODING_RESIDUAL_DELTA_RICE;
+    if (data.empty()) {
+        for (size_t i = 0; i < values.size(); ++i) {
+            writer.write(residual && i >= SENSOR_VALUES ? zigZag(values[i]) : values[i], FIRST_VALUE_BITS);
+        }
+    } else {
+        uint32_t timestampDifference = zigZag(timestamp - (previousTimestamp + getHeaderPeriod()));
+        writer.write(timestampDifference != 0, 1);
+        if (timestampDifference != 0) {
+            writer.write(timestampDifference, 32);
+        }
+        for (size_t i = 0; i < values.size(); ++i) {
+            writeRice(contexts[i], zigZag(values[i] - previousValues[i]));
+        }
+    }
+    if (statistics) {
+        for (size_t i = 0; i < values.size(); ++i) {
+            uint32_t value = std::min(dpi[i], SystemConfig::DATAPOINT_MAX_VALUE);
+            writeRice(contexts[10 + 3 * i], value - std::min(statistics->minimum[i], value));
+            writeRice(contexts[11 + 3 * i], std::max(statistics->maximum[i], value) - value);
+            writeRice(contexts[12 + 3 * i],
+                      std::min(statistics->standardDeviation[i], SystemConfig::DATAPOINT_MAX_VALUE));
+        }
+    }
+    return writer.bits;
+}
+
+uint8_t DataPointPacket::RiceContext::parameter() const
+{
+    uint8_t k = 0;
+    while (k < RICE_MAX_PARAMETER && (static_cast<uint32_t>(count) << k) < sum) {
+        ++k;
+    }
+    return k;
+}
+
+void DataPointPacket::RiceContext::update(uint32_t value)
+{
+    sum += value;
+    if (++count == RICE_RESET) {
+        sum >>= 1;
+        count >>= 1;
+    }
+}
+
+void DataPointPacket::setPeriod(time32_t period)
+{
+    assert(data.empty());
+    this->period = period;
+}
+
 bool DataPointPacket::isFull()
 {
-    return (MAX_SIZE_BYTES - data.size()) < SystemConfig::DATAPOINT_SIZE;
+    if (data.empty()) {
+        return false;
+    }
+    size_t size;
+    if (isRiceEncoding()) {
+        size_t minBits = MIN_RICE_DATA_POINT_BITS + (withStatistics ? MIN_RICE_STATISTICS_BITS : 0);
+        size = HEADER_SIZE + (bitLength + minBits + 7) / 8;
+    } else {
+        size = data.size() + MIN_DATA_POINT_SIZE + (withStatistics ? MIN_STATISTICS_SIZE : 0);
+    }
+    return data[6] == UINT8_MAX || size + 1 > FULL_SIZE_BYTES;
+}
+
+void DataPointPacket::finish(uint32_t sequenceNumber)
+{
+    assert(data.size() >= HEADER_SIZE);
+    std::memcpy(&data[7], &sequenceNumber, SEQUENCE_NUMBER_SIZE);
+    if (data.size() % SystemConfig::DATAPOINT_SIZE == 0) {
+        // would be taken for a packet of the former format
+        data.push_back(0);
+    }
+}
+
+time32_t DataPointPacket::getTimespan() const
+{
+    return data.empty() ? 0 : data[6] * period;
 }
 
+void DataPointPacket::reset()
+{
+    Packet::reset();
+    previousValues = {};
+    previousTimestamp = 0;
+    riceContexts = {};
+    bitLength = 0;
+}
+
+bool DataPointPacket::getSequenceNumber(const uint8_t* data, size_t size, uint32_t* sequenceNumber)
+{
+    if (size % SystemConfig::DATAPOINT_SIZE == 0 || size < HEADER_SIZE) {
+        return false;  // former format without sequence number
+    }
+    std::memcpy(sequenceNumber, data + 7, SEQUENCE_NUMBER_SIZE);
+    return true;
+}
+
+bool DataPointPacket::isDataPointPacket(const Packet& packet)
+{
+    return !std::strcmp(packet.getEventName(), eventName) || !std::strcmp(packet.getEventName(), statisticsEventName);
+}
+
+uint8_t* DataPointPacket::writeVarint(uint8_t* buf, uint32_t value)
+{
+    while (value >= 0x80) {
+        *buf++ = static_cast<uint8_t>(value) | 0x80;
+        value >>= 7;
+    }
+    *buf++ = static_cast<uint8_t>(value);
+    return buf;
+}
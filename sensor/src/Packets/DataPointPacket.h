@@ -9,53 +9,261 @@
 
 /**
  * Packet used to send data points obtained through regular measurements.
- * 
+ *
+ * Consecutive data points are strongly correlated, so every data point is stored as the difference to the previous
+ * one, encoded as zig-zag varints or as adaptive Rice codes.
+ *
  * Structure:
  * Bytes   |Function
  * --------|-----------
- * 0-n*34  |data points
+ * 0-3     |timestamp of the first data point (base timestamp)
+ * 4       |encoding (one of Encoding), with ENCODING_STATISTICS_FLAG set if the data points carry statistics
+ * 5       |period (s) between consecutive data points, 0 if the period exceeds 255 s
+ * 6       |number of data points
+ * 7-10    |sequence number
+ * 11-end  |data points, optionally followed by a padding byte
+ *
+ * Data point structure (all fields are varints):
+ * Field     | Function
+ * ----------|--------------------------
+ * timestamp | zig-zag difference between the timestamp and (previous timestamp + period in the header), usually 0
+ * values    | 10 values as 24-bit fixed-point integers; the first data point stores them as they are, the others
+ *           | store the zig-zag difference to the previous data point
+ * statistics| only with ENCODING_STATISTICS_FLAG: for each of the 10 values, the difference between the value and
+ *           | the minimum, the difference between the maximum and the value, and the standard deviation of the
+ *           | averaged measurements, all in the fixed-point representation
+ *
+ * With ENCODING_RESIDUAL_DELTA_VARINT, values 5-9 (sensor 2) are replaced by their differences to values 0-4
+ * (sensor 1) of the same size bins before the encoding, and the first data point stores them as zig-zag varints.
+ * The sensors sit side by side, so the residuals are small, and they are the signal filtered out by the magnetic
+ * filter of sensor 2.
+ *
+ * ENCODING_DELTA_RICE and ENCODING_RESIDUAL_DELTA_RICE store the same fields as a bit stream, most significant bit
+ * first, which ends with the packet or its padding byte:
+ * - The values of the first data point take FIRST_VALUE_BITS each, residuals as zig-zag integers.
+ * - The timestamp difference is a 0 bit, or a 1 bit followed by the 32-bit zig-zag difference.
+ * - The value differences (zig-zag) and the statistics are Rice codes: for the parameter k, the quotient
+ *   value >> k in unary (ones ended by a zero) and the k low bits of the value. A quotient of RICE_ESCAPE or more is
+ *   written as RICE_ESCAPE ones followed by the 32-bit value.
+ * - Each field (value or statistic of a size bin) has its own parameter, which follows the mean of the recent values
+ *   of the field in the packet: k is the smallest number with count << k >= sum, starting from count = 1 and
+ *   sum = RICE_INITIAL_SUM. After each value, sum is increased by it and count by 1, both are halved when count
+ *   reaches RICE_RESET. k is limited to RICE_MAX_PARAMETER.
+ * The differences of noisy values are spread over a few thousand fixed-point steps, which takes about 16 bits as a
+ * varint, but only a bit more than their entropy as a Rice code.
+ *
+ * Packets with statistics are published with the "dps" event name, but are stored, numbered and requested like
+ * the other Data Point Packets.
+ *
+ * The sequence number is incremented with every packet and persists across reboots, so that lost packets can be
+ * detected by the server and requested by their sequence numbers.
+ *
+ * Packets of the former format store data points as 34 bytes each (4-byte timestamp and 10 3-byte values), so
+ * their size is a multiple of DATAPOINT_SIZE. Packets in the current format are padded to never have such a size,
+ * which tells the formats apart.
  */
 class DataPointPacket : public Packet
 {
 public:
+    enum Encoding : uint8_t {
+        ENCODING_DELTA_VARINT = 1,
+        ENCODING_RESIDUAL_DELTA_VARINT = 2,
+        ENCODING_DELTA_RICE = 3,
+        ENCODING_RESIDUAL_DELTA_RICE = 4
+    };
+
+    // encoding of the packets of the Measurement Collector
+    static constexpr Encoding DEFAULT_ENCODING = SystemConfig::DATA_POINT_RICE_CODES
+        ? (SystemConfig::DATA_POINT_RESIDUAL_ENCODING ? ENCODING_RESIDUAL_DELTA_RICE : ENCODING_DELTA_RICE)
+        : (SystemConfig::DATA_POINT_RESIDUAL_ENCODING ? ENCODING_RESIDUAL_DELTA_VARINT : ENCODING_DELTA_VARINT);
+
     /**
      * @brief Construct an empty DataPointPacket
      */
     DataPointPacket();
 
+    static constexpr uint8_t ENCODING_STATISTICS_FLAG = 0x80;
+
+    /**
+     * @brief Construct an empty DataPointPacket with the given encoding
+     * @param encoding Encoding of the data points
+     * @param statistics Whether the data points carry statistics
+     */
+    explicit DataPointPacket(Encoding encoding, bool statistics = false);
+
     ~DataPointPacket() override;
-    
-    /**
-     * @brief Convert a data point into the binary format and append it to the payload.
-     * 
-     * Data point structure:
-     * Bytes | Function
-     * ------|--------------------------
-     * 0-3   | timestamp
-     * 4-33  | Values as 3-byte integers
-     * 
-     * @param dpd Data point
+
+    /**
+     * @brief Encode a data point and append it to the payload.
+     * @param dpi Data point in the fixed-point representation
      * @param timestamp Timestamp
-     * @return true on success
+     * @param statistics Statistics of the data point, required if and only if the packet carries statistics
+     * @return false if the data point does not fit, the packet is unchanged in that case
      */
-    bool append(DatapointDouble& dpd, time32_t timestamp);
+    bool append(const DatapointInteger& dpi, time32_t timestamp, const DatapointStatistics* statistics = nullptr);
 
     /**
-     * @brief Check if a further datapoint can be appended.
+     * @brief Set the period between consecutive data points. Must be called while the packet is empty, the period
+     * is kept after reset().
+     * @param period Period (s)
+     */
+    void setPeriod(time32_t period);
+
+    time32_t getPeriod() const { return period; }
+
+    bool isEmpty() const { return data.empty(); }
+
+    bool hasStatistics() const { return withStatistics; }
+
+    /**
+     * @brief Check if a further datapoint can be appended. A packet that is not full may still reject a data point
+     * whose differences to the previous one are large.
      * @return true if full
      */
     bool isFull();
 
+    /**
+     * @brief Write the sequence number into the header and pad the packet. No data points can be appended afterwards.
+     * @param sequenceNumber Sequence number
+     */
+    void finish(uint32_t sequenceNumber);
+
+    /**
+     * @brief Get the time span covered by the data points in the packet.
+     * @return Time span (s)
+     */
+    time32_t getTimespan() const;
+
+    void reset() override;
+
+    /**
+     * @brief Get the sequence number of a packet in binary form.
+     * @param data Packet data
+     * @param size Packet size
+     * @param sequenceNumber Output sequence number
+     * @return false if the packet has no sequence number
+     */
+    static bool getSequenceNumber(const uint8_t* data, size_t size, uint32_t* sequenceNumber);
+
+    /**
+     * @brief Check if a packet is a Data Point Packet, with or without statistics.
+     */
+    static bool isDataPointPacket(const Packet& packet);
+
     static constexpr char eventName[] = "dp";
+    static constexpr char statisticsEventName[] = "dps";
 
     // DataPointPacket needs to fit into RequestedDataPointPacket
     static constexpr size_t MAX_SIZE_BYTES = SystemConfig::PACKET_MAX_SIZE_BYTES - RequestedDataPointPacket::HEADER_SIZE;
 
-    static constexpr time32_t TIMESPAN = MAX_SIZE_BYTES / SystemConfig::DATAPOINT_SIZE *
-                                         SystemConfig::SPS30_MEASUREMENT_PERIOD * SystemConfig::N_DATA_POINTS_AVERAGING;
+    static constexpr size_t HEADER_SIZE = 11;
+
+    static constexpr size_t SEQUENCE_NUMBER_SIZE = 4;
+
+    // size of the largest packet, which still fits into a Requested Data Point Packet with its size prefix
+    static constexpr size_t FULL_SIZE_BYTES = MAX_SIZE_BYTES - RequestedDataPointPacket::ENTRY_HEADER_SIZE;
+
+    // parameters of the Rice codes, see above
+    static constexpr uint8_t FIRST_VALUE_BITS = 25;
+    static constexpr uint8_t RICE_ESCAPE = 16;
+    static constexpr uint8_t RICE_RESET = 32;
+    static constexpr uint32_t RICE_INITIAL_SUM = 256;
+    static constexpr uint8_t RICE_MAX_PARAMETER = 24;
+
+    // size of the smallest encoded data point and statistics with varints, and in bits with Rice codes
+    static constexpr size_t MIN_DATA_POINT_SIZE = 1 + 10;
+    static constexpr size_t MIN_STATISTICS_SIZE = 3 * 10;
+    static constexpr size_t MIN_RICE_DATA_POINT_BITS = 1 + 10;
+    static constexpr size_t MIN_RICE_STATISTICS_BITS = 3 * 10;
+    // size by which the largest data point and statistics grow a packet with any encoding, the Rice codes are larger
+    static constexpr size_t MAX_DATA_POINT_SIZE = (1 + 32 + 10 * (RICE_ESCAPE + 32) + 7) / 8;
+    static constexpr size_t MAX_STATISTICS_SIZE = 3 * 10 * (RICE_ESCAPE + 32) / 8;
+
+    // number of data points that always fit into a packet, even if they don't compress at all
+    static constexpr size_t MIN_DATA_POINTS = (FULL_SIZE_BYTES - 1 - HEADER_SIZE) / MAX_DATA_POINT_SIZE;
+    // number of data points with statistics that always fit into a packet
+    static constexpr size_t MIN_STATISTICS_DATA_POINTS =
+        (FULL_SIZE_BYTES - 1 - HEADER_SIZE) / (MAX_DATA_POINT_SIZE + MAX_STATISTICS_SIZE);
+    // number of data points that fit into a packet if they don't change at all, limited by the count in the header
+    static constexpr size_t MAX_DATA_POINTS =
+        std::min<size_t>(UINT8_MAX, (FULL_SIZE_BYTES - 1 - HEADER_SIZE) * 8 / MIN_RICE_DATA_POINT_BITS);
+
+    static constexpr time32_t MIN_PERIOD = SystemConfig::SPS30_MEASUREMENT_PERIOD * SystemConfig::AVERAGING_MIN_WINDOW;
+
+    // shortest time span of a full packet with any averaging window
+    static constexpr time32_t MIN_TIMESPAN = SystemConfig::DATA_POINT_STATISTICS
+        ? std::min<time32_t>(MIN_DATA_POINTS * MIN_PERIOD, MIN_STATISTICS_DATA_POINTS *
+                             SystemConfig::SPS30_MEASUREMENT_PERIOD * SystemConfig::STATISTICS_MIN_WINDOW)
+        : MIN_DATA_POINTS * MIN_PERIOD;
+
+    /**
+     * @brief Get the longest time span of a full packet with the given period. The actual time span depends on how
+     * well the data points compress.
+     * @param period Period (s)
+     * @return Time span (s)
+     */
+    static constexpr time32_t getMaxTimespan(time32_t period) { return MAX_DATA_POINTS * period; }
+
+    static_assert(MIN_DATA_POINTS >= 1 && MIN_STATISTICS_DATA_POINTS >= 1, "A data point must fit into an empty packet");
 
 private:
-    static constexpr double measurementMultiplier = 100.0 * 32.0;
+    /**
+     * Append a varint to the buffer.
+     * @return Pointer after the varint
+     */
+    static uint8_t* writeVarint(uint8_t* buf, uint32_t value);
+
+    static uint32_t zigZag(int32_t value) { return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31); }
+
+    /**
+     * Parameter of the Rice codes of a field, adapted to the values of the field.
+     */
+    struct RiceContext {
+        uint32_t sum = RICE_INITIAL_SUM;
+        uint8_t count = 1;
+
+        uint8_t parameter() const;
+        void update(uint32_t value);
+    };
+
+    bool isRiceEncoding() const { return encoding == ENCODING_DELTA_RICE || encoding == ENCODING_RESIDUAL_DELTA_RICE; }
+
+    /**
+     * Encode a data point as varints.
+     * @return Number of bits written to buf
+     */
+    size_t encodeVarint(const std::array<uint32_t, 10>& values, const DatapointInteger& dpi, time32_t timestamp,
+                        const DatapointStatistics* statistics, uint8_t* buf) const;
+
+    /**
+     * Encode a data point as Rice codes into a zeroed buffer, after the bits of the last incomplete byte of the
+     * packet.
+     * @param contexts Rice code parameters, updated
+     * @return Number of bits in buf, including those of the last incomplete byte
+     */
+    size_t encodeRice(const std::array<uint32_t, 10>& values, const DatapointInteger& dpi, time32_t timestamp,
+                      const DatapointStatistics* statistics, uint8_t* buf,
+                      std::array<RiceContext, 40>& contexts) const;
+
+    // number of values of one sensor
+    static constexpr size_t SENSOR_VALUES = 5;
+
+    /**
+     * Get the period stored in the header, the timestamps of the data points are encoded relative to it.
+     */
+    uint8_t getHeaderPeriod() const { return period <= UINT8_MAX ? period : 0; }
+
+    Encoding encoding = ENCODING_DELTA_VARINT;
+    bool withStatistics = false;
+    time32_t period = MIN_PERIOD;
+
+    // last appended data point (after the residual transform), the next one is encoded relative to it
+    std::array<uint32_t, 10> previousValues{};
+    time32_t previousTimestamp = 0;
+    // Rice code parameters of the 10 values and of their 30 statistics
+    std::array<RiceContext, 40> riceContexts{};
+    // length of the bit stream of the Rice codes
+    size_t bitLength = 0;
 };
 
 #endif
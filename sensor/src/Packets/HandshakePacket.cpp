@@ -8,14 +8,41 @@
 
 constexpr char HandshakePacket::eventName[];
 
+/**
+ * Get the exact length of ascii85-encoded data after decoding. The decoder expands every 'z' at the start of a
+ * group to 4 zero bytes.
+ */
+static size_t ascii85DecodedLength(const char* encoded, size_t length)
+{
+    size_t decoded = 0, group = 0;
+    for (size_t i = 0; i < length; ++i) {
+        if (encoded[i] == 'z' && group == 0) {
+            decoded += 4;
+        } else if (++group == 5) {
+            decoded += 4;
+            group = 0;
+        }
+    }
+    return decoded + (group > 0 ? group - 1 : 0);
+}
+
 HandshakePacket::HandshakePacket(const char* dataEncoded) : Packet(eventName)
 {
     size_t inLength = std::strlen(dataEncoded);
-    data.resize(ascii85MaxDecodedLength(inLength));
-    size_t realLength = decode_ascii85(reinterpret_cast<const uint8_t*>(dataEncoded), 
-                                       inLength, data.begin().get_ptr(), 
-                                       1000000);  // dirty hack
-    data.resize(realLength);
+    size_t decodedLength = ascii85DecodedLength(dataEncoded, inLength);
+    if (decodedLength > data.capacity()) {
+        return;  // a handshake that does not fit is treated as empty
+    }
+    data.resize(decodedLength);
+    // the decoder requires room for every character being a 'z', the exact length has been checked above
+    int32_t realLength = decode_ascii85(reinterpret_cast<const uint8_t*>(dataEncoded), inLength,
+                                        data.begin().get_ptr(), ascii85_get_max_decoded_length(inLength));
+    data.resize(realLength < 0 ? 0 : realLength);
 }
 
-HandshakePacket::HandshakePacket() = default;
\ No newline at end of file
+HandshakePacket::HandshakePacket() = default;
+
+HandshakePacket::Mode HandshakePacket::getMode() const
+{
+    return data.size() < HEADER_SIZE ? TIME_INTERVALS : static_cast<Mode>(data[4]);
+}
\ No newline at end of file
@@ -13,14 +13,22 @@
  * Bytes | Function
  * ------|---------------------------------
  * 0-3   | timestmap
- * 4-end | intervals (8 bytes per interval)
+ * 4     | mode: TIME_INTERVALS or SEQUENCE_RANGES (may be omitted if there are no intervals)
+ * 5-end | time intervals (begin and end exclusive) or ranges of sequence numbers (first and last inclusive),
+ *       | 8 bytes each
  */
 class HandshakePacket : public Packet
 {
 public:
 
+    enum Mode : uint8_t {
+        TIME_INTERVALS = 0,
+        SEQUENCE_RANGES = 1
+    };
+
     static constexpr char eventName[] = "hs";
-    static constexpr uint16_t MAX_INTERVALS = (SystemConfig::PACKET_MAX_SIZE_BYTES - 4) / (2 * 4);
+    static constexpr size_t HEADER_SIZE = 5;
+    static constexpr uint16_t MAX_INTERVALS = (SystemConfig::PACKET_MAX_SIZE_BYTES - HEADER_SIZE) / (2 * 4);
 
     /**
      * Construct from an ascii85-encoded string.
@@ -33,6 +41,11 @@ public:
      */
     HandshakePacket();
 
+    /**
+     * Get the mode, which tells whether the packet requests time intervals or sequence ranges
+     */
+    Mode getMode() const;
+
     /**
      * Get intervals from the packet
      * 
@@ -43,15 +56,35 @@ public:
     template<class Container>
     void getIntervals(std::back_insert_iterator<Container> outIt);
 
+    /**
+     * Get ranges of sequence numbers from the packet
+     *
+     * @tparam Container Container of value type sequence_range_t
+     * @param outIt Back insert iterator to a container of sequence_range_t elements, where to write the ranges
+     */
+    template<class Container>
+    void getSequenceRanges(std::back_insert_iterator<Container> outIt);
+
 };
 
 template<class Container>
 void HandshakePacket::getIntervals(std::back_insert_iterator<Container> outIntervalIt) {
-    for(auto dataIt = data.begin() + 4; dataIt <= data.end() - 8; dataIt += 8) {
+    if(data.size() < HEADER_SIZE) return;
+    for(auto dataIt = data.begin() + HEADER_SIZE; dataIt + 8 <= data.end(); dataIt += 8) {
         auto start = *reinterpret_cast<time32_t*>(dataIt.get_ptr());
         auto end = *reinterpret_cast<time32_t*>(dataIt.get_ptr() + 4);
         outIntervalIt = {start, end};
     }
 }
 
+template<class Container>
+void HandshakePacket::getSequenceRanges(std::back_insert_iterator<Container> outIt) {
+    if(data.size() < HEADER_SIZE) return;
+    for(auto dataIt = data.begin() + HEADER_SIZE; dataIt + 8 <= data.end(); dataIt += 8) {
+        auto first = *reinterpret_cast<uint32_t*>(dataIt.get_ptr());
+        auto last = *reinterpret_cast<uint32_t*>(dataIt.get_ptr() + 4);
+        outIt = {first, last};
+    }
+}
+
 #endif // KIST_SENSOR_ARGON_FW_LOCAL_HANDSHAKEPACKET_H
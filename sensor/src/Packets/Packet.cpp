@@ -11,6 +11,12 @@ Packet::Packet(const char* eventName)
 
 Packet::Packet() = default;
 
+Packet::Packet(const char* eventName, const uint8_t* bytes, uint16_t size) : Packet(eventName)
+{
+    assert(size <= data.capacity());
+    data.assign(bytes, bytes + size);
+}
+
 Packet::~Packet() = default;
 
 const uint8_t* Packet::getBytes(uint16_t* l) const
@@ -23,6 +23,15 @@ public:
      */
     Packet();
 
+    /**
+     * @brief Construct a Packet from its binary data, e.g. when it is read back from a file
+     *
+     * @param eventName event name to be used
+     * @param bytes binary data
+     * @param size size of the data, at most PACKET_MAX_SIZE_BYTES
+     */
+    Packet(const char* eventName, const uint8_t* bytes, uint16_t size);
+
     virtual ~Packet();
 
     /**
@@ -27,6 +27,14 @@ RequestedDataPointPacket::RequestedDataPointPacket(const HandshakePacket& hp, ui
 RequestedDataPointPacket::~RequestedDataPointPacket()
 = default;
 
-std::back_insert_iterator<decltype(RequestedDataPointPacket::data)> RequestedDataPointPacket::getDataBackInserter() {
-    return std::back_inserter(data);
+bool RequestedDataPointPacket::appendPacket(const uint8_t* packetData, uint16_t size) {
+    if(getFreeSpace() < ENTRY_HEADER_SIZE + size) return false;
+    const auto* sizePtr = reinterpret_cast<const uint8_t*>(&size);
+    data.insert(data.end(), sizePtr, sizePtr + ENTRY_HEADER_SIZE);
+    data.insert(data.end(), packetData, packetData + size);
+    return true;
+}
+
+size_t RequestedDataPointPacket::getFreeSpace() const {
+    return data.capacity() - data.size();
 }
\ No newline at end of file
@@ -10,10 +10,11 @@
  * Bytes   |Function
  * --------|-------------------
  * 0-3     |Timestamp
- * 4       |Total packets in the response or zero if not known. Must be specified in at least one packet.
+ * 4       |Total packets in the response or zero if not known. Must be specified in at least one packet,
+ *         |the firmware sets it in every packet of the response.
  * 5       |Number of this packet.
  * 6-9     |Handshake Timestamp
- * 10-end  |Requested packets in the standard format
+ * 10-end  |Requested packets in the standard format, each preceded by its size (2 bytes)
  */
 class RequestedDataPointPacket : public Packet
 {
@@ -29,14 +30,26 @@ public:
     ~RequestedDataPointPacket() override;
 
     /**
-     * @brief Get the back insert iterator for the payload of the packet.
-     * Used to write to the packet without copying.
-     * @return std::back_insert_iterator
+     * @brief Append a requested packet to the payload.
+     * @param packetData Data of the requested packet
+     * @param size Size of the requested packet
+     * @return false if the packet does not fit
      */
-    std::back_insert_iterator<decltype(data)> getDataBackInserter();
+    bool appendPacket(const uint8_t* packetData, uint16_t size);
+
+    /**
+     * @brief Get the number of payload bytes that can still be added to the packet.
+     */
+    size_t getFreeSpace() const;
 
     static constexpr size_t HEADER_SIZE = 10;
 
+    // payload bytes of an empty packet
+    static constexpr size_t MAX_PAYLOAD_SIZE = SystemConfig::PACKET_MAX_SIZE_BYTES - HEADER_SIZE;
+
+    // size of the length prefix of every requested packet, packets are larger than 255 bytes
+    static constexpr size_t ENTRY_HEADER_SIZE = 2;
+
     static constexpr char eventName[] = "rdp";
 };
 
@@ -1,5 +1,7 @@
 #include <SPS30.h>
 
+#include <cstring>
+
 SPS30::SPS30(uint8_t sda, uint8_t scl) : sw(sda, scl)
 {
     sw.setTxBuffer(swTxBuffer, sizeof(swTxBuffer));
@@ -59,6 +61,39 @@ uint8_t SPS30::setPointerRead(uint8_t* pointerAddress, uint8_t* data, uint8_t da
     return 1;
 }
 
+void SPS30::setPointerRead(SPS30* const* sensors, uint8_t count, uint8_t* pointerAddress,
+                           uint8_t* const* data, uint8_t dataBytesToRead, bool* valid)
+{
+    // data[i] receives the received bytes including the CRCs, the checked data is moved to its start
+    SoftWire* buses[SoftWireGroup::maxBuses];
+    for (uint8_t i = 0; i < count && i < SoftWireGroup::maxBuses; i++)
+    {
+        buses[i] = &sensors[i]->sw;
+    }
+    SoftWireGroup group(buses, count);
+    uint8_t results[SoftWireGroup::maxBuses];
+    uint8_t bytesRead[SoftWireGroup::maxBuses];
+    uint8_t bytesReceived = dataBytesToRead / 2 * 3;
+    group.writeTo(I2C_address, pointerAddress, 2, results);
+    group.requestFrom(I2C_address, bytesReceived, data, bytesRead);
+    for (uint8_t s = 0; s < group.getCount(); s++)
+    {
+        valid[s] = bytesRead[s] == bytesReceived;
+        uint8_t k = 0;
+        for (uint8_t i = 0; i < bytesReceived && valid[s]; i += 3)
+        {
+            if (calcCrc(data[s] + i) != data[s][i + 2])
+            {
+                valid[s] = false;
+                break;
+            }
+            data[s][k] = data[s][i];
+            data[s][k + 1] = data[s][i + 1];
+            k += 2;
+        }
+    }
+}
+
 uint8_t SPS30::calcCrc(uint8_t data[2])
 {
     uint8_t crc = 0xFF;
@@ -104,9 +139,52 @@ bool SPS30::readDataReadyFlag()
 void SPS30::readMeasuredValues(SPS30MeasuredValues* values)
 {
     uint8_t data[40] = {0};
-    float floatArray[10] = {0};
     uint8_t ptr_addr[] = {0x03, 0x00};
     setPointerRead(ptr_addr, data, 40); // TODO use crc check result
+    decodeMeasuredValues(data, values);
+}
+
+void SPS30::readDataReadyFlags(SPS30* const* sensors, uint8_t count, bool* ready)
+{
+    uint8_t buffers[SoftWireGroup::maxBuses][3];
+    uint8_t* data[SoftWireGroup::maxBuses];
+    bool valid[SoftWireGroup::maxBuses];
+    for (uint8_t i = 0; i < SoftWireGroup::maxBuses; i++)
+    {
+        data[i] = buffers[i];
+    }
+    uint8_t ptr_addr[] = {0x02, 0x02};
+    setPointerRead(sensors, count, ptr_addr, data, 2, valid);
+    for (uint8_t i = 0; i < count && i < SoftWireGroup::maxBuses; i++)
+    {
+        ready[i] = valid[i] && data[i][1];
+    }
+}
+
+void SPS30::readMeasuredValues(SPS30* const* sensors, uint8_t count, SPS30MeasuredValues* const* values, bool* valid)
+{
+    // the values of a sensor are only replaced if its frame is valid
+    uint8_t buffers[SoftWireGroup::maxBuses][60];
+    uint8_t* data[SoftWireGroup::maxBuses];
+    for (uint8_t i = 0; i < SoftWireGroup::maxBuses; i++)
+    {
+        data[i] = buffers[i];
+    }
+    uint8_t ptr_addr[] = {0x03, 0x00};
+    setPointerRead(sensors, count, ptr_addr, data, 40, valid);
+    for (uint8_t i = 0; i < count && i < SoftWireGroup::maxBuses; i++)
+    {
+        if (valid[i])
+        {
+            std::memcpy(values[i]->raw_data, buffers[i], sizeof(values[i]->raw_data));
+            decodeMeasuredValues(data[i], values[i]);
+        }
+    }
+}
+
+void SPS30::decodeMeasuredValues(const uint8_t data[40], SPS30MeasuredValues* values)
+{
+    float floatArray[10] = {0};
     for (int i = 0; i < 10; i++)
     {
         uint8_t* p = (uint8_t*)&floatArray[i];
@@ -2,6 +2,7 @@
 #define SPS30hpp
 
 #include <SoftWire.h>
+#include <SoftWireGroup.h>
 
 #define SPS30_UART 0
 #define SPS30_I2C 1
@@ -23,7 +24,7 @@ typedef struct
 class SPS30
 {
 private:
-    const uint8_t I2C_address = 0x69; // TODO Is this correct address
+    static constexpr uint8_t I2C_address = 0x69; // TODO Is this correct address
     SoftWire sw;
     uint8_t swTxBuffer[128]; // TODO: Buffer size can be reduced
     uint8_t swRxBuffer[128];
@@ -31,7 +32,10 @@ private:
     void setPointer(uint8_t* pointerAddress);
     uint8_t setPointerRead(uint8_t* pointerAddress, uint8_t* data, uint8_t dataBytesToRead);
     void setPointerWrite(uint8_t* pointerAddress, uint8_t* data, uint8_t size);
-    uint8_t calcCrc(uint8_t data[2]);
+    static void setPointerRead(SPS30* const* sensors, uint8_t count, uint8_t* pointerAddress,
+                               uint8_t* const* data, uint8_t dataBytesToRead, bool* valid);
+    static uint8_t calcCrc(uint8_t data[2]);
+    static void decodeMeasuredValues(const uint8_t data[40], SPS30MeasuredValues* values);
 
 public:
     SPS30(uint8_t sda, uint8_t scl);
@@ -41,6 +45,14 @@ public:
     void readMeasuredValues(SPS30MeasuredValues* values);
     void startFanCleaning();
     void reset();
+
+    // The following functions access several sensors on separate buses at once. The buses are clocked in
+    // lockstep (see SoftWireGroup), so reading all sensors takes about as long as reading one. At most
+    // SoftWireGroup::maxBuses sensors can be accessed at once.
+    static void readDataReadyFlags(SPS30* const* sensors, uint8_t count, bool* ready);
+    // valid[i] is false if the frame of sensor i failed the CRC check, its values are left unchanged then
+    static void readMeasuredValues(SPS30* const* sensors, uint8_t count, SPS30MeasuredValues* const* values,
+                                   bool* valid);
 };
 
 #endif
\ No newline at end of file
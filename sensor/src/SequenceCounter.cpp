@@ -0,0 +1,45 @@
+#include "SequenceCounter.h"
+
+#include <cstdio>
+#include <unistd.h>
+
+bool SequenceCounter::init()
+{
+    SequenceFile file{};
+    int f = open("/sequence.bin", O_RDONLY);
+    if (f != -1) {
+        bool s = ::read(f, &file, sizeof(file)) == sizeof(file)
+                 && file.magic == SEQUENCE_FILE_MAGIC && file.checksum == ~file.reservedEnd;
+        close(f);
+        if (s) {
+            nextSequence = file.reservedEnd;
+        } else {
+            Log.warn("Sequence file is corrupt, restarting the sequence numbers.");
+        }
+    }
+    Log.info("Sequence numbers continue at %lu.", nextSequence);
+    return reserve();
+}
+
+uint32_t SequenceCounter::next()
+{
+    if (nextSequence == reservedEnd && !reserve()) {
+        Log.error("Could not reserve sequence numbers.");
+        reservedEnd = nextSequence + SystemConfig::SEQUENCE_RESERVATION_BLOCK;  // try again after the block
+    }
+    return nextSequence++;
+}
+
+bool SequenceCounter::reserve()
+{
+    uint32_t end = nextSequence + SystemConfig::SEQUENCE_RESERVATION_BLOCK;
+    SequenceFile file{SEQUENCE_FILE_MAGIC, end, ~end};
+    int f = open("/sequence.tmp", O_RDWR | O_CREAT | O_TRUNC);
+    if (f == -1) return false;
+    bool s = write(f, &file, sizeof(file)) == sizeof(file);
+    s = (close(f) == 0) && s;
+    // rename replaces the old file atomically, so a reset never leaves the counter without a valid file
+    s = s && std::rename("/sequence.tmp", "/sequence.bin") == 0;
+    if (s) reservedEnd = end;
+    return s;
+}
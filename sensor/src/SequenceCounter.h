@@ -0,0 +1,59 @@
+#ifndef SEQUENCECOUNTER_H
+#define SEQUENCECOUNTER_H
+
+#include "main.h"
+
+#include <fcntl.h>
+
+/**
+ * Source of the sequence numbers of Data Point Packets, persisted in the flash file system.
+ *
+ * Writing the counter for every packet would wear the flash, so blocks of SEQUENCE_RESERVATION_BLOCK numbers
+ * are reserved instead: the end of the current block is saved in /sequence.bin before any number of the block
+ * is used. After a reboot the counter continues at the end of the reserved block, so numbers are never reused,
+ * but the unused rest of the block is skipped (the server sees it as a gap that cannot be filled).
+ *
+ * File structure:
+ * Bytes   |Function
+ * --------|-------------------
+ * 0-3     |SEQUENCE_FILE_MAGIC
+ * 4-7     |End of the reserved block (exclusive)
+ * 8-11    |Checksum (inverted end of the reserved block)
+ *
+ * The counter is not thread safe, it is used by the Measurement Collector only.
+ */
+class SequenceCounter
+{
+public:
+    struct SequenceFile {
+        uint32_t magic;
+        uint32_t reservedEnd;
+        uint32_t checksum;
+    };
+
+    static constexpr uint32_t SEQUENCE_FILE_MAGIC = 0x51455350;  // "PSEQ"
+
+    /**
+     * Load the reserved block from the flash. Without a valid file, the counter starts at 1.
+     * @return false if the first block could not be reserved
+     */
+    bool init();
+
+    /**
+     * Get the next sequence number, reserving a new block if necessary. If the reservation fails, the numbers
+     * are still handed out, but may be reused after a reboot.
+     */
+    uint32_t next();
+
+private:
+    /**
+     * Save the end of a new block, starting at nextSequence. The file is replaced atomically.
+     * @return true on success, false on failure
+     */
+    bool reserve();
+
+    uint32_t nextSequence = 1;
+    uint32_t reservedEnd = 1;  // nextSequence == reservedEnd means that a new block has to be reserved
+};
+
+#endif
@@ -0,0 +1,107 @@
+#include "SlidingMeans.h"
+
+#include <cstdio>
+
+namespace {
+/**
+ * Check that every window consists of whole buckets of measurements, which fit into a bucket.
+ */
+constexpr bool validWindows()
+{
+    constexpr uint32_t bucketPeriod = SystemConfig::SPS30_MEASUREMENT_PERIOD * SystemConfig::SLIDING_MEAN_BUCKETS;
+    for (uint16_t window : SystemConfig::SLIDING_MEAN_WINDOWS) {
+        if (window % bucketPeriod != 0 || window / bucketPeriod == 0 ||
+            window / bucketPeriod > SlidingWindowMean<10, SystemConfig::SLIDING_MEAN_BUCKETS>::MAX_BUCKET_SAMPLES) {
+            return false;
+        }
+    }
+    return true;
+}
+}
+
+static_assert(validWindows(), "Sliding mean windows must be whole, not too long multiples of the bucket period");
+
+SlidingMeans::SlidingMeans()
+{
+    for (size_t w = 0; w < WINDOW_COUNT; ++w) {
+        windows[w].init(SystemConfig::SLIDING_MEAN_WINDOWS[w] /
+                        (SystemConfig::SPS30_MEASUREMENT_PERIOD * SystemConfig::SLIDING_MEAN_BUCKETS));
+    }
+}
+
+void SlidingMeans::add(const DatapointFloat& measurement)
+{
+    DatapointInteger values;
+    for (size_t i = 0; i < values.size(); ++i) {
+        values[i] = toDatapointValue(measurement[i]);
+    }
+    for (auto& window : windows) {
+        window.add(values);
+    }
+    publish();
+}
+
+void SlidingMeans::skip()
+{
+    for (auto& window : windows) {
+        window.skip();
+    }
+    publish();
+}
+
+void SlidingMeans::publish()
+{
+    // write the slot that is not current, readers of the current one are not disturbed
+    uint32_t v = version.load(std::memory_order_relaxed);
+    Snapshot& snapshot = snapshots[(v + 1) % 2];
+    for (size_t w = 0; w < WINDOW_COUNT; ++w) {
+        for (size_t i = 0; i < snapshot.means[w].size(); ++i) {
+            snapshot.means[w][i] = windows[w].getMean(i);
+        }
+        snapshot.counts[w] = windows[w].getCount();
+    }
+    version.store(v + 1, std::memory_order_release);
+}
+
+SlidingMeans::Snapshot SlidingMeans::getSnapshot() const
+{
+    Snapshot snapshot;
+    uint32_t v;
+    do {
+        v = version.load(std::memory_order_acquire);
+        snapshot = snapshots[v % 2];
+        std::atomic_thread_fence(std::memory_order_acquire);
+        // the slot is only written again after the next snapshot has been published
+    } while (version.load(std::memory_order_relaxed) != v);
+    return snapshot;
+}
+
+String SlidingMeans::getSnapshotString() const
+{
+    Snapshot s = getSnapshot();
+    char buf[512];
+    size_t length = 0;
+    auto append = [&buf, &length](const char* format, auto... args) {
+        if (length < sizeof(buf)) {
+            length += std::snprintf(buf + length, sizeof(buf) - length, format, args...);
+        }
+    };
+    append("{\"windows\":[");
+    for (size_t w = 0; w < WINDOW_COUNT; ++w) {
+        append(w ? ",%u" : "%u", SystemConfig::SLIDING_MEAN_WINDOWS[w]);
+    }
+    append("],\"counts\":[");
+    for (size_t w = 0; w < WINDOW_COUNT; ++w) {
+        append(w ? ",%lu" : "%lu", static_cast<unsigned long>(s.counts[w]));
+    }
+    append("],\"means\":[");
+    for (size_t w = 0; w < WINDOW_COUNT; ++w) {
+        append(w ? ",[" : "[");
+        for (size_t i = 0; i < s.means[w].size(); ++i) {
+            append(i ? ",%.1f" : "%.1f", static_cast<double>(s.means[w][i]));
+        }
+        append("]");
+    }
+    append("]}");
+    return String(buf);
+}
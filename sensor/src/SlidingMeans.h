@@ -0,0 +1,63 @@
+#ifndef SLIDINGMEANS_H
+#define SLIDINGMEANS_H
+
+#include "SlidingWindowMean.h"
+#include "main.h"
+
+#include <atomic>
+
+/**
+ * Sliding means of the measurements over the windows in SLIDING_MEAN_WINDOWS, for the current air quality.
+ *
+ * The means are updated by the Measurement Collector with every measurement and published as a snapshot, which
+ * other threads read without a lock. The snapshot is double-buffered: a new snapshot is written into the slot that
+ * is not current, then the version is incremented, which makes it current. A reader copies the current slot and
+ * retries only if a whole snapshot has been published during the copy, so it never waits for the writer, and the
+ * writer never waits for a reader.
+ */
+class SlidingMeans
+{
+public:
+    static constexpr size_t WINDOW_COUNT = SystemConfig::SLIDING_MEAN_WINDOWS.size();
+
+    struct Snapshot {
+        std::array<DatapointFloat, WINDOW_COUNT> means;
+        std::array<uint32_t, WINDOW_COUNT> counts;  // number of measurements in each window
+    };
+
+    SlidingMeans();
+
+    /**
+     * Add a measurement to all windows and publish a new snapshot. Must only be called by one thread.
+     */
+    void add(const DatapointFloat& measurement);
+
+    /**
+     * Let a measurement period pass without a measurement, and publish a new snapshot. Must only be called by the
+     * thread that calls add().
+     */
+    void skip();
+
+    /**
+     * Get the most recent snapshot. Can be called by any thread.
+     */
+    Snapshot getSnapshot() const;
+
+    /**
+     * Format the most recent snapshot as JSON, to be exported as a cloud variable.
+     */
+    String getSnapshotString() const;
+
+private:
+    /**
+     * Publish the current means and counts of all windows as the new snapshot.
+     */
+    void publish();
+
+    std::array<SlidingWindowMean<10, SystemConfig::SLIDING_MEAN_BUCKETS>, WINDOW_COUNT> windows{};
+
+    std::array<Snapshot, 2> snapshots{};
+    std::atomic<uint32_t> version{0};  // the current snapshot is snapshots[version % 2]
+};
+
+#endif
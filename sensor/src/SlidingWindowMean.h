@@ -0,0 +1,104 @@
+#ifndef SLIDINGWINDOWMEAN_H
+#define SLIDINGWINDOWMEAN_H
+
+#include "main.h"
+
+#include <array>
+
+/**
+ * Mean of the most recent values over a sliding window, kept incrementally.
+ *
+ * The window is divided into a ring of buckets, each of which holds the partial sum of the values of bucketSamples
+ * sample periods. The sum of the whole ring is updated with every value, and when the current bucket is full, the
+ * oldest bucket leaves the window, so every update takes constant time. The window therefore slides in steps of one
+ * bucket and covers between (buckets - 1) / buckets of its length and its full length. A sample period without a
+ * value is skipped, so that the window keeps covering the same time, but holds fewer values.
+ *
+ * The values are summed as fixed-point integers (see toDatapointValue()), so the sums are exact and do not drift
+ * when buckets leave the window.
+ *
+ * @tparam channels Number of values of one sample
+ * @tparam buckets Number of buckets
+ */
+template<size_t channels, size_t buckets>
+class SlidingWindowMean
+{
+public:
+    typedef std::array<uint32_t, channels> Values;
+
+    // a full bucket holds at most this many values, so that its partial sums cannot overflow
+    static constexpr uint32_t MAX_BUCKET_SAMPLES = UINT32_MAX / SystemConfig::DATAPOINT_MAX_VALUE;
+
+    /**
+     * Set the number of sample periods in one bucket, and with it the length of the window, and clear the window.
+     */
+    void init(uint32_t bucketSamples) {
+        assert(bucketSamples >= 1 && bucketSamples <= MAX_BUCKET_SAMPLES);
+        this->bucketSamples = bucketSamples;
+        partialSums = {};
+        bucketCounts = {};
+        sums = {};
+        current = 0;
+        currentPeriods = 0;
+        count = 0;
+    }
+
+    /**
+     * Add the values of a sample in the fixed-point representation.
+     */
+    void add(const Values& values) {
+        for (size_t i = 0; i < channels; ++i) {
+            partialSums[current][i] += values[i];
+            sums[i] += values[i];
+        }
+        ++bucketCounts[current];
+        ++count;
+        advance();
+    }
+
+    /**
+     * Let a sample period pass without a value.
+     */
+    void skip() { advance(); }
+
+    /**
+     * Get the mean of a channel in the units of the measured values, 0 while the window is empty.
+     */
+    float getMean(size_t channel) const {
+        if (count == 0) return 0.0f;
+        return static_cast<float>(sums[channel]) / (static_cast<float>(count) * SystemConfig::DATAPOINT_SCALE);
+    }
+
+    /**
+     * Get the number of values in the window.
+     */
+    uint32_t getCount() const { return count; }
+
+private:
+    /**
+     * Count a sample period in the current bucket, and move on to the next bucket when the current one is full.
+     */
+    void advance() {
+        if (++currentPeriods == bucketSamples) {
+            // the next bucket holds the oldest values, which leave the window
+            current = (current + 1) % buckets;
+            for (size_t i = 0; i < channels; ++i) {
+                sums[i] -= partialSums[current][i];
+            }
+            count -= bucketCounts[current];
+            partialSums[current] = {};
+            bucketCounts[current] = 0;
+            currentPeriods = 0;
+        }
+    }
+
+    std::array<Values, buckets> partialSums{};
+    std::array<uint32_t, buckets> bucketCounts{};
+    std::array<uint64_t, channels> sums{};  // sums of all buckets
+    uint32_t bucketSamples = 1;
+    uint32_t count = 0;
+    size_t current = 0;  // bucket to which values are added
+    uint32_t currentPeriods = 0;  // sample periods counted in the current bucket
+};
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef SPSCRING_H
+#define SPSCRING_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+/**
+ * Bounded lock-free ring buffer for exactly one producer thread and one consumer thread.
+ *
+ * The producer only writes head and the consumer only writes tail, so push and pop need no read-modify-write
+ * operations. Head and tail are free-running counters, the slot is selected with a mask.
+ *
+ * @tparam T Trivially copyable item type
+ * @tparam N Capacity, must be a power of two
+ */
+template<class T, size_t N>
+class SpscRing
+{
+    static_assert(N > 0 && (N & (N - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    /**
+     * Append an item. Must only be called by the producer thread.
+     * @return false if the ring is full
+     */
+    bool push(const T& item) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if(h - tail.load(std::memory_order_acquire) == N) {
+            return false;
+        }
+        buffer[h & (N - 1)] = item;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Remove the oldest item. Must only be called by the consumer thread.
+     * @return false if the ring is empty
+     */
+    bool pop(T* item) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if(t == head.load(std::memory_order_acquire)) {
+            return false;
+        }
+        *item = buffer[t & (N - 1)];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+    static constexpr size_t capacity() { return N; }
+
+private:
+    std::array<T, N> buffer{};
+    std::atomic<size_t> head{0};  // next slot to write
+    std::atomic<size_t> tail{0};  // next slot to read
+};
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef STATISTICSACCUMULATOR_H
+#define STATISTICSACCUMULATOR_H
+
+#include "main.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+
+/**
+ * Minimum, maximum and variance of measured values, computed in a single pass with Welford's algorithm.
+ *
+ * The state of all channels is kept in separate arrays and every update is the same branch-free operation on each
+ * channel, so that the loops can be vectorised. The values are single-precision floats, as the Cortex-M4F has a
+ * single-precision FPU only. The mean of the samples is computed exactly by the AveragingAccumulator, the mean
+ * kept here only serves the variance.
+ *
+ * @tparam channels Number of values of one sample
+ */
+template<size_t channels>
+class StatisticsAccumulator
+{
+public:
+    typedef std::array<float, channels> Sample;
+    typedef std::array<uint32_t, channels> Values;
+
+    StatisticsAccumulator() { clear(); }
+
+    /**
+     * Add a sample. NaN values count as 0, as in the AveragingAccumulator.
+     */
+    void add(const Sample& sample) {
+        ++count;
+        const float inverseCount = 1.0f / count;
+        for (size_t i = 0; i < channels; ++i) {
+            float value = std::isnan(sample[i]) ? 0.0f : sample[i];
+            float delta = value - mean[i];
+            mean[i] += delta * inverseCount;
+            m2[i] += delta * (value - mean[i]);
+            minimum[i] = std::min(minimum[i], value);
+            maximum[i] = std::max(maximum[i], value);
+        }
+    }
+
+    /**
+     * Get the minima of the added samples in the fixed-point representation. Must not be called without samples.
+     */
+    Values getMinimum() const { return toFixedPoint(minimum); }
+
+    /**
+     * Get the maxima of the added samples in the fixed-point representation. Must not be called without samples.
+     */
+    Values getMaximum() const { return toFixedPoint(maximum); }
+
+    /**
+     * Get the sample standard deviations of the added samples in the fixed-point representation, 0 for a single
+     * sample.
+     */
+    Values getStandardDeviation() const {
+        Sample deviation{};
+        if (count > 1) {
+            const float inverseCount = 1.0f / (count - 1);
+            for (size_t i = 0; i < channels; ++i) {
+                // m2 is not negative in exact arithmetic, but rounding may make it slightly negative
+                deviation[i] = std::sqrt(std::max(m2[i] * inverseCount, 0.0f));
+            }
+        }
+        return toFixedPoint(deviation);
+    }
+
+    uint32_t getCount() const { return count; }
+
+    void clear() {
+        mean = {};
+        m2 = {};
+        minimum.fill(std::numeric_limits<float>::infinity());
+        maximum.fill(-std::numeric_limits<float>::infinity());
+        count = 0;
+    }
+
+private:
+    /**
+     * Convert values to the fixed-point representation in units of 1 / DATAPOINT_SCALE, limited to
+     * [0, DATAPOINT_MAX_VALUE].
+     */
+    static Values toFixedPoint(const Sample& sample) {
+        Values values{};
+        for (size_t i = 0; i < channels; ++i) {
+            values[i] = toDatapointValue(sample[i]);
+        }
+        return values;
+    }
+
+    Sample mean{};
+    Sample m2{};  // sum of the squared differences from the mean
+    Sample minimum;
+    Sample maximum;
+    uint32_t count;
+};
+
+#endif
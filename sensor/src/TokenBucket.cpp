@@ -0,0 +1,45 @@
+#include "TokenBucket.h"
+
+TokenBucket::TokenBucket(uint16_t burstSize, system_tick_t refillPeriod)
+    : burstSize(burstSize), refillPeriod(refillPeriod), tokens(burstSize), lastRefill(millis())
+{
+}
+
+system_tick_t TokenBucket::waitForToken()
+{
+    system_tick_t start = millis();
+    refill();
+    while(tokens == 0) {
+        delay(refillPeriod - (millis() - lastRefill) % refillPeriod);
+        refill();
+    }
+    return millis() - start;
+}
+
+bool TokenBucket::tryTake()
+{
+    refill();
+    if(tokens == 0) return false;
+    --tokens;
+    return true;
+}
+
+uint16_t TokenBucket::getTokens()
+{
+    refill();
+    return tokens;
+}
+
+void TokenBucket::refill()
+{
+    system_tick_t now = millis();
+    system_tick_t newTokens = (now - lastRefill) / refillPeriod;
+    if(tokens + newTokens >= burstSize) {
+        // a full bucket does not accumulate time
+        tokens = burstSize;
+        lastRefill = now;
+    } else {
+        tokens += newTokens;
+        lastRefill += newTokens * refillPeriod;
+    }
+}
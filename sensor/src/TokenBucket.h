@@ -0,0 +1,48 @@
+#ifndef TOKENBUCKET_H
+#define TOKENBUCKET_H
+
+#include "main.h"
+
+/**
+ * Token bucket rate limiter. The bucket holds up to burstSize tokens and gains one token every refillPeriod.
+ * Taking a token allows one operation, so up to burstSize operations can run back to back, followed by one
+ * operation per refillPeriod.
+ *
+ * The bucket is not thread safe, it is meant to be used by a single thread.
+ */
+class TokenBucket
+{
+public:
+    /**
+     * @param burstSize Maximum number of tokens, the bucket starts full
+     * @param refillPeriod Time (ms) in which one token is added
+     */
+    TokenBucket(uint16_t burstSize, system_tick_t refillPeriod);
+
+    /**
+     * Wait until a token is available, without taking it.
+     * @return Time (ms) spent waiting
+     */
+    system_tick_t waitForToken();
+
+    /**
+     * Take a token if one is available.
+     * @return false if the bucket is empty
+     */
+    bool tryTake();
+
+    uint16_t getTokens();
+
+private:
+    /**
+     * Add the tokens accumulated since the last refill.
+     */
+    void refill();
+
+    uint16_t burstSize;
+    system_tick_t refillPeriod;
+    uint16_t tokens;
+    system_tick_t lastRefill;  // time to which the tokens have been added
+};
+
+#endif
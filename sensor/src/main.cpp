@@ -1,5 +1,4 @@
 #include "Particle.h"
-#include <sys/stat.h>
 /*
  * Project KIST_Sensor_Argon_Fw
  * Description:
@@ -10,6 +9,7 @@
 // todo: disable automatic cleaning and clean fan once per week
 // todo: turn off SPS30s on shutdown
 
+#include "AveragingBenchmark.h"
 #include "MeasurementCollector.h"
 #include "Packets/Packet.h"
 #include "PacketPublisher.h"
@@ -20,6 +20,7 @@
 #include <variant>
 
 #define ENABLE_CLEAR_FLASH_FUNCTION
+// #define ENABLE_AVERAGING_BENCHMARK_FUNCTION
 
 SYSTEM_THREAD(ENABLED);
 
@@ -31,13 +32,27 @@ int clearFlash(const String& arg);
 
 int handshake(const char *arg);
 
+#ifdef ENABLE_AVERAGING_BENCHMARK_FUNCTION
+int benchmarkAveraging(const String& arg);
+#endif
+
+int setAveraging(const String& arg);
+
+String publishStats();
+
+String airQuality();
+
 SerialLogHandler logHandler(LOG_LEVEL_INFO);
 Timer timeSyncTimer = Timer(24 * 60 * 60 * 1000, syncTime);
 
+PacketPool packetPool;
+
 PacketQueue packetPublishingQueue;
 
 PacketQueue packetStorageQueue;
 
+PacketSpillArea packetSpillArea;
+
 SystemConfig sysconfig;
 
 SystemState sysstate;
@@ -71,8 +86,12 @@ void setup()
 
     sysconfig.deviceId = std::string(Particle.deviceID().c_str());
 
-    packetPublishingQueue.init(sysconfig.PACKET_QUEUE_CAPACITY);
-    packetStorageQueue.init(sysconfig.PACKET_QUEUE_CAPACITY);
+    packetPool.init();
+    // several threads publish packets, but only the Measurement Collector stores them
+    packetPublishingQueue.init(sysconfig.PACKET_QUEUE_CAPACITY, packetPool, PacketQueue::OverflowPolicy::SPILL,
+                               PacketQueue::Backend::MPSC_RING);
+    packetStorageQueue.init(sysconfig.PACKET_QUEUE_CAPACITY, packetPool, PacketQueue::OverflowPolicy::DROP_NEWEST,
+                            PacketQueue::Backend::SPSC_RING);
 
     // sysstate.serialLogEnabled = true;
 
@@ -82,11 +101,20 @@ void setup()
     Particle.function("clearFlash", clearFlash);
 #endif
     Particle.function("handshake", handshake);
+    Particle.function("setAveraging", setAveraging);
+#ifdef ENABLE_AVERAGING_BENCHMARK_FUNCTION
+    Particle.function("benchmarkAveraging", benchmarkAveraging);
+#endif
+    Particle.variable("publishStats", publishStats);
+    Particle.variable("airQuality", airQuality);
 
     Particle.syncTime();
 
     eh->init();
     psm->initStorage();
+    if(sysstate.flashActive && packetSpillArea.init()) {
+        packetPublishingQueue.setSpillArea(&packetSpillArea);
+    }
 
     //auto res = psm.getPacket(PacketStorageManager::PacketDescriptor{.location=PacketStorageManager::PacketDescriptor::FLASH_LOCATION, .packetTimestamp=1652555097});
 
@@ -138,40 +166,57 @@ void syncTime()
     Particle.syncTime(); // should run async
 }
 
-void clearDir(const String& path, bool selfDestruct) {
-    DIR* dir = opendir(path.c_str());
-    dirent* dirEntry = readdir(dir);
-    while(dirEntry != nullptr) {
-        String name{dirEntry->d_name};
-        String pathToEntry = path + "/" + name;
-        auto *statBuf = new struct stat;
-        stat(pathToEntry.c_str(), statBuf);
-        if(statBuf->st_mode & S_IFDIR) {
-            if(!name.equals(".") && !name.equals("..")) {
-                // is a directory
-                clearDir(pathToEntry, true);
-                rmdir(pathToEntry.c_str());
-            }
-        } else {
-            // is a file
-            unlink(pathToEntry.c_str());
-        }
-        dirEntry = readdir(dir);
-    }
-    closedir(dir);
-    if(selfDestruct) {
-        rmdir(path.c_str());
-    }
-}
-
 int clearFlash(const String& arg)
 {
     Log.info("Clear flash called");
-    clearDir("/Packets", false);
+    bool s = psm->clearFlash();
     Log.info("Clear flash done");
-    return 0;
+    return s ? 0 : -1;
 }
 
 int handshake(const char* arg) {
     return hh->putHandshake(arg);    
-}
\ No newline at end of file
+}
+
+/**
+ * Set the number of measurement data points that are averaged into one data point, until the next reboot.
+ * @param arg Number of data points, or an empty string to query the current number
+ * @return Number of data points, or -1 if the argument is not within [AVERAGING_MIN_WINDOW, AVERAGING_MAX_WINDOW]
+ */
+int setAveraging(const String& arg) {
+    if(arg.length() > 0) {
+        long window = arg.toInt();
+        if(window < SystemConfig::AVERAGING_MIN_WINDOW || window > SystemConfig::AVERAGING_MAX_WINDOW) {
+            return -1;
+        }
+        sysstate.averagingWindow = window;
+        Log.info("Averaging window set to %ld data points", window);
+    }
+    return sysstate.averagingWindow;
+}
+
+#ifdef ENABLE_AVERAGING_BENCHMARK_FUNCTION
+/**
+ * Count the CPU cycles of the former and the current averaging of one acquisition cycle, and log them.
+ * @param arg Number of measurements averaged into one data point, or an empty string for the current window
+ * @return How many times faster the current averaging is, in percent
+ */
+int benchmarkAveraging(const String& arg) {
+    long window = arg.length() > 0 ? arg.toInt() : sysstate.averagingWindow;
+    if(window < SystemConfig::AVERAGING_MIN_WINDOW || window > SystemConfig::AVERAGING_MAX_WINDOW) {
+        return -1;
+    }
+    AveragingBenchmark::Result result = AveragingBenchmark::run(window, 3600);
+    Log.info("Averaging of %ld data points: %lu cycles formerly, %lu cycles now", window,
+             static_cast<unsigned long>(result.formerTicks), static_cast<unsigned long>(result.accumulatorTicks));
+    return result.accumulatorTicks ? 100 * result.formerTicks / result.accumulatorTicks : -1;
+}
+#endif
+
+String publishStats() {
+    return pp->getStatsString();
+}
+
+String airQuality() {
+    return mc->getSlidingMeansString();
+}
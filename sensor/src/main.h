@@ -6,7 +6,9 @@
 #undef min
 #undef abs
 
+#include <algorithm>
 #include <array>
+#include <cmath>
 #include <vector>
 
 #include <boost/container/static_vector.hpp>
@@ -20,9 +22,13 @@
 #define LOG_W(s) Log.info(s); delay(200);
 
 // Typedefs
-typedef std::array<double, 10> DatapointDouble;    // for real values
-typedef std::array<uint32_t, 10> DatapointInteger; // for integer representation
+typedef std::array<float, 10> DatapointFloat;      // for real values, as read from the sensors
+typedef std::array<uint32_t, 10> DatapointInteger; // for the fixed-point representation (DATAPOINT_SCALE)
 typedef std::pair<time32_t, time32_t> interval_t;  // for time intervals
+struct DatapointStatistics {                       // for the statistics of the data points averaged into one
+    DatapointInteger minimum, maximum, standardDeviation;
+};
+typedef std::pair<uint32_t, uint32_t> sequence_range_t;  // for ranges of sequence numbers (inclusive)
 template<typename T, size_t capacity>
 using static_vector = boost::container::static_vector<T, capacity>;
 template<size_t length>
@@ -47,25 +53,114 @@ constexpr size_t ascii85MaxEncodedLength(size_t decodedLength) {
     return  ((decodedLength + 3) / 4) * 5;
 }
 
+/**
+ * Compute the Fletcher-16 checksum of a byte array
+ * @param data Data
+ * @param size Size of the data
+ * @return Checksum
+ */
+inline uint16_t fletcher16(const uint8_t* data, size_t size) {
+    uint16_t sum1 = 0, sum2 = 0;
+    for (size_t i = 0; i < size; ++i) {
+        sum1 = (sum1 + data[i]) % 255;
+        sum2 = (sum2 + sum1) % 255;
+    }
+    return (sum2 << 8) | sum1;
+}
+
 /**
  * System Config contains system parameters that are set at compile-time
  */
 struct SystemConfig
 {
     // MEASURING AND STORING
-    // max capacity of packetPublishingQueue and packetStorageQueue
-    static constexpr uint8_t PACKET_QUEUE_CAPACITY = 10;       
-    // maximum number of packets stored in the flash
-    static constexpr uint16_t FLASH_MAX_PACKETS = 1024;
-    // how many measurement data points are used to compute one average
+    // max capacity of packetPublishingQueue and packetStorageQueue (power of two, it is also the capacity of the
+    // ring buffers)
+    static constexpr uint8_t PACKET_QUEUE_CAPACITY = 8;
+    // capacity of the priority lane of packetPublishingQueue (power of two)
+    static constexpr uint8_t PACKET_PRIORITY_LANE_CAPACITY = 4;
+    // how long (ms) a push into a full queue with the BLOCK_WITH_TIMEOUT overflow policy waits for free space
+    static constexpr system_tick_t PACKET_QUEUE_BLOCK_TIMEOUT = 2000;
+    // how often a push into a full queue with the DROP_OLDEST overflow policy tries to make room before the new
+    // packet is dropped instead
+    static constexpr uint8_t PACKET_QUEUE_DROP_ATTEMPTS = 2 * PACKET_QUEUE_CAPACITY;
+    // number of packets that fit into the flash spill area of the Packet Publishing Queue
+    static constexpr uint16_t FLASH_SPILL_RECORDS = 64;
+    // number of queued packets above which the Packet Publisher moves routine packets of the Packet Publishing
+    // Queue to the flash spill area, so that the producers find room in the queue
+    static constexpr uint8_t PACKET_QUEUE_SPILL_THRESHOLD = PACKET_QUEUE_CAPACITY / 2;
+    // maximum number of publishes that are in flight (sent, but not yet completed) at the same time
+    static constexpr uint8_t PUBLISH_WINDOW_SIZE = 4;
+    // time (ms) after which an in-flight publish is considered failed and its packet is queued again
+    static constexpr system_tick_t PUBLISH_TIMEOUT = 60 * 1000;
+    // number of packets in the packet pool: the publishing (both lanes), storage and waiting error queues, the
+    // in-flight publishes plus the packets held by the threads. Every slot holds a whole Packet of about 830 bytes,
+    // so the 38 slots take about 31 KB of RAM, a large share of the Argon's heap
+    static constexpr uint16_t PACKET_POOL_SIZE = 3 * PACKET_QUEUE_CAPACITY + PACKET_PRIORITY_LANE_CAPACITY +
+                                                 PUBLISH_WINDOW_SIZE + 6;
+    // Particle cloud rate limit: a burst of PUBLISH_BURST_SIZE events, then one event every PUBLISH_REFILL_PERIOD ms
+    static constexpr uint16_t PUBLISH_BURST_SIZE = 4;
+    static constexpr system_tick_t PUBLISH_REFILL_PERIOD = 1000;
+    // how many packets are published between logs of the packet pool statistics
+    static constexpr uint16_t PACKET_POOL_STATS_LOG_INTERVAL = 100;
+    // upper bound for the number of packets stored in the flash (limits the RAM used by the index). The
+    // actual capacity is derived from the free space of the file system.
+    static constexpr uint16_t FLASH_MAX_PACKETS = 2048;
+    // number of packet records in one preallocated flash segment file
+    static constexpr uint16_t FLASH_SEGMENT_RECORDS = 64;
+    // number of segments left unallocated when the flash packet log is created
+    static constexpr uint16_t FLASH_RESERVED_SEGMENTS = 2;
+    // number of data point packet sequence numbers reserved with one write to the flash
+    static constexpr uint32_t SEQUENCE_RESERVATION_BLOCK = 256;
+    // how many measurement data points are used to compute one average after a reboot, the number can be changed
+    // at runtime with the setAveraging function
     static constexpr uint16_t N_DATA_POINTS_AVERAGING = 2;
+    // range of the number of measurement data points that are averaged. The minimum determines the shortest time
+    // span of a Data Point Packet, which sizes the folder indexes on the SD card.
+    static constexpr uint16_t AVERAGING_MIN_WINDOW = 1;
+    static constexpr uint16_t AVERAGING_MAX_WINDOW = 3600;
+    // lengths (s) of the windows of the sliding means, which are exposed as the airQuality cloud variable
+    static constexpr std::array<uint16_t, 4> SLIDING_MEAN_WINDOWS{60, 5 * 60, 15 * 60, 60 * 60};
+    // number of partial sums into which every sliding mean window is divided, the windows slide in steps of one
+    static constexpr uint16_t SLIDING_MEAN_BUCKETS = 15;
+    // how many acquisition cycles are timed between logs of their CPU cycle and scheduling statistics
+    static constexpr uint16_t ACQUISITION_STATS_LOG_INTERVAL = 300;
     // period (s) with which measurements are read from the sensors
     static constexpr uint16_t SPS30_MEASUREMENT_PERIOD = 1;
+    // the timestamps of the measurements follow the deadlines of the acquisition cycles, they are aligned to the
+    // system time again if they deviate from it by more than this (s)
+    static constexpr time32_t ACQUISITION_MAX_CLOCK_DEVIATION = 1;
     // max time between two handshakes. If this time is exceeded, the system will stop publishing packets until
     // the next handshake arrives.
     static constexpr time32_t HANDSHAKE_MAX_PERIOD = 100*3600;
     // how often new sub-folders are created on the sd-card
     static constexpr time32_t SD_CARD_SUBFOLDER_TIMESPAN = 3600;
+    // sub-folders are grouped into parent folders spanning this period (must be a multiple of
+    // SD_CARD_SUBFOLDER_TIMESPAN), so that no directory grows without bound
+    static constexpr time32_t SD_CARD_PARENT_FOLDER_TIMESPAN = 24 * 3600;
+    // store all packets of a sub-folder period in one preallocated segment file instead of one file per packet
+    static constexpr bool SD_CARD_SEGMENT_FILES = true;
+    // size of the buffer through which records are written to the segment file (multiple of 512, must hold a sector
+    // and a record)
+    static constexpr size_t SD_CARD_SEGMENT_BUFFER_SIZE = 2048;
+    // how many records are appended to the segment file before its directory entry is synced
+    static constexpr uint16_t SD_CARD_SEGMENT_SYNC_RECORDS = 10;
+    // how many folder indexes are cached in RAM for handshake searches
+    static constexpr size_t SD_CARD_FOLDER_INDEX_CACHE_SIZE = 3;
+    // write an index file when a sub-folder or segment file is closed, so that it is not scanned again
+    static constexpr bool SD_CARD_FOLDER_INDEX_FILES = true;
+    // number of entries in the sequence index on the SD card, which maps the sequence numbers of the most recent
+    // packets to their location
+    static constexpr uint32_t SD_CARD_SEQUENCE_INDEX_ENTRIES = 16384;
+    // how many sequence index entries are read with the storage mutex held, before it is released for other threads
+    static constexpr uint16_t SD_CARD_SEQUENCE_LOOKUP_CHUNK = 64;
+    // how many packets are saved to the SD card between logs of the save latency histogram
+    static constexpr uint16_t SD_CARD_LATENCY_LOG_INTERVAL = 60;
+    // how long (ms) the Packet Storage Queue must stay empty before packet files of the former SD card layouts are
+    // migrated
+    static constexpr system_tick_t SD_CARD_MIGRATION_IDLE_PERIOD = 5000;
+    // number of packet files migrated at a time, between the saves of new packets
+    static constexpr uint8_t SD_CARD_MIGRATION_BATCH = 16;
     // SPS30 COMMUNICATION
     static constexpr uint8_t SPS30_SDA_1 = SDA;
     static constexpr uint8_t SPS30_SCL_1 = SCL;
@@ -78,16 +173,54 @@ struct SystemConfig
     // Device ID of this board
     std::string deviceId;
 
-    // how many bytes one datapoint takes
+    // values of data points are sent as fixed-point integers in units of 1 / DATAPOINT_SCALE, limited to 24 bits
+    static constexpr uint32_t DATAPOINT_SCALE = 100 * 32;
+    static constexpr uint32_t DATAPOINT_MAX_VALUE = 0xFFFFFF;
+
+    // how many bytes one datapoint takes in the former, not delta-encoded format of Data Point Packets
     static constexpr int DATAPOINT_SIZE = 10 * 3 + 4;
 
-    // Maximum size of one outgoing packet before encoding
-    static constexpr int PACKET_MAX_SIZE_BYTES = 150 / 5 * 4;
+    // encode the values of sensor 2 as differences to the values of sensor 1 in Data Point Packets
+    static constexpr bool DATA_POINT_RESIDUAL_ENCODING = true;
+
+    // encode the data points as Rice codes instead of varints in Data Point Packets, which needs the current server
+    static constexpr bool DATA_POINT_RICE_CODES = true;
+
+    // send the minimum, maximum and standard deviation of the averaged measurements with every data point, in
+    // Data Point Packets with the "dps" event name, if at least STATISTICS_MIN_WINDOW measurements are averaged
+    static constexpr bool DATA_POINT_STATISTICS = true;
+    static constexpr uint16_t STATISTICS_MIN_WINDOW = 4;
+
+    // Maximum size of the data of a Particle Cloud event or function argument. Gen3 devices accept 1024 bytes,
+    // older platforms 622.
+#if PLATFORM_GEN >= 3
+    static constexpr int CLOUD_DATA_MAX_SIZE = 1024;
+#else
+    static constexpr int CLOUD_DATA_MAX_SIZE = 622;
+#endif
+
+    // Maximum size of one outgoing packet before encoding, so that its ascii85 encoding fits into the event data
+    static constexpr int PACKET_MAX_SIZE_BYTES = CLOUD_DATA_MAX_SIZE / 5 * 4;
+
+    // stack size of the threads, which keep packets and their encoded or stored forms on the stack
+    static constexpr size_t THREAD_STACK_SIZE = 2 * 1024 + 3 * PACKET_MAX_SIZE_BYTES;
 
     // Maximum number of requested packets that can be sent in response to one handshake (don't increase!)
     static constexpr uint8_t MAX_REQUESTED_PACKETS_PER_HANDSHAKE = 250;
+    // how long (ms) the handshake response waits for space in the publishing queue before it is aborted
+    static constexpr system_tick_t HANDSHAKE_RESPONSE_QUEUE_TIMEOUT = 60 * 1000;
 };
 
+/**
+ * Convert a measured value to the fixed-point representation of data points, rounded to the nearest integer and
+ * limited to [0, DATAPOINT_MAX_VALUE]. NaN is converted to 0.
+ */
+inline uint32_t toDatapointValue(float value) {
+    constexpr float MAX_VALUE = SystemConfig::DATAPOINT_MAX_VALUE;
+    if (std::isnan(value)) return 0;
+    return static_cast<uint32_t>(std::clamp(value * SystemConfig::DATAPOINT_SCALE + 0.5f, 0.0f, MAX_VALUE));
+}
+
 /**
  * System state stores the configuration variables that may change at runtime
  */
@@ -107,6 +240,10 @@ struct SystemState
     bool disableSPS30OnError = false;
 
     time32_t lastHandshakeTimestamp = 0;
+
+    // number of measurement data points that are averaged into one data point, within
+    // [AVERAGING_MIN_WINDOW, AVERAGING_MAX_WINDOW]
+    uint16_t averagingWindow = SystemConfig::N_DATA_POINTS_AVERAGING;
 };
 
 #endif
@@ -0,0 +1,201 @@
+// Equivalence test of the Averaging Accumulator with the former averaging of the Measurement Collector.
+//
+// The former code averaged the window of two measurements in double, and the packet converted the average through
+// float to the fixed-point value, floor(3200.0 * valF + 0.5). The accumulator computes the same value with integers
+// only. It must agree with it bit by bit for values up to DATAPOINT_MAX_VALUE / DATAPOINT_SCALE, beyond which the
+// former 3 bytes wrapped around and the accumulator limits the value instead.
+//
+// Windows of other lengths were not supported formerly. Their averages are checked against the exact average
+// rounded to the nearest float, up to the longest window of MAX_COUNT measurements.
+
+#include "AveragingAccumulator.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(condition, ...) do { if(!(condition)) { ++failures; std::printf("FAILED: " __VA_ARGS__); std::printf("\n"); } } while(0)
+
+// largest value whose fixed-point value fits into the 3 bytes of a data point, 5242.88 rounded down to a float
+const float MAX_VALUE =
+    std::nextafter(static_cast<float>(SystemConfig::DATAPOINT_MAX_VALUE) / SystemConfig::DATAPOINT_SCALE, 0.0f);
+
+/**
+ * The former computation: MeasurementCollector::computeAverage() and DataPointPacket::append().
+ */
+uint32_t formerAverage(const std::vector<float>& values)
+{
+    double avg = 0.0;
+    for(float value : values) {
+        avg += value;
+    }
+    avg /= values.size();
+    const float valF = avg;
+    const double measurementMultiplier = 100.0 * 32.0;
+    uint32_t valI = measurementMultiplier * valF + 0.5;
+    return valI;
+}
+
+uint32_t accumulatorAverage(const std::vector<float>& values)
+{
+    AveragingAccumulator<1> accumulator;
+    for(float value : values) {
+        accumulator.add({value});
+    }
+    return accumulator.getAverage()[0];
+}
+
+/**
+ * The exactly rounded average floor(3200 * average + 0.5), without the rounding to float.
+ */
+uint32_t exactAverage(const std::vector<float>& values)
+{
+    // every value of at least 2^-16 is a whole multiple of 2^-40
+    __int128 sum = 0;
+    for(float value : values) {
+        sum += static_cast<__int128>(std::ldexp(static_cast<double>(value), 40));
+    }
+    __int128 n = values.size();
+    return static_cast<uint32_t>((sum * 3200 + n * ((__int128)1 << 39)) / (n * ((__int128)1 << 40)));
+}
+
+/**
+ * The exact average rounded to the nearest float, ties to even, then scaled and rounded like the former average.
+ */
+uint32_t floatRoundedAverage(const std::vector<float>& values)
+{
+    __int128 sum = 0;
+    for(float value : values) {
+        sum += static_cast<__int128>(std::ldexp(static_cast<double>(value), 40));
+    }
+    const __int128 n = values.size();
+    // the nearest float is the approximation or one of its neighbours
+    const float approximation = static_cast<float>(static_cast<long double>(sum) / n / std::ldexp(1.0L, 40));
+    float nearest = approximation;
+    __int128 nearestError = -1;
+    for(float candidate : {std::nextafter(approximation, 0.0f), approximation,
+                           std::nextafter(approximation, HUGE_VALF)}) {
+        __int128 error = sum - n * static_cast<__int128>(std::ldexp(static_cast<double>(candidate), 40));
+        error = error < 0 ? -error : error;
+        bool even = (static_cast<uint32_t>(std::ldexp(candidate, -std::ilogb(candidate) + 23)) & 1) == 0;
+        if(nearestError < 0 || error < nearestError || (error == nearestError && even)) {
+            nearest = candidate;
+            nearestError = error;
+        }
+    }
+    return std::min<uint32_t>(3200.0 * nearest + 0.5, SystemConfig::DATAPOINT_MAX_VALUE);
+}
+
+/**
+ * Random measured value: uniform on a logarithmic scale from 2^-16 to the largest value, or uniform on a linear one.
+ */
+float randomValue(std::mt19937_64& random)
+{
+    if(random() & 1) {
+        std::uniform_real_distribution<float> exponent(-16.0f, std::log2(MAX_VALUE));
+        return std::min(std::exp2(exponent(random)), MAX_VALUE);
+    }
+    std::uniform_real_distribution<float> linear(0.0f, MAX_VALUE);
+    return linear(random);
+}
+
+void checkExample()
+{
+    // an average that is rounded differently with and without the rounding to float
+    std::vector<float> values{1384.64526f, 1036.30505f};
+    CHECK(formerAverage(values) == 3873520, "former average of the example is %u", formerAverage(values));
+    CHECK(accumulatorAverage(values) == 3873520, "average of the example is %u", accumulatorAverage(values));
+    CHECK(exactAverage(values) == 3873521, "exact average of the example is %u", exactAverage(values));
+}
+
+void checkRandomPairs(uint32_t pairs)
+{
+    std::mt19937_64 random(20);
+    uint32_t differences = 0;
+    uint32_t exactDifferences = 0;
+    for(uint32_t i = 0; i < pairs; ++i) {
+        std::vector<float> values{randomValue(random), randomValue(random)};
+        uint32_t former = formerAverage(values);
+        uint32_t average = accumulatorAverage(values);
+        if(average != former && ++differences <= 10) {
+            std::printf("FAILED: average of %.9g and %.9g is %u, formerly %u\n", values[0], values[1], average, former);
+        }
+        exactDifferences += exactAverage(values) != former;
+    }
+    failures += differences;
+    std::printf("%u random pairs: %u differences from the former average, which differs from the exactly rounded "
+                "one in %u (%.1f%%)\n", pairs, differences, exactDifferences, 100.0 * exactDifferences / pairs);
+}
+
+void checkTies(uint32_t pairs)
+{
+    // the average of neighbouring floats lies halfway between them, the float rounding goes to the even one
+    std::mt19937_64 random(21);
+    uint32_t differences = 0;
+    for(uint32_t i = 0; i < pairs; ++i) {
+        float value = randomValue(random);
+        std::vector<float> values{value, std::nextafter(value, MAX_VALUE)};
+        differences += accumulatorAverage(values) != formerAverage(values);
+    }
+    CHECK(differences == 0, "%u of %u averages of neighbouring floats differ from the former average", differences,
+          pairs);
+}
+
+void checkWindows(uint32_t windows)
+{
+    // long windows of large values take the path with two divisions, whose sums exceed 2^32 * 2^-8
+    std::mt19937_64 random(22);
+    uint32_t differences = 0;
+    uint32_t formerDifferences = 0;
+    uint64_t values = 0;
+    for(uint32_t w = 0; w < windows; ++w) {
+        uint32_t length = w % 100 == 0 ? AveragingAccumulator<1>::MAX_COUNT : 1 + random() % 3600;
+        std::vector<float> window(length);
+        for(float& value : window) {
+            value = randomValue(random);
+        }
+        uint32_t average = accumulatorAverage(window);
+        uint32_t expected = floatRoundedAverage(window);
+        if(average != expected && ++differences <= 10) {
+            std::printf("FAILED: average of %u values is %u, the float-rounded average %u\n", length, average,
+                        expected);
+        }
+        formerDifferences += average != std::min(formerAverage(window), SystemConfig::DATAPOINT_MAX_VALUE);
+        values += length;
+    }
+    failures += differences;
+    std::printf("%u windows of 1 to %lu values, %llu values: %u differences from the float-rounded average, %u from "
+                "the former double computation\n", windows,
+                static_cast<unsigned long>(AveragingAccumulator<1>::MAX_COUNT), static_cast<unsigned long long>(values),
+                differences, formerDifferences);
+}
+
+void checkSpecialValues()
+{
+    CHECK(accumulatorAverage({0.0f, 0.0f}) == 0, "average of zeros");
+    CHECK(accumulatorAverage({NAN, 2.0f}) == 3200, "NaN counts as 0");
+    CHECK(accumulatorAverage({-5.0f, 1.0f}) == 1600, "negative values count as 0");
+    CHECK(accumulatorAverage({1e-30f, 1e-30f}) == 0, "tiny average");
+    CHECK(accumulatorAverage({MAX_VALUE, MAX_VALUE}) == formerAverage({MAX_VALUE, MAX_VALUE}), "largest value");
+    CHECK(accumulatorAverage({6000.0f, 6000.0f}) == SystemConfig::DATAPOINT_MAX_VALUE, "large average is limited");
+    CHECK(accumulatorAverage({1e9f, 1e9f}) == SystemConfig::DATAPOINT_MAX_VALUE, "huge average is limited");
+}
+
+}
+
+int main()
+{
+    checkExample();
+    checkRandomPairs(2000000);
+    checkTies(200000);
+    checkWindows(5000);
+    checkSpecialValues();
+    std::printf(failures == 0 ? "passed\n" : "%d checks failed\n", failures);
+    return failures == 0 ? 0 : 1;
+}
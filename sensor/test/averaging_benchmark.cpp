@@ -0,0 +1,34 @@
+// Host run of the Averaging Benchmark: the former averaging of the acquisition cycles in double against the
+// Averaging Accumulator. On the device, the firmware runs it with the "benchmarkAveraging" function if it is built
+// with ENABLE_AVERAGING_BENCHMARK_FUNCTION.
+//
+// On the host, doubles are computed by the FPU, while the Cortex-M4F emulates them in software, so the host numbers
+// show the former path at its best.
+
+#include "AveragingBenchmark.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+int main()
+{
+    const uint32_t cycles = 1 << 16;
+    const int repetitions = 15;
+    std::printf("median ns per acquisition cycle of %lu cycles, %d repetitions\n",
+                static_cast<unsigned long>(cycles), repetitions);
+    std::printf("window   former   accumulator\n");
+    for (uint16_t window : {1, 2, 10, 60, 3600}) {
+        std::vector<uint32_t> former, accumulator;
+        for (int r = 0; r < repetitions; ++r) {
+            AveragingBenchmark::Result result = AveragingBenchmark::run(window, cycles);
+            former.push_back(result.formerTicks);
+            accumulator.push_back(result.accumulatorTicks);
+        }
+        std::sort(former.begin(), former.end());
+        std::sort(accumulator.begin(), accumulator.end());
+        std::printf("%6u %8lu %13lu\n", window, static_cast<unsigned long>(former[repetitions / 2]),
+                    static_cast<unsigned long>(accumulator[repetitions / 2]));
+    }
+    return 0;
+}
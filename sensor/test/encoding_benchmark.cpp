@@ -0,0 +1,118 @@
+// Benchmark of the Data Point Packet encodings with the firmware encoder: bytes per data point and data points per
+// publish of the former 34-byte format and of the delta encodings, with varints and with Rice codes. Fails if the
+// encoding of the firmware does not reach GOAL.
+//
+// The recording is read from the csv files written by server/data_event_listener.py (timestamp, time, 10 values),
+// or, without a directory, generated by recording.h. The synthetic recording has 1 % measurement noise on every
+// value.
+//
+//   ./encoding_benchmark [csv directory]
+
+#include "recording.h"
+
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+namespace {
+
+// the goal of the delta encoding: at least this many times more data points per publish than the former format
+constexpr double GOAL = 2.0;
+constexpr size_t FORMER_DATA_POINTS = DataPointPacket::FULL_SIZE_BYTES / SystemConfig::DATAPOINT_SIZE;
+
+using Rows = std::map<time32_t, DatapointInteger>;
+
+Rows readCsv(const std::filesystem::path& directory)
+{
+    Rows rows;
+    for(const auto& entry : std::filesystem::recursive_directory_iterator(directory)) {
+        if(entry.path().extension() != ".csv") continue;
+        std::ifstream file(entry.path());
+        std::string line;
+        while(std::getline(file, line)) {
+            std::stringstream fields(line);
+            std::string field;
+            std::vector<std::string> row;
+            while(std::getline(fields, field, ',')) row.push_back(field);
+            if(row.size() < 12) continue;
+            try {
+                DatapointInteger dpi;
+                for(size_t i = 0; i < dpi.size(); ++i) dpi[i] = toDatapointValue(std::stof(row[i + 2]));
+                rows[std::stoi(row[0])] = dpi;
+            } catch(const std::exception&) {
+                // header or corrupted line
+            }
+        }
+    }
+    return rows;
+}
+
+Rows generate(time32_t period, size_t count)
+{
+    Rows rows;
+    Recording recording;
+    for(size_t i = 0; i < count; ++i) rows[1704067200 + i * period] = recording.next();
+    return rows;
+}
+
+time32_t typicalPeriod(const Rows& rows)
+{
+    std::map<time32_t, size_t> periods;
+    for(auto it = rows.begin(); std::next(it) != rows.end(); ++it) ++periods[std::next(it)->first - it->first];
+    return std::max_element(periods.begin(), periods.end(), [](auto& a, auto& b) { return a.second < b.second; })->first;
+}
+
+struct Result {
+    size_t packets = 0;
+    size_t bytes = 0;
+};
+
+Result encode(const Rows& rows, time32_t period, DataPointPacket::Encoding encoding)
+{
+    Result result;
+    PacketWriter writer(period, encoding);
+    auto take = [&] {
+        uint16_t size;
+        writer.take().getBytes(&size);
+        ++result.packets;
+        result.bytes += size;
+    };
+    for(const auto& [timestamp, dpi] : rows) {
+        if(writer.append(dpi, timestamp)) take();
+    }
+    if(writer.flush()) take();
+    return result;
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    Rows rows = argc > 1 ? readCsv(argv[1]) : generate(2, 24 * 1800);
+    if(rows.size() < 2) {
+        std::printf("No data points found.\n");
+        return 1;
+    }
+    const time32_t period = typicalPeriod(rows);
+    std::printf("%zu data points (%s), period %d s, packets of up to %zu bytes\n", rows.size(),
+                argc > 1 ? argv[1] : "synthetic recording", period, DataPointPacket::FULL_SIZE_BYTES);
+    std::printf("%-24s %12s %16s %8s\n", "format", "bytes/point", "points/publish", "gain");
+    const double formerPoints = FORMER_DATA_POINTS;
+    std::printf("%-24s %12.1f %16.1f %7.2fx\n", "former 34-byte", static_cast<double>(SystemConfig::DATAPOINT_SIZE),
+                formerPoints, 1.0);
+    double gain = 0;
+    for(auto [name, encoding] : {std::pair{"delta varint", DataPointPacket::ENCODING_DELTA_VARINT},
+                                 std::pair{"residual delta varint", DataPointPacket::ENCODING_RESIDUAL_DELTA_VARINT},
+                                 std::pair{"delta Rice", DataPointPacket::ENCODING_DELTA_RICE},
+                                 std::pair{"residual delta Rice", DataPointPacket::ENCODING_RESIDUAL_DELTA_RICE}}) {
+        Result r = encode(rows, period, encoding);
+        double points = static_cast<double>(rows.size()) / r.packets;
+        bool firmware = encoding == DataPointPacket::DEFAULT_ENCODING;
+        if(firmware) gain = points / formerPoints;
+        std::printf("%-24s %12.1f %16.1f %7.2fx%s\n", name, static_cast<double>(r.bytes) / rows.size(), points,
+                    points / formerPoints, firmware ? "  (firmware)" : "");
+    }
+    std::printf("firmware encoding: %.2fx more data points per publish, at least %.0fx required\n", gain, GOAL);
+    return gain >= GOAL ? 0 : 1;
+}
@@ -0,0 +1,85 @@
+// Packet Storage Manager running on the host: the SD card is a temporary directory and the storage thread is a host
+// thread, which saves the packets pushed with save(). The flash is not used.
+#ifndef HOST_STORAGE_H
+#define HOST_STORAGE_H
+
+#include "ErrorHandler.h"
+#include "PacketPool.h"
+#include "PacketQueue.h"
+#include "PacketStorageManager.h"
+
+#include <filesystem>
+#include <functional>
+#include <stdexcept>
+
+class HostStorage
+{
+public:
+    /**
+     * @param name Prefix of the temporary directory of the card
+     * @param prepareCard Called with the device directory before the storage is initialised, e.g. to write the
+     *                    files of former layouts
+     */
+    explicit HostStorage(const std::string& name, const std::function<void(const std::string&)>& prepareCard = {})
+        : root(makeRoot(name)), sd(root), eh(publishingQueue, storageQueue, sysconfig, sysstate),
+          psm(storageQueue, sd, sysconfig, sysstate, eh)
+    {
+        sysconfig.deviceId = std::string(Particle.deviceID());
+        sysstate.flashActive = false;
+        pool.init();
+        publishingQueue.init(SystemConfig::PACKET_QUEUE_CAPACITY, pool, PacketQueue::OverflowPolicy::BLOCK_WITH_TIMEOUT,
+                             PacketQueue::Backend::MPSC_RING);
+        storageQueue.init(SystemConfig::PACKET_QUEUE_CAPACITY, pool, PacketQueue::OverflowPolicy::BLOCK_WITH_TIMEOUT,
+                          PacketQueue::Backend::SPSC_RING);
+        if(prepareCard) {
+            std::filesystem::create_directory(deviceDir());
+            prepareCard(deviceDir());
+        }
+        psm.initStorage();
+        if(!sysstate.sdActive) throw std::runtime_error("SD card init failed");
+        psm.start();
+    }
+
+    /**
+     * Queue a packet for the storage thread, waiting while the queue is full.
+     */
+    void save(const Packet& packet) {
+        if(!storageQueue.push(packet)) throw std::runtime_error("packet storage queue is full");
+    }
+
+    /**
+     * Wait until the storage thread has saved all queued packets.
+     */
+    void drain() const {
+        while(pool.getStats().used > 0) {
+            std::this_thread::yield();
+        }
+        if(!sysstate.sdActive) throw std::runtime_error("SD card error while saving packets");
+    }
+
+    /**
+     * Remove the card. The storage thread is never stopped, so the object must not be destroyed.
+     */
+    void removeCard() const { std::filesystem::remove_all(root); }
+
+    std::string deviceDir() const { return root + "/" + sysconfig.deviceId; }
+
+    const std::string root;
+    SystemConfig sysconfig;
+    SystemState sysstate;
+    PacketPool pool;
+    PacketQueue publishingQueue;
+    PacketQueue storageQueue;
+    SdFat32 sd;
+    ErrorHandler eh;
+    PacketStorageManager psm;
+
+private:
+    static std::string makeRoot(const std::string& name) {
+        std::string path = (std::filesystem::temp_directory_path() / (name + "-XXXXXX")).string();
+        if(mkdtemp(path.data()) == nullptr) throw std::runtime_error("cannot create " + path);
+        return path;
+    }
+};
+
+#endif
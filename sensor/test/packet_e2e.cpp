@@ -0,0 +1,157 @@
+// Device side of the end-to-end packet test, driven by packet_e2e_test.py: records data points into Data Point
+// Packets, saves them to a card in a temporary directory and answers handshakes through the Handshake Handler.
+// Everything that would be published is printed as it would be sent: ascii85-encoded by the firmware encoder.
+//
+// Output, one item per line:
+//   point <timestamp> <10 fixed-point values>   data point as recorded, before the encoding
+//   dp <ascii85>                                Data Point Packet
+//   rdp <ascii85>                               Requested Data Point Packet answering the current handshake
+//   end                                         response to the current handshake complete
+//   statistics <timestamp> <10 values> <10 minima> <10 maxima> <10 standard deviations>
+//                                               data point with statistics, recorded once for all encodings
+//   encoding <encoding>                         the following dps packets hold these data points in this encoding
+//   dps <ascii85>                               Data Point Packet with statistics
+// Input: one ascii85-encoded handshake per line, as the handshake function receives it.
+//
+//   ./packet_e2e <start timestamp> <hours>
+
+#include "HandshakeHandler.h"
+#include "ascii85.h"
+#include "host_storage.h"
+#include "recording.h"
+
+#include <iostream>
+#include <random>
+#include <tuple>
+
+namespace {
+
+void print(const char* type, const Packet& packet)
+{
+    uint16_t size;
+    const uint8_t* data = packet.getBytes(&size);
+    constexpr size_t PACKET_MAX_SIZE_UTF8 = ascii85MaxEncodedLength(SystemConfig::PACKET_MAX_SIZE_BYTES);
+    uint8_t encoded[PACKET_MAX_SIZE_UTF8];
+    int32_t length = encode_ascii85(data, size, encoded, PACKET_MAX_SIZE_UTF8);
+    if(length < 0 || length > SystemConfig::CLOUD_DATA_MAX_SIZE) {
+        std::fprintf(stderr, "%s packet of %u bytes cannot be published\n", type, size);
+        std::exit(1);
+    }
+    std::printf("%s %.*s\n", type, static_cast<int>(length), encoded);
+}
+
+/**
+ * Record data points with statistics into packets of every encoding. A few of the data points are late or jump, so
+ * that the escapes of the encodings are used.
+ */
+void printEncodings(time32_t start, time32_t period)
+{
+    Recording recording(2);
+    std::mt19937 random(2);
+    std::vector<std::tuple<time32_t, DatapointInteger, DatapointStatistics>> points;
+    time32_t t = start;
+    for(int n = 0; n < 300; ++n, t += period) {
+        DatapointInteger dpi = recording.next();
+        if(n % 50 == 49) t += 3;
+        if(n % 70 == 69) std::transform(dpi.begin(), dpi.end(), dpi.begin(), [](uint32_t v) { return 8 * v; });
+        DatapointStatistics statistics;
+        std::printf("statistics %d", t);
+        for(uint32_t v : dpi) std::printf(" %u", v);
+        for(size_t i = 0; i < dpi.size(); ++i) {
+            statistics.minimum[i] = dpi[i] - random() % (dpi[i] / 20 + 1);
+            statistics.maximum[i] = dpi[i] + random() % (dpi[i] / 20 + 1);
+            statistics.standardDeviation[i] = random() % (dpi[i] / 40 + 1);
+        }
+        for(const DatapointInteger* s : {&statistics.minimum, &statistics.maximum, &statistics.standardDeviation}) {
+            for(uint32_t v : *s) std::printf(" %u", v);
+        }
+        std::printf("\n");
+        points.emplace_back(t, dpi, statistics);
+    }
+    for(auto encoding : {DataPointPacket::ENCODING_DELTA_VARINT, DataPointPacket::ENCODING_RESIDUAL_DELTA_VARINT,
+                         DataPointPacket::ENCODING_DELTA_RICE, DataPointPacket::ENCODING_RESIDUAL_DELTA_RICE}) {
+        std::printf("encoding %u\n", encoding);
+        DataPointPacket packet(encoding, true);
+        packet.setPeriod(period);
+        uint32_t sequenceNumber = 1;
+        for(const auto& [timestamp, dpi, statistics] : points) {
+            if(!packet.append(dpi, timestamp, &statistics)) {
+                packet.finish(sequenceNumber++);
+                print("dps", packet);
+                packet.reset();
+                packet.append(dpi, timestamp, &statistics);
+            }
+        }
+        packet.finish(sequenceNumber);
+        print("dps", packet);
+    }
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    if(argc != 3) {
+        std::fprintf(stderr, "usage: %s <start timestamp> <hours>\n", argv[0]);
+        return 2;
+    }
+    const time32_t start = std::atoi(argv[1]);
+    const time32_t end = start + std::atoi(argv[2]) * 3600;
+    const time32_t period = SystemConfig::N_DATA_POINTS_AVERAGING * SystemConfig::SPS30_MEASUREMENT_PERIOD;
+    auto storage = new HostStorage("packet-e2e");  // never destroyed, see HostStorage::removeCard()
+
+    Recording recording;
+    PacketWriter writer(period);
+    for(time32_t t = start; t < end; t += period) {
+        DatapointInteger dpi = recording.next();
+        std::printf("point %d", t);
+        for(uint32_t v : dpi) std::printf(" %u", v);
+        std::printf("\n");
+        if(writer.append(dpi, t)) {
+            const DataPointPacket& packet = writer.take();
+            print("dp", packet);
+            storage->save(packet);
+        }
+    }
+    if(writer.flush()) {
+        const DataPointPacket& packet = writer.take();
+        print("dp", packet);
+        storage->save(packet);
+    }
+    storage->drain();
+    printEncodings(end, period);
+    std::fflush(stdout);
+
+    storage->sysstate.lastHandshakeTimestamp = Time.now();
+    HandshakeHandler handshakeHandler(storage->psm, storage->publishingQueue, storage->sysstate, storage->eh);
+    handshakeHandler.start();
+    std::string line;
+    while(std::getline(std::cin, line)) {
+        // the handler takes the next handshake once it has queued the last packet of the previous response
+        int attempts = 0;
+        while(!handshakeHandler.putHandshake(line.c_str())) {
+            if(++attempts == 100) {
+                std::fprintf(stderr, "handshake rejected\n");
+                return 1;
+            }
+            delay(50);
+        }
+        // the response ends with the packet whose number is the total minus one
+        Packet packet;
+        while(true) {
+            if(!storage->publishingQueue.take(&packet, 10000)) {
+                std::fprintf(stderr, "no response to the handshake\n");
+                return 1;
+            }
+            print("rdp", packet);
+            uint16_t size;
+            const uint8_t* data = packet.getBytes(&size);
+            if(size < RequestedDataPointPacket::HEADER_SIZE || data[5] + 1 >= data[4]) break;
+        }
+        std::printf("end\n");
+        std::fflush(stdout);
+    }
+
+    storage->removeCard();
+    return 0;
+}
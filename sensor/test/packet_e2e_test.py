@@ -0,0 +1,149 @@
+"""End-to-end test of the packet formats: the firmware encoders (run on the host by packet_e2e) against the
+decoders of the server in server/packet.py.
+
+- Every Data Point Packet must fit into an event and decode into the recorded data points.
+- Packets with statistics in every encoding must decode into the recorded data points and statistics.
+- The packets must use the full packet size.
+- Handshakes with the maximum number of time intervals and with sequence ranges, encoded by the server, must be
+  answered with Requested Data Point Packets that hold exactly the requested packets, numbered consistently.
+
+    python3 packet_e2e_test.py <path of packet_e2e>
+"""
+import os
+import subprocess
+import sys
+import time
+from pathlib import Path
+
+sys.path.insert(0, str(Path(__file__).resolve().parents[2] / 'server'))
+
+from packet import (DataPointPacket, DataPointStatisticsPacket, HandshakePacket,  # noqa: E402
+                    RequestedDataPointPacket, PACKET_MAX_SIZE_BYTES)
+
+CLOUD_DATA_MAX_SIZE = 1024
+MAX_DATA_POINT_SIZE = (1 + 32 + 10 * (16 + 32) + 7) // 8  # DataPointPacket::MAX_DATA_POINT_SIZE
+RDP_HEADER_SIZE = 10  # RequestedDataPointPacket::HEADER_SIZE
+FULL_SIZE_BYTES = PACKET_MAX_SIZE_BYTES - RDP_HEADER_SIZE - RequestedDataPointPacket._ENTRY_HEADER_LENGTH
+MULTIPLIER = 32 * 100
+START = 1704067200
+HOURS = 12
+DEVICE_ID = 'e00fce68host000000000000'
+# the maximum number of intervals, which cover about half of the packets
+INTERVALS = [(START + i * 400, START + i * 400 + 150) for i in range(HandshakePacket.max_intervals)]
+RANGES = [(5, 9), (100, 100), (200, 260)]
+
+failures = []
+
+
+def check(condition: bool, message: str):
+    if not condition:
+        failures.append(message)
+        print('FAILED:', message)
+
+
+def timestamp_of(entry) -> int:
+    return int(time.mktime(entry.timestamp))
+
+
+def check_data_points(packets, recorded):
+    decoded = {}
+    for packet in packets:
+        for entry in packet.get_data_points():
+            decoded[timestamp_of(entry)] = [round(v * MULTIPLIER) for v in entry.data]
+    check(decoded == recorded, f'{len(decoded)} data points decoded, {len(recorded)} recorded, '
+                               f'{sum(decoded.get(t) != v for t, v in recorded.items())} differ')
+
+
+def check_statistics(packets_by_encoding, recorded):
+    for encoding, packets in packets_by_encoding.items():
+        decoded = {}
+        for packet in packets:
+            statistics = packet.get_statistics()
+            check(len(statistics) == len(packet.get_data_points()), f'encoding {encoding}: statistics missing')
+            for entry, stats in zip(packet.get_data_points(), statistics):
+                decoded[timestamp_of(entry)] = [round(v * MULTIPLIER) for v in entry.data + stats.data]
+        check(decoded == recorded, f'encoding {encoding}: {len(decoded)} data points with statistics decoded, '
+                                   f'{len(recorded)} recorded, {sum(decoded.get(t) != v for t, v in recorded.items())} '
+                                   f'differ')
+
+
+def check_response(rdps, handshake, expected, name):
+    numbers = [rdp.get_number() for rdp in rdps]
+    total = len(rdps)
+    check(numbers == [(total, n) for n in range(total)], f'{name}: response numbered {numbers}')
+    check(all(rdp.compare_handshake(handshake) for rdp in rdps), f'{name}: handshake timestamp not copied')
+    answered = [bytes(packet.data) for rdp in rdps for packet in rdp.get_packets()]
+    check(answered == [bytes(packet.data) for packet in expected],
+          f'{name}: {len(answered)} packets answered, {len(expected)} requested')
+
+
+def main():
+    os.environ['TZ'] = 'UTC'
+    time.tzset()
+    handshakes = {
+        'time intervals': HandshakePacket(DEVICE_ID, time_intervals=INTERVALS),
+        'sequence ranges': HandshakePacket(DEVICE_ID, sequence_ranges=RANGES),
+    }
+    check(len(handshakes['time intervals'].encode()[0]) <= CLOUD_DATA_MAX_SIZE,
+          'handshake with the maximum number of intervals does not fit into a function argument')
+    handshake_input = ''.join(h.encode()[0].decode() + '\n' for h in handshakes.values())
+
+    result = subprocess.run([sys.argv[1], str(START), str(HOURS)], input=handshake_input, capture_output=True,
+                            text=True, timeout=300)
+    check(result.returncode == 0, f'packet_e2e failed: {result.stderr}')
+
+    recorded = {}
+    packets = []
+    recorded_statistics = {}
+    statistics_packets = {}
+    responses = [[]]
+    for line in result.stdout.splitlines():
+        kind, _, value = line.partition(' ')
+        if kind == 'point':
+            fields = [int(f) for f in value.split()]
+            recorded[fields[0]] = fields[1:]
+        elif kind == 'dp':
+            check(len(value) <= CLOUD_DATA_MAX_SIZE, f'dp of {len(value)} characters')
+            packets.append(DataPointPacket(data_encoded=value, device_id=DEVICE_ID))
+        elif kind == 'rdp':
+            check(len(value) <= CLOUD_DATA_MAX_SIZE, f'rdp of {len(value)} characters')
+            responses[-1].append(RequestedDataPointPacket(value, DEVICE_ID))
+        elif kind == 'end':
+            responses.append([])
+        elif kind == 'statistics':
+            fields = [int(f) for f in value.split()]
+            recorded_statistics[fields[0]] = fields[1:]
+        elif kind == 'encoding':
+            statistics_packets[int(value)] = []
+        elif kind == 'dps':
+            check(len(value) <= CLOUD_DATA_MAX_SIZE, f'dps of {len(value)} characters')
+            statistics_packets[list(statistics_packets)[-1]].append(
+                DataPointStatisticsPacket(data_encoded=value, device_id=DEVICE_ID))
+
+    sizes = [len(packet.data) for packet in packets]
+    print(f'{len(recorded)} data points in {len(packets)} packets of {min(sizes)}-{max(sizes)} bytes '
+          f'(full size {FULL_SIZE_BYTES}), {sum(sizes) / len(recorded):.1f} bytes per data point')
+    check(all(size <= FULL_SIZE_BYTES for size in sizes), 'packet larger than the full size')
+    check(all(size > FULL_SIZE_BYTES - MAX_DATA_POINT_SIZE for size in sizes[:-1]),
+          'packet closed before it was full')
+    check_data_points(packets, recorded)
+    check([p.get_sequence_number() for p in packets] == list(range(1, len(packets) + 1)),
+          'sequence numbers are not consecutive')
+    check(len(statistics_packets) == 4, f'packets with statistics in {len(statistics_packets)} encodings')
+    check_statistics(statistics_packets, recorded_statistics)
+
+    expected = {
+        'time intervals': [p for p in packets if any(a < p.get_timestamp() < b for a, b in INTERVALS)],
+        'sequence ranges': [p for p in packets if any(a <= p.get_sequence_number() <= b for a, b in RANGES)],
+    }
+    check(len(responses) == len(handshakes) + 1, f'{len(responses) - 1} handshake responses')
+    for (name, handshake), rdps in zip(handshakes.items(), responses):
+        print(f'{name}: {len(expected[name])} packets requested, answered in {len(rdps)} rdp packets')
+        check_response(rdps, handshake, expected[name], name)
+
+    print('passed' if not failures else f'{len(failures)} checks failed')
+    return 0 if not failures else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,215 @@
+// Benchmark of the SD card queries of handshakes: the former query path against the current one, on a catalog of
+// one year of packets recorded through the Packet Storage Manager, with 99 requested intervals per query.
+//
+// The current path is PacketStorageManager::findPackets(). The former path is the algorithm of the first firmware
+// version: the sub-folder timestamps are kept in RAM, every query walks all of them and rescans the remaining
+// intervals for each one, and the packets of a folder are found with linear find_if scans. It reads the timestamps
+// of a folder from the same folder index file as the current path, so both do the same I/O per visited folder.
+//
+//   ./query_benchmark [days] [queries]
+
+#include "host_storage.h"
+#include "recording.h"
+
+#include <set>
+
+namespace {
+
+constexpr time32_t START = 1704067200;  // 2024-01-01 00:00:00 UTC
+constexpr time32_t DAY = 24 * 3600;
+constexpr time32_t PERIOD = SystemConfig::N_DATA_POINTS_AVERAGING * SystemConfig::SPS30_MEASUREMENT_PERIOD;
+constexpr size_t INTERVALS = 99;
+
+using Descriptor = PacketStorageManager::PacketDescriptor;
+using Intervals = static_vector<interval_t, INTERVALS>;
+
+/**
+ * Former query path, see the comment at the top.
+ */
+class FormerQuery
+{
+public:
+    FormerQuery(const std::vector<time32_t>& subFolderTimestampsIndex, std::string deviceId)
+        : subFolderTimestampsIndex(subFolderTimestampsIndex), deviceId(std::move(deviceId)) {}
+
+    bool findPacketsOnSDCard(Intervals intervals, std::vector<Descriptor>& output) {
+        Intervals relevantIntervals{};  // intervals which may include the PREVIOUS subfolder
+        for(size_t i = 1; i < subFolderTimestampsIndex.size(); ++i) {
+            relevantIntervals.clear();
+            const time32_t currentFolder = subFolderTimestampsIndex[i];
+            const time32_t previousFolder = subFolderTimestampsIndex[i - 1];
+            auto intervalIt = intervals.begin();
+            while(intervalIt < intervals.end()) {
+                if(intervalIt->first < currentFolder) {
+                    relevantIntervals.push_back(*intervalIt);
+                    if(intervalIt->second < currentFolder) {
+                        intervalIt = intervals.erase(intervalIt);
+                        continue;
+                    }
+                }
+                ++intervalIt;
+            }
+            if(!relevantIntervals.empty()) {
+                if(!findPacketsInFolder(previousFolder, relevantIntervals, output)) return false;
+                if(i == subFolderTimestampsIndex.size() - 1 && !findPacketsInFolder(currentFolder, intervals, output)) {
+                    return false;
+                }
+            }
+            if(intervals.empty()) {
+                break;
+            }
+        }
+        return true;
+    }
+
+    size_t folderVisits = 0;
+
+private:
+    bool findPacketsInFolder(time32_t folderTimestamp, const Intervals& intervals, std::vector<Descriptor>& output) {
+        ++folderVisits;
+        static_vector<time32_t, PacketStorageManager::MAX_PACKETS_PER_FOLDER> packetTimestamps;
+        if(!readFolderIndexFile(folderTimestamp, packetTimestamps)) return false;
+        for(const auto& interval : intervals) {
+            auto packetsBegin = std::find_if(packetTimestamps.begin(), packetTimestamps.end(),
+                                             [interval](time32_t t) { return interval.first < t; });
+            auto packetsEnd = std::find_if(packetTimestamps.begin(), packetTimestamps.end(),
+                                           [interval](time32_t t) { return interval.second <= t; });
+            for(auto it = packetsBegin; it < packetsEnd; ++it) {
+                output.push_back(Descriptor{.location = folderTimestamp, .packetTimestamp = *it, .offset = 0});
+            }
+        }
+        return true;
+    }
+
+    template<class Container>
+    bool readFolderIndexFile(time32_t folderTimestamp, Container& timestamps) {
+        char path[64];
+        std::snprintf(path, sizeof(path), "/%s/%d/%d.idx", deviceId.c_str(),
+                      folderTimestamp - folderTimestamp % SystemConfig::SD_CARD_PARENT_FOLDER_TIMESPAN, folderTimestamp);
+        File32 file;
+        PacketStorageManager::FolderIndexFileHeader header;
+        if(!file.open(path, O_RDONLY) || file.read(&header, sizeof(header)) != sizeof(header) ||
+           header.count > timestamps.capacity()) {
+            return false;
+        }
+        timestamps.resize(header.count);
+        size_t size = header.count * sizeof(time32_t);
+        return file.read(timestamps.data(), size) == static_cast<int>(size);
+    }
+
+    const std::vector<time32_t>& subFolderTimestampsIndex;
+    std::string deviceId;
+};
+
+Intervals makeIntervals(std::mt19937& random, time32_t end)
+{
+    std::uniform_int_distribution<time32_t> start(START, end - 1800);
+    std::uniform_int_distribution<time32_t> length(60, 1800);
+    std::vector<time32_t> starts(INTERVALS);
+    std::generate(starts.begin(), starts.end(), [&] { return start(random); });
+    std::sort(starts.begin(), starts.end());
+    Intervals intervals;
+    time32_t previousEnd = 0;
+    for(time32_t s : starts) {
+        s = std::max(s, previousEnd);
+        intervals.push_back({s, s + length(random)});
+        previousEnd = intervals.back().second;
+    }
+    return intervals;
+}
+
+std::set<time32_t> timestamps(const std::vector<Descriptor>& descriptors)
+{
+    std::set<time32_t> result;
+    for(const auto& d : descriptors) result.insert(d.packetTimestamp);
+    return result;
+}
+
+volatile size_t planningSink;  // keeps the walk from being optimized away
+
+double median(std::vector<double> values)
+{
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    const int days = argc > 1 ? std::atoi(argv[1]) : 365;
+    const int queries = argc > 2 ? std::atoi(argv[2]) : 50;
+    auto storage = new HostStorage("query-benchmark");  // never destroyed, see HostStorage::removeCard()
+
+    std::printf("recording %d days...\n", days);
+    Recording recording;
+    PacketWriter writer(PERIOD);
+    size_t packets = 0;
+    for(time32_t t = START; t < START + days * DAY; t += PERIOD) {
+        if(writer.append(recording.next(), t)) {
+            storage->save(writer.take());
+            ++packets;
+        }
+    }
+    storage->drain();
+    std::vector<time32_t> subFolders;
+    for(time32_t folder = START; folder < START + days * DAY; folder += SystemConfig::SD_CARD_SUBFOLDER_TIMESPAN) {
+        subFolders.push_back(folder);
+    }
+    std::printf("%zu packets in %zu sub-folders, %d queries of %zu intervals\n", packets, subFolders.size(), queries,
+                INTERVALS);
+
+    // the segment of the last day is still written to, the former path can only read closed segments
+    const time32_t end = START + (days - 1) * DAY;
+    std::mt19937 random(3);
+    std::vector<double> formerMs, currentMs, planningMs;
+    size_t mismatches = 0, found = 0, formerVisits = 0;
+    for(int q = 0; q < queries; ++q) {
+        Intervals intervals = makeIntervals(random, end);
+        FormerQuery former(subFolders, storage->sysconfig.deviceId);
+        std::vector<Descriptor> formerOutput, currentOutput;
+
+        auto start = std::chrono::steady_clock::now();
+        former.findPacketsOnSDCard(intervals, formerOutput);
+        auto middle = std::chrono::steady_clock::now();
+        storage->psm.findPackets(intervals, currentOutput);
+        auto stop = std::chrono::steady_clock::now();
+        formerMs.push_back(std::chrono::duration<double, std::milli>(middle - start).count());
+        currentMs.push_back(std::chrono::duration<double, std::milli>(stop - middle).count());
+        formerVisits += former.folderVisits;
+
+        // the walk over the folders and intervals alone, without reading any folder
+        auto planningStart = std::chrono::steady_clock::now();
+        Intervals remaining = intervals;
+        size_t relevant = 0;
+        for(size_t i = 1; i < subFolders.size() && !remaining.empty(); ++i) {
+            for(auto it = remaining.begin(); it < remaining.end();) {
+                if(it->first < subFolders[i]) {
+                    ++relevant;
+                    if(it->second < subFolders[i]) {
+                        it = remaining.erase(it);
+                        continue;
+                    }
+                }
+                ++it;
+            }
+        }
+        planningMs.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() -
+                                                                       planningStart).count());
+        planningSink = relevant;
+
+        found += currentOutput.size();
+        if(timestamps(formerOutput) != timestamps(currentOutput)) ++mismatches;
+    }
+
+    std::printf("%-34s %12s\n", "query path", "median (ms)");
+    std::printf("%-34s %12.3f\n", "former: walk all folders, find_if", median(formerMs));
+    std::printf("%-34s %12.3f\n", "  of which the walk over folders", median(planningMs));
+    std::printf("%-34s %12.3f\n", "current: sweep, binary search", median(currentMs));
+    std::printf("speedup %.1fx, %.1f packets and %.1f folder reads of the former path per query, "
+                "%zu queries with different results\n",
+                median(formerMs) / median(currentMs), static_cast<double>(found) / queries,
+                static_cast<double>(formerVisits) / queries, mismatches);
+    storage->removeCard();
+    return 0;
+}
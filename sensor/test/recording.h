@@ -0,0 +1,104 @@
+// Synthetic recording of the two SPS30 sensors: slowly drifting concentrations with measurement noise, the second
+// sensor close to the first one. Values are in the fixed-point representation of data points.
+#ifndef RECORDING_H
+#define RECORDING_H
+
+#include "main.h"
+#include "Packets/DataPointPacket.h"
+
+#include <random>
+
+class Recording
+{
+public:
+    explicit Recording(uint32_t seed = 1) : random(seed) {}
+
+    DatapointInteger next() {
+        // mass concentrations PM1.0, PM2.5, PM4.0, PM10 (ug/m3) and the typical particle size (um), per sensor
+        level = std::clamp(level + drift(random), 2.0, 150.0);
+        const std::array<double, 5> base{level * 0.7, level, level * 1.1, level * 1.15, 0.6};
+        DatapointFloat values;
+        for(size_t i = 0; i < 5; ++i) {
+            values[i] = base[i] * (1 + noise(random));
+            values[i + 5] = values[i] * (1 + noise(random) / 2);
+        }
+        DatapointInteger dpi;
+        std::transform(values.begin(), values.end(), dpi.begin(), [](double v) { return toDatapointValue(v); });
+        return dpi;
+    }
+
+private:
+    std::mt19937 random;
+    std::normal_distribution<double> drift{0, 0.05};
+    std::normal_distribution<double> noise{0, 0.01};
+    double level = 12;
+};
+
+/**
+ * Packs the data points of a recording into Data Point Packets, the way the Measurement Collector does.
+ */
+class PacketWriter
+{
+public:
+    explicit PacketWriter(time32_t period, DataPointPacket::Encoding encoding = DataPointPacket::DEFAULT_ENCODING,
+                          uint32_t firstSequenceNumber = 1)
+        : period(period), encoding(encoding), sequenceNumber(firstSequenceNumber) { reset(); }
+
+    /**
+     * Append a data point.
+     * @return true if a packet is complete, it must be taken before the next data point is appended
+     */
+    bool append(const DatapointInteger& dpi, time32_t timestamp) {
+        if(!packet.append(dpi, timestamp)) {
+            finish();
+            pending = dpi;
+            pendingTimestamp = timestamp;
+            return true;
+        }
+        if(packet.isFull()) {
+            finish();
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * Finish the current packet early, e.g. when the device is switched off.
+     * @return true if there was a packet to finish
+     */
+    bool flush() {
+        if(packet.isEmpty()) return false;
+        finish();
+        return true;
+    }
+
+    /**
+     * Take the complete packet and start the next one.
+     */
+    const DataPointPacket& take() {
+        done = packet;
+        reset();
+        if(pendingTimestamp != 0) {
+            packet.append(pending, pendingTimestamp);
+            pendingTimestamp = 0;
+        }
+        return done;
+    }
+
+private:
+    void finish() { packet.finish(sequenceNumber++); }
+    void reset() {
+        packet = DataPointPacket{encoding};
+        packet.setPeriod(period);
+    }
+
+    time32_t period;
+    DataPointPacket::Encoding encoding;
+    uint32_t sequenceNumber;
+    DataPointPacket packet;
+    DataPointPacket done;
+    DatapointInteger pending{};
+    time32_t pendingTimestamp = 0;
+};
+
+#endif
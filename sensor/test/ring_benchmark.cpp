@@ -0,0 +1,136 @@
+// Microbenchmark of the Packet Queue backends: the lock-free MPSC and SPSC rings against a bounded queue guarded
+// by a mutex, which stands in for the RTOS queue (os_queue) of the OS_QUEUE backend. The RTOS queue takes a
+// critical section for every put and take and blocks on the empty and full conditions in the same way.
+//
+// The numbers are measured on the host, they show the relative cost of the backends under contention, not the
+// cost on the device.
+
+#include "MpscRing.h"
+#include "SpscRing.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr size_t CAPACITY = 8;  // SystemConfig::PACKET_QUEUE_CAPACITY
+
+struct Item {
+    uint64_t sentNs;
+    uint32_t id;
+};
+
+uint64_t nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * Bounded queue with the blocking behaviour of os_queue_put() and os_queue_take().
+ */
+class LockedQueue
+{
+public:
+    bool push(const Item& item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [this] { return items.size() < CAPACITY; });
+        items.push_back(item);
+        notEmpty.notify_one();
+        return true;
+    }
+
+    bool pop(Item* item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if(!notEmpty.wait_for(lock, std::chrono::milliseconds(1), [this] { return !items.empty(); })) {
+            return false;
+        }
+        *item = items.front();
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+    std::deque<Item> items;
+};
+
+struct Result {
+    double nsPerItem;
+    uint64_t medianLatencyNs;
+    uint64_t p99LatencyNs;
+};
+
+template<class Queue>
+Result run(Queue& queue, size_t producers, uint32_t itemsPerProducer)
+{
+    const uint64_t total = static_cast<uint64_t>(producers) * itemsPerProducer;
+    std::vector<uint64_t> latencies;
+    latencies.reserve(total);
+    std::atomic<bool> go{false};
+    std::vector<std::thread> threads;
+    for(size_t p = 0; p < producers; ++p) {
+        threads.emplace_back([&] {
+            while(!go.load()) {
+            }
+            for(uint32_t i = 0; i < itemsPerProducer; ++i) {
+                while(!queue.push(Item{nowNs(), i})) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+
+    uint64_t start = nowNs();
+    go.store(true);
+    Item item;
+    while(latencies.size() < total) {
+        if(queue.pop(&item)) {
+            latencies.push_back(nowNs() - item.sentNs);
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    uint64_t elapsed = nowNs() - start;
+    for(auto& t : threads) t.join();
+
+    std::sort(latencies.begin(), latencies.end());
+    return {static_cast<double>(elapsed) / total, latencies[total / 2], latencies[total * 99 / 100]};
+}
+
+void print(const char* name, size_t producers, const Result& r)
+{
+    std::printf("%-14s %9zu %12.1f %14llu %12llu\n", name, producers, r.nsPerItem,
+                static_cast<unsigned long long>(r.medianLatencyNs), static_cast<unsigned long long>(r.p99LatencyNs));
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    uint32_t items = argc > 1 ? std::atoi(argv[1]) : 200000;
+    std::printf("%u items per producer, queue capacity %zu\n", items, CAPACITY);
+    std::printf("%-14s %9s %12s %14s %12s\n", "backend", "producers", "ns/item", "median lat ns", "p99 lat ns");
+    for(size_t producers : {1, 2, 4}) {
+        LockedQueue locked;
+        print("os_queue-like", producers, run(locked, producers, items));
+        MpscRing<Item, CAPACITY> mpsc;
+        print("MPSC_RING", producers, run(mpsc, producers, items));
+        if(producers == 1) {
+            SpscRing<Item, CAPACITY> spsc;
+            print("SPSC_RING", producers, run(spsc, producers, items));
+        }
+    }
+    return 0;
+}
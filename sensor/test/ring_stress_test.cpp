@@ -0,0 +1,152 @@
+// Multi-producer stress test of the lock-free rings of the Packet Queue.
+//
+// Every item carries its producer and a per-producer counter, so the consumer can check that no item is lost,
+// duplicated or reordered. The rings have the capacity of the firmware queue, so they wrap around constantly.
+
+#include "MpscRing.h"
+#include "SpscRing.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr size_t CAPACITY = 8;  // SystemConfig::PACKET_QUEUE_CAPACITY
+constexpr uint32_t PRODUCER_SHIFT = 24;
+constexpr uint32_t COUNTER_MASK = (1u << PRODUCER_SHIFT) - 1;
+
+int failures = 0;
+
+void check(bool condition, const char* what)
+{
+    if(!condition) {
+        std::printf("FAILED: %s\n", what);
+        ++failures;
+    }
+}
+
+/**
+ * Consume until all producers are done and the ring is empty, checking the per-producer order.
+ * @return Number of items received from every producer
+ */
+template<class Ring>
+std::vector<uint32_t> consume(Ring& ring, size_t producers, const std::atomic<size_t>& producersDone)
+{
+    std::vector<uint32_t> received(producers, 0);
+    std::vector<int64_t> last(producers, -1);
+    bool ordered = true;
+    uint32_t item;
+    while(true) {
+        if(ring.pop(&item)) {
+            uint32_t producer = item >> PRODUCER_SHIFT;
+            int64_t counter = item & COUNTER_MASK;
+            ordered = ordered && producer < producers && counter > last[producer];
+            if(producer < producers) {
+                last[producer] = counter;
+                ++received[producer];
+            }
+        } else if(producersDone.load() == producers && ring.empty()) {
+            break;
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    check(ordered, "items of every producer arrive in order");
+    return received;
+}
+
+/**
+ * Producers retry until their item fits, the consumer must receive every item exactly once.
+ */
+void mpscNoLoss(size_t producers, uint32_t items)
+{
+    MpscRing<uint32_t, CAPACITY> ring;
+    std::atomic<size_t> producersDone{0};
+    std::vector<std::thread> threads;
+    for(uint32_t p = 0; p < producers; ++p) {
+        threads.emplace_back([&, p] {
+            for(uint32_t i = 0; i < items; ++i) {
+                while(!ring.push((p << PRODUCER_SHIFT) | i)) {
+                    std::this_thread::yield();
+                }
+            }
+            ++producersDone;
+        });
+    }
+    std::vector<uint32_t> received = consume(ring, producers, producersDone);
+    for(auto& t : threads) t.join();
+
+    bool complete = true;
+    for(uint32_t r : received) complete = complete && r == items;
+    check(complete, "MPSC ring delivers every item");
+    std::printf("mpsc no loss: %zu producers x %u items\n", producers, items);
+}
+
+/**
+ * Producers make room by popping the oldest item, like push() with the DROP_OLDEST policy, so the ring has a
+ * second consumer. Every item must be either received or dropped exactly once.
+ */
+void mpscDropOldest(size_t producers, uint32_t items)
+{
+    MpscRing<uint32_t, CAPACITY> ring;
+    std::atomic<size_t> producersDone{0};
+    std::atomic<uint32_t> dropped{0};
+    std::vector<std::thread> threads;
+    for(uint32_t p = 0; p < producers; ++p) {
+        threads.emplace_back([&, p] {
+            uint32_t oldest;
+            for(uint32_t i = 0; i < items; ++i) {
+                while(!ring.push((p << PRODUCER_SHIFT) | i)) {
+                    if(ring.pop(&oldest)) {
+                        ++dropped;
+                    } else {
+                        std::this_thread::yield();  // a preempted producer holds the cell
+                    }
+                }
+            }
+            ++producersDone;
+        });
+    }
+    std::vector<uint32_t> received = consume(ring, producers, producersDone);
+    for(auto& t : threads) t.join();
+
+    uint64_t total = dropped.load();
+    for(uint32_t r : received) total += r;
+    check(total == static_cast<uint64_t>(producers) * items, "every item is either received or dropped");
+    std::printf("mpsc drop oldest: %zu producers x %u items, %u dropped\n", producers, items, dropped.load());
+}
+
+void spsc(uint32_t items)
+{
+    SpscRing<uint32_t, CAPACITY> ring;
+    std::atomic<size_t> producersDone{0};
+    std::thread producer([&] {
+        for(uint32_t i = 0; i < items; ++i) {
+            while(!ring.push(i)) {
+                std::this_thread::yield();
+            }
+        }
+        ++producersDone;
+    });
+    std::vector<uint32_t> received = consume(ring, 1, producersDone);
+    producer.join();
+    check(received[0] == items, "SPSC ring delivers every item");
+    std::printf("spsc: %u items\n", items);
+}
+
+}  // namespace
+
+int main()
+{
+    mpscNoLoss(1, 200000);
+    mpscNoLoss(4, 200000);
+    mpscNoLoss(8, 100000);
+    mpscDropOldest(4, 200000);
+    mpscDropOldest(8, 100000);
+    spsc(1000000);
+    std::printf(failures == 0 ? "all checks passed\n" : "%d checks failed\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,204 @@
+// Soak test of the SD card catalog: records a year of packets through the Packet Storage Manager into a card in a
+// temporary directory, with outages of whole days and of hours, and checks after every month:
+// - that every directory of the card stays small: one parent folder per recorded day, at most a segment file and
+//   its index file per hour in a parent folder,
+// - that time interval and sequence number queries return exactly the recorded packets, and how long they take.
+// At the end, a packet of a closed hour reopens its segment file, which must be preallocated again.
+// The memory of the Packet Storage Manager is fixed at compile time, its size is printed.
+//
+//   ./sd_catalog_soak_test [days]
+
+#include "host_storage.h"
+#include "recording.h"
+
+#include <filesystem>
+#include <map>
+
+namespace {
+
+constexpr time32_t START = 1704067200;  // 2024-01-01 00:00:00 UTC
+constexpr time32_t DAY = 24 * 3600;
+constexpr time32_t PERIOD = SystemConfig::N_DATA_POINTS_AVERAGING * SystemConfig::SPS30_MEASUREMENT_PERIOD;
+constexpr size_t HANDSHAKE_INTERVALS = 99;
+
+int failures = 0;
+
+#define CHECK(condition, ...) do { if(!(condition)) { ++failures; std::printf("FAILED: " __VA_ARGS__); std::printf("\n"); } } while(0)
+
+using Descriptors = std::vector<PacketStorageManager::PacketDescriptor>;
+
+// timestamp -> sequence number of every saved packet
+std::map<time32_t, uint32_t> saved;
+
+/**
+ * The device is switched off on days 40-42 and every seventh day from 3:00 to 6:00.
+ */
+bool isRecording(time32_t t)
+{
+    time32_t day = (t - START) / DAY;
+    time32_t hour = (t - START) % DAY / 3600;
+    return !(day >= 40 && day <= 42) && !(day % 7 == 0 && hour >= 3 && hour < 6);
+}
+
+size_t expectedCount(const interval_t& interval)
+{
+    auto begin = saved.upper_bound(interval.first);
+    auto end = saved.lower_bound(interval.second);
+    return begin == saved.end() || begin->first >= interval.second ? 0 : std::distance(begin, end);
+}
+
+template<class F>
+double measureMs(F function)
+{
+    auto start = std::chrono::steady_clock::now();
+    function();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+struct CardLayout {
+    size_t deviceDirEntries = 0;
+    size_t parentFolders = 0;
+    size_t maxParentFolderEntries = 0;
+};
+
+CardLayout inspect(const std::string& deviceDir)
+{
+    CardLayout layout;
+    for(const auto& entry : std::filesystem::directory_iterator(deviceDir)) {
+        ++layout.deviceDirEntries;
+        if(!entry.is_directory()) continue;
+        ++layout.parentFolders;
+        size_t entries = std::distance(std::filesystem::directory_iterator(entry), {});
+        layout.maxParentFolderEntries = std::max(layout.maxParentFolderEntries, entries);
+    }
+    return layout;
+}
+
+/**
+ * Check the packets found for the intervals against the saved ones and read some of them back.
+ */
+void checkFound(HostStorage& storage, const static_vector<interval_t, HANDSHAKE_INTERVALS>& intervals,
+                const Descriptors& found, const char* query)
+{
+    size_t expected = 0;
+    for(const auto& interval : intervals) expected += expectedCount(interval);
+    CHECK(found.size() == expected, "%s found %zu packets, %zu were saved", query, found.size(), expected);
+    for(size_t i = 0; i < found.size(); i += 97) {
+        static_vector<uint8_t, DataPointPacket::MAX_SIZE_BYTES> data;
+        uint32_t sequenceNumber = 0;
+        bool read = storage.psm.getPacket(found[i], std::back_inserter(data)) &&
+                    DataPointPacket::getSequenceNumber(data.data(), data.size(), &sequenceNumber);
+        auto it = saved.find(found[i].packetTimestamp);
+        CHECK(read && it != saved.end() && it->second == sequenceNumber, "%s: packet %d cannot be read back", query,
+              found[i].packetTimestamp);
+    }
+}
+
+/**
+ * A handshake as the server sends it: short gaps spread over the recorded time.
+ */
+static_vector<interval_t, HANDSHAKE_INTERVALS> makeHandshakeIntervals(std::mt19937& random, time32_t end)
+{
+    std::uniform_int_distribution<time32_t> start(START, end - 1800);
+    std::uniform_int_distribution<time32_t> length(60, 1800);
+    std::vector<time32_t> starts(HANDSHAKE_INTERVALS);
+    std::generate(starts.begin(), starts.end(), [&] { return start(random); });
+    std::sort(starts.begin(), starts.end());
+    static_vector<interval_t, HANDSHAKE_INTERVALS> intervals;
+    time32_t previousEnd = 0;
+    for(time32_t s : starts) {
+        s = std::max(s, previousEnd);
+        intervals.push_back({s, s + length(random)});
+        previousEnd = intervals.back().second;
+    }
+    return intervals;
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    const int days = argc > 1 ? std::atoi(argv[1]) : 366;
+    auto storage = new HostStorage("sd-catalog-soak");  // never destroyed, see HostStorage::removeCard()
+    std::printf("sizeof(PacketStorageManager) = %zu bytes, fixed at compile time\n",
+                sizeof(PacketStorageManager));
+    std::printf("%5s %8s %14s %20s %18s %16s %16s\n", "day", "packets", "parent folders", "max entries/parent",
+                "99 intervals (ms)", "first day (ms)", "last 64 seq (ms)");
+
+    Recording recording;
+    PacketWriter writer(PERIOD);
+    uint32_t sequenceNumber = 1;
+    std::mt19937 random(7);
+    auto save = [&] {
+        const DataPointPacket& packet = writer.take();
+        saved[packet.getTimestamp()] = sequenceNumber++;
+        storage->save(packet);
+    };
+
+    for(int day = 1; day <= days; ++day) {
+        for(time32_t t = START + (day - 1) * DAY; t < START + day * DAY; t += PERIOD) {
+            if(!isRecording(t)) {
+                if(writer.flush()) save();
+                continue;
+            }
+            if(writer.append(recording.next(), t)) save();
+        }
+        if(day % 30 != 0 && day != days) continue;
+
+        if(writer.flush()) save();
+        storage->drain();
+        time32_t end = START + day * DAY;
+
+        CardLayout layout = inspect(storage->deviceDir());
+        int outageDays = std::clamp(day - 39, 0, 3);
+        CHECK(layout.parentFolders == static_cast<size_t>(day - outageDays), "%zu parent folders after %d days",
+              layout.parentFolders, day);
+        CHECK(layout.maxParentFolderEntries <= 2 * DAY / SystemConfig::SD_CARD_SUBFOLDER_TIMESPAN,
+              "%zu entries in a parent folder", layout.maxParentFolderEntries);
+
+        auto intervals = makeHandshakeIntervals(random, end);
+        Descriptors found;
+        double handshakeMs = measureMs([&] { storage->psm.findPackets(intervals, found); });
+        checkFound(*storage, intervals, found, "handshake");
+
+        static_vector<interval_t, HANDSHAKE_INTERVALS> firstDay{{START, START + DAY}};
+        Descriptors foundFirstDay;
+        double firstDayMs = measureMs([&] { storage->psm.findPackets(firstDay, foundFirstDay); });
+        checkFound(*storage, firstDay, foundFirstDay, "first day");
+
+        static_vector<interval_t, HANDSHAKE_INTERVALS> outage{{START + 40 * DAY, START + 43 * DAY}};
+        Descriptors foundOutage;
+        storage->psm.findPackets(outage, foundOutage);
+        CHECK(foundOutage.empty(), "%zu packets found in the outage", foundOutage.size());
+
+        static_vector<sequence_range_t, 1> ranges{{sequenceNumber - 64, sequenceNumber - 1}};
+        Descriptors foundSequence;
+        double sequenceMs = measureMs([&] { storage->psm.findPacketsBySequence(ranges, foundSequence); });
+        CHECK(foundSequence.size() == 64, "%zu of the last 64 sequence numbers found", foundSequence.size());
+
+        std::printf("%5d %8zu %14zu %20zu %18.2f %16.2f %16.2f\n", day, saved.size(), layout.parentFolders,
+                    layout.maxParentFolderEntries, handshakeMs, firstDayMs, sequenceMs);
+    }
+
+    // a packet of a closed hour, as after the clock was set back, reopens its segment file, which gets its
+    // preallocated space back
+    const time32_t hour = START + (days - 1) * DAY + 12 * 3600;
+    writer.append(recording.next(), hour + 1);
+    writer.flush();
+    save();
+    storage->drain();
+    std::string segmentPath = storage->deviceDir() + "/" + std::to_string(START + (days - 1) * DAY) + "/" +
+                              std::to_string(hour) + ".seg";
+    CHECK(std::filesystem::file_size(segmentPath) == PacketStorageManager::SEGMENT_PREALLOCATE_SIZE,
+          "reopened segment file has %ju bytes, %lu are preallocated",
+          static_cast<uintmax_t>(std::filesystem::file_size(segmentPath)),
+          static_cast<unsigned long>(PacketStorageManager::SEGMENT_PREALLOCATE_SIZE));
+    static_vector<interval_t, HANDSHAKE_INTERVALS> reopenedHour{{hour - 1, hour + 3600}};
+    Descriptors foundReopened;
+    storage->psm.findPackets(reopenedHour, foundReopened);
+    checkFound(*storage, reopenedHour, foundReopened, "reopened hour");
+
+    storage->removeCard();
+    std::printf(failures == 0 ? "passed\n" : "%d checks failed\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,150 @@
+// Test of the migration of the packet files of the former SD card layouts into the segment files, while packets are
+// saved to the segment file of the current hour:
+// - the packets of past hours are migrated into their own segment files, the current segment file keeps its
+//   preallocated space,
+// - the packets of the current hour are appended to the current segment file,
+// - the migrated files and folders are removed and the migration marker is written,
+// - a card with the migration marker is not migrated again.
+// The migration runs whenever the storage queue has been idle for SD_CARD_MIGRATION_IDLE_PERIOD, so the test takes
+// a few of these periods.
+
+#include "host_storage.h"
+#include "recording.h"
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <thread>
+
+namespace {
+
+constexpr time32_t START = 1704067200;  // 2024-01-01 00:00:00 UTC
+constexpr time32_t HOUR = SystemConfig::SD_CARD_SUBFOLDER_TIMESPAN;
+constexpr time32_t PAST_HOUR = START + 2 * HOUR;
+constexpr time32_t CURRENT_HOUR = START + 5 * HOUR;
+// folder of the former layout, created when the previous one was too old, so it is not aligned to a day
+constexpr time32_t FORMER_FOLDER = PAST_HOUR + 1234;
+
+int failures = 0;
+
+#define CHECK(condition, ...) do { if(!(condition)) { ++failures; std::printf("FAILED: " __VA_ARGS__); std::printf("\n"); } } while(0)
+
+using Descriptors = std::vector<PacketStorageManager::PacketDescriptor>;
+
+// timestamp -> sequence number of every packet, saved or written as a packet file
+std::map<time32_t, uint32_t> packets;
+PacketWriter writer(60);
+Recording recording;
+
+const DataPointPacket& makePacket(time32_t timestamp)
+{
+    writer.append(recording.next(), timestamp);
+    writer.flush();
+    const DataPointPacket& packet = writer.take();
+    uint32_t sequenceNumber = 0;
+    uint16_t size;
+    const uint8_t* data = packet.getBytes(&size);
+    DataPointPacket::getSequenceNumber(data, size, &sequenceNumber);
+    packets[timestamp] = sequenceNumber;
+    return packet;
+}
+
+void writePacketFile(const std::string& folder, time32_t timestamp)
+{
+    const DataPointPacket& packet = makePacket(timestamp);
+    uint16_t size;
+    const uint8_t* data = packet.getBytes(&size);
+    std::filesystem::create_directories(folder);
+    std::ofstream(folder + "/" + std::to_string(timestamp) + ".pkt", std::ios::binary)
+        .write(reinterpret_cast<const char*>(data), size);
+}
+
+std::string segmentPath(const std::string& deviceDir, time32_t hour)
+{
+    return deviceDir + "/" + std::to_string(hour - hour % SystemConfig::SD_CARD_PARENT_FOLDER_TIMESPAN) + "/" +
+           std::to_string(hour) + ".seg";
+}
+
+std::string markerPath(const std::string& deviceDir)
+{
+    return deviceDir + "/migrated.seg";
+}
+
+bool waitFor(const std::string& path, int seconds)
+{
+    for(int i = 0; i < seconds * 10 && !std::filesystem::exists(path); ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    return std::filesystem::exists(path);
+}
+
+/**
+ * Check that the packets of an hour are found and can be read back.
+ */
+void checkHour(HostStorage& storage, time32_t hour, size_t expected, const char* name)
+{
+    static_vector<interval_t, 1> intervals{{hour - 1, hour + HOUR}};
+    Descriptors found;
+    storage.psm.findPackets(intervals, found);
+    CHECK(found.size() == expected, "%zu packets of the %s hour found, %zu expected", found.size(), name, expected);
+    for(const auto& d : found) {
+        static_vector<uint8_t, DataPointPacket::MAX_SIZE_BYTES> data;
+        uint32_t sequenceNumber = 0;
+        bool read = storage.psm.getPacket(d, std::back_inserter(data)) &&
+                    DataPointPacket::getSequenceNumber(data.data(), data.size(), &sequenceNumber);
+        auto it = packets.find(d.packetTimestamp);
+        CHECK(read && it != packets.end() && it->second == sequenceNumber, "packet %d of the %s hour cannot be read",
+              d.packetTimestamp, name);
+    }
+}
+
+void checkMigration()
+{
+    auto storage = new HostStorage("sd-migration", [](const std::string& deviceDir) {
+        const std::string folder = deviceDir + "/" + std::to_string(FORMER_FOLDER);
+        for(time32_t t = PAST_HOUR + 1300; t < PAST_HOUR + 1300 + 20 * 60; t += 60) writePacketFile(folder, t);
+        for(time32_t t = CURRENT_HOUR + 60; t < CURRENT_HOUR + 4 * 60; t += 60) writePacketFile(folder, t);
+    });  // never destroyed, see HostStorage::removeCard()
+    const std::string deviceDir = storage->deviceDir();
+
+    for(time32_t t = CURRENT_HOUR + 600; t < CURRENT_HOUR + 660; t += 20) storage->save(makePacket(t));
+    storage->drain();
+    CHECK(!std::filesystem::exists(markerPath(deviceDir)), "migration marker written before the migration");
+
+    CHECK(waitFor(markerPath(deviceDir), 60), "migration did not finish");
+    CHECK(!std::filesystem::exists(deviceDir + "/" + std::to_string(FORMER_FOLDER)), "former folder is left");
+    CHECK(std::filesystem::file_size(segmentPath(deviceDir, CURRENT_HOUR)) ==
+          PacketStorageManager::SEGMENT_PREALLOCATE_SIZE, "current segment file lost its preallocated space");
+    checkHour(*storage, PAST_HOUR, 20, "past");
+    checkHour(*storage, CURRENT_HOUR, 6, "current");
+
+    // the current segment file is appended after the migrated packets
+    storage->save(makePacket(CURRENT_HOUR + 900));
+    storage->drain();
+    checkHour(*storage, CURRENT_HOUR, 7, "current");
+    storage->removeCard();
+}
+
+void checkMarker()
+{
+    // the marker of a finished migration is honoured after a reset, the folder is not scanned again
+    auto storage = new HostStorage("sd-migration", [](const std::string& deviceDir) {
+        std::ofstream(markerPath(deviceDir)).close();
+        writePacketFile(deviceDir + "/" + std::to_string(FORMER_FOLDER), PAST_HOUR + 1300);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(SystemConfig::SD_CARD_MIGRATION_IDLE_PERIOD + 1000));
+    CHECK(!std::filesystem::exists(segmentPath(storage->deviceDir(), PAST_HOUR)),
+          "card migrated again despite its migration marker");
+    storage->removeCard();
+}
+
+}  // namespace
+
+int main()
+{
+    checkMigration();
+    checkMarker();
+    std::printf(failures == 0 ? "passed\n" : "%d checks failed\n", failures);
+    return failures == 0 ? 0 : 1;
+}
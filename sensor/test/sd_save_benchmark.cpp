@@ -0,0 +1,166 @@
+// Benchmark of saving packets to per-packet files on the SD card: the former save path against the current one, with
+// the latency histogram that the Packet Storage Manager logs on the device.
+//
+// The former path is savePacketToSD() of the first firmware version: for every packet it checks that the sub-folder
+// exists, changes into it from the root, creates the file and changes back to the root. The current path keeps the
+// directory handle of the sub-folder open, as PacketStorageManager::openFolderDir() does, and creates the file
+// relative to it. On the device, every directory searched by a path lookup takes at least one sector read over SPI,
+// so the directory reads per save are the SPI time saved; the host latencies only show the relative cost of the calls.
+//
+//   ./sd_save_benchmark [packets]
+
+#include "LatencyHistogram.h"
+
+#include <SdFat.h>
+
+#include <filesystem>
+#include <stdexcept>
+
+namespace {
+
+constexpr time32_t START = 1704067200;  // 2024-01-01 00:00:00 UTC
+constexpr time32_t PERIOD = SystemConfig::N_DATA_POINTS_AVERAGING * SystemConfig::SPS30_MEASUREMENT_PERIOD;
+constexpr const char* DEVICE_ID = "e00fce68ae2b6ad5e46b2d8a";
+// clock of the software SPI of the card, see PacketStorageManager::initSDCardStorage()
+constexpr double SPI_CLOCK_HZ = 250000;
+constexpr double SECTOR_READ_US = 512 * 8 * 1e6 / SPI_CLOCK_HZ;
+
+uint8_t data[200] = {};
+
+void makeSubFolderPath(time32_t timestamp, char* path, size_t size)
+{
+    time32_t subFolder = timestamp - timestamp % SystemConfig::SD_CARD_SUBFOLDER_TIMESPAN;
+    std::snprintf(path, size, "/%s/%d/%d", DEVICE_ID,
+                  subFolder - subFolder % SystemConfig::SD_CARD_PARENT_FOLDER_TIMESPAN, subFolder);
+}
+
+/**
+ * Former save path, see the comment at the top.
+ */
+class FormerSave
+{
+public:
+    explicit FormerSave(SdFat32& sd) : sd(sd) {}
+
+    bool save(time32_t timestamp) {
+        char path[64];
+        makeSubFolderPath(timestamp, path, sizeof(path));
+        char filename[32];
+        std::snprintf(filename, sizeof(filename), "%d.pkt", timestamp);
+
+        File32 file;
+        if(!sd.exists(path) && !sd.mkdir(path)) return false;
+        return sd.chdir(path)
+               && file.open(filename, O_RDWR | O_CREAT)
+               && file.write(data, sizeof(data)) == sizeof(data)
+               && file.close()
+               && sd.chdir("/");
+    }
+
+private:
+    SdFat32& sd;
+};
+
+/**
+ * Current save path, with the directory handle that stays open while the packets go to the same sub-folder.
+ */
+class CurrentSave
+{
+public:
+    explicit CurrentSave(SdFat32& sd) : sd(sd) {}
+
+    bool save(time32_t timestamp) {
+        time32_t subFolder = timestamp - timestamp % SystemConfig::SD_CARD_SUBFOLDER_TIMESPAN;
+        if(!folderDir.isOpen() || subFolder != folderDirTimestamp) {
+            char path[64];
+            makeSubFolderPath(timestamp, path, sizeof(path));
+            folderDir.close();
+            if(!folderDir.open(path, O_RDONLY) && !(sd.mkdir(path) && folderDir.open(path, O_RDONLY))) return false;
+            folderDirTimestamp = subFolder;
+        }
+        char filename[32];
+        std::snprintf(filename, sizeof(filename), "%d.pkt", timestamp);
+        File32 file;
+        return file.open(&folderDir, filename, O_RDWR | O_CREAT)
+               && file.write(data, sizeof(data)) == sizeof(data)
+               && file.close();
+    }
+
+private:
+    SdFat32& sd;
+    File32 folderDir;
+    time32_t folderDirTimestamp = 0;
+};
+
+struct Result {
+    // the host is much faster than the card, so the histogram starts lower than on the device
+    LatencyHistogram latency{"SD save", 4};
+    uint64_t directoryReads = 0;
+};
+
+/**
+ * Save the packets on an empty card and record the latency and the directory reads of every save.
+ */
+template<class Save>
+Result run(const char* name, int packets)
+{
+    std::string root = (std::filesystem::temp_directory_path() / (std::string("sd-save-") + name + "-XXXXXX")).string();
+    if(mkdtemp(root.data()) == nullptr) throw std::runtime_error("cannot create " + root);
+    SdFat32 sd(root);
+    if(!sd.begin(SdSpiConfig())) throw std::runtime_error("cannot use " + root);
+
+    Result result;
+    uint64_t directoryReads = host::sdDirectoryReads;
+    {
+        Save save(sd);
+        for(int i = 0; i < packets; ++i) {
+            uint32_t startUs = micros();
+            if(!save.save(START + i * PERIOD)) throw std::runtime_error(std::string(name) + ": save failed");
+            result.latency.record(micros() - startUs);
+        }
+    }
+    result.directoryReads = host::sdDirectoryReads - directoryReads;
+    char path[64];
+    const time32_t last = START + (packets - 1) * PERIOD;
+    makeSubFolderPath(last, path, sizeof(path));
+    if(!std::filesystem::exists(root + path + "/" + std::to_string(last) + ".pkt")) {
+        throw std::runtime_error(std::string(name) + ": packet not saved in its sub-folder");
+    }
+    std::filesystem::remove_all(root);
+    return result;
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    const int packets = argc > 1 ? std::atoi(argv[1]) : 5000;
+    std::printf("saving %d packets of %zu bytes, one every %d s\n", packets, sizeof(data), PERIOD);
+
+    Result former = run<FormerSave>("former", packets);
+    Result current = run<CurrentSave>("current", packets);
+
+    std::printf("%-12s %12s %12s\n", "latency", "former", "current");
+    for(size_t i = 0; i < LatencyHistogram::BUCKETS; ++i) {
+        if(former.latency.getBucket(i) == 0 && current.latency.getBucket(i) == 0) continue;
+        char label[16];
+        if(i < LatencyHistogram::BUCKETS - 1) {
+            std::snprintf(label, sizeof(label), "<%luus", static_cast<unsigned long>(former.latency.getBucketLimit(i)));
+        } else {
+            std::snprintf(label, sizeof(label), ">=%luus",
+                          static_cast<unsigned long>(former.latency.getBucketLimit(i - 1)));
+        }
+        std::printf("%-12s %12lu %12lu\n", label, static_cast<unsigned long>(former.latency.getBucket(i)),
+                    static_cast<unsigned long>(current.latency.getBucket(i)));
+    }
+    std::printf("%-12s %12lu %12lu\n", "mean (us)", static_cast<unsigned long>(former.latency.getMean()),
+                static_cast<unsigned long>(current.latency.getMean()));
+    std::printf("%-12s %12lu %12lu\n", "max (us)", static_cast<unsigned long>(former.latency.getMax()),
+                static_cast<unsigned long>(current.latency.getMax()));
+    std::printf("%-12s %12.2f %12.2f\n", "dir reads", static_cast<double>(former.directoryReads) / packets,
+                static_cast<double>(current.directoryReads) / packets);
+    const double saved = static_cast<double>(former.directoryReads - current.directoryReads) / packets;
+    std::printf("%.2f fewer directory reads per save, at least %.1f ms of SPI transfer on the device\n", saved,
+                saved * SECTOR_READ_US / 1000);
+    return 0;
+}
@@ -0,0 +1,193 @@
+// Test of the sliding means of the current air quality:
+// - SlidingWindowMean against a reference that keeps every value with its sample period: the window holds the values
+//   of the current bucket and of the buckets - 1 before it, through rollover, eviction and skipped periods, and its
+//   partial sums do not overflow with the largest values,
+// - SlidingMeans snapshots read while the measurement thread publishes new ones are never torn.
+
+#include "SlidingMeans.h"
+
+#include <atomic>
+#include <cstdio>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(condition, ...) do { if(!(condition)) { ++failures; std::printf("FAILED: " __VA_ARGS__); std::printf("\n"); } } while(0)
+
+constexpr size_t CHANNELS = 2;
+constexpr size_t BUCKETS = 4;
+typedef SlidingWindowMean<CHANNELS, BUCKETS> Window;
+
+/**
+ * Every value with the sample period in which it was added.
+ */
+class ReferenceWindow
+{
+public:
+    explicit ReferenceWindow(uint32_t bucketSamples) : bucketSamples(bucketSamples) {}
+
+    void add(const Window::Values& values) { values_.push_back({period++, values}); }
+    void skip() { ++period; }
+
+    /**
+     * Number and sums of the values in the current bucket and the buckets - 1 before it.
+     */
+    uint32_t count(std::array<uint64_t, CHANNELS>* sums) const {
+        const uint64_t bucket = period / bucketSamples;
+        const uint64_t start = bucket >= BUCKETS - 1 ? (bucket - (BUCKETS - 1)) * bucketSamples : 0;
+        uint32_t n = 0;
+        *sums = {};
+        for(const auto& [p, values] : values_) {
+            if(p < start) continue;
+            ++n;
+            for(size_t i = 0; i < CHANNELS; ++i) (*sums)[i] += values[i];
+        }
+        return n;
+    }
+
+private:
+    uint32_t bucketSamples;
+    uint64_t period = 0;
+    std::vector<std::pair<uint64_t, Window::Values>> values_;
+};
+
+bool matches(const Window& window, const ReferenceWindow& reference)
+{
+    std::array<uint64_t, CHANNELS> sums;
+    uint32_t count = reference.count(&sums);
+    if(window.getCount() != count) return false;
+    for(size_t i = 0; i < CHANNELS; ++i) {
+        // the same float computation as getMean(), so the means must be equal
+        float mean = count == 0 ? 0.0f
+                     : static_cast<float>(sums[i]) / (static_cast<float>(count) * SystemConfig::DATAPOINT_SCALE);
+        if(window.getMean(i) != mean) return false;
+    }
+    return true;
+}
+
+void checkRollover()
+{
+    // random values and skipped periods, checked after every period
+    std::mt19937 random(23);
+    std::uniform_int_distribution<uint32_t> value(0, SystemConfig::DATAPOINT_MAX_VALUE);
+    for(uint32_t bucketSamples : {1, 3, 7}) {
+        Window window;
+        window.init(bucketSamples);
+        ReferenceWindow reference(bucketSamples);
+        int mismatches = 0;
+        for(int n = 0; n < 2000; ++n) {
+            if(random() % 10 < 3) {
+                window.skip();
+                reference.skip();
+            } else {
+                Window::Values values{value(random), value(random) / 1000};
+                window.add(values);
+                reference.add(values);
+            }
+            mismatches += !matches(window, reference);
+        }
+        CHECK(mismatches == 0, "%u sample periods per bucket: %d of 2000 periods differ from the reference",
+              bucketSamples, mismatches);
+    }
+}
+
+void checkEviction()
+{
+    Window window;
+    window.init(5);
+    ReferenceWindow reference(5);
+    for(int n = 0; n < 17; ++n) {
+        window.add({1000, 2000});
+        reference.add({1000, 2000});
+    }
+    CHECK(window.getCount() == 17 && window.getMean(1) == 2000.0f / SystemConfig::DATAPOINT_SCALE,
+          "window of 17 values holds %lu", static_cast<unsigned long>(window.getCount()));
+    // the window slides in steps of a bucket: the oldest bucket leaves it when a new one begins
+    for(int n = 0; n < 3; ++n) {
+        window.skip();
+        reference.skip();
+    }
+    CHECK(window.getCount() == 12 && matches(window, reference), "%lu values after the first bucket left the window",
+          static_cast<unsigned long>(window.getCount()));
+    for(size_t n = 0; n < 3 * 5; ++n) window.skip();
+    CHECK(window.getCount() == 0 && window.getMean(0) == 0.0f, "window is not empty after all buckets were skipped");
+    window.add({7, 8});
+    CHECK(window.getCount() == 1 && window.getMean(0) == 7.0f / SystemConfig::DATAPOINT_SCALE,
+          "value after an empty window");
+}
+
+void checkOverflow()
+{
+    // full buckets of the largest values, the sums of which do not fit into 32 bits
+    Window window;
+    window.init(Window::MAX_BUCKET_SAMPLES);
+    ReferenceWindow reference(Window::MAX_BUCKET_SAMPLES);
+    const Window::Values largest{SystemConfig::DATAPOINT_MAX_VALUE, SystemConfig::DATAPOINT_MAX_VALUE};
+    for(uint32_t n = 0; n < (BUCKETS + 2) * Window::MAX_BUCKET_SAMPLES; ++n) {
+        window.add(largest);
+        reference.add(largest);
+    }
+    CHECK(matches(window, reference), "window of the largest values differs from the reference");
+    CHECK(window.getCount() == (BUCKETS - 1) * Window::MAX_BUCKET_SAMPLES, "%lu values in the full window",
+          static_cast<unsigned long>(window.getCount()));
+}
+
+void checkSnapshots()
+{
+    // the writer gives all channels the same value, so a snapshot mixed from two publishes has different means
+    SlidingMeans means;
+    std::atomic<bool> done{false};
+    std::thread writer([&] {
+        DatapointFloat measurement;
+        for(uint32_t n = 0; n < 300000; ++n) {
+            if(n % 13 == 12) {
+                means.skip();
+                continue;
+            }
+            measurement.fill(static_cast<float>(n % 997) * 0.25f);
+            means.add(measurement);
+        }
+        done = true;
+    });
+    uint32_t snapshots = 0, torn = 0, inconsistent = 0;
+    while(!done) {
+        SlidingMeans::Snapshot s = means.getSnapshot();
+        ++snapshots;
+        bool whole = true, consistent = true;
+        for(size_t w = 0; w < SlidingMeans::WINDOW_COUNT; ++w) {
+            for(float mean : s.means[w]) whole = whole && mean == s.means[w][0];
+            consistent = consistent && s.counts[w] <= SystemConfig::SLIDING_MEAN_WINDOWS[w] &&
+                         (w == 0 || s.counts[w] >= s.counts[w - 1]);
+        }
+        torn += !whole;
+        inconsistent += !consistent;
+    }
+    writer.join();
+    CHECK(snapshots > 100, "only %u snapshots read while the writer ran", snapshots);
+    CHECK(torn == 0, "%u of %u snapshots mixed from two publishes", torn, snapshots);
+    CHECK(inconsistent == 0, "%u of %u snapshots with inconsistent counts", inconsistent, snapshots);
+
+    // the longest window is full, apart from the skipped periods
+    SlidingMeans::Snapshot s = means.getSnapshot();
+    const uint32_t longest = SystemConfig::SLIDING_MEAN_WINDOWS.back();
+    CHECK(s.counts.back() <= longest && s.counts.back() >= longest * 11 / 13,
+          "%lu measurements in the longest window", static_cast<unsigned long>(s.counts.back()));
+    String json = means.getSnapshotString();
+    CHECK(std::strstr(json.c_str(), "\"windows\":[60,300,900,3600]") != nullptr, "snapshot string %s", json.c_str());
+}
+
+}  // namespace
+
+int main()
+{
+    checkRollover();
+    checkEviction();
+    checkOverflow();
+    checkSnapshots();
+    std::printf(failures == 0 ? "passed\n" : "%d checks failed\n", failures);
+    return failures == 0 ? 0 : 1;
+}
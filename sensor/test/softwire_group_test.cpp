@@ -0,0 +1,318 @@
+// Test of the lockstep SoftWire buses against models of I2C slaves, and measurement of their bus time.
+//
+// Every bus is attached to a model of an SPS30 through the pin functions of SoftWire. The model sees the lines as
+// the wired AND of what the master and the slave drive, and follows the protocol on their edges: it acknowledges
+// its address and the written bytes, sends its response when it is read, and may stretch the clock after every
+// byte. The buses run with the delays of the firmware, busy-waiting on the host.
+
+#include <SoftWire.h>
+#include <SoftWireGroup.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(condition, ...) do { if(!(condition)) { ++failures; std::printf("FAILED: " __VA_ARGS__); std::printf("\n"); } } while(0)
+
+constexpr uint8_t SPS30_ADDRESS = 0x69;
+
+uint32_t nowUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * I2C slave with a fixed response, which holds SCL low for stretchUs after the acknowledge of every byte.
+ */
+class ModelSlave
+{
+public:
+    uint8_t address = SPS30_ADDRESS;
+    std::vector<uint8_t> response;
+    std::vector<uint8_t> received;
+    uint32_t stretchUs = 0;
+
+    void reset() {
+        received.clear();
+        state = IDLE;
+        masterSda = masterScl = slaveSda = slaveScl = true;
+        lastSda = lastScl = true;
+    }
+
+    void setMasterSda(bool released) { masterSda = released; update(); }
+    void setMasterScl(bool released) { masterScl = released; update(); }
+    bool sda() { update(); return lastSda; }
+    bool scl() { update(); return lastScl; }
+
+private:
+    enum State { IDLE, ADDRESS, WRITE, READ, IGNORE };
+
+    void update() {
+        if(!slaveScl && nowUs() - stretchStart >= stretchUs) {
+            slaveScl = true;
+        }
+        bool sda = masterSda && slaveSda;
+        bool scl = masterScl && slaveScl;
+        if(scl && lastScl && sda != lastSda) {
+            // a start condition, or a stop condition
+            state = sda ? IDLE : ADDRESS;
+            bits = 0;
+            slaveSda = true;
+        } else if(scl && !lastScl) {
+            sclRises(sda);
+        } else if(!scl && lastScl) {
+            sclFalls();
+        }
+        lastSda = masterSda && slaveSda;
+        lastScl = masterScl && slaveScl;
+    }
+
+    void sclRises(bool sda) {
+        if(bits < 8 && (state == ADDRESS || state == WRITE)) {
+            byte = (byte << 1) | sda;
+            ++bits;
+        } else if(acknowledging && state == READ && sda) {
+            state = IGNORE;  // not acknowledged, the master reads no more bytes
+        }
+    }
+
+    void sclFalls() {
+        if(bits < 8) {
+            if(state == READ) {
+                slaveSda = (byte >> (7 - bits)) & 1;
+                ++bits;
+            }
+        } else if(acknowledging) {
+            // end of the acknowledge, the next byte begins
+            acknowledging = false;
+            slaveSda = true;
+            if(state == ADDRESS) {
+                state = (byte & 1) ? READ : WRITE;
+                readIndex = 0;
+            } else if(state == WRITE) {
+                received.push_back(byte);
+            }
+            bits = 0;
+            if(state == READ) {
+                byte = readIndex < response.size() ? response[readIndex] : 0xFF;
+                ++readIndex;
+                slaveSda = byte >> 7;
+                bits = 1;
+            }
+            if(stretchUs > 0) {
+                slaveScl = false;
+                stretchStart = nowUs();
+            }
+        } else if(state == READ) {
+            // the master acknowledges
+            slaveSda = true;
+            acknowledging = true;
+        } else if(state == ADDRESS && (byte >> 1) != address) {
+            state = IGNORE;
+        } else if(state == ADDRESS || state == WRITE) {
+            slaveSda = false;
+            acknowledging = true;
+        }
+    }
+
+    State state = IDLE;
+    bool masterSda = true, masterScl = true, slaveSda = true, slaveScl = true;
+    bool lastSda = true, lastScl = true;
+    bool acknowledging = false;
+    uint8_t byte = 0;
+    uint8_t bits = 0;
+    size_t readIndex = 0;
+    uint32_t stretchStart = 0;
+};
+
+ModelSlave slaves[2];
+
+// bus i uses the pins 2i (SDA) and 2i + 1 (SCL)
+ModelSlave& slaveOf(const SoftWire* bus) { return slaves[bus->getSda() / 2]; }
+
+void attach(SoftWire& bus)
+{
+    bus.setSetSdaLow([](const SoftWire* p) { slaveOf(p).setMasterSda(false); });
+    bus.setSetSdaHigh([](const SoftWire* p) { slaveOf(p).setMasterSda(true); });
+    bus.setSetSclLow([](const SoftWire* p) { slaveOf(p).setMasterScl(false); });
+    bus.setSetSclHigh([](const SoftWire* p) { slaveOf(p).setMasterScl(true); });
+    bus.setReadSda([](const SoftWire* p) -> uint8_t { return slaveOf(p).sda(); });
+    bus.setReadScl([](const SoftWire* p) -> uint8_t { return slaveOf(p).scl(); });
+}
+
+/**
+ * Two buses with the delay of the firmware and a short timeout, so that the timeouts do not take long.
+ */
+struct Buses {
+    SoftWire bus0{0, 1};
+    SoftWire bus1{2, 3};
+    SoftWire* buses[2] = {&bus0, &bus1};
+
+    Buses() {
+        for(int i = 0; i < 2; ++i) {
+            slaves[i].reset();
+            slaves[i].stretchUs = 0;
+            slaves[i].response = {0x00, 0x01, 0xB0};  // the data-ready flag of the SPS30 and its CRC
+            attach(*buses[i]);
+            buses[i]->setTimeout_ms(5);
+            buses[i]->begin();
+        }
+    }
+};
+
+struct Transfer {
+    uint8_t results[2];
+    uint8_t bytesRead[2];
+    uint8_t data[2][3];
+};
+
+/**
+ * Set the pointer of the SPS30 and read three bytes, on both buses at once.
+ */
+Transfer readTogether(Buses& buses)
+{
+    Transfer t{};
+    SoftWireGroup group(buses.buses, 2);
+    const uint8_t pointer[] = {0x02, 0x02};
+    group.writeTo(SPS30_ADDRESS, pointer, 2, t.results);
+    uint8_t* data[2] = {t.data[0], t.data[1]};
+    group.requestFrom(SPS30_ADDRESS, 3, data, t.bytesRead);
+    return t;
+}
+
+/**
+ * The same transfers, one bus after the other, as SPS30 did before the buses were driven in lockstep.
+ */
+Transfer readOneByOne(Buses& buses)
+{
+    Transfer t{};
+    for(int i = 0; i < 2; ++i) {
+        SoftWire& bus = *buses.buses[i];
+        uint8_t tx[2];
+        bus.setTxBuffer(tx, sizeof(tx));
+        bus.setRxBuffer(t.data[i], sizeof(t.data[i]));
+        bus.beginTransmission(SPS30_ADDRESS);
+        bus.write(0x02);
+        bus.write(0x02);
+        t.results[i] = bus.endTransmission();
+        t.bytesRead[i] = bus.requestFrom(SPS30_ADDRESS, uint8_t{3});
+        for(int n = 0; n < t.bytesRead[i]; ++n) {
+            t.data[i][n] = bus.read();
+        }
+    }
+    return t;
+}
+
+bool responseRead(const Transfer& t, int bus)
+{
+    return t.bytesRead[bus] == 3 && std::equal(t.data[bus], t.data[bus] + 3, slaves[bus].response.begin());
+}
+
+bool pointerWritten(const Transfer& t, int bus)
+{
+    return t.results[bus] == 0 && slaves[bus].received == std::vector<uint8_t>{0x02, 0x02};
+}
+
+void checkBothBuses()
+{
+    Buses buses;
+    Transfer t = readTogether(buses);
+    for(int i = 0; i < 2; ++i) {
+        CHECK(pointerWritten(t, i), "bus %d: pointer written, result %u", i, t.results[i]);
+        CHECK(responseRead(t, i), "bus %d: response read, %u bytes", i, t.bytesRead[i]);
+    }
+}
+
+void checkShortStretch()
+{
+    // 2 ms after every byte, below the timeout of 5 ms, but more than it over the whole transfer
+    Buses buses;
+    slaves[0].stretchUs = 2000;
+    Transfer t = readTogether(buses);
+    for(int i = 0; i < 2; ++i) {
+        CHECK(pointerWritten(t, i), "short stretch, bus %d: pointer written, result %u", i, t.results[i]);
+        CHECK(responseRead(t, i), "short stretch, bus %d: response read, %u bytes", i, t.bytesRead[i]);
+    }
+}
+
+void checkTimeout()
+{
+    // the device of bus 0 stretches the clock beyond the timeout, bus 1 is not affected
+    Buses buses;
+    slaves[0].stretchUs = 8000;
+    Transfer t = readTogether(buses);
+    CHECK(t.results[0] == 4, "stretching bus 0 times out while writing, result %u", t.results[0]);
+    CHECK(t.bytesRead[0] < 3, "stretching bus 0 times out while reading, %u bytes", t.bytesRead[0]);
+    CHECK(pointerWritten(t, 1), "bus 1 beside a stretching bus: pointer written, result %u", t.results[1]);
+    CHECK(responseRead(t, 1), "bus 1 beside a stretching bus: response read, %u bytes", t.bytesRead[1]);
+}
+
+void checkOwnTimeouts()
+{
+    // the timeout of bus 1 is long enough for its device, that of bus 0 is not used up by waiting for bus 1
+    Buses buses;
+    buses.bus1.setTimeout_ms(20);
+    slaves[1].stretchUs = 8000;
+    Transfer t = readTogether(buses);
+    for(int i = 0; i < 2; ++i) {
+        CHECK(pointerWritten(t, i), "own timeouts, bus %d: pointer written, result %u", i, t.results[i]);
+        CHECK(responseRead(t, i), "own timeouts, bus %d: response read, %u bytes", i, t.bytesRead[i]);
+    }
+}
+
+void checkMissingDevice()
+{
+    Buses buses;
+    slaves[1].address = SPS30_ADDRESS + 1;
+    Transfer t = readTogether(buses);
+    slaves[1].address = SPS30_ADDRESS;
+    CHECK(pointerWritten(t, 0), "bus 0 beside a missing device: pointer written, result %u", t.results[0]);
+    CHECK(responseRead(t, 0), "bus 0 beside a missing device: response read, %u bytes", t.bytesRead[0]);
+    CHECK(t.results[1] == 2 && t.bytesRead[1] == 0, "missing device is not acknowledged, result %u, %u bytes",
+          t.results[1], t.bytesRead[1]);
+}
+
+void measureBusTime()
+{
+    Buses buses;
+    std::vector<uint32_t> together, oneByOne;
+    for(int r = 0; r < 51; ++r) {
+        uint32_t start = nowUs();
+        Transfer t = readTogether(buses);
+        together.push_back(nowUs() - start);
+        CHECK(responseRead(t, 0) && responseRead(t, 1), "lockstep read of both buses");
+        start = nowUs();
+        t = readOneByOne(buses);
+        oneByOne.push_back(nowUs() - start);
+        CHECK(responseRead(t, 0) && responseRead(t, 1), "read of one bus after the other");
+    }
+    std::sort(together.begin(), together.end());
+    std::sort(oneByOne.begin(), oneByOne.end());
+    uint32_t lockstepUs = together[together.size() / 2];
+    uint32_t sequentialUs = oneByOne[oneByOne.size() / 2];
+    std::printf("data-ready read of two sensors: %lu us one after the other, %lu us in lockstep (%.2f)\n",
+                static_cast<unsigned long>(sequentialUs), static_cast<unsigned long>(lockstepUs),
+                static_cast<double>(lockstepUs) / sequentialUs);
+    CHECK(lockstepUs < sequentialUs * 3 / 4, "lockstep read takes less than 3/4 of the time");
+}
+
+}
+
+int main()
+{
+    checkBothBuses();
+    checkShortStretch();
+    checkTimeout();
+    checkOwnTimeouts();
+    checkMissingDevice();
+    measureBusTime();
+    std::printf(failures == 0 ? "passed\n" : "%d checks failed\n", failures);
+    return failures == 0 ? 0 : 1;
+}
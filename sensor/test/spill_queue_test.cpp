@@ -0,0 +1,199 @@
+// Test of the SPILL overflow policy of the Packet Queue with a spill area in a temporary directory:
+// - packets pushed into a full queue are spilled instead of dropped, and all are taken in the order they were pushed,
+//   also when the consumer spills the backlog and priority packets overtake the routine ones,
+// - producer threads that overflow the queue concurrently keep their order,
+// - the spilled packets and the read offset survive a reset, a record torn by the reset is cut off.
+
+#include "PacketPool.h"
+#include "PacketQueue.h"
+#include "PacketSpillArea.h"
+
+#include <atomic>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(condition, ...) do { if(!(condition)) { ++failures; std::printf("FAILED: " __VA_ARGS__); std::printf("\n"); } } while(0)
+
+constexpr uint32_t PRIORITY_FLAG = 1u << 31;
+
+std::string spillPath;
+PacketPool pool;
+
+Packet makePacket(uint32_t number)
+{
+    // a packet of typical size, which carries its number
+    uint8_t data[200] = {};
+    std::memcpy(data, &number, sizeof(number));
+    return Packet("dp", data, sizeof(data));
+}
+
+uint32_t numberOf(const Packet& packet)
+{
+    uint16_t size;
+    uint32_t number;
+    std::memcpy(&number, packet.getBytes(&size), sizeof(number));
+    return number;
+}
+
+/**
+ * Queue with the configuration of the Packet Publishing Queue and an empty spill area.
+ */
+struct SpillQueue {
+    PacketSpillArea spillArea{spillPath.c_str()};
+    PacketQueue queue;
+
+    SpillQueue() {
+        std::filesystem::remove(spillPath);
+        queue.init(SystemConfig::PACKET_QUEUE_CAPACITY, pool, PacketQueue::OverflowPolicy::SPILL,
+                   PacketQueue::Backend::MPSC_RING);
+        if(!spillArea.init()) throw std::runtime_error("cannot create " + spillPath);
+        queue.setSpillArea(&spillArea);
+    }
+
+    std::vector<uint32_t> takeAll() {
+        std::vector<uint32_t> numbers;
+        PacketHandle handle;
+        while(queue.take(&handle, 0)) {
+            numbers.push_back(numberOf(pool.get(handle)));
+            pool.release(handle);
+        }
+        return numbers;
+    }
+};
+
+bool inOrder(const std::vector<uint32_t>& numbers, uint32_t count)
+{
+    if(numbers.size() != count) return false;
+    for(uint32_t i = 0; i < count; ++i) {
+        if(numbers[i] != i) return false;
+    }
+    return true;
+}
+
+void checkOverflow()
+{
+    // without a consumer, every packet beyond the capacity of the queue spills its oldest one
+    SpillQueue q;
+    const uint32_t count = SystemConfig::PACKET_QUEUE_CAPACITY + 40;
+    for(uint32_t i = 0; i < count; ++i) {
+        CHECK(q.queue.push(makePacket(i)), "push of packet %u", i);
+    }
+    PacketQueue::OverflowStats stats = q.queue.getOverflowStats();
+    CHECK(stats.dropped == 0 && stats.spilled == 40, "overflow: %lu dropped, %lu spilled",
+          static_cast<unsigned long>(stats.dropped), static_cast<unsigned long>(stats.spilled));
+    CHECK(inOrder(q.takeAll(), count), "overflowing packets are taken in the order they were pushed");
+    CHECK(q.spillArea.empty() && std::filesystem::file_size(spillPath) == 0, "spill file is emptied");
+}
+
+void checkBacklogAndPriority()
+{
+    // the consumer spills the backlog between pushes, priority packets are taken first
+    SpillQueue q;
+    uint32_t next = 0;
+    for(int round = 0; round < 5; ++round) {
+        for(int i = 0; i < SystemConfig::PACKET_QUEUE_CAPACITY; ++i) {
+            q.queue.push(makePacket(next++));
+        }
+        q.queue.spillBacklog();
+    }
+    q.queue.push(makePacket(PRIORITY_FLAG), PacketQueue::Lane::PRIORITY);
+    std::vector<uint32_t> numbers = q.takeAll();
+    CHECK(!numbers.empty() && numbers.front() == PRIORITY_FLAG, "priority packet is taken first");
+    if(!numbers.empty()) numbers.erase(numbers.begin());
+    CHECK(inOrder(numbers, next), "spilled backlog is taken in order, %zu of %u packets", numbers.size(), next);
+}
+
+void checkConcurrentProducers()
+{
+    // two producers overflow the queue at once, while the consumer takes packets slowly
+    SpillQueue q;
+    const uint32_t perProducer = 30;
+    std::atomic<int> done{0};
+    auto produce = [&](uint32_t producer) {
+        for(uint32_t i = 0; i < perProducer; ++i) {
+            q.queue.push(makePacket(producer << 16 | i));
+            if(i % 4 == 0) std::this_thread::yield();
+        }
+        ++done;
+    };
+    std::thread first(produce, 0), second(produce, 1);
+    std::vector<uint32_t> next(2, 0);
+    bool ordered = true;
+    uint32_t received = 0;
+    PacketHandle handle;
+    while(done.load() < 2 || !q.spillArea.empty() || q.queue.getDepthStats().depth > 0) {
+        if(!q.queue.take(&handle, 1)) continue;
+        uint32_t number = numberOf(pool.get(handle));
+        pool.release(handle);
+        ordered = ordered && (number & 0xFFFF) == next[number >> 16];
+        next[number >> 16] = (number & 0xFFFF) + 1;
+        ++received;
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+    first.join();
+    second.join();
+    CHECK(ordered, "every producer's packets are taken in its order");
+    CHECK(received == 2 * perProducer, "%u of %u packets taken, %lu dropped", received, 2 * perProducer,
+          static_cast<unsigned long>(q.queue.getOverflowStats().dropped));
+}
+
+void checkReset()
+{
+    {
+        SpillQueue q;
+        for(uint32_t i = 0; i < SystemConfig::PACKET_QUEUE_CAPACITY + 10; ++i) {
+            q.queue.push(makePacket(i));
+        }
+        PacketHandle handle;
+        for(int i = 0; i < 4; ++i) {
+            q.queue.take(&handle, 0);
+            pool.release(handle);
+        }
+        CHECK(q.spillArea.size() == 6, "%u packets left in the spill area", q.spillArea.size());
+    }
+    // a reset while a packet was appended
+    std::ofstream(spillPath, std::ios::binary | std::ios::app).write("\x10\x00\x34\x12torn", 8);
+
+    PacketSpillArea spillArea{spillPath.c_str()};
+    CHECK(spillArea.init(), "spill area opened after the reset");
+    CHECK(spillArea.size() == 6, "%u packets found in the spill area after the reset", spillArea.size());
+    Packet packet;
+    std::vector<uint32_t> numbers;
+    while(spillArea.front(&packet)) {
+        numbers.push_back(numberOf(packet));
+        spillArea.pop();
+        if(numbers.size() == 2) {
+            // another reset, after the read offset of the second packet was written
+            PacketSpillArea reopened{spillPath.c_str()};
+            CHECK(reopened.init() && reopened.size() == 4, "%u packets left after the second reset",
+                  reopened.size());
+        }
+    }
+    CHECK(numbers == std::vector<uint32_t>({4, 5, 6, 7, 8, 9}), "spilled packets survive the reset in order");
+    PacketSpillArea emptied{spillPath.c_str()};
+    CHECK(emptied.init() && emptied.empty(), "spill area is empty after all packets were taken");
+}
+
+}  // namespace
+
+int main()
+{
+    spillPath = (std::filesystem::temp_directory_path() / ("spill-" + std::to_string(getpid()) + ".bin")).string();
+    pool.init();
+    checkOverflow();
+    checkBacklogAndPriority();
+    checkConcurrentProducers();
+    checkReset();
+    std::filesystem::remove(spillPath);
+    std::printf(failures == 0 ? "passed\n" : "%d checks failed\n", failures);
+    return failures == 0 ? 0 : 1;
+}
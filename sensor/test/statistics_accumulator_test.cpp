@@ -0,0 +1,156 @@
+// Test of the Statistics Accumulator against a two-pass reference in double precision.
+//
+// The minima and maxima must be exact. The standard deviation is computed in a single pass in float, so it may
+// differ from the reference by the rounding of the float arithmetic: a relative error that grows with the number of
+// samples, and an absolute one of a few units in the last place of the mean, which dominates when the deviation is
+// small compared with the mean.
+
+#include "StatisticsAccumulator.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(condition, ...) do { if(!(condition)) { ++failures; std::printf("FAILED: " __VA_ARGS__); std::printf("\n"); } } while(0)
+
+constexpr size_t CHANNELS = 10;
+typedef StatisticsAccumulator<CHANNELS> Accumulator;
+
+// largest relative error of the standard deviations seen, for the summary
+double worstRelativeError = 0;
+
+struct Reference {
+    Accumulator::Values minimum, maximum, standardDeviation;
+    std::array<double, CHANNELS> mean;
+};
+
+/**
+ * Two-pass statistics in double precision: the mean first, then the sum of the squared differences from it.
+ */
+Reference reference(const std::vector<Accumulator::Sample>& samples)
+{
+    Reference r{};
+    for(size_t i = 0; i < CHANNELS; ++i) {
+        double sum = 0;
+        float minimum = HUGE_VALF, maximum = -HUGE_VALF;
+        for(const auto& sample : samples) {
+            float value = std::isnan(sample[i]) ? 0.0f : sample[i];
+            sum += value;
+            minimum = std::min(minimum, value);
+            maximum = std::max(maximum, value);
+        }
+        const double mean = sum / samples.size();
+        double squares = 0;
+        for(const auto& sample : samples) {
+            double value = std::isnan(sample[i]) ? 0.0 : sample[i];
+            squares += (value - mean) * (value - mean);
+        }
+        r.mean[i] = mean;
+        r.minimum[i] = toDatapointValue(minimum);
+        r.maximum[i] = toDatapointValue(maximum);
+        r.standardDeviation[i] =
+            samples.size() > 1 ? toDatapointValue(static_cast<float>(std::sqrt(squares / (samples.size() - 1)))) : 0;
+    }
+    return r;
+}
+
+void checkWindow(const std::vector<Accumulator::Sample>& samples, const char* name)
+{
+    Accumulator accumulator;
+    for(const auto& sample : samples) {
+        accumulator.add(sample);
+    }
+    Reference r = reference(samples);
+    CHECK(accumulator.getCount() == samples.size(), "%s: %lu samples counted, %zu added", name,
+          static_cast<unsigned long>(accumulator.getCount()), samples.size());
+    CHECK(accumulator.getMinimum() == r.minimum, "%s: minima differ", name);
+    CHECK(accumulator.getMaximum() == r.maximum, "%s: maxima differ", name);
+    Accumulator::Values deviation = accumulator.getStandardDeviation();
+    for(size_t i = 0; i < CHANNELS; ++i) {
+        const double expected = r.standardDeviation[i];
+        const double error = std::fabs(static_cast<double>(deviation[i]) - expected);
+        // a unit of the rounding to fixed point, the float rounding of the updates and 16 units in the last place
+        // of the mean
+        const double tolerance = 1 + 1e-3 * expected + 16 * SystemConfig::DATAPOINT_SCALE * r.mean[i] * 0x1p-24;
+        CHECK(error <= tolerance, "%s, channel %zu: standard deviation %lu, %.0f expected", name, i,
+              static_cast<unsigned long>(deviation[i]), expected);
+        if(expected >= 1000) {
+            worstRelativeError = std::max(worstRelativeError, error / expected);
+        }
+    }
+}
+
+/**
+ * Samples of the 10 channels as the sensors measure them: a level that drifts, with noise on every value.
+ */
+std::vector<Accumulator::Sample> randomWindow(std::mt19937& random, size_t length, double level, double noise)
+{
+    std::normal_distribution<double> normal(0, 1);
+    std::vector<Accumulator::Sample> samples(length);
+    for(auto& sample : samples) {
+        level = std::max(0.0, level * (1 + 0.01 * normal(random)));
+        for(size_t i = 0; i < CHANNELS; ++i) {
+            sample[i] = static_cast<float>(std::max(0.0, level * (0.5 + 0.1 * i) * (1 + noise * normal(random))));
+        }
+    }
+    return samples;
+}
+
+void checkRandomWindows()
+{
+    std::mt19937 random(22);
+    std::uniform_real_distribution<double> logLevel(-2, 3.5);
+    for(size_t length : {2, 3, 4, 30, 300, static_cast<int>(SystemConfig::AVERAGING_MAX_WINDOW)}) {
+        for(int n = 0; n < 50; ++n) {
+            checkWindow(randomWindow(random, length, std::pow(10, logLevel(random)), 0.2), "random window");
+        }
+    }
+}
+
+void checkEdgeCases()
+{
+    std::mt19937 random(23);
+    checkWindow(randomWindow(random, 1, 12, 0.2), "single sample");
+    Accumulator::Sample constant;
+    constant.fill(12.34f);
+    checkWindow(std::vector<Accumulator::Sample>(100, constant), "constant window");
+    Accumulator accumulator;
+    for(int i = 0; i < 100; ++i) accumulator.add(constant);
+    CHECK(accumulator.getStandardDeviation() == Accumulator::Values{}, "constant window has a standard deviation");
+
+    // NaN counts as 0, as in the average
+    auto samples = randomWindow(random, 10, 50, 0.1);
+    samples[3][2] = NAN;
+    checkWindow(samples, "window with NaN");
+    accumulator.clear();
+    for(const auto& sample : samples) accumulator.add(sample);
+    CHECK(accumulator.getMinimum()[2] == 0, "NaN is not counted as 0 in the minimum");
+
+    // a large mean with a small deviation, where the resolution of the float mean limits the accuracy
+    checkWindow(randomWindow(random, 3600, 3000, 1e-5), "large mean, small deviation");
+
+    // clear() starts a new window
+    accumulator.clear();
+    samples = randomWindow(random, 60, 5, 0.3);
+    for(const auto& sample : samples) accumulator.add(sample);
+    Reference r = reference(samples);
+    CHECK(accumulator.getCount() == 60 && accumulator.getMinimum() == r.minimum && accumulator.getMaximum() == r.maximum,
+          "statistics after clear() include the former window");
+}
+
+}  // namespace
+
+int main()
+{
+    checkRandomWindows();
+    checkEdgeCases();
+    std::printf("largest relative error of the standard deviation: %.2g\n", worstRelativeError);
+    std::printf(failures == 0 ? "passed\n" : "%d checks failed\n", failures);
+    return failures == 0 ? 0 : 1;
+}
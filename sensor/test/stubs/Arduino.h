@@ -0,0 +1,193 @@
+// Host stand-in for the parts of the Device OS Wiring API that the tested modules use.
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <thread>
+
+#include <sys/stat.h>
+
+typedef int32_t time32_t;
+typedef uint32_t system_tick_t;
+
+enum { D0, D1, D2, D3, D4, D5, D6, D7, D8, D9, D10, D11, D12, D13, D14, A0, A1, A2, A3, A4, A5, SDA, SCL };
+
+/**
+ * Warnings and errors go to stderr, info messages only if SENSOR_TEST_LOG is set in the environment.
+ */
+class Logger
+{
+public:
+    void info(const char* format, ...) const { va_list args; va_start(args, format); print("INFO", format, args, verbose()); va_end(args); }
+    void trace(const char* format, ...) const { va_list args; va_start(args, format); print("TRACE", format, args, verbose()); va_end(args); }
+    void warn(const char* format, ...) const { va_list args; va_start(args, format); print("WARN", format, args, true); va_end(args); }
+    void error(const char* format, ...) const { va_list args; va_start(args, format); print("ERROR", format, args, true); va_end(args); }
+
+private:
+    static bool verbose() { static const bool v = std::getenv("SENSOR_TEST_LOG") != nullptr; return v; }
+    static void print(const char* level, const char* format, va_list args, bool enabled) {
+        if(!enabled) return;
+        std::fprintf(stderr, "[%s] ", level);
+        std::vfprintf(stderr, format, args);
+        std::fputc('\n', stderr);
+    }
+};
+inline Logger Log;
+
+inline system_tick_t millis() {
+    using namespace std::chrono;
+    return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+inline uint32_t micros() {
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+inline void delay(system_tick_t ms) { std::this_thread::sleep_for(std::chrono::milliseconds(ms)); }
+// busy-waits like the device, sleeping would take much longer than a few microseconds
+inline void delayMicroseconds(unsigned int us) {
+    auto end = std::chrono::steady_clock::now() + std::chrono::microseconds(us);
+    while(std::chrono::steady_clock::now() < end) {}
+}
+
+// GPIO pins do nothing on the host, the lines of a bus read high. Tests of the SoftWire buses attach models of the
+// devices through the pin functions of SoftWire.
+#define LOW 0x0
+#define HIGH 0x1
+enum PinMode { INPUT, OUTPUT, INPUT_PULLUP, INPUT_PULLDOWN };
+inline void pinMode(uint16_t, PinMode) {}
+inline void digitalWrite(uint16_t, uint8_t) {}
+inline int32_t digitalRead(uint16_t) { return HIGH; }
+
+class Stream
+{
+public:
+    virtual ~Stream() = default;
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    virtual void flush() = 0;
+    virtual size_t write(uint8_t data) = 0;
+    virtual size_t write(const uint8_t* data, size_t quantity) = 0;
+    int getWriteError() const { return writeError; }
+    void clearWriteError() { writeError = 0; }
+
+protected:
+    void setWriteError(int error = 1) { writeError = error; }
+
+private:
+    int writeError = 0;
+};
+
+class String : public std::string
+{
+public:
+    using std::string::string;
+    String(const std::string& s) : std::string(s) {}
+    operator const char*() const { return c_str(); }
+    static String format(const char* format, ...) {
+        char buf[1024];
+        va_list args;
+        va_start(args, format);
+        std::vsnprintf(buf, sizeof(buf), format, args);
+        va_end(args);
+        return String(buf);
+    }
+};
+
+class SystemClass
+{
+public:
+    [[noreturn]] static void reset() { std::abort(); }
+    // the device counts CPU cycles, the host nanoseconds
+    static uint32_t ticks() {
+        using namespace std::chrono;
+        return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+    }
+    static uint32_t ticksPerMicrosecond() { return 1000; }
+    static uint32_t freeMemory() { return 0; }
+};
+inline SystemClass System;
+
+/**
+ * Wall clock of the device, which the tests set to the simulated time with setTime().
+ */
+class TimeClass
+{
+public:
+    time32_t now() const { return offset + static_cast<time32_t>(std::time(nullptr)); }
+    void setTime(time32_t t) { offset = t - static_cast<time32_t>(std::time(nullptr)); }
+
+private:
+    time32_t offset = 0;
+};
+inline TimeClass Time;
+
+class SerialClass
+{
+public:
+    int printf(const char*, ...) { return 0; }
+    int printlnf(const char*, ...) { return 0; }
+    template<class T> size_t print(const T&) { return 0; }
+    template<class T> size_t println(const T&) { return 0; }
+};
+inline SerialClass Serial;
+
+// threads run as detached host threads, which are never joined: the tests end the process while they wait
+#define OS_THREAD_PRIORITY_DEFAULT 3
+class Thread
+{
+public:
+    Thread() = default;
+    template<class Function, class... Args> Thread(const char*, Function function, Args&&...) {
+        std::thread(function).detach();
+    }
+};
+
+// timers are not started on the host
+
+class Timer
+{
+public:
+    template<class... Args> Timer(Args&&...) {}
+    bool start() { return true; }
+    bool stop() { return true; }
+    bool reset() { return true; }
+    bool changePeriod(unsigned) { return true; }
+};
+
+enum PublishFlag { PUBLIC, PRIVATE, NO_ACK, WITH_ACK };
+
+namespace particle {
+struct Error {};
+}
+
+class PublishFuture
+{
+public:
+    template<class F> PublishFuture& onSuccess(F) { return *this; }
+    template<class F> PublishFuture& onError(F) { return *this; }
+};
+
+class ParticleClass
+{
+public:
+    String deviceID() const { return "e00fce68host000000000000"; }
+    bool connected() const { return false; }
+    bool disconnected() const { return true; }
+    template<class... Args> PublishFuture publish(Args&&...) { return {}; }
+    template<class... Args> bool function(Args&&...) { return true; }
+    template<class... Args> bool variable(Args&&...) { return true; }
+    void syncTime() {}
+};
+inline ParticleClass Particle;
+
+#endif
@@ -0,0 +1,104 @@
+// Host stand-in for the concurrency primitives of the Device OS.
+#ifndef HOST_PARTICLE_H
+#define HOST_PARTICLE_H
+
+#include "Arduino.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#define CONCURRENT_WAIT_FOREVER ((system_tick_t)0xFFFFFFFF)
+
+namespace host {
+
+template<class Predicate>
+bool wait(std::condition_variable& cv, std::unique_lock<std::mutex>& lock, system_tick_t timeout, Predicate p)
+{
+    if(timeout == CONCURRENT_WAIT_FOREVER) {
+        cv.wait(lock, p);
+        return true;
+    }
+    return cv.wait_for(lock, std::chrono::milliseconds(timeout), p);
+}
+
+struct Queue {
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<std::vector<uint8_t>> items;
+    size_t itemSize;
+    size_t length;
+};
+
+struct Semaphore {
+    std::mutex mutex;
+    std::condition_variable changed;
+    unsigned count;
+    unsigned max;
+};
+
+}  // namespace host
+
+typedef host::Queue* os_queue_t;
+typedef host::Semaphore* os_semaphore_t;
+typedef std::mutex* os_mutex_t;
+
+inline int os_queue_create(os_queue_t* queue, size_t itemSize, size_t length, void*)
+{
+    *queue = new host::Queue{{}, {}, {}, itemSize, length};
+    return 0;
+}
+
+inline int os_queue_put(os_queue_t queue, const void* item, system_tick_t timeout, void*)
+{
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    if(!host::wait(queue->changed, lock, timeout, [queue] { return queue->items.size() < queue->length; })) return 1;
+    auto bytes = static_cast<const uint8_t*>(item);
+    queue->items.emplace_back(bytes, bytes + queue->itemSize);
+    queue->changed.notify_all();
+    return 0;
+}
+
+inline int os_queue_take(os_queue_t queue, void* item, system_tick_t timeout, void*)
+{
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    if(!host::wait(queue->changed, lock, timeout, [queue] { return !queue->items.empty(); })) return 1;
+    std::memcpy(item, queue->items.front().data(), queue->itemSize);
+    queue->items.pop_front();
+    queue->changed.notify_all();
+    return 0;
+}
+
+inline int os_semaphore_create(os_semaphore_t* semaphore, unsigned max, unsigned initial)
+{
+    *semaphore = new host::Semaphore{{}, {}, initial, max};
+    return 0;
+}
+
+inline int os_semaphore_take(os_semaphore_t semaphore, system_tick_t timeout, bool)
+{
+    std::unique_lock<std::mutex> lock(semaphore->mutex);
+    if(!host::wait(semaphore->changed, lock, timeout, [semaphore] { return semaphore->count > 0; })) return 1;
+    --semaphore->count;
+    return 0;
+}
+
+inline int os_semaphore_give(os_semaphore_t semaphore, bool)
+{
+    std::lock_guard<std::mutex> lock(semaphore->mutex);
+    if(semaphore->count < semaphore->max) ++semaphore->count;
+    semaphore->changed.notify_one();
+    return 0;
+}
+
+inline int os_mutex_create(os_mutex_t* mutex)
+{
+    *mutex = new std::mutex;
+    return 0;
+}
+
+inline int os_mutex_lock(os_mutex_t mutex) { mutex->lock(); return 0; }
+inline int os_mutex_unlock(os_mutex_t mutex) { mutex->unlock(); return 0; }
+
+#endif
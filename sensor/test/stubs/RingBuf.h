@@ -0,0 +1,2 @@
+// The RingBuf of SdFat is part of SdFat.h on the host.
+#include "SdFat.h"
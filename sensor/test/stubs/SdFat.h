@@ -0,0 +1,248 @@
+// Host stand-in for SdFat: the card is a directory of the host file system, set with the constructor of SdFat32.
+#ifndef HOST_SDFAT_H
+#define HOST_SDFAT_H
+
+#include "Arduino.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+namespace host {
+inline std::string sdRoot;
+inline std::string sdWorkingDirectory = "/";
+// directories searched by path lookups, on the card each one takes at least one sector read over SPI
+inline std::atomic<uint64_t> sdDirectoryReads{0};
+
+inline std::string sdPath(const char* path)
+{
+    if(path[0] == '/') return sdRoot + path;
+    return sdRoot + sdWorkingDirectory + (sdWorkingDirectory.back() == '/' ? "" : "/") + path;
+}
+
+/**
+ * Count the directories searched to resolve a path, one per component.
+ */
+inline void countLookup(const char* path)
+{
+    for(const char* c = path; *c != '\0'; ++c) {
+        if(*c != '/' && (c == path || c[-1] == '/')) ++sdDirectoryReads;
+    }
+}
+}  // namespace host
+
+class File32
+{
+public:
+    File32() = default;
+    File32(const File32&) = delete;
+    File32& operator=(const File32&) = delete;
+    ~File32() { close(); }
+
+    bool open(const char* path, int oflag = O_RDONLY) {
+        host::countLookup(path);
+        return openHost(host::sdPath(path), oflag);
+    }
+
+    bool open(File32* dir, const char* name, int oflag = O_RDONLY) {
+        if(!dir->directory) return false;
+        host::countLookup(name);
+        return openHost(dir->path + "/" + name, oflag);
+    }
+
+    bool createContiguous(const char* path, uint32_t size) {
+        return open(path, O_RDWR | O_CREAT | O_TRUNC) && ::ftruncate(fd, size) == 0;
+    }
+
+    bool close() {
+        if(fd >= 0) ::close(fd);
+        fd = -1;
+        directory = false;
+        return true;
+    }
+
+    bool isOpen() const { return fd >= 0 || directory; }
+    bool isDir() const { return directory; }
+    explicit operator bool() const { return isOpen(); }
+
+    int read(void* buf, size_t count) { return fd < 0 ? -1 : static_cast<int>(::read(fd, buf, count)); }
+    size_t write(const void* buf, size_t count) {
+        if(fd < 0) return 0;
+        ssize_t n = ::write(fd, buf, count);
+        return n < 0 ? 0 : n;
+    }
+    bool seekSet(uint32_t position) { return fd >= 0 && ::lseek(fd, position, SEEK_SET) >= 0; }
+    uint32_t curPosition() const { return fd < 0 ? 0 : ::lseek(fd, 0, SEEK_CUR); }
+    uint32_t fileSize() const {
+        struct stat st;
+        return fd >= 0 && ::fstat(fd, &st) == 0 ? st.st_size : 0;
+    }
+    // the data is in the page cache of the host, which survives the simulated resets
+    bool sync() { return fd >= 0; }
+    bool truncate() { return fd >= 0 && ::ftruncate(fd, curPosition()) == 0; }
+    // like SdFat, only an empty file is preallocated, and its size is the preallocated length until it is truncated
+    bool preAllocate(uint32_t length) { return fd >= 0 && fileSize() == 0 && ::ftruncate(fd, length) == 0; }
+
+    const std::string& hostPath() const { return path; }
+
+private:
+    bool openHost(const std::string& hostPath, int oflag) {
+        close();
+        struct stat st;
+        if(::stat(hostPath.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+            if((oflag & O_ACCMODE) != O_RDONLY) return false;
+            directory = true;
+            path = hostPath;
+            return true;
+        }
+        fd = ::open(hostPath.c_str(), oflag, 0644);
+        path = hostPath;
+        return fd >= 0;
+    }
+
+    int fd = -1;
+    bool directory = false;
+    std::string path;
+};
+
+class FatDirIterator
+{
+public:
+    static const uint8_t NAME_SIZE = 64;
+
+    explicit FatDirIterator(File32* dir) {
+        if(dir->isDir()) {
+            stream = ::opendir(dir->hostPath().c_str());
+            path = dir->hostPath();
+        }
+    }
+    ~FatDirIterator() {
+        if(stream != nullptr) ::closedir(stream);
+    }
+
+    int8_t next() {
+        if(stream == nullptr) return -1;
+        while(dirent* entry = ::readdir(stream)) {
+            if(std::strcmp(entry->d_name, ".") == 0 || std::strcmp(entry->d_name, "..") == 0) continue;
+            size_t length = std::strlen(entry->d_name);
+            nameTruncated = length >= NAME_SIZE;
+            nameLength_ = std::min<size_t>(length, NAME_SIZE - 1);
+            std::memcpy(name_, entry->d_name, nameLength_);
+            name_[nameLength_] = '\0';
+            struct stat st;
+            ::stat((path + "/" + entry->d_name).c_str(), &st);
+            directory = S_ISDIR(st.st_mode);
+            size = st.st_size;
+            return 1;
+        }
+        return 0;
+    }
+
+    const char* name() const { return name_; }
+    uint8_t nameLength() const { return nameLength_; }
+    bool isNameTruncated() const { return nameTruncated; }
+    uint32_t fileSize() const { return size; }
+    bool isDir() const { return directory; }
+    bool isFile() const { return !directory; }
+
+private:
+    DIR* stream = nullptr;
+    std::string path;
+    char name_[NAME_SIZE] = {};
+    uint8_t nameLength_ = 0;
+    bool nameTruncated = false;
+    bool directory = false;
+    uint32_t size = 0;
+};
+
+template<class File, size_t Size>
+class RingBuf
+{
+public:
+    void begin(File* file) { this->file = file; used = 0; }
+    size_t bytesUsed() const { return used; }
+    size_t bytesFree() const { return Size - used; }
+    size_t write(const void* buf, size_t count) {
+        count = std::min(count, bytesFree());
+        std::memcpy(data + used, buf, count);
+        used += count;
+        return count;
+    }
+    size_t writeOut(size_t count) {
+        count = std::min(count, used);
+        size_t n = file->write(data, count);
+        std::memmove(data, data + n, used - n);
+        used -= n;
+        return n;
+    }
+    bool sync() {
+        size_t count = used;
+        return writeOut(count) == count;
+    }
+
+private:
+    File* file = nullptr;
+    uint8_t data[Size];
+    size_t used = 0;
+};
+
+#define DEDICATED_SPI 1
+#define SD_SCK_MHZ(maxMhz) (1000000UL * (maxMhz))
+
+class SdSpiConfig
+{
+public:
+    template<class... Args> SdSpiConfig(Args&&...) {}
+};
+
+template<uint8_t MisoPin, uint8_t MosiPin, uint8_t SckPin>
+class SoftSpiDriver {};
+
+class SdFat32
+{
+public:
+    explicit SdFat32(std::string root = "") : root(std::move(root)) {}
+
+    bool begin(const SdSpiConfig&) {
+        host::sdRoot = root;
+        host::sdWorkingDirectory = "/";
+        struct stat st;
+        return !root.empty() && ::stat(root.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+    }
+    bool chdir(const char* path) {
+        host::countLookup(path);
+        std::string hostPath = host::sdPath(path);
+        struct stat st;
+        if(::stat(hostPath.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) return false;
+        host::sdWorkingDirectory = hostPath.substr(host::sdRoot.size());
+        if(host::sdWorkingDirectory.empty()) host::sdWorkingDirectory = "/";
+        return true;
+    }
+    bool exists(const char* path) {
+        host::countLookup(path);
+        struct stat st;
+        return ::stat(host::sdPath(path).c_str(), &st) == 0;
+    }
+    bool mkdir(const char* path, bool pFlag = true) {
+        std::string hostPath = host::sdPath(path);
+        if(exists(path)) return false;
+        for(size_t i = host::sdRoot.size() + 1; pFlag && (i = hostPath.find('/', i)) != std::string::npos; ++i) {
+            ::mkdir(hostPath.substr(0, i).c_str(), 0755);
+        }
+        return ::mkdir(hostPath.c_str(), 0755) == 0;
+    }
+    bool remove(const char* path) { return ::unlink(host::sdPath(path).c_str()) == 0; }
+    bool rmdir(const char* path) { return ::rmdir(host::sdPath(path).c_str()) == 0; }
+    bool rename(const char* oldPath, const char* newPath) {
+        return !exists(newPath) && ::rename(host::sdPath(oldPath).c_str(), host::sdPath(newPath).c_str()) == 0;
+    }
+
+private:
+    std::string root;
+};
+
+#endif
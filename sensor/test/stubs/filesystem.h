@@ -0,0 +1,37 @@
+// Host stand-in for the LittleFS instance of the Device OS: an empty file system of the size of the Gen3 flash.
+#ifndef HOST_FILESYSTEM_H
+#define HOST_FILESYSTEM_H
+
+#include <cstdint>
+
+typedef int32_t lfs_ssize_t;
+
+struct lfs_t {};
+
+struct lfs_config {
+    uint32_t block_size;
+    uint32_t block_count;
+};
+
+struct filesystem_t {
+    lfs_t instance;
+    lfs_config config;
+};
+
+enum filesystem_instance_t {
+    FILESYSTEM_INSTANCE_DEFAULT = 0
+};
+
+inline filesystem_t* filesystem_get_instance(filesystem_instance_t, void*)
+{
+    static filesystem_t fs{{}, {4096, 512}};
+    return &fs;
+}
+
+inline int filesystem_lock(filesystem_t*) { return 0; }
+inline int filesystem_unlock(filesystem_t*) { return 0; }
+
+// number of allocated blocks
+inline lfs_ssize_t lfs_fs_size(lfs_t*) { return 2; }
+
+#endif
@@ -11,8 +11,9 @@ from typing import Optional
 import requests
 from sseclient import SSEClient
 
-from packet import DataPointPacket
-from util import append_entries
+from packet import DataPointPacket, DataPointStatisticsPacket
+from sequence_tracker import SequenceTracker
+from util import append_entries, statistics_header_row
 
 class MeasurementDataReceiver(Thread):
     def __init__(self, config: dict, dp_queue: Queue):
@@ -23,6 +24,7 @@ class MeasurementDataReceiver(Thread):
         self._session_duration = 3600  # default session duration in seconds
         if "session_duration" in config:
             self._session_duration = config["session_duration"]
+        # the event name is a prefix filter, so that data point statistics packets are received too
         self._url = f'https://api.particle.io/v1/devices/events/{DataPointPacket.event_name}'
 
     def start(self) -> None:
@@ -52,6 +54,10 @@ class MeasurementDataReceiver(Thread):
                     data_encoded = event_data["data"]  # data encoded in ascii85
                     self._dp_queue.put(DataPointPacket(data_encoded=data_encoded,
                                                        device_id=device_id))
+                elif event.event == DataPointStatisticsPacket.event_name:
+                    data_encoded = event_data["data"]
+                    self._dp_queue.put(DataPointStatisticsPacket(data_encoded=data_encoded,
+                                                                 device_id=device_id))
 
 
 class CSVWriter(Thread):
@@ -80,6 +86,16 @@ class CSVWriter(Thread):
 
             data_points = dp.get_data_points()
             append_entries(f'sensors/{dev_name}', data_points)
+            # kept apart from the data points, whose csv files are searched for gaps
+            statistics = dp.get_statistics()
+            if statistics:
+                append_entries(f'statistics/{dev_name}', statistics, header=statistics_header_row)
+
+            sequence_number = dp.get_sequence_number()
+            if sequence_number is not None:
+                tracker = SequenceTracker(f'sensors/{dev_name}')
+                tracker.record(sequence_number)
+                tracker.save()
 
 
 if __name__ == "__main__":
@@ -0,0 +1,125 @@
+import argparse
+import csv
+from pathlib import Path
+from typing import List, Tuple
+
+from packet import DataPointPacket, PACKET_MAX_SIZE_BYTES
+from util import get_path
+
+# Sizes of the firmware's Data Point Packet, see DataPointPacket.h
+FULL_SIZE_BYTES = PACKET_MAX_SIZE_BYTES - 10 - 2  # requested data point packet header and size prefix
+HEADER_SIZE = 11
+PERIOD = 2
+RAW_DATA_POINT_SIZE = 34
+RAW_DATA_POINTS_PER_PACKET = FULL_SIZE_BYTES // RAW_DATA_POINT_SIZE
+MAX_DATA_POINTS = 255  # the count in the header
+
+
+def varint_size(value: int) -> int:
+    size = 1
+    while value >= 0x80:
+        value >>= 7
+        size += 1
+    return size
+
+
+def zig_zag(value: int) -> int:
+    return value * 2 if value >= 0 else -value * 2 - 1
+
+
+def rice_parameter(context: List[int]) -> int:
+    k = 0
+    while k < DataPointPacket.RICE_MAX_PARAMETER and context[1] << k < context[0]:
+        k += 1
+    return k
+
+
+def rice_size(context: List[int], value: int) -> int:
+    """Size of the Rice code of a value in bits. Updates the parameter like the firmware does."""
+    k = rice_parameter(context)
+    quotient = value >> k
+    size = quotient + 1 + k if quotient < DataPointPacket.RICE_ESCAPE else DataPointPacket.RICE_ESCAPE + 32
+    context[0] += value
+    context[1] += 1
+    if context[1] == DataPointPacket.RICE_RESET:
+        context[0] >>= 1
+        context[1] >>= 1
+    return size
+
+
+def encoded_sizes(rows: List[Tuple[int, List[int]]], residual: bool, rice: bool) -> List[int]:
+    """Simulate the firmware encoder and return the sizes of the packets."""
+    def point_bits(timestamp, values, previous, contexts):
+        if previous is None:
+            if rice:
+                return 8 * HEADER_SIZE + 10 * DataPointPacket.FIRST_VALUE_BITS
+            return 8 * HEADER_SIZE + 8 * sum(varint_size(zig_zag(v)) if residual and i >= 5 else varint_size(v)
+                                             for i, v in enumerate(values))
+        timestamp_difference = zig_zag(timestamp - previous[0] - PERIOD)
+        if rice:
+            return (33 if timestamp_difference else 1) \
+                + sum(rice_size(c, zig_zag(v - p)) for c, v, p in zip(contexts, values, previous[1]))
+        return 8 * varint_size(timestamp_difference) \
+            + 8 * sum(varint_size(zig_zag(v - p)) for v, p in zip(values, previous[1]))
+
+    def new_contexts():
+        return [[DataPointPacket.RICE_INITIAL_SUM, 1] for _ in range(10)]
+
+    packets = []
+    bits = 0
+    count = 0
+    previous = None
+    contexts = new_contexts()
+    for timestamp, values in rows:
+        if residual:
+            values = values[:5] + [v2 - v1 for v1, v2 in zip(values[:5], values[5:])]
+        point = point_bits(timestamp, values, previous, contexts)
+        if (bits + point + 7) // 8 + 1 > FULL_SIZE_BYTES or count == MAX_DATA_POINTS:
+            # the data point starts the next packet, with new Rice code parameters
+            packets.append((bits + 7) // 8 + 1)
+            bits = 0
+            count = 0
+            contexts = new_contexts()
+            point = point_bits(timestamp, values, None, contexts)
+        bits += point
+        count += 1
+        previous = (timestamp, values)
+    if bits:
+        packets.append((bits + 7) // 8 + 1)
+    return packets
+
+
+def read_rows(directory: Path) -> List[Tuple[int, List[int]]]:
+    rows = []
+    for f in sorted(directory.glob('**/*.csv')):
+        with open(f) as file:
+            for row in csv.reader(file):
+                try:
+                    rows.append((int(row[0]), [round(float(v) * DataPointPacket._MULTIPLIER)
+                                               for v in row[2:12]]))
+                except (ValueError, IndexError):
+                    continue  # header or corrupted line
+    rows.sort(key=lambda r: r[0])
+    return rows
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description=
+    "Compare the size of data point packets in the raw 34-byte layout and in the delta-encoded "
+    "formats on archived data points (csv files as written by data_event_listener.py).")
+    parser.add_argument("directory", type=str, help="Directory with the csv files of a device.")
+    args = parser.parse_args()
+
+    rows = read_rows(get_path(args.directory))
+    if not rows:
+        print("No data points found.")
+        exit(1)
+    raw_packets = -(-len(rows) // RAW_DATA_POINTS_PER_PACKET)
+    print(f"{len(rows)} data points")
+    print(f"raw:              {RAW_DATA_POINT_SIZE:.2f} bytes per data point, "
+          f"{raw_packets} packets")
+    for name, residual, rice in (("delta varint", False, False), ("residual varint", True, False),
+                                 ("delta Rice", False, True), ("residual Rice", True, True)):
+        sizes = encoded_sizes(rows, residual, rice)
+        print(f"{name + ':':17} {sum(sizes) / len(rows):.2f} bytes per data point, {len(sizes)} packets, "
+              f"{raw_packets / len(sizes):.2f}x fewer packets than raw")
@@ -12,6 +12,7 @@ import requests
 from sseclient import SSEClient
 
 from packet import HandshakePacket, RequestedDataPointPacket
+from sequence_tracker import SequenceTracker
 from util import insert_entries_into_directory, TimestampedCSVEntry, data_point_header_row
 
 class PacketVerificationError(RuntimeError):
@@ -89,11 +90,14 @@ def find_gaps_in_dir(directory: Path, max_gap: int, file_filter: Callable) -> Li
 
 
 def send_handshake_and_listen(device_id: str, access_token: str, queue: multiprocessing.SimpleQueue,
-                              intervals: List[Tuple[int, int]] | None = None):
+                              intervals: List[Tuple[int, int]] | None = None,
+                              sequence_ranges: List[Tuple[int, int]] | None = None):
     """
     Sends a handshake and listens for Requested Data Point Packets from the device.
 
     :param intervals: List of requested intervals. Can be None.
+    :param sequence_ranges: List of requested ranges of sequence numbers, instead of intervals.
+    Can be None.
     :param device_id:
     :param access_token:
     :param queue: multiprocessing.SimpleQueue to put the result in. The result is a single queue
@@ -101,7 +105,7 @@ def send_handshake_and_listen(device_id: str, access_token: str, queue: multipro
     :return: nothing
     """
     handshake_url = f'https://api.particle.io/v1/devices/{device_id}/handshake'
-    hp = HandshakePacket(device_id, intervals)
+    hp = HandshakePacket(device_id, intervals, sequence_ranges)
     data = {'arg': hp.encode()[0]}
     try:
         requests.post(handshake_url,
@@ -110,7 +114,7 @@ def send_handshake_and_listen(device_id: str, access_token: str, queue: multipro
     except requests.exceptions.ReadTimeout:
         pass
 
-    if not intervals:
+    if not intervals and not sequence_ranges:
         # put empty list into the return queue and return
         queue.put([])
         return
@@ -123,6 +127,7 @@ def send_handshake_and_listen(device_id: str, access_token: str, queue: multipro
     client = SSEClient(resp)
     client.events()
     packet_numbers_received = set()
+    total_packets = 0  # every packet of the response carries the total number of packets, 0 if not known
     packets: List[RequestedDataPointPacket] = []
     for event in client.events():
         event_data = json.loads(event.data)
@@ -135,7 +140,9 @@ def send_handshake_and_listen(device_id: str, access_token: str, queue: multipro
                 return
             total, number = packets[-1].get_number()
             packet_numbers_received.add(number)
-            if len(packet_numbers_received) == total:
+            if total:
+                total_packets = total
+            if total_packets and len(packet_numbers_received) == total_packets:
                 queue.put(packets)
                 return
 
@@ -143,7 +150,8 @@ def send_handshake_and_listen(device_id: str, access_token: str, queue: multipro
 def handshake(device_id: str,
               access_token: str,
               intervals: List[Tuple[int, int]] | None = None,
-              timeout=600) -> List[TimestampedCSVEntry]:
+              timeout=600,
+              sequence_ranges: List[Tuple[int, int]] | None = None) -> List[TimestampedCSVEntry]:
     """
     Send a handshake to a device and wait for response or timeout.
 
@@ -153,16 +161,19 @@ def handshake(device_id: str,
     :param access_token:
     :param intervals: list of intervals to request
     :param timeout: timeout for the response packets (seconds)
+    :param sequence_ranges: list of ranges of sequence numbers to request instead of intervals
     :return: list of data points
     """
-    if intervals and len(intervals) > HandshakePacket.max_intervals:
-        raise ValueError("Cannot pack that many intervals into one handshake packet.")
+    for entries in (intervals, sequence_ranges):
+        if entries and len(entries) > HandshakePacket.max_intervals:
+            raise ValueError("Cannot pack that many intervals into one handshake packet.")
 
     # queue to return a value from  the request_and_listen() process
     queue = multiprocessing.SimpleQueue()
 
     process = multiprocessing.Process(target=send_handshake_and_listen,
                                 kwargs={"intervals": intervals,
+                                        "sequence_ranges": sequence_ranges,
                                         "device_id": device_id,
                                         "access_token": access_token,
                                         "queue": queue})
@@ -255,6 +266,50 @@ def send_handshakes(device_id: str,
     return data_points
 
 
+def send_sequence_handshakes(device_id: str,
+                             device_name: str,
+                             access_token: str, *,
+                             n_attempts: int = 1) -> List[TimestampedCSVEntry]:
+    """
+    Requests the data point packets whose sequence numbers are missing in a given device's data,
+    as recorded by data_event_listener.py in sensors/<device name>/missing_sequences.json.
+
+    Ranges that have been answered are removed from the missing ones, even if the device did not
+    have all of the packets, as it will not find them later either.
+    :param device_id:
+    :param device_name: Name of the device.
+    :param access_token:
+    :param n_attempts: Total number of attempts to send a handshake if a TimeoutError or
+    PacketVerificationError occurs. If all attempts fail, the underlying error is raised.
+    :return: Received data points.
+    """
+    tracker = SequenceTracker(f'sensors/{device_name}')
+    requested_ranges = list(tracker.missing)
+    logging.info(f"Found {len(requested_ranges)} missing sequence ranges.")
+    data_points = []
+    for i in range(0, len(requested_ranges), HandshakePacket.max_intervals):
+        ranges = requested_ranges[i:i + HandshakePacket.max_intervals]
+        last_error = None
+        for j in range(n_attempts):
+            try:
+                result = handshake(device_id, access_token, sequence_ranges=ranges)
+            except (TimeoutError, PacketVerificationError) as e:
+                logging.warning(f"Error when performing handshake: {e}")
+                last_error = e
+            else:
+                break
+        else:
+            logging.error("Error on all attempts.")
+            raise last_error
+        logging.info(f"Received response, number of datapoints: {len(result)}")
+        data_points.extend(result)
+        for first, last in ranges:
+            tracker.remove(first, last)
+        tracker.save()
+
+    return data_points
+
+
 if __name__ == "__main__":
     logging.basicConfig(level=logging.INFO)
     dev_id = "e00fce68cdb95fcd741bbb51"
@@ -4,6 +4,11 @@ from typing import List, Tuple
 
 from util import uint_to_bytes, bytes_to_uint, TimestampedCSVEntry
 
+# Maximum size of a packet before the ascii85 encoding, so that the encoding fits into the data of a
+# Particle Cloud event or function argument (1024 bytes on Gen3 devices). Must match
+# SystemConfig::PACKET_MAX_SIZE_BYTES in the firmware.
+PACKET_MAX_SIZE_BYTES = 1024 // 5 * 4
+
 
 class OutgoingPacket:
     """Represents a general packet sent from server to a device.
@@ -23,24 +28,38 @@ class OutgoingPacket:
 class HandshakePacket(OutgoingPacket):
     """
     A handshake packet sent from server to a device.
+
+    Requests either data points in time intervals (begin and end exclusive), or data point packets
+    by ranges of their sequence numbers (first and last inclusive).
     """
-    max_intervals = 99
+    HEADER_LENGTH = 5
+    max_intervals = (PACKET_MAX_SIZE_BYTES - HEADER_LENGTH) // 8
+    MODE_TIME_INTERVALS = 0
+    MODE_SEQUENCE_RANGES = 1
 
-    def __init__(self, device_id: str, time_intervals: List[Tuple[int, int]] = None):
+    def __init__(self, device_id: str, time_intervals: List[Tuple[int, int]] = None,
+                 sequence_ranges: List[Tuple[int, int]] = None):
         """
         :param device_id
         :param time_intervals: A list of time intervals for the device to look for data points
         in, or None.
+        :param sequence_ranges: A list of ranges of sequence numbers of the requested packets, or
+        None. Cannot be combined with time_intervals.
         """
         super().__init__()
-        if time_intervals is None:
-            time_intervals = []
+        if time_intervals and sequence_ranges:
+            raise ValueError("A handshake requests either time intervals or sequence ranges.")
         self.device_id = device_id
         self.TIMESTAMP = int(time.time())
         self.data.extend(uint_to_bytes(self.TIMESTAMP, 4))
-        for interval in time_intervals:
-            self.data.extend(uint_to_bytes(interval[0], 4))
-            self.data.extend(uint_to_bytes(interval[1], 4))
+        if sequence_ranges:
+            mode, entries = self.MODE_SEQUENCE_RANGES, sequence_ranges
+        else:
+            mode, entries = self.MODE_TIME_INTERVALS, time_intervals or []
+        self.data.extend(uint_to_bytes(mode, 1))
+        for entry in entries:
+            self.data.extend(uint_to_bytes(entry[0], 4))
+            self.data.extend(uint_to_bytes(entry[1], 4))
 
 
 class IncomingPacket:
@@ -90,10 +109,156 @@ class GeneralDataPointPacket(IncomingPacket):
 
 
 class DataPointPacket(GeneralDataPointPacket):
-    """Packet of data points containing the regular measurements."""
+    """Packet of data points containing the regular measurements.
+
+    See the corresponding class in the firmware for packet format. Packets of the former format,
+    with 34 bytes per data point, are told apart by their size."""
     _HEADER_LENGTH = 0
+    _ENCODED_HEADER_LENGTH = 11
+    ENCODING_DELTA_VARINT = 1
+    ENCODING_RESIDUAL_DELTA_VARINT = 2
+    ENCODING_DELTA_RICE = 3
+    ENCODING_RESIDUAL_DELTA_RICE = 4
+    ENCODING_STATISTICS_FLAG = 0x80  # set if the data points carry statistics
+    SENSOR_VALUES = 5  # number of values of one sensor
+    # parameters of the Rice codes, see DataPointPacket.h in the firmware
+    FIRST_VALUE_BITS = 25
+    RICE_ESCAPE = 16
+    RICE_RESET = 32
+    RICE_INITIAL_SUM = 256
+    RICE_MAX_PARAMETER = 24
     event_name = "dp"
 
+    def _is_former_format(self) -> bool:
+        return len(self.data) % self._DATAPOINT_SIZE == 0
+
+    def get_sequence_number(self) -> int | None:
+        if self._is_former_format():
+            return None
+        return bytes_to_uint(self.data[7:11])
+
+    def get_data_points(self) -> List[TimestampedCSVEntry]:
+        if self._is_former_format():
+            return super().get_data_points()
+        return [TimestampedCSVEntry(time.localtime(timestamp),
+                                    [v / self._MULTIPLIER for v in values])
+                for timestamp, values, _ in self._decode_delta()]
+
+    def get_statistics(self) -> List[TimestampedCSVEntry]:
+        """Get the minima, maxima and standard deviations of the measurements averaged into the data
+        points, or an empty list if the packet carries no statistics."""
+        if self._is_former_format():
+            return []
+        return [TimestampedCSVEntry(time.localtime(timestamp),
+                                    [v / self._MULTIPLIER for v in statistics])
+                for timestamp, _, statistics in self._decode_delta() if statistics is not None]
+
+    def _decode_delta(self) -> List[Tuple[int, List[int], List[int] | None]]:
+        """Decode the data points into timestamps, fixed-point values and, if the packet carries
+        statistics, the fixed-point minima, maxima and standard deviations of the values."""
+        encoding = self.data[4] & ~self.ENCODING_STATISTICS_FLAG
+        if encoding not in (self.ENCODING_DELTA_VARINT, self.ENCODING_RESIDUAL_DELTA_VARINT,
+                            self.ENCODING_DELTA_RICE, self.ENCODING_RESIDUAL_DELTA_RICE):
+            raise ValueError(f"Unknown data point packet encoding {encoding}")
+        residual = encoding in (self.ENCODING_RESIDUAL_DELTA_VARINT, self.ENCODING_RESIDUAL_DELTA_RICE)
+        rice = encoding in (self.ENCODING_DELTA_RICE, self.ENCODING_RESIDUAL_DELTA_RICE)
+        with_statistics = bool(self.data[4] & self.ENCODING_STATISTICS_FLAG)
+        timestamp = bytes_to_uint(self.data[0:4])
+        period = self.data[5]
+        count = self.data[6]
+        offset = self._ENCODED_HEADER_LENGTH
+
+        def read_varint() -> int:
+            nonlocal offset
+            value = 0
+            shift = 0
+            while True:
+                b = self.data[offset]
+                offset += 1
+                value |= (b & 0x7F) << shift
+                shift += 7
+                if not b & 0x80:
+                    return value
+
+        def un_zig_zag(value: int) -> int:
+            return (value >> 1) ^ -(value & 1)
+
+        bit = 8 * offset  # position in the bit stream of the Rice codes
+        # sum and count of the recent values of every field, from which its Rice parameter follows
+        contexts = [[self.RICE_INITIAL_SUM, 1] for _ in range(40)]
+
+        def read_bits(length: int) -> int:
+            nonlocal bit
+            value = 0
+            for _ in range(length):
+                value = value << 1 | (self.data[bit // 8] >> (7 - bit % 8)) & 1
+                bit += 1
+            return value
+
+        def read_rice(field: int) -> int:
+            context = contexts[field]
+            k = 0
+            while k < self.RICE_MAX_PARAMETER and context[1] << k < context[0]:
+                k += 1
+            quotient = 0
+            while quotient < self.RICE_ESCAPE and read_bits(1):
+                quotient += 1
+            value = read_bits(32) if quotient == self.RICE_ESCAPE else quotient << k | read_bits(k)
+            context[0] += value
+            context[1] += 1
+            if context[1] == self.RICE_RESET:
+                context[0] >>= 1
+                context[1] >>= 1
+            return value
+
+        def read_first_value(i: int) -> int:
+            value = read_bits(self.FIRST_VALUE_BITS) if rice else read_varint()
+            # residuals may be negative
+            return un_zig_zag(value) if residual and i >= self.SENSOR_VALUES else value
+
+        def read_timestamp_difference() -> int:
+            if rice:
+                return un_zig_zag(read_bits(32)) if read_bits(1) else 0
+            return un_zig_zag(read_varint())
+
+        def read_difference(i: int) -> int:
+            return un_zig_zag(read_rice(i) if rice else read_varint())
+
+        def read_statistic(field: int) -> int:
+            return read_rice(field) if rice else read_varint()
+
+        data_points = []
+        # values of sensor 2 are residuals to sensor 1 if the residual encoding is used
+        values = []
+        if count:
+            values = [read_first_value(i) for i in range(10)]
+        for i in range(count):
+            if i > 0:
+                timestamp += period + read_timestamp_difference()
+                values = [v + read_difference(j) for j, v in enumerate(values)]
+            if residual:
+                sensor1 = values[:self.SENSOR_VALUES]
+                point = sensor1 + [v + r for v, r in zip(sensor1, values[self.SENSOR_VALUES:])]
+            else:
+                point = values
+            statistics = None
+            if with_statistics:
+                # minima, maxima and standard deviations, the extremes are stored relative to the value
+                statistics = [0] * (3 * len(point))
+                for j, value in enumerate(point):
+                    statistics[j] = value - read_statistic(10 + 3 * j)
+                    statistics[len(point) + j] = value + read_statistic(11 + 3 * j)
+                    statistics[2 * len(point) + j] = read_statistic(12 + 3 * j)
+            data_points.append((timestamp, point, statistics))
+        return data_points
+
+
+class DataPointStatisticsPacket(DataPointPacket):
+    """Data point packet whose data points carry the minima, maxima and standard deviations of the
+    averaged measurements. It is published with its own event name; requested packets are told apart
+    by their encoding."""
+    event_name = "dps"
+
 
 class RequestedDataPointPacket(GeneralDataPointPacket):
     """Represents a packet of data points, which were previously requested by the server.
@@ -101,6 +266,7 @@ class RequestedDataPointPacket(GeneralDataPointPacket):
     See the corresponding class in the firmware for packet format."""
 
     event_name = 'rdp'
+    _ENTRY_HEADER_LENGTH = 2  # size prefix of every requested packet
 
     def __init__(self, data_encoded: str, device_id: str):
         super().__init__(data_encoded=data_encoded, device_id=device_id)
@@ -115,6 +281,24 @@ class RequestedDataPointPacket(GeneralDataPointPacket):
     def get_number(self) -> Tuple[int, int]:
         return bytes_to_uint(self.data[4:5]), bytes_to_uint(self.data[5:6])
 
+    def get_packets(self) -> List[DataPointPacket]:
+        """Split the payload into the requested packets, each of which is preceded by its size."""
+        packets = []
+        offset = self._HEADER_LENGTH
+        while offset < len(self.data):
+            size = bytes_to_uint(self.data[offset:offset + self._ENTRY_HEADER_LENGTH])
+            offset += self._ENTRY_HEADER_LENGTH
+            packets.append(DataPointPacket(data_decoded=self.data[offset:offset + size],
+                                           device_id=self.device_id))
+            offset += size
+        return packets
+
+    def get_data_points(self) -> List[TimestampedCSVEntry]:
+        data_points = []
+        for packet in self.get_packets():
+            data_points.extend(packet.get_data_points())
+        return data_points
+
 
 class TextPacket(IncomingPacket):
     """A base class for packets containing text data.
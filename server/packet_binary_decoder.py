@@ -1,13 +1,46 @@
 import argparse
+import struct
 from pathlib import Path
 
 from packet import DataPointPacket, ErrorPacket
 from util import insert_entries_into_directory, insert_entries_into_file, get_path, \
-    data_point_header_row, TimestampedCSVEntry
+    data_point_header_row, statistics_header_row, TimestampedCSVEntry
 from time import localtime
 
 # calling syntax: packet_binary_decoder.py file [end of range] output_dir
 
+SEGMENT_RECORD_HEADER = struct.Struct("<HHiHH")  # magic, size, timestamp, checksum, reserved
+SEGMENT_RECORD_MAGIC = 0x5053
+
+
+def fletcher16(data):
+    sum1 = 0
+    sum2 = 0
+    for b in data:
+        sum1 = (sum1 + b) % 255
+        sum2 = (sum2 + sum1) % 255
+    return (sum2 << 8) | sum1
+
+
+def read_segment_records(data):
+    """
+    Split the contents of a segment file (<timestamp>.seg) into packets. The records end at the
+    first invalid record, as the tail of the file may contain stale preallocated data.
+    """
+    packets = []
+    offset = 0
+    while offset + SEGMENT_RECORD_HEADER.size <= len(data):
+        magic, size, timestamp, checksum, _ = SEGMENT_RECORD_HEADER.unpack_from(data, offset)
+        offset += SEGMENT_RECORD_HEADER.size
+        packet_data = data[offset:offset + size]
+        if magic != SEGMENT_RECORD_MAGIC or len(packet_data) != size \
+                or fletcher16(packet_data) != checksum:
+            break
+        packets.append(packet_data)
+        offset += size
+    return packets
+
+
 if __name__ == "__main__":
     parser = argparse.ArgumentParser(description=
     "This small utility can be used to convert from binary packet files to CSV files.\n\n"
@@ -16,6 +49,9 @@ if __name__ == "__main__":
     "- Single file mode: packet_binary_decoder.py <packet file> <output dir> [options]\n"
     "- Range mode: packet_binary_decoder.py <first packet> <last packet> <output dir> [options]\n\n"
     
+    "A segment file (<timestamp>.seg), which holds all data point packets of one period, can be "
+    "converted in single file mode.\n\n"
+    
     "When operating in range mode, the utility attempts to convert all packets files in the "
     "directory, whose timestamps are between the first and the last packet (inclusive). It assumes" 
     "that the packets are named using the standard convention: <integer unix "
@@ -38,6 +74,9 @@ if __name__ == "__main__":
                                                       "written.")
     parser.add_argument("-replace", action='store_true', help="Replace data points with matching "
                                                               "timestamps.")
+    parser.add_argument("-statistics", type=str, help="Directory in which the csv files of the "
+                                                      "data point statistics are written. They are "
+                                                      "skipped without it.")
 
     args = parser.parse_args()
 
@@ -67,6 +106,9 @@ if __name__ == "__main__":
     for filename in packet_files:
         with open(filename, "rb") as file:
             data = file.read()
+            if get_path(filename).suffix == ".seg":
+                data_packets.extend(DataPointPacket(data_decoded=d) for d in read_segment_records(data))
+                continue
             event_name = filename.suffixes[0][1:]
             if event_name == DataPointPacket.event_name:
                 data_packets.append(DataPointPacket(data_decoded=data))
@@ -83,6 +125,14 @@ if __name__ == "__main__":
                                                         header=data_point_header_row,
                                                         replace=args.replace)
 
+    statistics_entries = []
+    if args.statistics:
+        for p in data_packets:
+            statistics_entries.extend(p.get_statistics())
+    if statistics_entries:
+        insert_entries_into_directory(args.statistics, statistics_entries,
+                                      header=statistics_header_row, replace=args.replace)
+
     # Save text packets to a log file
     text_entries = []
     for p in text_packets:
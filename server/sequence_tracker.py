@@ -0,0 +1,60 @@
+import json
+from pathlib import Path
+from typing import List, Tuple
+
+from util import get_path
+
+
+class SequenceTracker:
+    """Tracks the sequence numbers of the data point packets received from a device and the ranges
+    of sequence numbers that are missing.
+
+    The state is kept in sensors/<device name>/missing_sequences.json, so that the missing packets
+    can be requested by missing_datapoint_handler.py with a handshake.
+
+    A device reserves sequence numbers in blocks, so after a reboot it skips the rest of the
+    block. Those numbers are reported as missing until a handshake for them has been answered.
+    """
+    FILENAME = "missing_sequences.json"
+    max_missing_ranges = 1000  # oldest ranges are forgotten beyond this limit
+
+    def __init__(self, directory: str):
+        self._path: Path = get_path(directory).joinpath(self.FILENAME)
+        self.last = None  # highest sequence number received
+        self.missing: List[Tuple[int, int]] = []  # sorted ranges, first and last inclusive
+        if self._path.exists():
+            with open(self._path) as f:
+                state = json.load(f)
+            self.last = state["last"]
+            self.missing = [tuple(r) for r in state["missing"]]
+
+    def save(self) -> None:
+        self._path.parent.mkdir(parents=True, exist_ok=True)
+        with open(self._path, 'w') as f:
+            json.dump({"last": self.last, "missing": self.missing}, f)
+
+    def record(self, sequence_number: int) -> None:
+        """Record a received sequence number."""
+        if self.last is None:
+            self.last = sequence_number
+        elif sequence_number > self.last:
+            if sequence_number > self.last + 1:
+                self.missing.append((self.last + 1, sequence_number - 1))
+                del self.missing[:-self.max_missing_ranges]
+            self.last = sequence_number
+        else:
+            self.remove(sequence_number, sequence_number)
+
+    def remove(self, first: int, last: int) -> None:
+        """Remove a range of sequence numbers from the missing ones, e.g. after they have been
+        requested."""
+        remaining = []
+        for r_first, r_last in self.missing:
+            if r_last < first or r_first > last:
+                remaining.append((r_first, r_last))
+                continue
+            if r_first < first:
+                remaining.append((r_first, first - 1))
+            if r_last > last:
+                remaining.append((last + 1, r_last))
+        self.missing = remaining
@@ -10,6 +10,11 @@ from os import name as os_name
 data_point_header_row = ['# Unix time', 'Time', '1-NP0.5', '1-NP1.0', '1-NP2.5', '1-NP4.0', '1-NP10',
               '2-NP0.5', '2-NP1.0', '2-NP2.5', '2-NP4.0', '2-NP10']
 
+# Header for the csv files of the data point statistics
+statistics_header_row = data_point_header_row[:2] + [f'{statistic} {column}'
+                                                     for statistic in ('Min', 'Max', 'Std')
+                                                     for column in data_point_header_row[2:]]
+
 
 @dataclass
 class TimestampedCSVEntry:
@@ -47,14 +52,15 @@ def get_path(path_str):
     return dir_path.absolute()
 
 
-def append_entries(directory: str, entries: List[TimestampedCSVEntry]) \
-        -> None:
+def append_entries(directory: str, entries: List[TimestampedCSVEntry],
+                   header: List[str] = data_point_header_row) -> None:
     """
     Sorts entries and writes them to a file. Overwrites the file, if it already exists,
     without checking for duplication or correct order.
 
     :param directory: directory of the output files
     :param entries: list of csv entries
+    :param header: header used to create new files
     """
     last_filename = None
     file = None
@@ -71,7 +77,7 @@ def append_entries(directory: str, entries: List[TimestampedCSVEntry]) \
             file = file_path.open('a')
             csv_writer = csv.writer(file)
             if new:
-                csv_writer.writerow(data_point_header_row)
+                csv_writer.writerow(header)
             last_filename = filename
         csv_writer.writerow(e.get_row())
     file.close()